@@ -8,10 +8,19 @@
 
 #define TIMELINE_MAX		60000
 
+// The maximum number of single targets that can be chosen for one turn.
+#define MAX_TURN_TARGETS	4
+
 
 namespace overworld
 {
 	struct Ally;
+	struct Item;
+}
+
+namespace data
+{
+	struct Record;
 }
 
 namespace battle
@@ -29,6 +38,7 @@ namespace battle
 
 
 	class Agent;
+	class BehaviorScript;
 	struct Usable;
 
 	struct Party;
@@ -78,6 +88,9 @@ namespace battle
 		// The entity's allies and enemies.
 		Party* party;
 
+		// The index of the entity in its party.
+		int party_index = -1;
+
 
 		// All available usables. (These should be constructed with new when the entity is initialized, and deleted when the entity is destroyed.)
 		std::vector<Usable*> usables;
@@ -135,8 +148,33 @@ namespace battle
 		// The entities that need to be defeated.
 		Party* enemies;
 
-		// The entities aligned with the party.
+		// The entities aligned with the party. Only change this through add() and remove(), so that the living entities are kept up to date.
 		std::vector<Entity*> allies;
+
+		// The entities that are not incapacitated, in party order.
+		std::vector<Entity*> living;
+
+		// Which side the party is on. Entities are allies if their parties have the same faction.
+		int faction;
+
+		/// <summary>Adds an entity to the end of the party.</summary>
+		/// <param name="entity">The entity.</param>
+		void add(Entity* entity);
+
+		/// <summary>Removes an entity from the party, without deleting it.</summary>
+		/// <param name="entity">The entity.</param>
+		void remove(Entity* entity);
+
+		/// <summary>Removes every entity from the party, without deleting them.</summary>
+		void clear();
+
+		/// <summary>Updates whether an entity is counted as living. Must be called whenever its Health may have reached or left 0.</summary>
+		/// <param name="entity">The entity.</param>
+		void update(Entity* entity);
+
+		/// <summary>Gets the number of entities that are not incapacitated.</summary>
+		/// <returns>The number of living entities.</returns>
+		int alive_count() const;
 	};
 
 
@@ -146,6 +184,9 @@ namespace battle
 		// The ally's cursor.
 		onion::Graphic* cursor;
 
+		// The character the ally was created from.
+		overworld::Ally* character;
+
 		/// <summary>Constructs an entity primarily controlled by a character in battle.</summary>
 		Ally(overworld::Ally& ally);
 
@@ -154,26 +195,60 @@ namespace battle
 
 		/// <summary>Animates the ally's incapacitation.</summary>
 		void defeat();
+
+		/// <summary>Copies the ally's Health back to the character it was created from, so that it carries over to the overworld and the next battle.</summary>
+		void write_back() const;
 	};
 	
+	// The data shared by all enemies with the same ID.
+	struct EnemyTemplate
+	{
+		// The maximum Health of the enemy.
+		int health;
+
+		// The maximum Shield of the enemy.
+		int shield;
+
+		// The base Offense of the enemy.
+		int offense;
+
+		// The base Defense of the enemy.
+		int defense;
+
+		// The type of the enemy, which determines its sprite sheet.
+		std::string type;
+
+		// The IDs of the items the enemy can use.
+		std::vector<std::string> items;
+
+		// The path of the policy table the enemy acts from, or empty if it doesn't have one.
+		std::string policy;
+
+		// The path of the policy network the enemy acts from, or empty if it doesn't have one.
+		std::string network;
+
+		// The behavior script the enemy follows, or nullptr if it doesn't have one.
+		std::shared_ptr<const BehaviorScript> behavior;
+
+		// A hash of the record the enemy was loaded from, and of the text of its behavior script.
+		uint64_t checksum = 0;
+
+		/// <summary>Sets the values of the template from its data.</summary>
+		/// <param name="data">The record for the enemy.</param>
+		void load(const data::Record& data);
+
+		/// <summary>Finds the checksum that a template loaded from a record would have. Reads the enemy's behavior script again, so that edits to the script count as changes to the enemy.</summary>
+		/// <param name="data">The record for the enemy.</param>
+		static uint64_t hash(const data::Record& data);
+	};
+
 	// An enemy.
 	struct Enemy : public Entity
 	{
 	private:
-		// The data about all enemies.
-		static std::unordered_map<std::string, std::unordered_map<std::string, std::string>*> m_EnemyData;
-
 		// The sprite sheets for each enemy type.
 		static std::unordered_map<std::string, onion::SpriteSheet*> m_EnemySprites;
 
-		/// <summary>Loads an integer from the data about an enemy.</summary>
-		/// <param name="data">The data about a particular enemy.</param>
-		int load_int(const std::unordered_map<std::string, std::string>& data, std::string key);
-
-		/// <summary>Loads a string from the data about an enemy.</summary>
-		/// <param name="data">The data about a particular enemy.</param>
-		std::string load_string(const std::unordered_map<std::string, std::string>& data, std::string key);
-
 	public:
 		// The enemy sprite.
 		onion::Graphic* image;
@@ -279,6 +354,9 @@ namespace battle
 		int update(int frames_passed);
 	};
 
+	class AgentDecision;
+	class FlashEvent;
+
 	// An event that lets an entity take a turn.
 	class EntityEvent : public Event, public onion::KeyboardListener
 	{
@@ -308,18 +386,19 @@ namespace battle
 
 			// The index that this target maps to.
 			int target_index;
-
-			TS(Target target_type, int target_index);
 		};
 		
 		
 		// The sequence of targets to select.
-		std::list<TS> m_SelectSequence;
+		TS m_SelectSequence[MAX_TURN_TARGETS + 1];
 
-		// What the player is currently selecting.
-		std::list<TS>::iterator m_Selecting;
+		// The number of targets to select.
+		int m_SelectCount = 0;
 
-		// The target currently selected by the player.
+		// The index in the sequence of what the player is currently selecting.
+		int m_Selecting = 0;
+
+		// The target currently selected by the player, as an index into the legal targets.
 		int m_SelectedTarget;
 		
 		
@@ -343,6 +422,24 @@ namespace battle
 		// The selected action for the turn.
 		Turn m_Turn;
 
+
+		// The decision being made on a worker thread by the entity's Agent, or nullptr if there isn't one.
+		AgentDecision* m_Decision = nullptr;
+
+		// The flash indicating who is acting while the Agent decides, or nullptr between flashes.
+		FlashEvent* m_Flash = nullptr;
+
+		// The number of flashes finished while the Agent decides.
+		int m_Flashes = 0;
+
+		/// <summary>Queues the selected action, followed by the events that end the turn.</summary>
+		void __enqueue_turn();
+
+		/// <summary>Flashes the entity until its Agent has decided what to do.</summary>
+		/// <param name="frames_passed">The number of frames that have passed since the last update.</param>
+		/// <returns>EVENT_STOP once the Agent has decided, EVENT_CONTINUE otherwise.</returns>
+		int __wait_for_decision(int frames_passed);
+
 	public:
 		/// <summary>Displays which entities are being targeted, and stuff.</summary>
 		static void display();
@@ -351,11 +448,14 @@ namespace battle
 		/// <param name="entity">The entity taking a turn.</param>
 		EntityEvent(Entity* entity);
 
-		/// <summary>Uses the entity's Agent to decide what it should do.</summary>
-		/// <returns>EVENT_STOP if the entity isn't controlled by the player, EVENT_CONTINUE if it is.</returns>
+		/// <summary>Stops the Agent deciding, if it still is.</summary>
+		~EntityEvent();
+
+		/// <summary>Uses the entity's Agent to decide what it should do. Agents that can decide on a worker thread are left to do so.</summary>
+		/// <returns>EVENT_STOP if the Agent decided straight away, EVENT_CONTINUE if the player or a worker thread is deciding.</returns>
 		int start();
 
-		/// <summary>Lets the player select what the entity should do.</summary>
+		/// <summary>Lets the player select what the entity should do, or waits for the Agent to decide.</summary>
 		/// <param name="frames_passed">The number of frames that have passed since the last update.</param>
 		/// <returns>EVENT_STOP if the player has selected an action, EVENT_CONTINUE if not.</returns>
 		int update(int frames_passed);
@@ -799,6 +899,9 @@ namespace battle
 		// The icon for the usable.
 		onion::Graphic* icon;
 
+		// The item that the usable was generated from, if any.
+		const overworld::Item* item = nullptr;
+
 		/// <summary>Shortcut for what will be most usables: a single set of targets, and a time setback for the user.</summary>
 		/// <param name="icon">The icon for the usable.</param>
 		/// <param name="animation">The animation for when the set of effects activate.</param>
@@ -808,6 +911,10 @@ namespace battle
 		Usable(onion::Graphic* icon, Effect* animation, Target target, std::vector<Effect*>& effects, int speed);
 	};
 
+	/// <summary>Regenerates all usables in the current battle that were generated from an item, after the item has been reloaded.</summary>
+	/// <param name="item">The item that was reloaded.</param>
+	void refresh_usables(const overworld::Item* item);
+
 
 	// An effect that deals damage.
 	struct DamageEffect : public Effect
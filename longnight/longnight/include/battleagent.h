@@ -1,9 +1,30 @@
 #pragma once
+#include <atomic>
+#include <chrono>
+#include <thread>
 #include "battle.h"
+#include "simulation.h"
+#include "transposition.h"
+
+
+// The exploration constant for UCT.
+#define MCTS_EXPLORATION		1.4f
+
+// The number of turns after which a rollout is abandoned as a draw.
+#define MCTS_ROLLOUT_TURNS		200
+
+// The maximum number of turns considered for any one decision.
+#define MCTS_MAX_CHILDREN		64
+
+// The number of seconds an enemy with no behavior script, policy table or network searches for each of its turns, short enough not to hold up the battle.
+#define MCTS_ENEMY_SECONDS		0.01f
+
+// The value of winning a battle in expectiminimax search. Heuristic values are always smaller.
+#define SEARCH_WIN				100000
 
 namespace battle
 {
-	
+
 	// An agent that acts totally at random.
 	class RandomAgent : public Agent
 	{
@@ -17,4 +38,177 @@ namespace battle
 		void decide(Turn& turn);
 	};
 
-}
\ No newline at end of file
+	class AgentDecision;
+
+	// An agent that decides from a snapshot of the battle, and can be stopped at any time to give its best answer so far. Can decide on a worker thread, so that slow searches don't stall the game.
+	class AnytimeAgent : public Agent
+	{
+	protected:
+		// The maximum time to decide for, in seconds, or 0 for no limit.
+		float m_Seconds;
+
+	public:
+		/// <summary>Constructs an anytime agent.</summary>
+		/// <param name="self">The entity that the agent acts for.</param>
+		/// <param name="seconds">The maximum time to decide for, in seconds, or 0 for no limit.</param>
+		AnytimeAgent(Entity* self, float seconds);
+
+		/// <summary>Decides what to do in a simulated battle. May be called from any thread, but only for one decision at a time.</summary>
+		/// <param name="snapshot">The battle, with the acting entity taking its turn. May be changed, as long as it is restored afterwards.</param>
+		/// <param name="stop">Set when the agent must stop deciding. The agent should return its best turn so far promptly once it is set.</param>
+		/// <returns>The turn. Targets chosen at random are left as 0xFF.</returns>
+		virtual SimTurn think(BattleSnapshot& snapshot, const std::atomic<bool>& stop) = 0;
+
+		/// <summary>Decides what the entity should do, on the calling thread.</summary>
+		/// <param name="turn">To be filled out with the data for the turn.</param>
+		void decide(Turn& turn);
+
+		/// <summary>Starts deciding what the entity should do on a worker thread, using a snapshot of the battle as it is now.</summary>
+		/// <returns>The decision in progress, allocated with new.</returns>
+		AgentDecision* decide_async();
+	};
+
+	// A decision being made by an anytime agent on a worker thread.
+	class AgentDecision
+	{
+	private:
+		// The entity the decision is for.
+		Entity* m_Self;
+
+		// The usables of the captured battle.
+		UsableTable m_Usables;
+
+		// The entity each index of the snapshot refers to.
+		std::vector<Entity*> m_Entities;
+
+		// The battle as it was when the decision started.
+		BattleSnapshot m_Snapshot;
+
+		// The turn decided on. Only read once m_Ready is set.
+		SimTurn m_Result;
+
+		// Set to make the agent stop deciding.
+		std::atomic<bool> m_Stop{ false };
+
+		// Set once the agent has decided.
+		std::atomic<bool> m_Ready{ false };
+
+		// True if the decision has a time limit.
+		bool m_Timed;
+
+		// The time at which the agent is told to stop.
+		std::chrono::steady_clock::time_point m_Deadline;
+
+		// The worker thread.
+		std::thread m_Thread;
+
+	public:
+		/// <summary>Captures the battle and starts deciding on a worker thread.</summary>
+		/// <param name="agent">The agent deciding.</param>
+		/// <param name="self">The entity the decision is for.</param>
+		/// <param name="seconds">The time after which the agent is told to stop, or 0 for no limit.</param>
+		AgentDecision(AnytimeAgent* agent, Entity* self, float seconds);
+
+		/// <summary>Stops the agent and waits for the worker thread to finish.</summary>
+		~AgentDecision();
+
+		/// <summary>Checks if the agent has decided, without waiting. Tells the agent to stop if it has run out of time.</summary>
+		/// <param name="turn">Filled out with the data for the turn, once the agent has decided.</param>
+		/// <returns>True if the agent has decided, false otherwise.</returns>
+		bool poll(Turn& turn);
+	};
+
+	// An agent that decides using Monte Carlo tree search (UCT) over simulated battles.
+	class MctsAgent : public AnytimeAgent
+	{
+	protected:
+		// The maximum number of iterations per thread, or 0 for no limit.
+		int m_Iterations;
+
+		// The number of threads to search with, each building its own tree.
+		unsigned int m_Threads;
+
+	public:
+		/// <summary>Constructs an agent that decides using Monte Carlo tree search.</summary>
+		/// <param name="self">The entity that the agent acts for.</param>
+		/// <param name="iterations">The maximum number of iterations per thread, or 0 for no limit.</param>
+		/// <param name="seconds">The maximum time to search for, in seconds, or 0 for no limit.</param>
+		/// <param name="threads">The number of threads to search with, or 0 to use every hardware thread.</param>
+		MctsAgent(Entity* self, int iterations, float seconds = 0.f, unsigned int threads = 1);
+
+		/// <summary>Searches for the best turn for a simulated battle.</summary>
+		/// <param name="snapshot">The battle, with the acting entity taking its turn.</param>
+		/// <param name="seed">The seed for the searches.</param>
+		/// <param name="stop">If not nullptr, the search stops early once it is set.</param>
+		/// <returns>The turn with the most visits. Targets chosen at random are left as 0xFF.</returns>
+		SimTurn search(const BattleSnapshot& snapshot, uint64_t seed, const std::atomic<bool>* stop = nullptr) const;
+
+		/// <summary>Searches for the best turn, until the search runs out of iterations or time, or is stopped.</summary>
+		/// <param name="snapshot">The battle, with the acting entity taking its turn.</param>
+		/// <param name="stop">Set when the search must stop.</param>
+		/// <returns>The turn with the most visits so far.</returns>
+		SimTurn think(BattleSnapshot& snapshot, const std::atomic<bool>& stop);
+	};
+
+	// An agent that decides using depth-limited expectiminimax search, with random targets as chance nodes. Searches deeper and deeper until it runs out of time.
+	class ExpectiminimaxAgent : public AnytimeAgent
+	{
+	protected:
+		// The maximum depth to search to, in turns.
+		int m_MaxDepth;
+
+		// Results of searches, reused as each search goes deeper and by the decisions after it.
+		TranspositionTable m_Table;
+
+		// The fingerprint of the battle the table's results were found in.
+		uint64_t m_Fingerprint;
+
+		// The side that the search is maximising the value for.
+		int m_Side;
+
+		// The number of positions searched so far.
+		uint64_t m_Nodes;
+
+		// The time at which to stop searching.
+		std::chrono::steady_clock::time_point m_Deadline;
+
+		// If not nullptr, the search stops once it is set.
+		const std::atomic<bool>* m_Stop;
+
+		// True if the search ran out of time.
+		bool m_Abort;
+
+		// The log of changes for undoing turns.
+		SimUndoLog m_Log;
+
+		/// <summary>Estimates the value of a battle without searching any further.</summary>
+		int evaluate(const BattleSnapshot& snapshot) const;
+
+		/// <summary>Searches a position where an entity is deciding what to do.</summary>
+		int search(BattleSnapshot& snapshot, int depth, int alpha, int beta, int ply, uint8_t* best = nullptr);
+
+		/// <summary>Finds the expected value of a turn, averaged over every way its random targets could be picked.</summary>
+		int expect(BattleSnapshot& snapshot, SimTurn turn, int depth, int alpha, int beta, int ply);
+
+	public:
+		/// <summary>Constructs an agent that decides using expectiminimax search.</summary>
+		/// <param name="self">The entity that the agent acts for.</param>
+		/// <param name="seconds">The maximum time to search for, in seconds.</param>
+		/// <param name="max_depth">The maximum depth to search to, in turns.</param>
+		/// <param name="table_bits">The base-2 logarithm of the number of transposition table slots.</param>
+		ExpectiminimaxAgent(Entity* self, float seconds, int max_depth = 32, unsigned int table_bits = 16);
+
+		/// <summary>Searches for the best turn for a simulated battle.</summary>
+		/// <param name="snapshot">The battle, with the acting entity taking its turn. Left unchanged.</param>
+		/// <param name="stop">If not nullptr, the search stops early once it is set.</param>
+		/// <returns>The best turn found at the deepest completed depth. Targets chosen at random are left as 0xFF.</returns>
+		SimTurn search(BattleSnapshot& snapshot, const std::atomic<bool>* stop = nullptr);
+
+		/// <summary>Searches deeper and deeper for the best turn, until the search runs out of time or is stopped.</summary>
+		/// <param name="snapshot">The battle, with the acting entity taking its turn. Left unchanged.</param>
+		/// <param name="stop">Set when the search must stop.</param>
+		/// <returns>The best turn found at the deepest completed depth.</returns>
+		SimTurn think(BattleSnapshot& snapshot, const std::atomic<bool>& stop);
+	};
+
+}
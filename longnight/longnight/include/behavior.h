@@ -0,0 +1,197 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+#include "battle.h"
+#include "simulation.h"
+
+
+// The folder that behavior scripts are loaded from. A script named "x" is in the file "x.txt".
+#define BEHAVIOR_FOLDER			"res/data/behaviors/"
+
+// The maximum number of different items a behavior script can refer to.
+#define BEHAVIOR_MAX_ITEMS		16
+
+namespace battle
+{
+
+
+	// The instructions of compiled behavior scripts. Operands follow each opcode directly, with multi-byte operands in little-endian order.
+	enum BehaviorOp : uint8_t
+	{
+		// Compares a stat of an entity to a value, and jumps if the comparison fails.
+		// Operands: subject (u8), stat (u8), comparison (u8), whether the stat is a percentage (u8), value (i32), jump target (u16).
+		BEHAVIOR_TEST,
+
+		// Checks which side is next on the timeline, and jumps if it isn't the given side.
+		// Operands: side, as BEHAVIOR_ALLY or BEHAVIOR_ENEMY (u8), jump target (u16).
+		BEHAVIOR_TEST_NEXT,
+
+		// Uses an item, if the entity has it and it is legal. Falls through to the next instruction otherwise.
+		// Operands: index of the item name (u8), how to pick targets (u8).
+		BEHAVIOR_USE,
+
+		// Ends the script without deciding anything.
+		BEHAVIOR_END
+	};
+
+	// Who a condition in a behavior script is about.
+	enum BehaviorSubject : uint8_t
+	{
+		// The entity taking its turn.
+		BEHAVIOR_SELF,
+
+		// The other living ally with the lowest fraction of its Health left.
+		BEHAVIOR_ALLY,
+
+		// The living opponent with the lowest fraction of its Health left.
+		BEHAVIOR_ENEMY,
+
+		// The number of other living allies. Only used with BEHAVIOR_COUNT.
+		BEHAVIOR_ALLIES,
+
+		// The number of living opponents. Only used with BEHAVIOR_COUNT.
+		BEHAVIOR_ENEMIES
+	};
+
+	// A stat tested by a behavior script.
+	enum BehaviorStat : uint8_t
+	{
+		BEHAVIOR_HEALTH,
+		BEHAVIOR_SHIELD,
+		BEHAVIOR_BURN,
+		BEHAVIOR_TOXIN,
+		BEHAVIOR_OFFENSE,
+		BEHAVIOR_DEFENSE,
+		BEHAVIOR_TIME,
+
+		// The number of entities in a group.
+		BEHAVIOR_COUNT
+	};
+
+	// A comparison in a behavior script.
+	enum BehaviorCompare : uint8_t
+	{
+		BEHAVIOR_LESS,
+		BEHAVIOR_LESS_EQUAL,
+		BEHAVIOR_GREATER,
+		BEHAVIOR_GREATER_EQUAL,
+		BEHAVIOR_EQUAL,
+		BEHAVIOR_NOT_EQUAL
+	};
+
+	// How a behavior script picks single targets.
+	enum BehaviorTargeting : uint8_t
+	{
+		// The target with the lowest fraction of its Health left.
+		BEHAVIOR_WEAKEST,
+
+		// The target with the highest fraction of its Health left.
+		BEHAVIOR_STRONGEST,
+
+		// The first target in party order.
+		BEHAVIOR_FIRST,
+
+		// A target picked at random.
+		BEHAVIOR_RANDOM
+	};
+
+
+	// A behavior script, compiled to bytecode. Scripts are lists of rules, tried in order until one of them uses an item:
+	//     # Comments start with a hash.
+	//     when self health < 30% use "debug support" on self
+	//     when enemies >= 2 and enemy burn = 0 use "burn"
+	//     when enemy next use "guard"
+	//     otherwise use "debug offense" on weakest
+	// Subjects are "self", "ally" (the other ally with the least Health left) and "enemy" (the opponent with the least Health left), with the stats health, shield, burn, toxin, offense, defense and time.
+	// Health and shield can be compared as a percentage of their maximum. "allies" and "enemies" count the other living allies and the living opponents.
+	// Targets are picked "on weakest" (the default), "on strongest", "on first" or "on random". "on self" is the same as "on weakest", for usables that target the user anyway.
+	class BehaviorScript
+	{
+	private:
+		// The bytecode.
+		std::vector<uint8_t> m_Code;
+
+		// The IDs of the items the script refers to.
+		std::vector<std::string> m_Items;
+
+	public:
+		/// <summary>Compiles a behavior script.</summary>
+		/// <param name="source">The text of the script.</param>
+		/// <param name="error">Set to a description of the first error, if there is one.</param>
+		/// <returns>The script, or nullptr if it has an error.</returns>
+		static std::shared_ptr<const BehaviorScript> compile(const std::string& source, std::string& error);
+
+		/// <summary>Loads and compiles a behavior script from BEHAVIOR_FOLDER. Errors are printed to the error stream.</summary>
+		/// <param name="name">The name of the script.</param>
+		/// <returns>The script, or nullptr if it doesn't exist or has an error.</returns>
+		static std::shared_ptr<const BehaviorScript> load(const std::string& name);
+
+		/// <summary>Hashes the text of a behavior script in BEHAVIOR_FOLDER, so that changes to the script can be noticed without compiling it.</summary>
+		/// <param name="name">The name of the script.</param>
+		/// <returns>The hash, or FNV1A_OFFSET if the file cannot be read.</returns>
+		static uint64_t hash(const std::string& name);
+
+		/// <summary>Retrieves the bytecode.</summary>
+		const std::vector<uint8_t>& code() const;
+
+		/// <summary>Retrieves the IDs of the items the script refers to, by the index that BEHAVIOR_USE refers to them with.</summary>
+		const std::vector<std::string>& items() const;
+	};
+
+
+	// An agent that follows a behavior script, falling back to acting at random if none of its rules apply.
+	class ScriptedAgent : public Agent
+	{
+	protected:
+		// The script.
+		std::shared_ptr<const BehaviorScript> m_Script;
+
+		// The slot of the usable for each item the script refers to, or -1 if the entity doesn't have it.
+		int8_t m_Slots[BEHAVIOR_MAX_ITEMS];
+
+	public:
+		/// <summary>Constructs an agent that follows a behavior script.</summary>
+		/// <param name="self">The entity that the agent acts for. Its usables must already have been generated.</param>
+		/// <param name="script">The script.</param>
+		ScriptedAgent(Entity* self, std::shared_ptr<const BehaviorScript> script);
+
+		/// <summary>Runs the script for the entity. Allocates nothing apart from the targets of the turn.</summary>
+		/// <param name="turn">To be filled out with the data for the turn.</param>
+		void decide(Turn& turn);
+	};
+
+	/// <summary>Finds the behavior script of each entity in a battle made by BattleSnapshot::create, for a ScriptedPolicy. Allies have none.</summary>
+	/// <param name="allies">The number of allies the battle was made with.</param>
+	/// <param name="enemies">The IDs of the enemies the battle was made with. Every ID must be known, since create() leaves out unknown enemies.</param>
+	/// <returns>The script of each entity by index in the snapshot, or an empty list if none of the enemies has a script.</returns>
+	std::vector<std::shared_ptr<const BehaviorScript>> enemy_scripts(size_t allies, const std::vector<std::string>& enemies);
+
+	// A simulated policy that runs the behavior script of each entity, the same way ScriptedAgent does. Entities without a script act at random, so with no scripts at all it takes the same turns as a RandomPolicy with the same seed.
+	class ScriptedPolicy : public SimPolicy
+	{
+	private:
+		// The script for each entity, by index in the snapshot.
+		std::vector<std::shared_ptr<const BehaviorScript>> m_Scripts;
+
+		// The item each script refers to, for each entity.
+		std::vector<const overworld::Item*> m_Items;
+
+		// The random number generator.
+		SimRandom m_Random;
+
+	public:
+		/// <summary>Constructs a simulated policy that runs behavior scripts.</summary>
+		/// <param name="scripts">The script for each entity, by index in the snapshot. Entities past the end or with nullptr act at random.</param>
+		/// <param name="seed">The seed for the random number generator.</param>
+		ScriptedPolicy(const std::vector<std::shared_ptr<const BehaviorScript>>& scripts, uint64_t seed);
+
+		/// <summary>Runs the script for an entity.</summary>
+		/// <param name="snapshot">The state of the battle.</param>
+		/// <param name="actor">The index of the entity taking its turn.</param>
+		/// <returns>The turn.</returns>
+		SimTurn choose(const BattleSnapshot& snapshot, int actor);
+	};
+
+
+}
@@ -0,0 +1,136 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "party.h"
+#include "simulation.h"
+
+
+// The number of buckets in the histogram of the party's Health when it reaches an encounter. Bucket k counts parties with at least k tenths of their maximum Health, so the last is for parties at full Health.
+#define CAMPAIGN_HEALTH_BUCKETS		11
+
+namespace battle
+{
+
+
+	// One encounter of a campaign.
+	struct CampaignEncounter
+	{
+		// The ID of the encounter.
+		std::string id;
+
+		// The IDs of the enemies. An encounter with no enemies is always won, and only rests the party.
+		std::vector<std::string> enemies;
+
+		// The percentage of their maximum Health restored to the allies left standing, once the encounter is won.
+		int heal = 0;
+
+		// The percentage of their maximum Health that incapacitated allies get back, once the encounter is won. At 0, they stay incapacitated for the encounters after.
+		int revive = 0;
+
+		// The items found once the encounter is won. Each goes to the ally holding the fewest items, as long as that ally holds fewer than ALLY_MAX_ITEMS.
+		std::vector<const overworld::Item*> loot;
+	};
+
+	/// <summary>Reads a campaign from an encounter list, a data file with one encounter per line, in order: id enemies="..." heal="..." revive="..." loot="...".
+	/// The enemies and loot are comma-separated lists of IDs, and every field can be left out.</summary>
+	/// <param name="path">The path of the file.</param>
+	/// <param name="encounters">Set to the encounters.</param>
+	/// <param name="error">Set to a description of the problem, if the file cannot be used.</param>
+	/// <returns>True if the file was read, false otherwise.</returns>
+	bool load_campaign(const std::string& path, std::vector<CampaignEncounter>& encounters, std::string& error);
+
+
+	// What happened at one encounter, over every campaign that reached it.
+	struct EncounterStats
+	{
+		// The number of campaigns that reached the encounter.
+		uint64_t reached = 0;
+
+		// The number of campaigns that won the encounter.
+		uint64_t won = 0;
+
+		// The number of campaigns that ended because the battle was abandoned at the turn limit.
+		uint64_t abandoned = 0;
+
+		// The total number of turns the encounter's battles took.
+		uint64_t turns = 0;
+
+		// The total Health of each ally on reaching the encounter.
+		std::vector<uint64_t> health;
+
+		// The number of campaigns that reached the encounter with each number of allies standing.
+		std::vector<uint64_t> standing;
+
+		// The number of campaigns that reached the encounter with each tenth of the party's maximum Health.
+		uint64_t party_health[CAMPAIGN_HEALTH_BUCKETS] = {};
+
+		/// <summary>Adds the counts of other statistics to these.</summary>
+		/// <param name="other">Statistics for the same encounter and party.</param>
+		void merge(const EncounterStats& other);
+	};
+
+
+	// Runs a party through the encounters of a campaign many times over, where enemies follow their behavior scripts and every other entity acts at random. The party's Health and items carry over from each battle to the next, and a campaign ends at the first battle the party does not win.
+	// This counts how likely the party is to reach each encounter and how worn down it is when it does, since balance problems show up over a whole run rather than in single battles.
+	class CampaignSimulator
+	{
+	private:
+		// The party at the start of every campaign.
+		std::vector<overworld::Ally> m_Party;
+
+		// The encounters, in order.
+		std::vector<CampaignEncounter> m_Encounters;
+
+		// The number of turns after which a battle is abandoned.
+		int m_MaxTurns;
+
+		// The seed of every battle. Encounter e of campaign c always has the same seed, so campaigns can be compared between parties and runs.
+		uint64_t m_Seed;
+
+		// The usable of every item the party holds or can find and every enemy's item, added up front so that battles only read from the table.
+		UsableTable m_Table;
+
+		// The statistics of each encounter, followed by those of the campaigns that won every encounter.
+		std::vector<EncounterStats> m_Stats;
+
+		// The number of campaigns run.
+		uint64_t m_Campaigns = 0;
+
+		/// <summary>Gets empty statistics for each encounter, and for the end of the campaign.</summary>
+		std::vector<EncounterStats> empty_stats() const;
+
+		/// <summary>Runs one campaign, counting what happened in some statistics. Only reads from the usable table, so campaigns can run on several threads at once.</summary>
+		/// <param name="campaign">The index of the campaign, which seeds its battles.</param>
+		/// <param name="stats">The statistics of each encounter, and of the end of the campaign.</param>
+		void run_campaign(uint64_t campaign, std::vector<EncounterStats>& stats);
+
+	public:
+		/// <summary>Sets up a campaign.</summary>
+		/// <param name="party">The party at the start of the campaign.</param>
+		/// <param name="encounters">The encounters, in order.</param>
+		/// <param name="max_turns">The number of turns after which a battle is abandoned, losing the campaign.</param>
+		/// <param name="seed">The seed of every battle.</param>
+		CampaignSimulator(const std::vector<overworld::Ally>& party, const std::vector<CampaignEncounter>& encounters, int max_turns, uint64_t seed);
+
+		/// <summary>Runs more campaigns, split between threads. Campaigns are numbered on from those already run, so several calls count the same campaigns as one call would.</summary>
+		/// <param name="campaigns">The number of campaigns.</param>
+		/// <param name="threads">The number of threads.</param>
+		void run(uint64_t campaigns, unsigned int threads);
+
+		/// <summary>Gets the number of campaigns run.</summary>
+		uint64_t campaigns() const;
+
+		/// <summary>Gets the encounters.</summary>
+		const std::vector<CampaignEncounter>& encounters() const;
+
+		/// <summary>Gets the statistics of each encounter, followed by those of the campaigns that won every encounter, as they reached the end.</summary>
+		const std::vector<EncounterStats>& stats() const;
+
+		/// <summary>Writes the attrition curve of the campaign to a CSV file, one row per encounter and a last row for the end: how often it was reached and won, and the Health and standing allies the party reached it with.</summary>
+		/// <param name="path">The path of the file.</param>
+		/// <returns>True if the file was written, false otherwise.</returns>
+		bool write_csv(const std::string& path) const;
+	};
+
+
+}
@@ -0,0 +1,125 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+// The minimum number of bytes in each shard of a data file that is tokenized in parallel.
+#define DATAFILE_MIN_SHARD_SIZE		65536
+
+// The starting value of a 64-bit FNV-1a hash.
+#define FNV1A_OFFSET				0xCBF29CE484222325ull
+
+namespace data
+{
+
+
+	// A key-value pair in a data record. Both views point into the buffer of the file that the record was read from.
+	struct Field
+	{
+		// The key of the field.
+		std::string_view key;
+
+		// The value of the field, without the surrounding quotes.
+		std::string_view value;
+	};
+
+
+	// A single line of a data file, in the form: id key="value" key="value" ...
+	struct Record
+	{
+		// The ID of the record.
+		std::string_view id;
+
+		// The first field of the record.
+		const Field* fields;
+
+		// The number of fields in the record.
+		size_t count;
+
+		/// <summary>Retrieves the value of a field as a string.</summary>
+		/// <param name="key">The key of the field.</param>
+		/// <returns>The value of the field, or an empty view if the record has no field with the key.</returns>
+		std::string_view get_string(std::string_view key) const;
+
+		/// <summary>Retrieves the value of a field as an integer.</summary>
+		/// <param name="key">The key of the field.</param>
+		/// <returns>The value of the field, or 0 if the record has no field with the key.</returns>
+		int get_int(std::string_view key) const;
+
+		/// <summary>Hashes the ID and fields of the record with 64-bit FNV-1a, over the length and bytes of each, so that every platform and compiler gets the same hash.</summary>
+		/// <returns>A hash that changes whenever the record is edited.</returns>
+		uint64_t hash() const;
+	};
+
+
+	/// <summary>Splits a comma-separated list, such as the value of a field, trimming spaces and tabs around each entry. Empty entries are left out.</summary>
+	/// <param name="list">The list.</param>
+	/// <returns>The entries.</returns>
+	std::vector<std::string> split_list(std::string_view list);
+
+	/// <summary>Adds bytes to a 64-bit FNV-1a hash.</summary>
+	/// <param name="hash">The hash so far, starting from FNV1A_OFFSET.</param>
+	/// <param name="data">The bytes.</param>
+	/// <param name="size">The number of bytes.</param>
+	/// <returns>The hash with the bytes added.</returns>
+	uint64_t fnv1a(uint64_t hash, const void* data, size_t size);
+
+
+	/// <summary>Parses an integer directly from a view of text.</summary>
+	/// <param name="text">The text to parse. Leading whitespace and a sign are allowed, and parsing stops at the first non-digit.</param>
+	/// <returns>The parsed integer, or 0 if the text does not start with a number.</returns>
+	int parse_int(std::string_view text);
+
+
+	// A data file, read into a single buffer and tokenized in place.
+	class DataFile
+	{
+	private:
+		// The contents of the file.
+		std::string m_Buffer;
+
+		// The fields of all records, in the order they appear in the file.
+		std::vector<Field> m_Fields;
+
+		// For each record, its ID and the index of its first field.
+		std::vector<std::pair<std::string_view, size_t>> m_Records;
+
+		/// <summary>Tokenizes a single line of the file.</summary>
+		/// <param name="line">The line to tokenize.</param>
+		/// <param name="fields">The fields to append the fields of the line to.</param>
+		/// <param name="records">The records to append the line to, with field indices relative to the start of the fields.</param>
+		static void tokenize_line(std::string_view line, std::vector<Field>& fields, std::vector<std::pair<std::string_view, size_t>>& records);
+
+		/// <summary>Tokenizes a range of whole lines of the file.</summary>
+		/// <param name="text">The lines to tokenize.</param>
+		/// <param name="fields">The fields to append the fields of the lines to.</param>
+		/// <param name="records">The records to append the lines to, with field indices relative to the start of the fields.</param>
+		static void tokenize(std::string_view text, std::vector<Field>& fields, std::vector<std::pair<std::string_view, size_t>>& records);
+
+	public:
+		/// <summary>Reads and tokenizes a data file. Large files are split into shards at line breaks, which are tokenized concurrently and merged back in file order.</summary>
+		/// <param name="path">The path to the file.</param>
+		/// <param name="threads">The maximum number of threads to tokenize with. 0 uses one per hardware thread.</param>
+		DataFile(const char* path, unsigned int threads = 0);
+
+		DataFile(const DataFile&) = delete;
+		DataFile& operator=(const DataFile&) = delete;
+
+		/// <summary>Checks if the file was read successfully.</summary>
+		/// <returns>True if the file was read, false otherwise.</returns>
+		bool good() const;
+
+		/// <summary>Gets the number of records in the file.</summary>
+		/// <returns>The number of records.</returns>
+		size_t size() const;
+
+		/// <summary>Retrieves a record. The record is only valid for as long as the file is.</summary>
+		/// <param name="index">The index of the record.</param>
+		/// <returns>The record at the given index.</returns>
+		Record operator[](size_t index) const;
+	};
+
+
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include <string>
+#include <unordered_map>
+#include "item.h"
+
+namespace data
+{
+
+
+	// All game data loaded from the data files. The registry is loaded and published once, after which headless tools only ever read from it, from any number of threads.
+	// The game itself still changes it in place on the main thread: attach_graphics() gives items their icons, and hot reloading patches items and enemy templates so that pointers to them stay valid. Nothing may read the registry from another thread while it does; agents deciding on worker threads only read their own copy of the battle.
+	class Registry
+	{
+	private:
+		friend void load_registry();
+		friend void attach_graphics();
+		friend void reload_items();
+		friend void reload_enemies();
+		friend double time_registry_load(const char* items, const char* enemies, unsigned int threads, size_t& records);
+
+		// All items, by ID.
+		std::unordered_map<std::string, overworld::Item*> m_Items;
+
+		// All enemy templates, by ID.
+		std::unordered_map<std::string, battle::EnemyTemplate> m_Enemies;
+
+		/// <summary>Loads all items. Records are parsed in parallel.</summary>
+		/// <param name="path">The path of the item data file.</param>
+		/// <param name="threads">The number of threads to tokenize and parse with.</param>
+		void load_items(const char* path, unsigned int threads);
+
+		/// <summary>Loads all enemy templates. Records are parsed in parallel.</summary>
+		/// <param name="path">The path of the enemy data file.</param>
+		/// <param name="threads">The number of threads to tokenize and parse with.</param>
+		void load_enemies(const char* path, unsigned int threads);
+
+		/// <summary>Loads the items and the enemy templates concurrently.</summary>
+		/// <param name="items">The path of the item data file.</param>
+		/// <param name="enemies">The path of the enemy data file.</param>
+		/// <param name="threads">The number of threads each file is tokenized and parsed with.</param>
+		void load(const char* items, const char* enemies, unsigned int threads);
+
+		Registry() {}
+
+	public:
+		Registry(const Registry&) = delete;
+		Registry& operator=(const Registry&) = delete;
+
+		/// <summary>Retrieves an item.</summary>
+		/// <param name="id">The ID of the item.</param>
+		/// <returns>The item with the given ID, or nullptr if there is no such item.</returns>
+		const overworld::Item* get_item(const std::string& id) const;
+
+		/// <summary>Retrieves an enemy template.</summary>
+		/// <param name="id">The ID of the enemy.</param>
+		/// <returns>The template for the enemy with the given ID, or nullptr if there is no such enemy.</returns>
+		const battle::EnemyTemplate* get_enemy(const std::string& id) const;
+
+		/// <summary>Retrieves all items.</summary>
+		/// <returns>All items, by ID.</returns>
+		const std::unordered_map<std::string, overworld::Item*>& items() const;
+
+		/// <summary>Retrieves all enemy templates.</summary>
+		/// <returns>All enemy templates, by ID.</returns>
+		const std::unordered_map<std::string, battle::EnemyTemplate>& enemies() const;
+	};
+
+
+	/// <summary>Loads all game data and publishes the registry. Items and enemies are loaded concurrently. Safe to call from any thread, and any number of times; only the first call loads anything.</summary>
+	void load_registry();
+
+	/// <summary>Loads game data into a registry of its own, the same way load_registry() does, and then destroys it, in order to time loading.</summary>
+	/// <param name="items">The path of the item data file.</param>
+	/// <param name="enemies">The path of the enemy data file.</param>
+	/// <param name="threads">The number of threads each file is tokenized and parsed with.</param>
+	/// <param name="records">Set to the number of items and enemy templates loaded.</param>
+	/// <returns>The number of seconds loading took.</returns>
+	double time_registry_load(const char* items, const char* enemies, unsigned int threads, size_t& records);
+
+	/// <summary>Retrieves the game data registry, loading it first if it has not been loaded yet.</summary>
+	/// <returns>The game data registry.</returns>
+	const Registry& get_registry();
+
+	/// <summary>Loads the graphics for the game data, such as item icons. Must be called from the thread that owns the graphics context. Headless processes never need to call this.</summary>
+	void attach_graphics();
+
+	/// <summary>Reloads the item data file. Changed items are updated in place, along with the usables generated from them in the current battle, and new items are added. Must only be called while no other thread is reading the registry.</summary>
+	void reload_items();
+
+	/// <summary>Reloads the enemy data file. Changed templates are updated in place, and new templates are added. Enemies already in battle are unaffected. Must only be called while no other thread is reading the registry.</summary>
+	void reload_enemies();
+
+
+}
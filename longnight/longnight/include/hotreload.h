@@ -0,0 +1,50 @@
+#pragma once
+#include <string>
+#include <onions/event.h>
+
+namespace data
+{
+
+
+	// Watches the data files and behavior scripts for changes, and reloads them when they are saved.
+	class DataWatcher : public onion::UpdateListener
+	{
+	private:
+#ifdef __linux__
+		// The inotify instance, or -1 if it could not be created.
+		int m_Inotify;
+
+		// The inotify watch on the folder of behavior scripts, or -1 if it could not be watched.
+		int m_Behaviors;
+#else
+		// The directory containing the data files.
+		std::string m_Directory;
+
+		// The number of frames until the files are checked for changes again.
+		int m_Countdown;
+
+		// The last time that the items file was written to.
+		long long m_ItemsTime;
+
+		// The last time that the enemies file was written to.
+		long long m_EnemiesTime;
+
+		// The last time that any behavior script was written to.
+		long long m_BehaviorsTime;
+#endif
+
+		/// <summary>Checks for changes to the data files.</summary>
+		/// <param name="frames_passed">The number of frames that have passed since the last update.</param>
+		void __update(int frames_passed);
+
+	public:
+		/// <summary>Starts watching the data files.</summary>
+		/// <param name="directory">The directory containing the data files.</param>
+		DataWatcher(const char* directory);
+
+		/// <summary>Stops watching the data files.</summary>
+		~DataWatcher();
+	};
+
+
+}
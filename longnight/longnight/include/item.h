@@ -1,6 +1,7 @@
 #pragma once
 #include <onions/graphics.h>
 #include "battle.h"
+#include "datafile.h"
 
 namespace overworld
 {
@@ -8,29 +9,37 @@ namespace overworld
 
 	struct Item
 	{
-	private:
-		// 
-		static std::unordered_map<std::string, Item*> m_Items;
-
-		// 
-		static onion::SpriteSheet* m_SpriteSheet;
-
 	public:
-		/// <summary>Retrieves the item with the given ID.</summary>
+		/// <summary>Creates an item from its data.</summary>
+		/// <param name="data">The data about the item.</param>
+		/// <returns>An item allocated with new, or nullptr if the item has an unknown type.</returns>
+		static Item* parse(const data::Record& data);
+
+		/// <summary>Retrieves the item with the given ID from the game data registry.</summary>
 		/// <returns>The item with the given ID.</returns>
-		static Item* get_item(std::string id);
+		static const Item* get_item(std::string id);
+
+		// The icon for the item. Only set once graphics have been attached to the game data registry.
+		onion::Graphic* icon = nullptr;
 
-		// The icon for the item.
-		onion::Graphic* icon;
+		// The name of the icon sprite, without the "item " prefix.
+		std::string icon_name;
 
 		// The speed of the item, with 1 being the lowest speed and 5 being the highest.
 		int speed;
 
+		// A hash of the record the item was loaded from.
+		uint64_t checksum = 0;
+
 		/// <summary>Virtual deconstructor.</summary>
 		virtual ~Item();
 
+		/// <summary>Sets the values of the item from its data.</summary>
+		/// <param name="data">The data about the item.</param>
+		virtual void load(const data::Record& data);
+
 		/// <summary>Generates a usable for battle.</summary>
-		virtual battle::Usable* generate() = 0;
+		virtual battle::Usable* generate() const = 0;
 	};
 
 
@@ -68,10 +77,14 @@ namespace overworld
 		int stun;
 
 
-		OffenseItem(const std::unordered_map<std::string, std::string>& data);
+		OffenseItem(const data::Record& data);
+
+		/// <summary>Sets the values of the item from its data.</summary>
+		/// <param name="data">The data about the item.</param>
+		void load(const data::Record& data);
 
 		/// <summary>Generates a usable for battle.</summary>
-		battle::Usable* generate();
+		battle::Usable* generate() const;
 	};
 
 	// An item used on allies.
@@ -100,10 +113,14 @@ namespace overworld
 		int defense;
 
 
-		SupportItem(const std::unordered_map<std::string, std::string>& data);
+		SupportItem(const data::Record& data);
+
+		/// <summary>Sets the values of the item from its data.</summary>
+		/// <param name="data">The data about the item.</param>
+		void load(const data::Record& data);
 
 		/// <summary>Generates a usable for battle.</summary>
-		battle::Usable* generate();
+		battle::Usable* generate() const;
 	};
 
 
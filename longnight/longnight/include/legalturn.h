@@ -0,0 +1,81 @@
+#pragma once
+#include "battle.h"
+#include "simulation.h"
+
+
+namespace battle
+{
+
+
+	// A legal turn for an entity in battle. Targets are stored inline, so lists of turns need no allocation.
+	struct LegalTurn
+	{
+		// The usable.
+		Usable* usable;
+
+		// The number of single targets.
+		int target_count;
+
+		// The single targets, in the order the usable's selections require them. Targets that are picked at random when the turn is taken are nullptr.
+		Entity* targets[MAX_TURN_TARGETS];
+	};
+
+
+	/// <summary>Counts the entities that can be chosen for a single-target selection. Only entities that are not incapacitated can be targeted.</summary>
+	/// <param name="user">The entity taking its turn.</param>
+	/// <param name="target">The kind of selection.</param>
+	/// <returns>The number of entities that can be chosen, or 1 if the selection doesn't need a target to be chosen.</returns>
+	int count_targets(const Entity* user, Target target);
+
+	/// <summary>Finds one of the entities that can be chosen for a single-target selection, in party order.</summary>
+	/// <param name="user">The entity taking its turn.</param>
+	/// <param name="target">The kind of selection.</param>
+	/// <param name="n">Which of the entities to find, from 0 to count_targets() - 1.</param>
+	/// <returns>The entity, or nullptr if there is no such entity.</returns>
+	Entity* nth_target(const Entity* user, Target target, int n);
+
+	/// <summary>Counts the legal turns an entity can take with a usable.</summary>
+	/// <param name="user">The entity taking its turn.</param>
+	/// <param name="usable">The usable.</param>
+	/// <returns>The number of different combinations of targets that can be chosen. Targets picked at random count as one choice.</returns>
+	int count_turns(const Entity* user, const Usable* usable);
+
+	/// <summary>Lists every legal turn an entity can take, without allocating anything.</summary>
+	/// <param name="user">The entity taking its turn.</param>
+	/// <param name="turns">Filled with the turns.</param>
+	/// <param name="capacity">The maximum number of turns to list.</param>
+	/// <returns>The number of turns listed.</returns>
+	int legal_turns(const Entity* user, LegalTurn* turns, int capacity);
+
+	/// <summary>Picks one of an entity's legal turns uniformly at random, then picks any random targets.</summary>
+	/// <param name="user">The entity taking its turn.</param>
+	/// <param name="turn">To be filled out with the data for the turn.</param>
+	/// <returns>True if the entity has a legal turn, false if it can only pass (in which case the turn's usable is nullptr).</returns>
+	bool sample_turn(Entity* user, Turn& turn);
+
+
+	/// <summary>Counts the legal turns an entity can take with a usable in a simulated battle.</summary>
+	/// <param name="snapshot">The battle.</param>
+	/// <param name="actor">The index of the entity taking its turn.</param>
+	/// <param name="slot">The index of the usable within the entity's usables.</param>
+	/// <returns>The number of different combinations of targets that can be chosen. Targets picked at random count as one choice.</returns>
+	int count_turns(const BattleSnapshot& snapshot, int actor, int slot);
+
+	/// <summary>Lists every legal turn an entity can take in a simulated battle, without allocating anything. Targets picked at random are left as 0xFF.</summary>
+	/// <param name="snapshot">The battle.</param>
+	/// <param name="actor">The index of the entity taking its turn.</param>
+	/// <param name="turns">Filled with the turns.</param>
+	/// <param name="capacity">The maximum number of turns to list.</param>
+	/// <returns>The number of turns listed.</returns>
+	int legal_turns(const BattleSnapshot& snapshot, int actor, SimTurn* turns, int capacity);
+
+	/// <summary>Picks one of an entity's legal turns in a simulated battle uniformly at random, then picks any random targets.</summary>
+	/// <param name="snapshot">The battle.</param>
+	/// <param name="actor">The index of the entity taking its turn.</param>
+	/// <param name="random">The random number generator.</param>
+	/// <param name="turn">Set to the turn, or to a pass if the entity has no legal turn.</param>
+	/// <returns>True if the entity has a legal turn, false if it can only pass.</returns>
+	bool sample_turn(const BattleSnapshot& snapshot, int actor, SimRandom& random, SimTurn& turn);
+
+
+}
@@ -0,0 +1,189 @@
+#pragma once
+#include <map>
+#include <string>
+#include <vector>
+#include "sweep.h"
+
+
+// The number of items each ally holds in a loadout, as in the party the game starts with.
+#define LOADOUT_ITEMS			ALLY_MAX_ITEMS
+
+// The number of times a round of a loadout search tries to draw each loadout it needs, before giving up on pools too small to fill the round with different loadouts.
+#define LOADOUT_ATTEMPTS		16
+
+namespace battle
+{
+
+
+	// What a loadout optimiser looks for.
+	enum LoadoutObjective
+	{
+		// The party that wins the most battles. Ties go to the party that wins sooner.
+		LOADOUT_WIN_RATE,
+
+		// The party that wins in the fewest turns. Battles that are lost or abandoned count as taking the turn limit.
+		LOADOUT_SHORTEST
+	};
+
+	// How a loadout optimiser searches.
+	struct LoadoutOptions
+	{
+		// The number of allies.
+		int allies = 3;
+
+		// The number of items each ally holds.
+		int items = LOADOUT_ITEMS;
+
+		// What to look for.
+		LoadoutObjective objective = LOADOUT_WIN_RATE;
+
+		// The number of loadouts tried in each round. Must be at least 1.
+		unsigned int population = 64;
+
+		// The number of rounds, at least 1. Every round after the first breeds most of its loadouts from the best of the round before.
+		unsigned int rounds = 4;
+
+		// The number of battles each loadout of a round runs before the first half is dropped.
+		unsigned int min_battles = 50;
+
+		// The number of loadouts of a round that are never dropped, and run the most battles, so that the best can be told apart from its closest rivals.
+		unsigned int finalists = 4;
+
+		// The most battles a loadout runs in a round.
+		unsigned int max_battles = 3200;
+
+		// The number of turns after which a battle is abandoned.
+		int max_turns = 200;
+
+		// The seed of the search, and of every battle. Battle k of every loadout has the same seed, so that loadouts are compared on the same starting timelines and random streams.
+		uint64_t seed = 1;
+	};
+
+	// How well a loadout did.
+	struct LoadoutResult
+	{
+		// The IDs of the items held by each ally.
+		std::vector<std::vector<std::string>> items;
+
+		// The number of battles run.
+		unsigned int battles;
+
+		// The number of battles won.
+		unsigned int wins;
+
+		// The mean number of turns, where battles that were lost or abandoned count as taking the turn limit.
+		double turns;
+
+		// The lower and upper bound of the confidence interval of the win rate.
+		double interval[2];
+	};
+
+
+	// Searches the items the allies of a party could hold for the loadout that does best against some enemies, where enemies follow their behavior scripts and every other entity acts at random.
+	// Each round runs successive halving: every loadout runs a few battles, the better half runs twice as many, and so on until only the finalists are left, so that the budget of battles goes to the loadouts that might be best. Every round after the first starts from the best loadouts of the last, crossed with each other and mutated, along with some new random loadouts.
+	// A loadout's battles are kept for the rest of the search, so a loadout that comes up again only runs the battles it hasn't yet, and they can also be read from and written to a result cache.
+	class LoadoutOptimiser
+	{
+	private:
+		// A loadout, as the index of each ally's items in the pool, ally by ally. Each ally's items are sorted and so are the allies, since neither order changes what the party can do.
+		typedef std::vector<uint16_t> Loadout;
+
+		// The battles run for a loadout.
+		struct Evaluation
+		{
+			// The allies.
+			std::vector<overworld::Ally> party;
+
+			// The key of the loadout's entry in the result cache.
+			uint64_t key;
+
+			// The outcome of each battle, in order.
+			std::vector<SweepOutcome> outcomes;
+
+			// The number of battles in the loadout's entry in the result cache.
+			size_t cached;
+		};
+
+		// The items the allies can hold.
+		std::vector<const overworld::Item*> m_Pool;
+
+		// The ID of each item in the pool.
+		std::vector<std::string> m_PoolIds;
+
+		// The IDs of the enemies.
+		std::vector<std::string> m_Enemies;
+
+		// How to search.
+		LoadoutOptions m_Options;
+
+		// The usable of every item in the pool and every enemy's item, added up front so that battles only read from the table.
+		UsableTable m_Table;
+
+		// The battles run for every loadout tried.
+		std::map<Loadout, Evaluation> m_Evaluations;
+
+		// The best loadouts of the last round, which the next round is bred from.
+		std::vector<Loadout> m_Parents;
+
+		// The result cache, if there is one.
+		ResultCache m_Cache;
+
+		// Draws loadouts and choices for breeding them.
+		SimRandom m_Random;
+
+		// The number of battles run, and read from the result cache.
+		size_t m_Run = 0;
+		size_t m_CacheHits = 0;
+
+		/// <summary>Sorts the items of each ally, and then the allies.</summary>
+		void canonicalise(Loadout& loadout) const;
+
+		/// <summary>Draws a loadout at random.</summary>
+		Loadout random_loadout();
+
+		/// <summary>Breeds a loadout from two others, taking each ally from one or the other, and then changing one item at random.</summary>
+		Loadout breed(const Loadout& first, const Loadout& second);
+
+		/// <summary>Finds the battles run for a loadout, setting them up if the loadout has not been tried.</summary>
+		Evaluation& evaluation(const Loadout& loadout);
+
+		/// <summary>Runs battles split between threads until each loadout has run at least some number of them, and writes the new battles to the result cache.</summary>
+		void evaluate(const std::vector<const Loadout*>& loadouts, unsigned int battles, unsigned int threads);
+
+		/// <summary>Scores a loadout on its first battles, where higher is better.</summary>
+		double score(const Evaluation& evaluation, unsigned int battles) const;
+
+	public:
+		/// <summary>Sets up a search.</summary>
+		/// <param name="pool">The IDs of the items the allies can hold. Items can be held more than once.</param>
+		/// <param name="enemies">The IDs of the enemies.</param>
+		/// <param name="options">How to search.</param>
+		LoadoutOptimiser(const std::vector<std::string>& pool, const std::vector<std::string>& enemies, const LoadoutOptions& options);
+
+		/// <summary>Reads the battles of loadouts from a result cache, and writes the battles the search runs to it. Keys are found the same way a sweep with common random numbers finds them, so the two share entries.</summary>
+		/// <param name="directory">The path of the cache's directory, which is created if it does not exist.</param>
+		/// <param name="error">Set to a description of the problem, if the cache cannot be used.</param>
+		/// <returns>True if the cache was opened, false otherwise.</returns>
+		bool open_cache(const std::string& directory, std::string& error);
+
+		/// <summary>Runs one round of the search. The first round tries random loadouts, and each round after breeds most of its loadouts from the best of the round before.</summary>
+		/// <param name="threads">The number of threads.</param>
+		void run_round(unsigned int threads);
+
+		/// <summary>Gets how well every loadout tried did, with those that ran the most battles first (up to the most a round runs), and then from best to worst.</summary>
+		std::vector<LoadoutResult> results() const;
+
+		/// <summary>Gets the number of battles run.</summary>
+		size_t battles_run() const;
+
+		/// <summary>Gets the number of battles read from the result cache.</summary>
+		size_t battles_cached() const;
+
+		/// <summary>Writes how well every loadout tried did to a CSV file, one row per loadout, in the order of results().</summary>
+		/// <param name="path">The path of the file.</param>
+		/// <returns>True if the file was written, false otherwise.</returns>
+		bool write_csv(const std::string& path) const;
+	};
+
+
+}
@@ -0,0 +1,173 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "battle.h"
+#include "simulation.h"
+#include "tablepolicy.h"
+
+
+// The number of inputs encoded for each entity.
+#define NET_ENTITY_FEATURES		8
+
+// The number of other living allies encoded, in party order.
+#define NET_ALLIES				3
+
+// The number of living opponents encoded, in party order.
+#define NET_OPPONENTS			4
+
+// The number of inputs to a policy network: the acting entity, then its allies, then its opponents.
+#define NET_INPUTS				((1 + NET_ALLIES + NET_OPPONENTS) * NET_ENTITY_FEATURES)
+
+// The output of a policy network holding its estimate of the chance that the acting entity's side wins. The outputs before it are a score for each action.
+#define NET_VALUE_OUTPUT		POLICY_MAX_ACTIONS
+
+// The number of outputs of a policy network.
+#define NET_OUTPUTS				(POLICY_MAX_ACTIONS + 1)
+
+// The maximum number of layers in a policy network.
+#define NET_MAX_LAYERS			8
+
+// The maximum width of any layer of a policy network.
+#define NET_MAX_WIDTH			1024
+
+// Layer widths are padded to a multiple of this, so that the kernels never need a remainder loop.
+#define NET_LANES				8
+
+// The first four bytes of a policy network file.
+#define NET_MAGIC				0x4E4E4E4Cu
+
+// The version of the policy network file format.
+#define NET_VERSION				1
+
+namespace battle
+{
+
+
+	/// <summary>Encodes the state of a battle, as seen by the entity taking its turn, as inputs to a policy network.</summary>
+	/// <param name="user">The entity taking its turn.</param>
+	/// <param name="inputs">Filled with NET_INPUTS inputs.</param>
+	void encode_state(const Entity* user, float* inputs);
+
+	/// <summary>Encodes the state of a simulated battle, as seen by the entity taking its turn, as inputs to a policy network. Gives the same inputs as the live battle would.</summary>
+	/// <param name="snapshot">The battle.</param>
+	/// <param name="actor">The index of the entity taking its turn.</param>
+	/// <param name="inputs">Filled with NET_INPUTS inputs.</param>
+	void encode_state(const BattleSnapshot& snapshot, int actor, float* inputs);
+
+
+	// A small fully-connected network that scores the actions of the entity taking its turn, and estimates the chance of winning. Every layer but the last applies ReLU. Evaluated with AVX2 or SSE kernels when the CPU has them, or scalar code otherwise.
+	// The file is a header of NET_MAGIC, NET_VERSION and the number of layers, then the width of each layer from the inputs to the outputs (all as 32-bit integers), then for each layer its weights (one row of inputs per output) followed by its biases (all as 32-bit floats).
+	class PolicyNetwork
+	{
+	private:
+		// The number of layers.
+		int m_LayerCount = 0;
+
+		// The width of each layer, from the inputs to the outputs.
+		int m_Widths[NET_MAX_LAYERS + 1];
+
+		// The width of each layer, padded to a multiple of NET_LANES.
+		int m_Padded[NET_MAX_LAYERS + 1];
+
+		// The weights of each layer, with each row padded with zeros.
+		std::vector<float> m_Weights[NET_MAX_LAYERS];
+
+		// The biases of each layer.
+		std::vector<float> m_Biases[NET_MAX_LAYERS];
+
+	public:
+		/// <summary>Reads a network from a file.</summary>
+		/// <param name="path">The path of the file.</param>
+		/// <returns>True if the file was a valid network with NET_INPUTS inputs and NET_OUTPUTS outputs, false otherwise (in which case the network is left empty).</returns>
+		bool load(const std::string& path);
+
+		/// <summary>Evaluates the network for a batch of inputs. Each layer is applied to the whole batch at once, so that its weights are only read once.</summary>
+		/// <param name="inputs">The inputs, NET_INPUTS for each item of the batch.</param>
+		/// <param name="count">The number of items in the batch.</param>
+		/// <param name="outputs">Filled with the outputs, NET_OUTPUTS for each item of the batch.</param>
+		void evaluate(const float* inputs, int count, float* outputs) const;
+
+		/// <summary>Encodes and evaluates a batch of simulated battles, such as the leaves of a search.</summary>
+		/// <param name="snapshots">The battles.</param>
+		/// <param name="actors">The index of the entity taking its turn in each battle.</param>
+		/// <param name="count">The number of battles.</param>
+		/// <param name="outputs">Filled with the outputs, NET_OUTPUTS for each battle.</param>
+		void evaluate(const BattleSnapshot* const* snapshots, const int* actors, int count, float* outputs) const;
+
+		/// <summary>Retrieves a network loaded from a file. Each file is only loaded once, and the network is kept for the rest of the program. Safe to call from any thread.</summary>
+		/// <param name="path">The path of the file.</param>
+		/// <returns>The network, or nullptr if the file is not a valid network.</returns>
+		static const PolicyNetwork* get(const std::string& path);
+	};
+
+	/// <summary>Gets the name of the kernels used to evaluate policy networks on this CPU.</summary>
+	/// <returns>"avx2", "sse2" or "scalar".</returns>
+	const char* network_kernel_name();
+
+	// How one of the kernels that evaluate policy networks did on a random layer.
+	struct NetworkKernelCheck
+	{
+		// The name of the kernels: "scalar", "sse2" or "avx2".
+		const char* name;
+
+		// The largest difference between an output and a double-precision reference, divided by the sum of the sizes of the terms that made the output.
+		double error;
+
+		// The average number of seconds taken to apply the layer to the batch.
+		double seconds;
+	};
+
+	/// <summary>Applies a layer of random weights to a batch of random inputs with each kernel that this CPU supports, and compares them to a double-precision reference.
+	/// Only the fastest kernel is ever used for evaluating networks, so this is how the others get run on CPUs that have it.</summary>
+	/// <param name="in">The number of inputs of the layer.</param>
+	/// <param name="out">The number of outputs of the layer.</param>
+	/// <param name="count">The number of items in the batch.</param>
+	/// <param name="repeats">The number of times each kernel is timed applying the layer.</param>
+	/// <param name="seed">The seed of the weights and inputs.</param>
+	/// <returns>How each kernel did, starting with the scalar kernel.</returns>
+	std::vector<NetworkKernelCheck> check_network_kernels(int in, int out, int count, int repeats, uint64_t seed);
+
+
+	// An agent that takes the legal action its policy network scores highest.
+	class NetworkAgent : public Agent
+	{
+	protected:
+		// The network.
+		const PolicyNetwork* m_Network;
+
+	public:
+		/// <summary>Constructs an agent that acts from a policy network.</summary>
+		/// <param name="self">The entity that the agent acts for.</param>
+		/// <param name="network">The network. Must outlive the agent.</param>
+		NetworkAgent(Entity* self, const PolicyNetwork* network);
+
+		/// <summary>Evaluates the network for the entity.</summary>
+		/// <param name="turn">To be filled out with the data for the turn.</param>
+		void decide(Turn& turn);
+	};
+
+	// A simulated policy that takes the legal action its policy network scores highest, the same way NetworkAgent does.
+	class NetworkPolicy : public SimPolicy
+	{
+	private:
+		// The network.
+		const PolicyNetwork* m_Network;
+
+		// The random number generator, for random targets.
+		SimRandom m_Random;
+
+	public:
+		/// <summary>Constructs a simulated policy that acts from a policy network.</summary>
+		/// <param name="network">The network.</param>
+		/// <param name="seed">The seed for the random number generator.</param>
+		NetworkPolicy(const PolicyNetwork* network, uint64_t seed);
+
+		/// <summary>Evaluates the network for an entity.</summary>
+		/// <param name="snapshot">The state of the battle.</param>
+		/// <param name="actor">The index of the entity taking its turn.</param>
+		/// <returns>The turn.</returns>
+		SimTurn choose(const BattleSnapshot& snapshot, int actor);
+	};
+
+
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+
+/// <summary>Gets the number of worker threads to use for parallel work.</summary>
+/// <returns>The number of hardware threads, or 1 if it cannot be determined.</returns>
+inline unsigned int worker_count()
+{
+	unsigned int count = std::thread::hardware_concurrency();
+	return count == 0 ? 1 : count;
+}
+
+/// <summary>Splits a range of indices into contiguous chunks, and calls a function on each chunk from its own thread. Chunk k always covers the same indices for the same count and number of chunks.</summary>
+/// <param name="count">The number of indices.</param>
+/// <param name="chunks">The number of chunks to split the range into. The calling thread processes the first chunk.</param>
+/// <param name="func">A function taking (chunk index, first index, one past the last index).</param>
+template <class F>
+void parallel_for(size_t count, unsigned int chunks, F func)
+{
+	chunks = (unsigned int)std::max<size_t>(1, std::min<size_t>(chunks, count));
+
+	std::vector<std::thread> threads;
+	threads.reserve(chunks - 1);
+
+	for (unsigned int k = 1; k < chunks; ++k)
+		threads.emplace_back(func, k, count * k / chunks, count * (k + 1) / chunks);
+
+	func(0u, (size_t)0, count / chunks);
+
+	for (auto iter = threads.begin(); iter != threads.end(); ++iter)
+		iter->join();
+}
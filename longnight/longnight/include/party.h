@@ -1,6 +1,10 @@
 #pragma once
 #include "item.h"
 
+
+// The most items an ally can hold.
+#define ALLY_MAX_ITEMS			5
+
 namespace overworld
 {
 
@@ -15,11 +19,15 @@ namespace overworld
 		int max_health = 999;
 
 
-		// The items held by the ally.
-		std::vector<Item*> items;
+		// The items held by the ally, at most ALLY_MAX_ITEMS.
+		std::vector<const Item*> items;
 	};
 
 
+	/// <summary>Creates the party used for testing: three allies, each with four Debug Offense items and a Debug Support item.</summary>
+	/// <returns>The allies.</returns>
+	std::vector<Ally> debug_party();
+
 	/// <summary>Retrieves all ally characters.</summary>
 	/// <returns>An array of all player-controlled characters.</returns>
 	std::vector<Ally>& get_party();
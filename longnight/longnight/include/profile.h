@@ -0,0 +1,38 @@
+#pragma once
+#include <chrono>
+#include <ostream>
+#include <onions/event.h>
+
+
+// A phase of startup, timed from when it is constructed to when it is destroyed. Phases can run on any thread.
+class StartupPhase
+{
+private:
+	// The name of the phase.
+	const char* m_Name;
+
+	// When the phase started.
+	std::chrono::steady_clock::time_point m_Start;
+
+public:
+	/// <summary>Starts timing a phase of startup.</summary>
+	/// <param name="name">The name of the phase. Must outlive the program.</param>
+	StartupPhase(const char* name);
+
+	/// <summary>Records the phase in the startup timeline.</summary>
+	~StartupPhase();
+};
+
+// Records the time to the first frame, prints the startup timeline, then destroys itself.
+class StartupReport : public onion::UpdateListener
+{
+protected:
+	/// <summary>Prints the startup timeline on the first update.</summary>
+	/// <param name="frames_passed">The number of frames that have passed since the last update.</param>
+	void __update(int frames_passed);
+};
+
+
+/// <summary>Prints every recorded phase of startup, in the order they started.</summary>
+/// <param name="out">The stream to print to.</param>
+void print_startup_timeline(std::ostream& out);
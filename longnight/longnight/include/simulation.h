@@ -0,0 +1,501 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "battle.h"
+
+
+// The number of entities a snapshot stores inline. Larger battles share their entities between clones until one of the clones changes them.
+#define SNAPSHOT_INLINE_ENTITIES	8
+
+// The maximum number of usables an entity can have in a simulated battle.
+#define SIM_MAX_USABLES				8
+
+// The maximum number of single targets a usable can require.
+#define SIM_MAX_TARGETS				MAX_TURN_TARGETS
+
+// The usable index of a turn where the entity does nothing.
+#define SIM_PASS					0xFF
+
+// The distance the timeline advances each frame, at 60 frames per second.
+#define SIM_TIMELINE_STEP			150
+
+// The distance between tick points on the timeline.
+#define SIM_TIMELINE_TICK			(TIMELINE_MAX / 5)
+
+// Where an entity goes on the timeline when its turn ends without moving it, as when it passes. Matches TickEvent.
+#define SIM_PASS_TIME				(TIMELINE_MAX * 3 / 5)
+
+
+namespace battle
+{
+
+
+	// A fast random number generator for simulations (splitmix64). Cheap to copy, so each simulation can own one.
+	struct SimRandom
+	{
+		// The state of the generator.
+		uint64_t state;
+
+		/// <summary>Seeds the generator.</summary>
+		/// <param name="seed">The seed.</param>
+		SimRandom(uint64_t seed = 0);
+
+		/// <summary>Generates the next random number.</summary>
+		/// <returns>A random 64-bit number.</returns>
+		uint64_t next();
+
+		/// <summary>Generates a random number in a range.</summary>
+		/// <param name="n">One past the largest number to generate. Must be positive.</param>
+		/// <returns>A random number from 0 to n - 1.</returns>
+		unsigned int below(unsigned int n);
+	};
+
+
+	// The kind of a simulated effect.
+	enum SimEffectType : uint8_t
+	{
+		SIM_DAMAGE,
+		SIM_STATUS
+	};
+
+	// An effect of a usable, reduced to what it does to the battle state.
+	struct SimEffect
+	{
+		// What kind of effect it is.
+		SimEffectType type;
+
+		// The status inflicted, for status effects.
+		Status status;
+
+		// The base damage, or the amount of status to inflict.
+		int value;
+	};
+
+	// A set of targets for a sequence of effects.
+	struct SimSelection
+	{
+		// Who is targeted.
+		Target target;
+
+		// The index of the first effect in the usable table.
+		uint16_t first_effect;
+
+		// The number of effects.
+		uint16_t effect_count;
+	};
+
+	// A usable, reduced to what it does to the battle state.
+	struct SimUsable
+	{
+		// The index of the first target selection in the usable table.
+		uint16_t first_selection;
+
+		// The number of target selections.
+		uint8_t selection_count;
+
+		// The number of selections that require a single target to be chosen.
+		uint8_t single_targets;
+	};
+
+
+	// Every usable that simulated battles can refer to. Snapshots only point to the table, so it must outlive them.
+	class UsableTable
+	{
+	private:
+		// All effects.
+		std::vector<SimEffect> m_Effects;
+
+		// All target selections.
+		std::vector<SimSelection> m_Selections;
+
+		// All usables.
+		std::vector<SimUsable> m_Usables;
+
+		// The index of the usable generated from each item.
+		std::unordered_map<const overworld::Item*, uint16_t> m_ItemIndex;
+
+	public:
+		/// <summary>Adds a usable to the table.</summary>
+		/// <param name="usable">The usable to add.</param>
+		/// <returns>The index of the usable in the table.</returns>
+		uint16_t add(const Usable& usable);
+
+		/// <summary>Adds the usable generated by an item to the table, if it has not been added already.</summary>
+		/// <param name="item">The item.</param>
+		/// <returns>The index of the usable in the table.</returns>
+		uint16_t add(const overworld::Item* item);
+
+		/// <summary>Adds the usable generated by one item in place of another's, so that entities with the original item use the replacement's usable. Must be called before the original item is added.</summary>
+		/// <param name="item">The original item.</param>
+		/// <param name="replacement">The item to generate the usable from.</param>
+		/// <returns>The index of the usable in the table.</returns>
+		uint16_t replace(const overworld::Item* item, const overworld::Item* replacement);
+
+		/// <summary>Finds the usable generated by an item, without adding it.</summary>
+		/// <param name="item">The item.</param>
+		/// <returns>The index of the usable in the table, or 0xFFFF if the item has not been added.</returns>
+		uint16_t find(const overworld::Item* item) const;
+
+		/// <summary>Retrieves a usable.</summary>
+		/// <param name="index">The index of the usable.</param>
+		/// <returns>The usable.</returns>
+		const SimUsable& operator[](uint16_t index) const;
+
+		/// <summary>Retrieves a target selection of a usable.</summary>
+		/// <param name="usable">The usable.</param>
+		/// <param name="index">The index of the selection within the usable.</param>
+		/// <returns>The target selection.</returns>
+		const SimSelection& selection(const SimUsable& usable, int index) const;
+
+		/// <summary>Retrieves an effect of a target selection.</summary>
+		/// <param name="selection">The target selection.</param>
+		/// <param name="index">The index of the effect within the selection.</param>
+		/// <returns>The effect.</returns>
+		const SimEffect& effect(const SimSelection& selection, int index) const;
+
+		/// <summary>Gets the number of usables in the table.</summary>
+		/// <returns>The number of usables.</returns>
+		size_t size() const;
+	};
+
+
+	// Flags for the state of a simulated entity.
+	enum SimEntityFlags : uint8_t
+	{
+		// The entity is still in the battle. Defeated enemies are ejected from the battle.
+		SIM_PRESENT = 1,
+
+		// The entity has reached the front of the timeline, and is waiting to take its turn.
+		SIM_PENDING_TURN = 2,
+
+		// The entity has passed a tick point, and is waiting for its tick to be processed.
+		SIM_PENDING_TICK = 4
+	};
+
+	// An ally or enemy in a simulated battle. The stats mirror those of Entity.
+	struct SimEntity
+	{
+		int cur_health;
+		int max_health;
+
+		int cur_shield;
+		int max_shield;
+
+		int base_offense;
+		int cur_offense;
+		int base_defense;
+		int cur_defense;
+
+		int burn;
+		int toxin;
+
+		// The entity's position on the timeline.
+		int time;
+
+		// Which side the entity is on. Entities on the same side are allies.
+		uint8_t side;
+
+		// A combination of SimEntityFlags.
+		uint8_t flags;
+
+		// The number of usables the entity has.
+		uint8_t usable_count;
+
+		// The indices of the entity's usables in the usable table.
+		uint16_t usables[SIM_MAX_USABLES];
+	};
+
+	// A turn in a simulated battle.
+	struct SimTurn
+	{
+		// The index of the usable within the acting entity's usables, or SIM_PASS if the entity does nothing.
+		uint8_t usable;
+
+		// The number of single targets.
+		uint8_t target_count;
+
+		// The entity indices of the single targets, in the order the usable's selections require them.
+		uint8_t targets[SIM_MAX_TARGETS];
+	};
+
+
+	// A change to one value of a simulated entity, recorded so that it can be undone.
+	struct SimChange
+	{
+		// The index of the entity.
+		uint8_t entity;
+
+		// The byte offset of the value within SimEntity.
+		uint8_t field;
+
+		// The value before the change.
+		int value;
+	};
+
+	// A record of changes made to a snapshot, so that turns can be undone in reverse order. Reused across turns, so that it stops allocating once it has grown large enough.
+	struct SimUndoLog
+	{
+		// The changes, in the order they were made.
+		std::vector<SimChange> changes;
+	};
+
+	// What is needed to undo a turn, in addition to the changes in the undo log.
+	struct SimUndo
+	{
+		// The size of the undo log before the turn.
+		size_t position;
+
+		// The hash of the entities before the turn.
+		uint64_t hash;
+
+		// The number of living entities on each side before the turn.
+		uint8_t alive[2];
+
+		// The acting entity before the turn.
+		uint8_t actor;
+
+		// The winner before the turn.
+		int8_t winner;
+
+		// The number of turns taken before the turn.
+		uint16_t turns;
+	};
+
+
+	// The damage taken in a simulated battle, counted as it is dealt.
+	struct SimDamageTally
+	{
+		// The Health and Shield lost by each side, by DamageSource.
+		uint64_t damage[2][3];
+	};
+
+
+	// A compact copy of the logical state of a battle, without any animation. Applies the same rules as the battle events, and can be cloned cheaply to explore what might happen.
+	class BattleSnapshot
+	{
+	private:
+		// The usables that entities refer to.
+		const UsableTable* m_Usables;
+
+		// The number of entities.
+		uint8_t m_Count = 0;
+
+		// The entity currently taking its turn, or 0xFF if there is none.
+		uint8_t m_Actor = 0xFF;
+
+		// The side that won, or -1 if the battle is ongoing.
+		int8_t m_Winner = -1;
+
+		// The number of turns that have been taken.
+		uint16_t m_Turns = 0;
+
+		// The entities, if there are few enough to store inline.
+		SimEntity m_Inline[SNAPSHOT_INLINE_ENTITIES];
+
+		// The entities, if there are too many to store inline. Shared between clones until one of them changes it.
+		std::shared_ptr<std::vector<SimEntity>> m_Shared;
+
+		// The Zobrist hash of the entities, kept up to date as they change.
+		uint64_t m_Hash = 0;
+
+		// The number of entities on each side that are present and not incapacitated, kept up to date as they change.
+		uint8_t m_Alive[2] = { 0, 0 };
+
+		// The log to record changes in, or nullptr if changes are not being recorded.
+		SimUndoLog* m_Log = nullptr;
+
+		// The tally to count damage in, or nullptr if damage is not being counted.
+		SimDamageTally* m_Tally = nullptr;
+
+		/// <summary>Changes a value of an entity, recording the change if needed.</summary>
+		void set(int index, int SimEntity::* field, int value);
+
+		/// <summary>Changes the flags of an entity, recording the change if needed.</summary>
+		void set_flags(int index, uint8_t flags);
+
+		/// <summary>Deals damage to an entity, following the rules of DamageEvent.</summary>
+		void damage(int user, int target, int damage, DamageSource source);
+
+		/// <summary>Inflicts a status effect on an entity, following the rules of InflictStatusEvent.</summary>
+		void inflict(int target, Status status, int value);
+
+		/// <summary>Applies the effects of a target selection to a target.</summary>
+		void apply_effects(int user, int target, const SimSelection& selection);
+
+		/// <summary>Handles an entity being reduced to 0 Health, and checks whether one side has won.</summary>
+		void defeat(int target);
+
+		/// <summary>Processes an entity passing a tick, following the rules of TickEvent.</summary>
+		void tick(int index);
+
+		/// <summary>Advances the timeline until an entity reaches the front or passes a tick, following the rules of TimelineEvent.</summary>
+		/// <returns>False if no entity can move along the timeline, true otherwise.</returns>
+		bool advance_timeline();
+
+	public:
+		/// <summary>Constructs an empty snapshot.</summary>
+		/// <param name="usables">The usables that entities will refer to.</param>
+		BattleSnapshot(const UsableTable* usables);
+
+		/// <summary>Captures the state of a battle in progress. Turns already waiting in the event queue are captured as pending turns, but pending ticks and animations are not.</summary>
+		/// <param name="party">The party to capture as side 0. Its enemies are captured as side 1.</param>
+		/// <param name="usables">The table to add the usables of all entities to.</param>
+		/// <param name="entities">If not nullptr, filled with the entity each index of the snapshot refers to.</param>
+		/// <param name="actor">The entity currently taking its turn, if any.</param>
+		/// <returns>The snapshot.</returns>
+		static BattleSnapshot capture(const Party& party, UsableTable& usables, std::vector<Entity*>* entities = nullptr, Entity* actor = nullptr);
+
+		/// <summary>Sets up a new battle from the game data, the way battle::State does.</summary>
+		/// <param name="allies">The player characters, as side 0.</param>
+		/// <param name="enemies">The IDs of the enemies, as side 1.</param>
+		/// <param name="usables">The table to add the usables of all entities to.</param>
+		/// <param name="random">The random number generator for the starting timeline positions.</param>
+		/// <returns>The snapshot.</returns>
+		static BattleSnapshot create(const std::vector<overworld::Ally>& allies, const std::vector<std::string>& enemies, UsableTable& usables, SimRandom& random);
+
+		/// <summary>Copies the Health of the allies back to the player characters, the way battle::State does when a battle ends.</summary>
+		/// <param name="allies">The player characters the snapshot was created from, in the same order.</param>
+		void write_back(std::vector<overworld::Ally>& allies) const;
+
+		/// <summary>Adds an entity to the battle.</summary>
+		/// <param name="entity">The entity.</param>
+		void add(const SimEntity& entity);
+
+		/// <summary>Copies the snapshot. Battles of up to SNAPSHOT_INLINE_ENTITIES entities are copied in full; larger ones share their entities until either copy changes them. The copy does not count damage in the original's tally.</summary>
+		/// <returns>The copy.</returns>
+		BattleSnapshot clone() const;
+
+		/// <summary>Counts the damage dealt from now on in a tally, which must outlive the counting.</summary>
+		/// <param name="tally">The tally to add to, or nullptr to stop counting.</param>
+		void tally(SimDamageTally* tally);
+
+		/// <summary>Gets the number of entities.</summary>
+		/// <returns>The number of entities.</returns>
+		size_t size() const;
+
+		/// <summary>Retrieves an entity.</summary>
+		/// <param name="index">The index of the entity.</param>
+		/// <returns>The entity.</returns>
+		const SimEntity& operator[](size_t index) const;
+
+		/// <summary>Retrieves an entity in order to change it, unsharing the entities first if needed. Changes made this way are not recorded, and the hash must be recomputed afterwards.</summary>
+		/// <param name="index">The index of the entity.</param>
+		/// <returns>The entity.</returns>
+		SimEntity& mutate(size_t index);
+
+		/// <summary>Gets a Zobrist hash of the state of the battle: every entity's stats, timeline position and flags, and the acting entity. Usables are not included, since they never change.</summary>
+		/// <returns>The hash.</returns>
+		uint64_t hash() const;
+
+		/// <summary>Gets a fingerprint of what an entity's usables do, in slot order.</summary>
+		/// <param name="index">The index of the entity.</param>
+		/// <returns>The fingerprint.</returns>
+		uint64_t usables_fingerprint(size_t index) const;
+
+		/// <summary>Gets a fingerprint of everything about an entity that hash() leaves out, since it never changes during a battle: its side, maximum and base values, and what its usables do.</summary>
+		/// <param name="index">The index of the entity.</param>
+		/// <returns>The fingerprint.</returns>
+		uint64_t fingerprint(size_t index) const;
+
+		/// <summary>Gets a fingerprint of everything about the battle that hash() leaves out: the fingerprint of every entity, in order.</summary>
+		/// <returns>The fingerprint.</returns>
+		uint64_t fingerprint() const;
+
+		/// <summary>Recomputes the hash and the number of living entities from scratch, after entities have been changed through mutate().</summary>
+		void rehash();
+
+		/// <summary>Retrieves the usable table.</summary>
+		/// <returns>The usables that entities refer to.</returns>
+		const UsableTable& usables() const;
+
+		/// <summary>Retrieves one of an entity's usables.</summary>
+		/// <param name="entity">The index of the entity.</param>
+		/// <param name="slot">The index of the usable within the entity's usables.</param>
+		/// <returns>The usable.</returns>
+		const SimUsable& usable(int entity, int slot) const;
+
+		/// <summary>Gets the entity taking its turn.</summary>
+		/// <returns>The index of the entity taking its turn, or -1 if no entity is.</returns>
+		int actor() const;
+
+		/// <summary>Gets the number of living entities on a side.</summary>
+		/// <param name="side">The side.</param>
+		/// <returns>The number of entities on the side that are present and not incapacitated.</returns>
+		int alive_count(int side) const;
+
+		/// <summary>Gets the side that won.</summary>
+		/// <returns>The side that won, or -1 if the battle is ongoing.</returns>
+		int winner() const;
+
+		/// <summary>Gets the number of turns taken so far.</summary>
+		/// <returns>The number of turns taken.</returns>
+		int turns() const;
+
+		/// <summary>Runs the battle until an entity needs to decide what to do.</summary>
+		/// <returns>True if an entity is now taking its turn, false if the battle is over.</returns>
+		bool advance();
+
+		/// <summary>Applies the turn of the acting entity, followed by its end-of-turn tick.</summary>
+		/// <param name="turn">The turn.</param>
+		void apply(const SimTurn& turn);
+
+		/// <summary>Applies the turn of the acting entity, then runs the battle until the next entity needs to decide what to do. Every change is recorded so that it can be undone.</summary>
+		/// <param name="turn">The turn.</param>
+		/// <param name="log">The log to record changes in.</param>
+		/// <returns>The token to undo the turn with.</returns>
+		SimUndo apply(const SimTurn& turn, SimUndoLog& log);
+
+		/// <summary>Restores the snapshot to exactly how it was before a turn. Turns must be undone in the reverse order they were applied.</summary>
+		/// <param name="token">The token returned when the turn was applied.</param>
+		/// <param name="log">The log the turn was recorded in.</param>
+		void undo(const SimUndo& token, SimUndoLog& log);
+	};
+
+
+	// Decides turns for entities in a simulated battle.
+	class SimPolicy
+	{
+	public:
+		/// <summary>Virtual deconstructor.</summary>
+		virtual ~SimPolicy() {}
+
+		/// <summary>Decides what an entity does on its turn.</summary>
+		/// <param name="snapshot">The state of the battle.</param>
+		/// <param name="actor">The index of the entity taking its turn.</param>
+		/// <returns>The turn.</returns>
+		virtual SimTurn choose(const BattleSnapshot& snapshot, int actor) = 0;
+	};
+
+	// A policy that acts totally at random, the same way RandomAgent does.
+	class RandomPolicy : public SimPolicy
+	{
+	private:
+		// The random number generator.
+		SimRandom m_Random;
+
+	public:
+		/// <summary>Constructs a random policy.</summary>
+		/// <param name="seed">The seed for the random number generator.</param>
+		RandomPolicy(uint64_t seed);
+
+		/// <summary>Picks a random turn.</summary>
+		/// <param name="snapshot">The state of the battle.</param>
+		/// <param name="actor">The index of the entity taking its turn.</param>
+		/// <returns>The turn.</returns>
+		SimTurn choose(const BattleSnapshot& snapshot, int actor);
+	};
+
+
+	/// <summary>Runs a simulated battle from its current state until it ends.</summary>
+	/// <param name="snapshot">The battle, which is left in its final state.</param>
+	/// <param name="side0">The policy for entities on side 0.</param>
+	/// <param name="side1">The policy for entities on side 1.</param>
+	/// <param name="max_turns">The number of turns after which the battle is abandoned.</param>
+	/// <returns>The side that won, or -1 if the battle was abandoned.</returns>
+	int simulate(BattleSnapshot& snapshot, SimPolicy& side0, SimPolicy& side1, int max_turns);
+
+
+}
@@ -0,0 +1,171 @@
+#pragma once
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "simulation.h"
+
+
+// The number of independently locked parts of a solver's memo table.
+#define SOLVER_SHARDS			64
+
+// The solver expands a battle breadth-first until it has this many states per thread to solve in parallel.
+#define SOLVER_SPLIT_STATES		16
+
+// The maximum number of turns the solver expands a battle to before solving it in parallel.
+#define SOLVER_SPLIT_TURNS		6
+
+// The first four bytes of a solved table file.
+#define SOLVER_MAGIC			0x564C4F53u
+
+// The version of the solved table file format.
+#define SOLVER_VERSION			1
+
+namespace battle
+{
+
+
+	// The exact outcome of a battle from a given state, where every entity acts at random, the way RandomPolicy does.
+	struct SolverResult
+	{
+		// The chance that side 0 wins.
+		double win;
+
+		// The chance that side 1 wins.
+		double loss;
+
+		// The expected number of turns until the battle ends or reaches the turn limit.
+		double turns;
+	};
+
+	// A solved state, as stored in a solved table file.
+	struct SolvedRecord
+	{
+		// The hash of the state and the number of turns left. Never 0 for a used slot.
+		uint64_t key;
+
+		// A second, independent hash of the state, to tell states with the same key apart.
+		uint64_t check;
+
+		// The outcome of the state.
+		SolverResult result;
+	};
+
+
+	// A read-only table of solved states, mapped straight from a file so that even large tables can be reused without reading them in.
+	// The file is a header of SOLVER_MAGIC, SOLVER_VERSION, the fingerprint of the battle and the number of slots (a power of two), followed by the slots as SolvedRecords, placed by linear probing from their key.
+	class SolvedTable
+	{
+	private:
+		// The mapped file, or nullptr if no file is open.
+		const uint8_t* m_Data = nullptr;
+
+		// The size of the mapped file.
+		size_t m_Size = 0;
+
+		// The slots.
+		const SolvedRecord* m_Records = nullptr;
+
+		// The number of slots minus one.
+		uint64_t m_Mask = 0;
+
+	public:
+		/// <summary>Constructs a table without a file.</summary>
+		SolvedTable() = default;
+
+		SolvedTable(const SolvedTable&) = delete;
+		SolvedTable& operator=(const SolvedTable&) = delete;
+
+		/// <summary>Unmaps the file.</summary>
+		~SolvedTable();
+
+		/// <summary>Maps a table from a file.</summary>
+		/// <param name="path">The path of the file.</param>
+		/// <param name="fingerprint">The fingerprint of the battle the table must have been solved for.</param>
+		/// <returns>True if the file was a valid table for the battle, false otherwise (in which case the table is left empty).</returns>
+		bool open(const std::string& path, uint64_t fingerprint);
+
+		/// <summary>Unmaps the file, leaving the table empty.</summary>
+		void close();
+
+		/// <summary>Looks up a state.</summary>
+		/// <param name="record">The key and check of the state. Set to the stored record if there is one.</param>
+		/// <returns>True if the state was solved, false otherwise.</returns>
+		bool find(SolvedRecord& record) const;
+
+		/// <summary>Copies every solved state in the table.</summary>
+		std::vector<SolvedRecord> records() const;
+
+		/// <summary>Writes a table to a file.</summary>
+		/// <param name="path">The path of the file.</param>
+		/// <param name="fingerprint">The fingerprint of the battle the states were solved for.</param>
+		/// <param name="records">The solved states.</param>
+		/// <returns>True if the file was written, false otherwise.</returns>
+		static bool write(const std::string& path, uint64_t fingerprint, const std::vector<SolvedRecord>& records);
+	};
+
+
+	// Computes the exact chance of winning a battle where every entity acts at random, along with its expected length, by dynamic programming over every state the battle can reach.
+	// The result is exact for the state the battle is solved from. A new battle places everyone on the timeline at random, so solving one start gives the outcome given that start, not the outcome of the battle as a whole.
+	// Each state is solved once: identical states reached along different paths share one entry in the memo table. Battles that reach the turn limit count as neither a win nor a loss.
+	class WinSolver
+	{
+	private:
+		// A part of the memo table, with its own lock.
+		struct Shard
+		{
+			// The lock for the memo table.
+			std::mutex lock;
+
+			// The check and outcome of each solved state, by key.
+			std::unordered_map<uint64_t, std::pair<uint64_t, SolverResult>> states;
+		};
+
+		// The number of turns after which a battle is abandoned.
+		int m_MaxTurns;
+
+		// States solved by earlier runs, or nullptr if there are none.
+		const SolvedTable* m_Solved;
+
+		// The memo table.
+		std::unique_ptr<Shard[]> m_Shards;
+
+		/// <summary>Looks up a state in the memo table and the solved table.</summary>
+		bool lookup(SolvedRecord& record);
+
+		/// <summary>Adds a solved state to the memo table.</summary>
+		void remember(const SolvedRecord& record);
+
+		/// <summary>Solves a state where an entity is deciding what to do, or the battle has ended.</summary>
+		SolverResult solve_state(BattleSnapshot& snapshot, SimUndoLog& log);
+
+		/// <summary>Solves a turn, averaged over every way its random targets could be picked.</summary>
+		SolverResult solve_turn(BattleSnapshot& snapshot, SimTurn turn, SimUndoLog& log);
+
+	public:
+		/// <summary>Constructs a solver.</summary>
+		/// <param name="max_turns">The number of turns after which a battle is abandoned.</param>
+		/// <param name="solved">States solved by earlier runs of the same battle, or nullptr. Must outlive the solver.</param>
+		WinSolver(int max_turns, const SolvedTable* solved = nullptr);
+
+		/// <summary>Solves a battle. Independent parts of the battle are solved in parallel.</summary>
+		/// <param name="snapshot">The battle.</param>
+		/// <param name="threads">The number of threads to solve with.</param>
+		/// <returns>The outcome of the battle.</returns>
+		SolverResult solve(const BattleSnapshot& snapshot, unsigned int threads);
+
+		/// <summary>Gets the number of states in the memo table.</summary>
+		size_t size() const;
+
+		/// <summary>Copies every state in the memo table and the solved table, to be written to a new solved table.</summary>
+		std::vector<SolvedRecord> records() const;
+
+		/// <summary>Computes a fingerprint of everything about a battle that solved states depend on but their keys don't cover: the usables of every entity, and the turn limit.</summary>
+		/// <param name="snapshot">The battle.</param>
+		/// <param name="max_turns">The number of turns after which the battle is abandoned.</param>
+		/// <returns>The fingerprint.</returns>
+		static uint64_t fingerprint(const BattleSnapshot& snapshot, int max_turns);
+	};
+
+
+}
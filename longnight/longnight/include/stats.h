@@ -0,0 +1,182 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "simulation.h"
+
+
+// The size of a cache line. Each worker's counters are padded by this much on both sides, so that no two workers write to the same line.
+#define STATS_CACHE_LINE		64
+
+// The number of status effects whose uptime is counted: Burn, Toxin, changed Offense and changed Defense.
+#define STATS_STATUSES			4
+
+// Identifies a file of partial statistics.
+#define STATS_MAGIC				0x54415453u
+
+// The version of the partial statistics file format.
+#define STATS_VERSION			1
+
+namespace battle
+{
+
+
+	// A histogram of small non-negative integers, stored in the counters of a BattleStats.
+	class StatHistogram
+	{
+	private:
+		// The count of each value. Values past the end are counted in the last bucket.
+		const uint64_t* m_Counts;
+
+		// The number of buckets.
+		size_t m_Size;
+
+	public:
+		/// <summary>Constructs a histogram over some counters.</summary>
+		/// <param name="counts">The count of each value.</param>
+		/// <param name="size">The number of buckets.</param>
+		StatHistogram(const uint64_t* counts, size_t size);
+
+		/// <summary>Gets the number of values counted.</summary>
+		uint64_t total() const;
+
+		/// <summary>Gets the mean of the values counted, or 0 if there are none.</summary>
+		double mean() const;
+
+		/// <summary>Finds a percentile of the values counted.</summary>
+		/// <param name="fraction">The fraction of values at or below the percentile, from 0 to 1.</param>
+		/// <returns>The smallest value with at least that fraction of values at or below it, or 0 if there are none.</returns>
+		size_t percentile(double fraction) const;
+
+		/// <summary>Gets the number of buckets.</summary>
+		size_t size() const;
+
+		/// <summary>Gets the count of a value.</summary>
+		uint64_t operator[](size_t value) const;
+	};
+
+
+	// Which part of a run some statistics were counted for, when the run is split between processes.
+	struct StatsShard
+	{
+		// A fingerprint of the settings of the run. Only statistics with the same fingerprint can be merged.
+		uint64_t fingerprint;
+
+		// The index of the shard.
+		uint32_t index;
+
+		// The number of shards the run is split into.
+		uint32_t count;
+	};
+
+
+	// Statistics about a batch of simulated battles between the same entities: outcomes, battle lengths, damage by source, status uptime, when each entity was defeated, and how often each usable was picked.
+	// Every counter lives in one flat array, so that each worker thread can count into its own BattleStats with plain increments, and merging is a sum of arrays.
+	class BattleStats
+	{
+	private:
+		// The number of entities counted. Entities past this are ignored.
+		size_t m_Entities;
+
+		// The number of turns after which a battle is abandoned.
+		int m_MaxTurns;
+
+		// Every counter, with a cache line of padding before and after.
+		std::vector<uint64_t> m_Counts;
+
+		/// <summary>Gets the first counter, after the padding.</summary>
+		uint64_t* counts();
+
+		/// <summary>Gets the first counter, after the padding.</summary>
+		const uint64_t* counts() const;
+
+		/// <summary>Gets the number of counters for each entity.</summary>
+		size_t entity_size() const;
+
+		/// <summary>Gets the offset of an entity's counters.</summary>
+		size_t entity_offset(size_t entity) const;
+
+	public:
+		/// <summary>Constructs empty statistics.</summary>
+		/// <param name="entities">The number of entities in each battle.</param>
+		/// <param name="max_turns">The number of turns after which a battle is abandoned.</param>
+		BattleStats(size_t entities, int max_turns);
+
+		/// <summary>Runs a simulated battle from its current state until it ends, counting everything that happens.</summary>
+		/// <param name="snapshot">The battle, which is left in its final state.</param>
+		/// <param name="side0">The policy for entities on side 0.</param>
+		/// <param name="side1">The policy for entities on side 1.</param>
+		/// <returns>The side that won, or -1 if the battle was abandoned.</returns>
+		int record(BattleSnapshot& snapshot, SimPolicy& side0, SimPolicy& side1);
+
+		/// <summary>Adds the counts of other statistics to these. Neither may be counting at the time.</summary>
+		/// <param name="other">Statistics for the same entities and turn limit.</param>
+		void merge(const BattleStats& other);
+
+		/// <summary>Resets every count to 0.</summary>
+		void clear();
+
+		/// <summary>Gets the number of entities counted.</summary>
+		size_t entities() const;
+
+		/// <summary>Gets the number of turns after which a battle is abandoned.</summary>
+		int max_turns() const;
+
+		/// <summary>Gets the number of battles counted.</summary>
+		uint64_t battles() const;
+
+		/// <summary>Gets the number of battles with an outcome.</summary>
+		/// <param name="winner">The side that won, or -1 for battles that were abandoned.</param>
+		uint64_t outcomes(int winner) const;
+
+		/// <summary>Gets the histogram of the number of turns each battle took.</summary>
+		StatHistogram turns() const;
+
+		/// <summary>Gets the total Health and Shield a side lost from a source of damage.</summary>
+		/// <param name="side">The side.</param>
+		/// <param name="source">The source of damage.</param>
+		uint64_t damage(int side, DamageSource source) const;
+
+		/// <summary>Gets the number of turns an entity was in the battle and not incapacitated.</summary>
+		/// <param name="entity">The index of the entity.</param>
+		uint64_t present_turns(size_t entity) const;
+
+		/// <summary>Gets the number of turns an entity had a status effect.</summary>
+		/// <param name="entity">The index of the entity.</param>
+		/// <param name="status">0 for Burn, 1 for Toxin, 2 for changed Offense, 3 for changed Defense.</param>
+		uint64_t status_turns(size_t entity, int status) const;
+
+		/// <summary>Gets the histogram of the turn on which an entity was defeated, in battles where it was.</summary>
+		/// <param name="entity">The index of the entity.</param>
+		StatHistogram defeats(size_t entity) const;
+
+		/// <summary>Gets the number of times an entity picked one of its usables.</summary>
+		/// <param name="entity">The index of the entity.</param>
+		/// <param name="slot">The index of the usable within the entity's usables, or SIM_MAX_USABLES for turns where it did nothing.</param>
+		uint64_t picks(size_t entity, int slot) const;
+
+		/// <summary>Writes the statistics to a JSON file.</summary>
+		/// <param name="path">The path of the file.</param>
+		/// <param name="names">The name of each entity.</param>
+		/// <returns>True if the file was written, false otherwise.</returns>
+		bool write_json(const std::string& path, const std::vector<std::string>& names) const;
+
+		/// <summary>Writes the counters to a compact binary file, so that statistics counted by separate processes can be merged exactly.
+		/// The file is a header of STATS_MAGIC, STATS_VERSION, the shard's fingerprint, index and count, the number of entities and the turn limit, followed by each entity's name and then every counter, all as variable-length integers.
+		/// It is written alongside and then renamed over the old file, so that a merge never reads half of one.</summary>
+		/// <param name="path">The path of the file.</param>
+		/// <param name="shard">The part of the run that was counted.</param>
+		/// <param name="names">The name of each entity.</param>
+		/// <returns>True if the file was written, false otherwise.</returns>
+		bool write_partial(const std::string& path, const StatsShard& shard, const std::vector<std::string>& names) const;
+
+		/// <summary>Reads statistics written by write_partial().</summary>
+		/// <param name="path">The path of the file.</param>
+		/// <param name="stats">Replaced by the statistics in the file.</param>
+		/// <param name="shard">Set to the part of the run that was counted.</param>
+		/// <param name="names">Set to the name of each entity.</param>
+		/// <returns>True if the file was read, false if it could not be read or is not a partial statistics file.</returns>
+		static bool read_partial(const std::string& path, BattleStats& stats, StatsShard& shard, std::vector<std::string>& names);
+	};
+
+
+}
@@ -0,0 +1,457 @@
+#pragma once
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "datafile.h"
+#include "party.h"
+#include "simulation.h"
+
+
+// The item fields that a sweep can vary. Each is read by OffenseItem or SupportItem.
+#define SWEEP_FIELDS			{ "damage", "offense", "defense", "burn", "toxin", "stun", "speed", "health", "shield" }
+
+// The first four bytes of a sweep's columnar results file.
+#define SWEEP_MAGIC				0x50575353u
+
+// The version of the columnar results file format.
+#define SWEEP_VERSION			1
+
+// The first four bytes of a sweep's journal.
+#define SWEEP_JOURNAL_MAGIC		0x4C4A5753u
+
+// The version of the journal format.
+#define SWEEP_JOURNAL_VERSION	1
+
+// The most battles in one journal record. Each record is written as soon as it is full, so a sweep that is killed loses at most this many battles for each thread.
+#define SWEEP_JOURNAL_RANGE		256
+
+// The most seconds between syncs of a sweep's journal to disk, so that a machine that stops loses at most this much work.
+#define SWEEP_JOURNAL_SYNC		1.0
+
+// The first four bytes of a partial results file, written by one shard of a sweep.
+#define SWEEP_PARTIAL_MAGIC		0x50505753u
+
+// The version of the partial results file format.
+#define SWEEP_PARTIAL_VERSION	1
+
+// The first four bytes of an entry in a sweep's result cache.
+#define SWEEP_CACHE_MAGIC		0x43575353u
+
+// The version of the cache entry format.
+#define SWEEP_CACHE_VERSION		1
+
+// The version of the rules of simulated battles, as far as sweeps are concerned. Bump it whenever a change to the simulation changes the outcomes of battles, so that journals and caches stop reusing outcomes from before.
+#define SWEEP_RULES_VERSION		2
+
+// The z-score of the confidence intervals of a sweep's win rates (95%).
+#define SWEEP_CONFIDENCE_Z		1.959964
+
+namespace battle
+{
+
+
+	// An item field varied by a sweep.
+	struct SweepParameter
+	{
+		// The ID of the item.
+		std::string item;
+
+		// The name of the field.
+		std::string field;
+
+		// The values to try, for a grid. Empty if the parameter is a range.
+		std::vector<int> values;
+
+		// The lowest value of the range, if the parameter is a range.
+		int low = 0;
+
+		// The highest value of the range, if the parameter is a range.
+		int high = 0;
+
+		/// <summary>Parses a parameter, in the form "item.field=1,2,3" for a list of values or "item.field=1..3" for a range.</summary>
+		/// <param name="text">The text of the parameter.</param>
+		/// <param name="error">Set to a description of the problem, if the parameter is invalid.</param>
+		/// <returns>True if the parameter is valid, false otherwise.</returns>
+		bool parse(const std::string& text, std::string& error);
+	};
+
+	/// <summary>Lists every combination of values of the parameters. Ranges are split into evenly spaced steps.</summary>
+	/// <param name="parameters">The parameters.</param>
+	/// <param name="steps">The number of values to try for each range.</param>
+	/// <returns>The value of each parameter, for each configuration.</returns>
+	std::vector<std::vector<int>> sweep_grid(const std::vector<SweepParameter>& parameters, int steps);
+
+	/// <summary>Samples configurations with a Latin hypercube, so that every parameter's range is covered evenly however few samples there are. Lists are sampled by index.</summary>
+	/// <param name="parameters">The parameters.</param>
+	/// <param name="samples">The number of configurations.</param>
+	/// <param name="seed">The seed for the random number generator.</param>
+	/// <returns>The value of each parameter, for each configuration.</returns>
+	std::vector<std::vector<int>> sweep_latin_hypercube(const std::vector<SweepParameter>& parameters, int samples, uint64_t seed);
+
+
+	// Makes copies of items with some of their fields changed, by patching the records they were loaded from.
+	class ItemPatcher
+	{
+	private:
+		// The item data file.
+		data::DataFile m_File;
+
+		// The index of the first record with each ID.
+		std::unordered_map<std::string, size_t> m_Records;
+
+	public:
+		/// <summary>Reads the item data file.</summary>
+		/// <param name="path">The path of the file.</param>
+		ItemPatcher(const char* path = "res/data/items.txt");
+
+		/// <summary>Creates a copy of an item with some of its fields changed.</summary>
+		/// <param name="id">The ID of the item.</param>
+		/// <param name="fields">The name and new value of each field to change.</param>
+		/// <returns>The item, or nullptr if there is no item with the ID.</returns>
+		std::unique_ptr<overworld::Item> patch(const std::string& id, const std::vector<std::pair<std::string, int>>& fields) const;
+	};
+
+
+	// How many battles a sweep runs, and how they are seeded.
+	struct SweepOptions
+	{
+		// The maximum number of battles per configuration.
+		unsigned int battles = 1000;
+
+		// The number of turns after which a battle is abandoned.
+		int max_turns = 200;
+
+		// The seed that every battle's seed is derived from.
+		uint64_t seed = 1;
+
+		// If true, battle k of every configuration has the same seed, so that configurations are compared on the same starting timelines and random streams. This makes the differences between configurations far less noisy than their win rates. Otherwise, each configuration's battles are seeded by the records it patches, so a configuration runs the same battles wherever it falls in a sweep.
+		bool common_random_numbers = false;
+
+		// The number of battles each configuration runs between checks of whether it can stop. 0 runs every battle at once.
+		unsigned int batch = 100;
+
+		// A configuration stops once the confidence interval of its win rate is narrower than this. 0 never stops on the interval.
+		double interval_width = 0;
+
+		// If not 0, each configuration is compared to the first with a sequential probability ratio test, and stops once the test decides which wins more.
+		// The test counts the battles that one configuration won and the other lost, which should use common random numbers, and tells apart the hypotheses that the configuration wins 0.5 + delta or 0.5 - delta of them.
+		double sprt_delta = 0;
+
+		// The chance of the test deciding a configuration is better when it is worse.
+		double sprt_alpha = 0.05;
+
+		// The chance of the test deciding a configuration is worse when it is better.
+		double sprt_beta = 0.05;
+
+		// The index of the shard of the configurations to run, counting from 0. Configuration k belongs to shard k modulo shard_count, and every shard also runs the first configuration when the sequential test compares against it.
+		unsigned int shard_index = 0;
+
+		// The number of shards the configurations are split into.
+		unsigned int shard_count = 1;
+	};
+
+	// The outcome of one battle of a sweep.
+	struct SweepOutcome
+	{
+		// The side that won, or -1 if the battle reached the turn limit.
+		int8_t winner;
+
+		// The number of turns taken.
+		uint16_t turns;
+
+		// The Health and Shield lost by side 0, after any healing.
+		int party_damage;
+
+		// The Health and Shield lost by side 1, after any healing.
+		int enemy_damage;
+	};
+
+	/// <summary>Derives the seed of one battle of a sweep. Battle k of every configuration has the same seed when configuration 0 is passed for all of them.</summary>
+	/// <param name="seed">The seed of the sweep.</param>
+	/// <param name="configuration">Identifies the configuration, such as a hash of the records it patches.</param>
+	/// <param name="battle">The index of the battle within the configuration.</param>
+	uint64_t battle_seed(uint64_t seed, uint64_t configuration, uint64_t battle);
+
+	/// <summary>Finds the Wilson score interval of a win rate, at the confidence of SWEEP_CONFIDENCE_Z.</summary>
+	/// <param name="wins">The number of battles won.</param>
+	/// <param name="battles">The number of battles.</param>
+	/// <param name="interval">Set to the lower and upper bound of the interval, or 0 and 1 if there are no battles.</param>
+	void wilson_interval(unsigned int wins, unsigned int battles, double interval[2]);
+
+	/// <summary>Quotes a value for a CSV file, if it needs to be.</summary>
+	std::string csv_field(const std::string& value);
+
+	/// <summary>Runs a headless battle where enemies with a behavior script follow it, and every other entity acts at random.</summary>
+	/// <param name="allies">The allies, as side 0.</param>
+	/// <param name="enemies">The IDs of the enemies, as side 1.</param>
+	/// <param name="usables">The usable table, which must already hold every usable of the battle if it is shared between threads.</param>
+	/// <param name="seed">The seed of the battle, from which the timeline and each side's policy are drawn.</param>
+	/// <param name="max_turns">The number of turns after which the battle is abandoned.</param>
+	/// <returns>The outcome of the battle.</returns>
+	SweepOutcome random_battle(const std::vector<overworld::Ally>& allies, const std::vector<std::string>& enemies, UsableTable& usables, uint64_t seed, int max_turns);
+
+	/// <summary>Finds the key of the results of battles from random_battle(), for a sweep's journal and result cache.
+	/// It covers everything the outcome of a battle depends on: the records of every item and enemy in the battle, the enemies' behavior scripts, the allies' Health, the usables the items turn into, the turn limit, the seeds, and SWEEP_RULES_VERSION.</summary>
+	/// <param name="allies">The allies.</param>
+	/// <param name="enemies">The IDs of the enemies.</param>
+	/// <param name="checksums">The checksum of the patched record of each item that is patched.</param>
+	/// <param name="snapshot">A battle between the entities, built from the usable table the battles use.</param>
+	/// <param name="first_seed">The seed of the first battle.</param>
+	/// <param name="max_turns">The number of turns after which a battle is abandoned.</param>
+	uint64_t battle_key(const std::vector<overworld::Ally>& allies, const std::vector<std::string>& enemies, const std::unordered_map<const overworld::Item*, uint64_t>& checksums, const BattleSnapshot& snapshot, uint64_t first_seed, int max_turns);
+
+
+	// A directory of the outcomes of battles from random_battle(), shared by every run that uses it. Each entry holds the outcomes of the first battles with a key from battle_key(), in order.
+	// An entry is a file named by the key in hexadecimal, with a header of SWEEP_CACHE_MAGIC, SWEEP_CACHE_VERSION, the key, the number of battles and a checksum, followed by the winner, turns and damage to each side of every battle.
+	// Since keys cover the game data records each battle uses, changing one item only misses the cache for battles with an entity that uses the item.
+	class ResultCache
+	{
+	private:
+		// The directory, or empty if the cache is not open.
+		std::string m_Directory;
+
+		/// <summary>Gets the path of an entry.</summary>
+		std::string path(uint64_t key) const;
+
+	public:
+		/// <summary>Opens a cache.</summary>
+		/// <param name="directory">The path of the directory, which is created if it does not exist.</param>
+		/// <param name="error">Set to a description of the problem, if the cache cannot be used.</param>
+		/// <returns>True if the cache was opened, false otherwise.</returns>
+		bool open(const std::string& directory, std::string& error);
+
+		/// <summary>Checks whether the cache is open.</summary>
+		bool is_open() const;
+
+		/// <summary>Reads an entry. An entry that cannot be read is treated as missing.</summary>
+		/// <param name="key">The key of the entry.</param>
+		/// <param name="outcomes">Replaced by the outcome of each battle in the entry, or emptied if there is no entry.</param>
+		/// <returns>True if the entry was read, false otherwise.</returns>
+		bool read(uint64_t key, std::vector<SweepOutcome>& outcomes) const;
+
+		/// <summary>Writes an entry, alongside and then renamed over the old one, so that readers never see half of one. Other processes may be writing the same entry at once.</summary>
+		/// <param name="key">The key of the entry.</param>
+		/// <param name="outcomes">The outcomes of the first battles with the key.</param>
+		/// <param name="count">The number of battles.</param>
+		/// <returns>True if the entry was written, false otherwise.</returns>
+		bool write(uint64_t key, const SweepOutcome* outcomes, size_t count) const;
+	};
+
+
+	// A summary of the battles of one configuration of a sweep.
+	struct SweepSummary
+	{
+		// The number of battles.
+		unsigned int battles;
+
+		// The number of battles won by side 0.
+		unsigned int wins;
+
+		// The mean number of turns.
+		double turns;
+
+		// The mean, 10th, 50th and 90th percentile of the damage to side 0.
+		double party_damage[4];
+
+		// The mean, 10th, 50th and 90th percentile of the damage to side 1.
+		double enemy_damage[4];
+
+		// The lower and upper bound of the confidence interval of the win rate.
+		double interval[2];
+
+		// The decision of the sequential test against the first configuration: 1 if this configuration wins more, -1 if it wins less, 0 if undecided or not tested.
+		int decision;
+	};
+
+
+	// Runs many headless battles for each configuration of item fields, where enemies follow their behavior scripts and every other entity acts at random. Each configuration has its own usable table, built from patched copies of the items, so the game data is never changed.
+	class Sweep
+	{
+	private:
+		// The parameters.
+		std::vector<SweepParameter> m_Parameters;
+
+		// The value of each parameter, for each configuration.
+		std::vector<std::vector<int>> m_Configurations;
+
+		// The allies.
+		std::vector<overworld::Ally> m_Allies;
+
+		// The IDs of the enemies.
+		std::vector<std::string> m_Enemies;
+
+		// The usable table of each configuration. Every usable is added up front, so that battles only read from the tables.
+		std::vector<std::unique_ptr<UsableTable>> m_Tables;
+
+		// How many battles to run, and how to seed them.
+		SweepOptions m_Options;
+
+		// The outcome of every battle, by configuration and then battle. Only the first m_Done[k] battles of configuration k have been run.
+		std::vector<SweepOutcome> m_Outcomes;
+
+		// The number of battles run for each configuration.
+		std::vector<unsigned int> m_Done;
+
+		// The number of battles actually run, leaving out those whose outcomes were already known.
+		size_t m_Run = 0;
+
+		// The decision of the sequential test for each configuration.
+		std::vector<int8_t> m_Decisions;
+
+		// Whether the outcome of each battle is known, by configuration and then battle. Battles read from the journal are known before they are run.
+		std::vector<uint8_t> m_Known;
+
+		// The key of each configuration's results in the journal and the cache, from battle_key().
+		std::vector<uint64_t> m_Keys;
+
+		// The value each configuration's battles are seeded with along with the sweep's seed: 0 with common random numbers, or a hash of the patched records otherwise.
+		std::vector<uint64_t> m_Streams;
+
+		// A fingerprint of the keys and the options that decide which battles are run. Only shards with the same fingerprint can be merged.
+		uint64_t m_Fingerprint = 0;
+
+		// The journal that the outcome of each battle is appended to, or nullptr if there is none.
+		FILE* m_Journal = nullptr;
+
+		// Guards appending to the journal.
+		std::mutex m_JournalLock;
+
+		// False if a record could not be written to the journal.
+		bool m_JournalIntact = true;
+
+		// When the journal was last synced to disk.
+		std::chrono::steady_clock::time_point m_Synced;
+
+		// The number of battles whose outcomes were read from the journal.
+		size_t m_Resumed = 0;
+
+		// The result cache, if there is one.
+		ResultCache m_Cache;
+
+		// The number of battles in each configuration's cache entry.
+		std::vector<unsigned int> m_Cached;
+
+		// The number of battles whose outcomes were read from the cache.
+		size_t m_CacheHits = 0;
+
+		/// <summary>Constructs an empty sweep, for read_partial() to fill in.</summary>
+		Sweep() {}
+
+		/// <summary>Checks whether a configuration belongs to the shard this sweep runs.</summary>
+		bool owned(size_t configuration) const;
+
+		/// <summary>Checks whether a configuration needs to run more battles.</summary>
+		bool active(size_t configuration) const;
+
+		/// <summary>Appends the outcomes of a range of battles of a configuration to the journal.</summary>
+		void journal(size_t configuration, unsigned int first, unsigned int count);
+
+		/// <summary>Syncs the journal to disk if it was last synced more than SWEEP_JOURNAL_SYNC seconds ago, or if forced. The caller must hold the journal lock.</summary>
+		void sync_journal(bool force);
+
+	public:
+		/// <summary>Sets up a sweep, patching the items for each configuration.</summary>
+		/// <param name="parameters">The parameters.</param>
+		/// <param name="configurations">The value of each parameter, for each configuration.</param>
+		/// <param name="allies">The allies, as side 0.</param>
+		/// <param name="enemies">The IDs of the enemies, as side 1.</param>
+		/// <param name="patcher">Makes the patched items.</param>
+		/// <param name="options">How many battles to run, and how to seed them.</param>
+		Sweep(const std::vector<SweepParameter>& parameters, const std::vector<std::vector<int>>& configurations, const std::vector<overworld::Ally>& allies, const std::vector<std::string>& enemies, const ItemPatcher& patcher, const SweepOptions& options);
+
+		/// <summary>Closes the journal.</summary>
+		~Sweep();
+
+		/// <summary>Reads the outcomes of battles that an earlier sweep already ran from a journal, and appends every battle run from now on to it.
+		/// The journal is a header of SWEEP_JOURNAL_MAGIC and SWEEP_JOURNAL_VERSION (as 32-bit integers), followed by records of a configuration's key, the first battle and the number of battles (at most SWEEP_JOURNAL_RANGE), a checksum, and the winner, turns and damage to each side of every battle.
+		/// Records are matched to configurations by key, as in the result cache, so a journal can be shared by sweeps with other parameters, stopping rules or battle counts. A record left half-written by an interruption fails its checksum, and is cut off along with everything after it.</summary>
+		/// <param name="path">The path of the journal, which is created if it does not exist.</param>
+		/// <param name="error">Set to a description of the problem, if the journal cannot be used.</param>
+		/// <returns>True if the journal was opened, false otherwise.</returns>
+		bool open_journal(const std::string& path, std::string& error);
+
+		/// <summary>Reads the outcomes of battles that any earlier run made for the same configurations from a result cache, so that they are not run again.</summary>
+		/// <param name="directory">The path of the cache's directory, which is created if it does not exist.</param>
+		/// <param name="error">Set to a description of the problem, if the cache cannot be used.</param>
+		/// <returns>True if the cache was opened, false otherwise.</returns>
+		bool open_cache(const std::string& directory, std::string& error);
+
+		/// <summary>Writes the outcomes of each configuration's battles to the result cache, for configurations that now know more battles in a row than their entry held.</summary>
+		/// <returns>True if every entry was written or there is no cache, false otherwise.</returns>
+		bool write_cache();
+
+		/// <summary>Runs one battle.</summary>
+		/// <param name="configuration">The index of the configuration.</param>
+		/// <param name="battle">The index of the battle within the configuration.</param>
+		/// <returns>The outcome of the battle.</returns>
+		SweepOutcome run_battle(size_t configuration, uint64_t battle) const;
+
+		/// <summary>Runs battles for every configuration in batches split between threads, until each configuration has run every battle or met its stopping rule.
+		/// Battles whose outcomes are already known are not run again, but otherwise the batches and stopping rules proceed exactly as they would have, so a resumed sweep ends the same as an uninterrupted one.</summary>
+		/// <param name="threads">The number of threads.</param>
+		void run(unsigned int threads);
+
+		/// <summary>Gets the number of battles the results cover, whether they were run or read from the journal or the cache.</summary>
+		size_t battles_used() const;
+
+		/// <summary>Gets the number of battles actually run, leaving out those read from the journal or the cache.</summary>
+		size_t battles_run() const;
+
+		/// <summary>Gets the number of battles whose outcomes were read from the journal.</summary>
+		size_t battles_resumed() const;
+
+		/// <summary>Gets the number of battles whose outcomes were read from the result cache.</summary>
+		size_t battles_cached() const;
+
+		/// <summary>Checks that every battle run was written to the journal, if there is one.</summary>
+		bool journal_intact() const;
+
+		/// <summary>Summarises the battles of a configuration.</summary>
+		/// <param name="configuration">The index of the configuration.</param>
+		/// <returns>The summary.</returns>
+		SweepSummary summarise(size_t configuration) const;
+
+		/// <summary>Writes a summary of each configuration to a CSV file, one row per configuration.</summary>
+		/// <param name="path">The path of the file.</param>
+		/// <returns>True if the file was written, false otherwise.</returns>
+		bool write_csv(const std::string& path) const;
+
+		/// <summary>Writes the outcome of every battle that was run to a columnar file, for analysis tools to load a column at a time.
+		/// The file is a header of SWEEP_MAGIC, SWEEP_VERSION, the number of rows and the number of columns (as 32-bit integers), then for each column its name (a 32-bit length and the characters) and its values (as 32-bit integers).
+		/// The columns are the configuration, the battle, each parameter, the winner, the turns, and the damage to each side.</summary>
+		/// <param name="path">The path of the file.</param>
+		/// <returns>True if the file was written, false otherwise.</returns>
+		bool write_columns(const std::string& path) const;
+
+		/// <summary>Writes the results of the configurations in this sweep's shard to a partial file, for "merge" to combine with those of the other shards.
+		/// The file is a header of SWEEP_PARTIAL_MAGIC, SWEEP_PARTIAL_VERSION, the fingerprint, the shard's index and count, the number of battles per configuration, whether the sequential test was used, and the numbers of parameters and configurations,
+		/// then the item and field of each parameter (each a 32-bit length and the characters), then for each configuration its key, number of battles, decision and parameter values followed by the winner, turns and damage to each side of its battles.</summary>
+		/// <param name="path">The path of the file.</param>
+		/// <returns>True if the file was written, false otherwise.</returns>
+		bool write_partial(const std::string& path) const;
+
+		/// <summary>Reads the results written by write_partial(), as a sweep that can merge and write results, but not run battles.</summary>
+		/// <param name="path">The path of the file.</param>
+		/// <returns>The sweep, or nullptr if the file could not be read or is not a partial results file.</returns>
+		static std::unique_ptr<Sweep> read_partial(const std::string& path);
+
+		/// <summary>Takes the results of every configuration that another shard of the same sweep ran more battles of. Shards all run the same battles of a configuration, so the result is the same as if one process had run the whole sweep.</summary>
+		/// <param name="other">A shard with the same fingerprint.</param>
+		void merge(const Sweep& other);
+
+		/// <summary>Gets a fingerprint of the keys of the configurations and the options that decide which battles are run.</summary>
+		uint64_t fingerprint() const;
+
+		/// <summary>Gets the options.</summary>
+		const SweepOptions& options() const;
+
+		/// <summary>Gets the number of configurations.</summary>
+		size_t size() const;
+	};
+
+
+}
@@ -0,0 +1,217 @@
+#pragma once
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "battle.h"
+#include "party.h"
+#include "simulation.h"
+
+
+// The number of buckets that Health is quantised into.
+#define POLICY_HEALTH_BUCKETS	4
+
+// The number of opponents whose Health is part of the features.
+#define POLICY_OPPONENTS		3
+
+// The number of ways to rank single targets by Health.
+#define POLICY_TARGET_RANKS		3
+
+// The number of actions an entity can have: one for every rank of target with every usable.
+#define POLICY_MAX_ACTIONS		(SIM_MAX_USABLES * POLICY_TARGET_RANKS)
+
+// Marks a slot of a policy table as used. Feature keys never use this bit.
+#define POLICY_KEY_USED			0x80000000ull
+
+// The number of turns after which a training battle is abandoned as a loss.
+#define POLICY_BATTLE_TURNS		200
+
+// The first four bytes of a policy table file.
+#define POLICY_MAGIC			0x54504E4Cu
+
+// The version of the policy table file format.
+#define POLICY_VERSION			2
+
+namespace battle
+{
+
+
+	/// <summary>Quantises the state of a simulated battle, as seen by the entity taking its turn, into a feature key.
+	/// The low 32 bits cover the entity's own Health bucket and statuses, its allies, the Health buckets of the first few opponents, and whether an opponent is next on the timeline.
+	/// The high 32 bits are a fingerprint of the entity's usables, since actions pick usables by slot: entities with different items never share actions, even when one table is trained for several kinds of enemy.</summary>
+	/// <param name="snapshot">The battle.</param>
+	/// <param name="actor">The index of the entity taking its turn.</param>
+	/// <returns>The feature key.</returns>
+	uint64_t policy_features(const BattleSnapshot& snapshot, int actor);
+
+	/// <summary>Turns an action into a turn in a simulated battle. Single targets are picked by their rank in Health, lowest first, with ties going to the earliest in party order.</summary>
+	/// <param name="snapshot">The battle.</param>
+	/// <param name="actor">The index of the entity taking its turn.</param>
+	/// <param name="action">The action, as usable slot * POLICY_TARGET_RANKS + target rank.</param>
+	/// <param name="random">The random number generator, for picking random targets.</param>
+	/// <param name="turn">Set to the turn.</param>
+	/// <returns>True if the action is legal, false otherwise.</returns>
+	bool policy_turn(const BattleSnapshot& snapshot, int actor, int action, SimRandom& random, SimTurn& turn);
+
+	/// <summary>Turns an action into a turn in a live battle, picking targets the same way as in a simulated battle.</summary>
+	/// <param name="user">The entity taking its turn.</param>
+	/// <param name="action">The action, as usable slot * POLICY_TARGET_RANKS + target rank.</param>
+	/// <param name="turn">To be filled out with the data for the turn.</param>
+	/// <returns>True if the action is legal, false otherwise (in which case the turn's usable is nullptr).</returns>
+	bool policy_turn(Entity* user, int action, Turn& turn);
+
+
+	// A slot of a policy table.
+	struct PolicyEntry
+	{
+		// The feature key, combined with POLICY_KEY_USED, or 0 if the slot is empty.
+		uint64_t key;
+
+		// The best action, as usable slot * POLICY_TARGET_RANKS + target rank.
+		uint8_t action;
+
+		// The win rate of the action seen in training, out of 255.
+		uint8_t confidence;
+
+		uint8_t reserved[6];
+	};
+
+	// A compact open-addressed table from feature keys to actions, compiled offline from simulated battles. The file is the table itself, so it is loaded with one read.
+	class PolicyTable
+	{
+	private:
+		// The base-2 logarithm of the number of slots.
+		unsigned int m_Bits = 0;
+
+		// The number of used slots. Always less than the number of slots, so that every search reaches an empty slot.
+		unsigned int m_Count = 0;
+
+		// The slots.
+		std::vector<PolicyEntry> m_Slots;
+
+		/// <summary>Finds the slot for a key.</summary>
+		/// <returns>The slot holding the key, or the empty slot where it would go.</returns>
+		size_t find(uint64_t key) const;
+
+	public:
+		/// <summary>Constructs an empty table.</summary>
+		/// <param name="bits">The base-2 logarithm of the number of slots.</param>
+		PolicyTable(unsigned int bits = 0);
+
+		/// <summary>Sets the action for a feature key. The table must have an empty slot left.</summary>
+		/// <param name="features">The feature key.</param>
+		/// <param name="action">The action.</param>
+		/// <param name="confidence">The win rate of the action, out of 255.</param>
+		void insert(uint64_t features, uint8_t action, uint8_t confidence);
+
+		/// <summary>Looks up the action for a feature key.</summary>
+		/// <param name="features">The feature key.</param>
+		/// <returns>The entry, or nullptr if the table has no action for the key.</returns>
+		const PolicyEntry* lookup(uint64_t features) const;
+
+		/// <summary>Gets the number of feature keys with actions.</summary>
+		unsigned int size() const;
+
+		/// <summary>Writes the table to a file.</summary>
+		/// <param name="path">The path of the file.</param>
+		/// <returns>True if the file was written, false otherwise.</returns>
+		bool save(const std::string& path) const;
+
+		/// <summary>Reads a table from a file.</summary>
+		/// <param name="path">The path of the file.</param>
+		/// <returns>True if the file was a valid table, with as many used slots as its header says and at least one empty slot, false otherwise (in which case the table is left empty).</returns>
+		bool load(const std::string& path);
+
+		/// <summary>Retrieves a table loaded from a file. Each file is only loaded once, and the table is kept for the rest of the program. Safe to call from any thread.</summary>
+		/// <param name="path">The path of the file.</param>
+		/// <returns>The table, or nullptr if the file is not a valid table.</returns>
+		static const PolicyTable* get(const std::string& path);
+	};
+
+
+	// An agent that looks up what to do in a policy table, falling back to acting at random in states the table has never seen.
+	class TablePolicyAgent : public Agent
+	{
+	protected:
+		// The table of actions.
+		const PolicyTable* m_Table;
+
+	public:
+		/// <summary>Constructs an agent that acts from a policy table.</summary>
+		/// <param name="self">The entity that the agent acts for.</param>
+		/// <param name="table">The table of actions. Must outlive the agent.</param>
+		TablePolicyAgent(Entity* self, const PolicyTable* table);
+
+		/// <summary>Looks up the action for the entity.</summary>
+		/// <param name="turn">To be filled out with the data for the turn.</param>
+		void decide(Turn& turn);
+	};
+
+	// A simulated policy that acts from a policy table, the same way TablePolicyAgent does.
+	class TablePolicy : public SimPolicy
+	{
+	private:
+		// The table of actions.
+		const PolicyTable* m_Table;
+
+		// The random number generator, for unseen states and random targets.
+		SimRandom m_Random;
+
+	public:
+		/// <summary>Constructs a simulated policy that acts from a policy table.</summary>
+		/// <param name="table">The table of actions.</param>
+		/// <param name="seed">The seed for the random number generator.</param>
+		TablePolicy(const PolicyTable* table, uint64_t seed);
+
+		/// <summary>Looks up the turn for an entity.</summary>
+		/// <param name="snapshot">The state of the battle.</param>
+		/// <param name="actor">The index of the entity taking its turn.</param>
+		/// <returns>The turn.</returns>
+		SimTurn choose(const BattleSnapshot& snapshot, int actor);
+	};
+
+
+	// How often each action has been taken from a feature key in training, and how often it led to a win.
+	struct PolicyStats
+	{
+		uint32_t visits[POLICY_MAX_ACTIONS] = {};
+		uint32_t wins[POLICY_MAX_ACTIONS] = {};
+	};
+
+	// Learns a policy table for one side of a battle, by playing batches of simulated battles against a random opponent.
+	class PolicyTrainer
+	{
+	private:
+		// The allies of the battle.
+		std::vector<overworld::Ally> m_Allies;
+
+		// The IDs of the enemies of the battle.
+		std::vector<std::string> m_Enemies;
+
+		// The side that the policy is learned for.
+		int m_Side;
+
+		// The statistics gathered so far, by feature key.
+		std::unordered_map<uint64_t, PolicyStats> m_Stats;
+
+	public:
+		/// <summary>Constructs a trainer for a battle.</summary>
+		/// <param name="allies">The allies of the battle.</param>
+		/// <param name="enemies">The IDs of the enemies of the battle.</param>
+		/// <param name="side">The side to learn the policy for: 0 for the allies, 1 for the enemies.</param>
+		PolicyTrainer(const std::vector<overworld::Ally>& allies, const std::vector<std::string>& enemies, int side);
+
+		/// <summary>Plays a round of simulated battles across every worker thread. The side being trained follows the best actions found so far, exploring a random action some of the time; the other side acts at random.</summary>
+		/// <param name="battles">The number of battles to play.</param>
+		/// <param name="explore">The probability of exploring a random action.</param>
+		/// <param name="seed">The seed for the battles. Each battle is seeded from its index, so results do not depend on the number of threads.</param>
+		/// <returns>The fraction of the battles won by the side being trained.</returns>
+		float train(unsigned int battles, float explore, uint64_t seed);
+
+		/// <summary>Compiles the best action for every feature key seen so far into a table.</summary>
+		/// <param name="min_visits">The number of times a feature key must have been seen for it to be included.</param>
+		/// <returns>The table, sized to be at most half full.</returns>
+		PolicyTable compile(unsigned int min_visits = 1) const;
+	};
+
+
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "party.h"
+
+
+// The arguments to a command-line tool: positional arguments, and options given as "--name value".
+class ToolArguments
+{
+private:
+	// The positional arguments, in order.
+	std::vector<std::string> m_Positional;
+
+	// The values of each option, in the order they were given.
+	std::unordered_map<std::string, std::vector<std::string>> m_Options;
+
+	// True if an option read as a number was not one.
+	mutable bool m_Invalid = false;
+
+	/// <summary>Reports an option that was read as a number but is not one.</summary>
+	void invalid(const std::string& name, const char* expected) const;
+
+public:
+	/// <summary>Parses the arguments to a tool.</summary>
+	/// <param name="argc">The number of arguments, not including the name of the tool.</param>
+	/// <param name="argv">The arguments.</param>
+	ToolArguments(int argc, char** argv);
+
+	/// <summary>Gets the number of positional arguments.</summary>
+	size_t size() const;
+
+	/// <summary>Retrieves a positional argument.</summary>
+	const std::string& operator[](size_t index) const;
+
+	/// <summary>Checks if an option was given.</summary>
+	bool has(const std::string& name) const;
+
+	/// <summary>Retrieves the last value given for an option.</summary>
+	/// <param name="name">The name of the option, without the leading dashes.</param>
+	/// <param name="fallback">The value if the option was not given.</param>
+	std::string get(const std::string& name, const std::string& fallback = "") const;
+
+	/// <summary>Retrieves the last value given for an option, as an integer. A value that is not an integer is reported, and gives the fallback.</summary>
+	long long get_int(const std::string& name, long long fallback) const;
+
+	/// <summary>Retrieves the last value given for an option, as a number. A value that is not a finite number is reported, and gives the fallback.</summary>
+	double get_float(const std::string& name, double fallback) const;
+
+	/// <summary>Checks that every option read as a number so far was one. Tools check this once they have read their options, and stop if it fails.</summary>
+	bool good() const;
+
+	/// <summary>Retrieves every value given for an option.</summary>
+	std::vector<std::string> get_all(const std::string& name) const;
+};
+
+
+/// <summary>Builds the allies of a headless battle from "--ally" options, each a comma-separated list of item IDs. Uses the debug party if no allies are given.</summary>
+/// <param name="args">The arguments to the tool.</param>
+/// <param name="allies">Set to the allies.</param>
+/// <returns>True if every item ID names an item, false otherwise, once the unknown IDs have been reported.</returns>
+bool parse_allies(const ToolArguments& args, std::vector<overworld::Ally>& allies);
+
+/// <summary>Reads the enemies of a headless battle from the positional arguments.</summary>
+/// <param name="args">The arguments to the tool.</param>
+/// <param name="first">The index of the first enemy ID among the positional arguments.</param>
+/// <param name="enemies">Set to the enemy IDs.</param>
+/// <returns>True if every ID names an enemy, false otherwise, once the unknown IDs have been reported.</returns>
+bool parse_enemies(const ToolArguments& args, size_t first, std::vector<std::string>& enemies);
+
+
+/// <summary>Runs a command-line tool instead of the game, if the first argument names one. Tools run headless, without opening a window.</summary>
+/// <param name="argc">The number of arguments to the program.</param>
+/// <param name="argv">The arguments to the program.</param>
+/// <param name="status">Set to the exit status of the tool.</param>
+/// <returns>True if a tool was run, false if the game should start.</returns>
+bool run_tool(int argc, char** argv, int& status);
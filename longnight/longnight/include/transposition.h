@@ -0,0 +1,92 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+
+namespace battle
+{
+
+
+	// How a stored search value relates to the true value.
+	enum Bound : uint8_t
+	{
+		BOUND_NONE,
+
+		// The stored value is exact.
+		BOUND_EXACT,
+
+		// The true value is at least the stored value.
+		BOUND_LOWER,
+
+		// The true value is at most the stored value.
+		BOUND_UPPER
+	};
+
+	// The result of searching a position.
+	struct TableEntry
+	{
+		// The value of the position.
+		int32_t value;
+
+		// How many turns deep the position was searched.
+		uint8_t depth;
+
+		// How the value relates to the true value.
+		Bound bound;
+
+		// The index of the best turn found, or 0xFF if there is none.
+		uint8_t best;
+
+		// The generation of the table when the result was stored. Set by TranspositionTable::store().
+		uint8_t generation;
+	};
+
+	// A fixed-size hash table of search results, shared between threads without locking. Each slot stores its key XORed with its data, so a slot torn by two threads writing at once fails the key check instead of returning the wrong data.
+	class TranspositionTable
+	{
+	private:
+		// A slot of the table.
+		struct Slot
+		{
+			// The key, XORed with the data.
+			std::atomic<uint64_t> check;
+
+			// The packed entry.
+			std::atomic<uint64_t> data;
+		};
+
+		// The slots.
+		std::unique_ptr<Slot[]> m_Slots;
+
+		// The number of slots minus one. The number of slots is always a power of two.
+		uint64_t m_Mask;
+
+		// The generation that results are stored with. Only changed between searches.
+		uint8_t m_Generation;
+
+	public:
+		/// <summary>Constructs an empty table.</summary>
+		/// <param name="bits">The base-2 logarithm of the number of slots.</param>
+		TranspositionTable(unsigned int bits);
+
+		/// <summary>Empties the table.</summary>
+		void clear();
+
+		/// <summary>Starts a new generation, keeping the results stored so far. Results from older generations can still be looked up, but give way to any result stored from now on.</summary>
+		void age();
+
+		/// <summary>Looks up a position.</summary>
+		/// <param name="key">The hash of the position.</param>
+		/// <param name="entry">Set to the stored result, if there is one.</param>
+		/// <returns>True if a result was stored for the position, false otherwise.</returns>
+		bool probe(uint64_t key, TableEntry& entry) const;
+
+		/// <summary>Stores the result of searching a position. Replaces what is in the same slot, unless it is the same position searched more deeply, or another position searched more deeply in the current generation.</summary>
+		/// <param name="key">The hash of the position.</param>
+		/// <param name="entry">The result.</param>
+		void store(uint64_t key, const TableEntry& entry);
+	};
+
+
+}
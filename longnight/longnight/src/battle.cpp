@@ -1,12 +1,16 @@
 #include <algorithm>
 #include <unordered_set>
-#include <regex>
 
 #include "../include/battle.h"
 #include "../include/battleevent.h"
 #include "../include/battleagent.h"
+#include "../include/legalturn.h"
+#include "../include/tablepolicy.h"
+#include "../include/netpolicy.h"
+#include "../include/behavior.h"
 #include "../include/ui.h"
 #include "../include/party.h"
+#include "../include/gamedata.h"
 
 #include <iostream>
 
@@ -20,8 +24,59 @@ using namespace battle;
 Palette* g_ClearPalette = nullptr;
 
 
-Party g_Allies = { nullptr, vector<Entity*>() };
-Party g_Enemies = { nullptr, vector<Entity*>() };
+Party g_Allies = { nullptr, vector<Entity*>(), vector<Entity*>(), 0 };
+Party g_Enemies = { nullptr, vector<Entity*>(), vector<Entity*>(), 1 };
+
+
+/// <summary>Orders entities by their index in their party.</summary>
+inline bool party_order(const Entity* a, const Entity* b)
+{
+	return a->party_index < b->party_index;
+}
+
+void Party::add(Entity* entity)
+{
+	entity->party = this;
+	entity->party_index = allies.size();
+	allies.push_back(entity);
+	update(entity);
+}
+
+void Party::remove(Entity* entity)
+{
+	auto iter = lower_bound(living.begin(), living.end(), entity, party_order);
+	if (iter != living.end() && *iter == entity)
+		living.erase(iter);
+
+	// Shift everyone after the entity down, to keep the indices and their order
+	allies.erase(allies.begin() + entity->party_index);
+	for (size_t k = entity->party_index; k < allies.size(); ++k)
+		allies[k]->party_index = (int)k;
+	entity->party_index = -1;
+}
+
+void Party::clear()
+{
+	allies.clear();
+	living.clear();
+}
+
+void Party::update(Entity* entity)
+{
+	auto iter = lower_bound(living.begin(), living.end(), entity, party_order);
+	bool listed = iter != living.end() && *iter == entity;
+
+	// Only changes when the entity's Health crosses 0, so this rarely moves anything
+	if (entity->cur_health > 0 && !listed)
+		living.insert(iter, entity);
+	else if (entity->cur_health <= 0 && listed)
+		living.erase(iter);
+}
+
+int Party::alive_count() const
+{
+	return living.size();
+}
 
 
 Entity::Entity() : palette(vec4i(255, 0, 0, 0), vec4i(0, 255, 0, 0), vec4i(0, 0, 255, 0)) {}
@@ -34,12 +89,7 @@ Entity::~Entity()
 
 bool Entity::is_ally(Entity* other)
 {
-	for (auto iter = party->allies.begin(); iter != party->allies.end(); ++iter)
-	{
-		if (*iter == other) return true;
-	}
-
-	return false;
+	return other && other->party->faction == party->faction;
 }
 
 
@@ -51,6 +101,9 @@ Ally::Ally(overworld::Ally& ally)
 	// Set the agent
 	agent = nullptr;
 
+	// Remember the character, so that its Health can be written back
+	character = &ally;
+
 	// Set up the palette
 	SinglePalette* ui_palette = get_ui_palette();
 	vec4f ui_color;
@@ -98,72 +151,69 @@ void Ally::defeat()
 	palette.set_green_maps_to(vec4i(213, 110, 110, 0));
 
 	// Check if all allies have been defeated. If so, the player loses the battle.
-	for (auto iter = party->allies.begin(); iter != party->allies.end(); ++iter)
-	{
-		if ((*iter)->cur_health > 0)
-			return; // Quits the function if any ally is not incapacitated, so the last section isn't reached
-	}
+	if (party->alive_count() > 0)
+		return;
 
 	// TODO game over
 }
 
+void Ally::write_back() const
+{
+	character->cur_health = max(0, min(cur_health, character->max_health));
+}
+
 
-unordered_map<string, unordered_map<string, string>*> Enemy::m_EnemyData{};
 unordered_map<string, SpriteSheet*> Enemy::m_EnemySprites{};
 
-int Enemy::load_int(const unordered_map<string, string>& data, string key)
+void EnemyTemplate::load(const data::Record& data)
 {
-	auto iter = data.find(key);
-	if (iter != data.end())
-		return stoi(iter->second);
-	return 0;
+	health = data.get_int("health");
+	shield = data.get_int("shield");
+	offense = data.get_int("offense");
+	defense = data.get_int("defense");
+	type = data.get_string("type");
+	policy = data.get_string("policy");
+	network = data.get_string("network");
+
+	string behavior_name(data.get_string("behavior"));
+	behavior = behavior_name.empty() ? nullptr : BehaviorScript::load(behavior_name);
+	checksum = hash(data);
+
+	items = data::split_list(data.get_string("items"));
 }
 
-string Enemy::load_string(const unordered_map<string, string>& data, string key)
+uint64_t EnemyTemplate::hash(const data::Record& data)
 {
-	auto iter = data.find(key);
-	if (iter != data.end())
-		return iter->second;
-	return "";
+	uint64_t checksum = data.hash();
+	string behavior_name(data.get_string("behavior"));
+	if (behavior_name.empty())
+		return checksum;
+
+	uint64_t script = BehaviorScript::hash(behavior_name);
+	return data::fnv1a(checksum, &script, sizeof(script));
 }
 
 Enemy::Enemy(string id)
 {
-	// Load data about the enemies.
-	if (m_EnemyData.empty())
-	{
-		LoadFile file("res/data/enemies.txt");
-
-		while (file.good())
-		{
-			unordered_map<string, string>* data = new unordered_map<string, string>();
-			string data_id = file.load_data(*data);
-
-			m_EnemyData.emplace(data_id, data);
-		}
-	}
-
 	// Set the enemy's party
 	party = &g_Enemies;
 
 	// Load the data for this particular enemy.
-	auto iter = m_EnemyData.find(id);
-	if (iter != m_EnemyData.end())
+	if (const EnemyTemplate* enemy = data::get_registry().get_enemy(id))
 	{
-		unordered_map<string, string>& data = *iter->second;
+		const EnemyTemplate& data = *enemy;
 
-		max_health = load_int(data, "health");
+		max_health = data.health;
 		cur_health = max_health;
-		max_shield = load_int(data, "shield");
+		max_shield = data.shield;
 		cur_shield = max_shield;
 
-		base_offense = load_int(data, "offense");
+		base_offense = data.offense;
 		cur_offense = 0;
-		base_defense = load_int(data, "defense");
+		base_defense = data.defense;
 		cur_defense = 0;
 
-		string type = load_string(data, "type");
-		auto sprite_iter = m_EnemySprites.find(type);
+		auto sprite_iter = m_EnemySprites.find(data.type);
 		if (sprite_iter != m_EnemySprites.end())
 		{
 			// If the sprite sheet has been loaded, set the image
@@ -172,9 +222,9 @@ Enemy::Enemy(string id)
 		else
 		{
 			// Load the sprite sheet
-			string path = "sprites/enemies/" + type + ".png";
+			string path = "sprites/enemies/" + data.type + ".png";
 			SpriteSheet* sheet = SpriteSheet::generate(path.c_str());
-			m_EnemySprites.emplace(type, sheet);
+			m_EnemySprites.emplace(data.type, sheet);
 
 			image = new StaticSpriteGraphic(sheet, Sprite::get_sprite("battle enemy " + id), &palette);
 		}
@@ -183,18 +233,11 @@ Enemy::Enemy(string id)
 			dimensions = vec2i(image->get_width(), image->get_height());
 
 		// Load items
-		string items = load_string(data, "items");
-		regex comma("(.*),\\s*(.*)");
-		smatch match;
-		while (regex_match(items, match, comma))
+		for (auto item_iter = data.items.begin(); item_iter != data.items.end(); ++item_iter)
 		{
-			if (overworld::Item* item = overworld::Item::get_item(match[1].str()))
+			if (const overworld::Item* item = overworld::Item::get_item(*item_iter))
 				usables.push_back(item->generate());
-
-			items = match[2].str();
 		}
-		if (overworld::Item* item = overworld::Item::get_item(items))
-			usables.push_back(item->generate());
 	}
 }
 
@@ -356,13 +399,17 @@ int TimelineEvent::update(int frames_passed)
 
 EntityEvent* EntityEvent::m_ActiveEntity{ nullptr };
 
-EntityEvent::TS::TS(Target target_type, int target_index) : target_type(target_type), target_index(target_index) {}
-
 EntityEvent::EntityEvent(Entity* entity)
 {
 	m_Entity = entity;
 }
 
+EntityEvent::~EntityEvent()
+{
+	delete m_Decision;
+	delete m_Flash;
+}
+
 #define USABLE_ANGLE	0.4833219467f
 
 void EntityEvent::__display() const
@@ -424,9 +471,9 @@ void EntityEvent::reset_cursor()
 	m_Cursors.clear();
 
 	// Set the new cursors
-	if (m_Turn.usable != nullptr && m_Selecting != m_SelectSequence.end())
+	if (m_Turn.usable != nullptr && m_Selecting < m_SelectCount)
 	{
-		switch (m_Selecting->target_type)
+		switch (m_SelectSequence[m_Selecting].target_type)
 		{
 		case TARGET_ALL_ENEMIES:
 		case TARGET_RANDOM_ENEMY:
@@ -437,7 +484,7 @@ void EntityEvent::reset_cursor()
 		}
 		case TARGET_SINGLE_ENEMY:
 		{
-			hover_cursor(m_Entity->party->enemies->allies[m_SelectedTarget]);
+			hover_cursor(nth_target(m_Entity, TARGET_SINGLE_ENEMY, m_SelectedTarget));
 			break;
 		}
 		case TARGET_ALL_ALLIES:
@@ -448,7 +495,7 @@ void EntityEvent::reset_cursor()
 		}
 		case TARGET_SINGLE_ALLY:
 		{
-			hover_cursor(m_Entity->party->allies[m_SelectedTarget]);
+			hover_cursor(nth_target(m_Entity, TARGET_SINGLE_ALLY, m_SelectedTarget));
 			break;
 		}
 		case TARGET_SELF:
@@ -468,15 +515,16 @@ int EntityEvent::start()
 	// Check if the entity has an Agent to decide what to do
 	if (m_Entity->agent)
 	{
-		// We're enqueueing everything in the reverse order that it will happen (so basically, using our priority queue as a stack)
-
-		// Queue the listener triggering events
-		primary_queue_insert(new TickEvent(m_Entity));
-		primary_queue_insert(new TurnEndEvent(m_Entity));
+		// Let agents that search for a while do so on a worker thread, flashing the entity in the meantime
+		if (AnytimeAgent* agent = dynamic_cast<AnytimeAgent*>(m_Entity->agent))
+		{
+			m_Decision = agent->decide_async();
+			return EVENT_CONTINUE;
+		}
 
 		// Queue the entity's action
 		m_Entity->agent->decide(m_Turn);
-		m_Turn.enqueue();
+		__enqueue_turn();
 
 		// Queue making the entity flash to indicate who is acting
 		float filter = dynamic_cast<Enemy*>(m_Entity) == nullptr ? 1.f : 0.5f;
@@ -506,10 +554,60 @@ int EntityEvent::start()
 	return EVENT_CONTINUE;
 }
 
+void EntityEvent::__enqueue_turn()
+{
+	// We're enqueueing everything in the reverse order that it will happen (so basically, using our priority queue as a stack)
+
+	// Queue the listener triggering events
+	primary_queue_insert(new TickEvent(m_Entity));
+	primary_queue_insert(new TurnEndEvent(m_Entity));
+
+	// Queue the selected usable with the selected targets
+	m_Turn.enqueue();
+}
+
+int EntityEvent::__wait_for_decision(int frames_passed)
+{
+	// Play the flash inline, since events queued now would only run after this one stops
+	if (m_Flash)
+	{
+		if (m_Flash->update(frames_passed) == EVENT_CONTINUE)
+			return EVENT_CONTINUE;
+
+		delete m_Flash;
+		m_Flash = nullptr;
+		++m_Flashes;
+	}
+
+	// Flash at least twice, the same as when the Agent decides straight away, and keep flashing until the Agent has decided
+	if (m_Flashes >= 2 && m_Decision->poll(m_Turn))
+	{
+		delete m_Decision;
+		m_Decision = nullptr;
+
+		__enqueue_turn();
+		return EVENT_STOP;
+	}
+
+	float filter = dynamic_cast<Enemy*>(m_Entity) == nullptr ? 1.f : 0.5f;
+	m_Flash = new FlashEvent(&m_Entity->palette, vec3i(255, 255, 255), filter, 0.1f, 0.f);
+	if (m_Flash->start() == EVENT_STOP)
+	{
+		delete m_Flash;
+		m_Flash = nullptr;
+		++m_Flashes;
+	}
+
+	return EVENT_CONTINUE;
+}
+
 #define USABLE_ANGLE_SPEED (USABLE_ANGLE * 4.f)
 
 int EntityEvent::update(int frames_passed)
 {
+	if (m_Decision)
+		return __wait_for_decision(frames_passed);
+
 	if (m_UsableAngle < m_TargetUsableAngle)
 	{
 		m_UsableAngle += frames_passed * USABLE_ANGLE_SPEED / UpdateEvent::frames_per_second;
@@ -525,14 +623,9 @@ int EntityEvent::update(int frames_passed)
 
 	m_CursorBob += frames_passed;
 
-	if (m_Turn.usable != nullptr && m_Selecting == m_SelectSequence.end())
+	if (m_Turn.usable != nullptr && m_Selecting == m_SelectCount)
 	{
-		// Queue triggering listeners
-		primary_queue_insert(new TickEvent(m_Entity));
-		primary_queue_insert(new TurnEndEvent(m_Entity));
-
-		// Queue the selected usable with the selected targets
-		m_Turn.enqueue();
+		__enqueue_turn();
 
 		// Unset as the active entity event
 		m_ActiveEntity = nullptr;
@@ -555,9 +648,10 @@ int EntityEvent::trigger(const KeyEvent& event_data)
 			case KEY_RIGHT:
 			{
 				int r = event_data.control == KEY_LEFT ? -1 : 1;
-				int s = m_Selecting->target_type == TARGET_SINGLE_ENEMY ? m_Entity->party->enemies->allies.size() : m_Entity->party->allies.size();
+				Target target = m_SelectSequence[m_Selecting].target_type;
+				int s = count_targets(m_Entity, target);
 
-				if (m_Selecting->target_type == TARGET_SINGLE_ENEMY || m_Selecting->target_type == TARGET_SINGLE_ALLY)
+				if (target == TARGET_SINGLE_ENEMY || target == TARGET_SINGLE_ALLY)
 				{
 					m_SelectedTarget = (m_SelectedTarget + r + s) % s;
 					reset_cursor();
@@ -567,25 +661,18 @@ int EntityEvent::trigger(const KeyEvent& event_data)
 			}
 			case KEY_SELECT:
 			{
-				if (m_Selecting->target_index >= 0)
-				{
-					if (m_Selecting->target_type == TARGET_SINGLE_ENEMY)
-					{
-						m_Turn.targets[m_Selecting->target_index] = m_Entity->party->enemies->allies[m_SelectedTarget];
-					}
-					else
-					{
-						m_Turn.targets[m_Selecting->target_index] = m_Entity->party->allies[m_SelectedTarget];
-					}
-				}
+				const TS& selecting = m_SelectSequence[m_Selecting];
+				if (selecting.target_index >= 0)
+					m_Turn.targets[selecting.target_index] = nth_target(m_Entity, selecting.target_type, m_SelectedTarget);
 
 				++m_Selecting;
+				m_SelectedTarget = 0;
 				reset_cursor();
 				break;
 			}
 			case KEY_CANCEL:
 			{
-				if (m_Selecting == m_SelectSequence.begin())
+				if (m_Selecting == 0)
 				{
 					m_Turn.usable = nullptr;
 				}
@@ -618,11 +705,16 @@ int EntityEvent::trigger(const KeyEvent& event_data)
 			}
 			case KEY_SELECT:
 			{
+				// Usables with no legal targets can't be selected
+				Usable* usable = m_Entity->usables[m_SelectedUsable];
+				if (count_turns(m_Entity, usable) == 0)
+					break;
+
 				// Set which usable to use
-				m_Turn.usable = m_Entity->usables[m_SelectedUsable];
+				m_Turn.usable = usable;
 
-				// Set the sequence of targets to select
-				m_SelectSequence.clear();
+				// Set the sequence of targets to select. Only single targets need to be selected, unless the first set of targets is for confirmation.
+				m_SelectCount = 0;
 				m_Turn.targets.clear();
 				for (int k = 0; k < m_Turn.usable->targets.size(); ++k)
 				{
@@ -631,44 +723,20 @@ int EntityEvent::trigger(const KeyEvent& event_data)
 					if (t == TARGET_SINGLE_ALLY || t == TARGET_SINGLE_ENEMY)
 					{
 						m_Turn.targets.push_back(nullptr);
-						m_SelectSequence.push_back(EntityEvent::TS(t, m_Turn.targets.size() - 1));
+						m_SelectSequence[m_SelectCount++] = { t, (int)m_Turn.targets.size() - 1 };
 					}
 					else
 					{
 						if (t == TARGET_RANDOM_ENEMY)
-						{
-							vector<Entity*>& opts = m_Entity->party->enemies->allies;
-							m_Turn.targets.push_back(opts[rand() % opts.size()]);
-						}
-						
-						m_SelectSequence.push_back(EntityEvent::TS(t, -1));
-					}
-				}
+							m_Turn.targets.push_back(nth_target(m_Entity, t, rand() % count_targets(m_Entity, t)));
 
-				auto iter = m_SelectSequence.begin();
-				while (iter != m_SelectSequence.end())
-				{
-					if (iter->target_type != TARGET_SINGLE_ALLY && iter->target_type != TARGET_SINGLE_ENEMY && iter != m_SelectSequence.begin())
-					{
-						if (iter == m_SelectSequence.begin())
-						{
-							m_SelectSequence.erase(iter);
-							iter = m_SelectSequence.begin();
-						}
-						else
-						{
-							m_SelectSequence.erase(iter--);
-							++iter;
-						}
-					}
-					else
-					{
-						++iter;
+						if (k == 0)
+							m_SelectSequence[m_SelectCount++] = { t, -1 };
 					}
 				}
 
 				// Hover the cursor over the currently selected target(s)
-				m_Selecting = m_SelectSequence.begin();
+				m_Selecting = 0;
 				m_SelectedTarget = 0;
 				reset_cursor();
 
@@ -990,19 +1058,12 @@ EjectEvent::EjectEvent(Entity* entity)
 
 int EjectEvent::start()
 {
-	vector<Entity*>& ally_vec = m_Entity->party->allies;
-	for (auto iter = ally_vec.begin(); iter != ally_vec.end(); ++iter)
-	{
-		if (*iter == m_Entity)
-		{
-			ally_vec.erase(iter);
-			break;
-		}
-	}
+	Party* party = m_Entity->party;
+	party->remove(m_Entity);
 	delete m_Entity;
 
 	// Check if all enemies have been defeated. If so, end the battle.
-	if (ally_vec.empty())
+	if (party->alive_count() == 0)
 	{
 		// TODO player wins
 	}
@@ -1104,6 +1165,26 @@ void TargetSequence::enqueue(Entity* user, vector<Entity*>& single_targets) cons
 
 Usable::Usable(onion::Graphic* icon, Effect* animation, Target target, vector<Effect*>& target_effects, int speed) : TargetSequence(animation, target, target_effects, speed), icon(icon) {}
 
+void battle::refresh_usables(const overworld::Item* item)
+{
+	for (Party* party : { &g_Allies, &g_Enemies })
+	{
+		for (auto iter = party->allies.begin(); iter != party->allies.end(); ++iter)
+		{
+			for (auto usable_iter = (*iter)->usables.begin(); usable_iter != (*iter)->usables.end(); ++usable_iter)
+			{
+				if ((*usable_iter)->item == item)
+				{
+					// Replace the contents of the usable, so anything pointing to it stays valid
+					Usable* fresh = item->generate();
+					**usable_iter = *fresh;
+					delete fresh;
+				}
+			}
+		}
+	}
+}
+
 
 DamageEffect::DamageEffect(int damage) : damage(damage) {}
 
@@ -1209,18 +1290,18 @@ battle::State::State(const vector<string>& enemies)
 	// Set data for allies
 	vector<overworld::Ally>& party = overworld::get_party();
 
-	g_Allies.allies.resize(party.size());
+	vector<Entity*> allies(party.size());
 
 	Sprite* ally_bg = Sprite::get_sprite("battle ally bg");
 	vec2i ally_dimensions(ally_bg->width, ally_bg->height);
-	int ally_x = -(ally_bg->width * g_Allies.allies.size() / 2);
+	int ally_x = -(ally_bg->width * allies.size() / 2);
 
 	PALETTE_MATRIX ui_palette = get_ui_palette()->get_red_palette_matrix();
 
 	for (int k = party.size() - 1; k >= 0; --k)
 	{
 		Ally* ally = new Ally(party[k]);
-		g_Allies.allies[k] = ally;
+		allies[k] = ally;
 
 		string name = k == 0 ? "linh" : (k == 1 ? "mosi" : "jude");
 		ally->cursor = new StaticSpriteGraphic(m_SpriteSheet, Sprite::get_sprite("battle cursor " + name), g_ClearPalette);
@@ -1233,26 +1314,41 @@ battle::State::State(const vector<string>& enemies)
 		ally_x += ally_bg->width;
 	}
 
+	for (auto iter = allies.begin(); iter != allies.end(); ++iter)
+		g_Allies.add(*iter);
 	g_Allies.enemies = &g_Enemies;
 
 	// Set data for enemies
 #define ENEMY_PADDING	80
 	int enemy_width = ENEMY_PADDING * (enemies.size() - 1);
 
-	g_Enemies.allies.resize(enemies.size());
-	for (int k = g_Enemies.allies.size() - 1; k >= 0; --k)
+	vector<Entity*> enemy_entities(enemies.size());
+	for (int k = enemy_entities.size() - 1; k >= 0; --k)
 	{
 		Enemy* enemy = new Enemy(enemies[k]);
-		g_Enemies.allies[k] = enemy;
+		enemy_entities[k] = enemy;
 
 		enemy_width += enemy->image->get_width();
 
-		// debug TODO remove
-		enemy->agent = new RandomAgent(enemy);
+		// Enemies with a behavior script follow it, enemies with a compiled policy table or network act from it, and the rest search for what to do
+		const EnemyTemplate* enemy_data = data::get_registry().get_enemy(enemies[k]);
+		const PolicyTable* table = enemy_data && !enemy_data->policy.empty() ? PolicyTable::get(enemy_data->policy) : nullptr;
+		const PolicyNetwork* network = enemy_data && !enemy_data->network.empty() ? PolicyNetwork::get(enemy_data->network) : nullptr;
+		if (enemy_data && enemy_data->behavior)
+			enemy->agent = new ScriptedAgent(enemy, enemy_data->behavior);
+		else if (table)
+			enemy->agent = new TablePolicyAgent(enemy, table);
+		else if (network)
+			enemy->agent = new NetworkAgent(enemy, network);
+		else
+			enemy->agent = new MctsAgent(enemy, 0, MCTS_ENEMY_SECONDS);
 
 		enemy->time = (rand() % (4 * TIMELINE_MAX / 5)) + (TIMELINE_MAX / 5);
 	}
 
+	for (auto iter = enemy_entities.begin(); iter != enemy_entities.end(); ++iter)
+		g_Enemies.add(*iter);
+
 	enemy_width = -enemy_width / 2;
 	for (auto iter = g_Enemies.allies.begin(); iter != g_Enemies.allies.end(); ++iter)
 	{
@@ -1277,12 +1373,19 @@ battle::State::State(const vector<string>& enemies)
 
 battle::State::~State()
 {
+	// Write the allies' Health back to the party. Allies are never ejected, so every one is still here.
+	for (auto iter = g_Allies.allies.begin(); iter != g_Allies.allies.end(); ++iter)
+		((Ally*)*iter)->write_back();
+
 	// Delete the allies and enemies.
 	for (auto iter = g_Allies.allies.begin(); iter != g_Allies.allies.end(); ++iter)
 		delete *iter;
 	for (auto iter = g_Enemies.allies.begin(); iter != g_Enemies.allies.end(); ++iter)
 		delete *iter;
 
+	g_Allies.clear();
+	g_Enemies.clear();
+
 	// Delete the primary queue.
 	delete g_PrimaryQueue;
 }
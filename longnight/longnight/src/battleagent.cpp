@@ -1,4 +1,8 @@
+#include <chrono>
+#include <cmath>
 #include "../include/battleagent.h"
+#include "../include/legalturn.h"
+#include "../include/parallel.h"
 
 using namespace std;
 using namespace battle;
@@ -8,30 +12,523 @@ RandomAgent::RandomAgent(Entity* self) : Agent(self) {}
 
 void RandomAgent::decide(Turn& turn)
 {
-	turn.user = m_Self;
+	sample_turn(m_Self, turn);
+}
 
-	vector<Usable*>& opts = m_Self->usables;
+
+
+
+/// <summary>Checks if a turn can still be taken, and picks any targets chosen at random.</summary>
+/// <param name="snapshot">The battle.</param>
+/// <param name="turn">The turn, which is changed to have every target picked.</param>
+/// <param name="random">The random number generator.</param>
+/// <returns>True if every target can still be targeted, false otherwise.</returns>
+bool resolve_turn(const BattleSnapshot& snapshot, SimTurn& turn, SimRandom& random)
+{
+	int self = snapshot.actor();
+	for (int k = 0; k < turn.target_count; ++k)
+	{
+		if (turn.targets[k] == 0xFF)
+		{
+			// Pick a living enemy at random
+			uint8_t enemies[256];
+			int enemy_count = 0;
+			for (int e = 0; e < (int)snapshot.size(); ++e)
+			{
+				if ((snapshot[e].flags & SIM_PRESENT) && snapshot[e].side != snapshot[self].side && snapshot[e].cur_health > 0)
+					enemies[enemy_count++] = e;
+			}
+
+			if (enemy_count == 0)
+				return false;
+			turn.targets[k] = enemies[random.below(enemy_count)];
+		}
+		else
+		{
+			const SimEntity& target = snapshot[turn.targets[k]];
+			if (!(target.flags & SIM_PRESENT) || target.cur_health <= 0)
+				return false;
+		}
+	}
+	return true;
+}
+
+
+/// <summary>Fills out a turn from a simulated turn decided for a captured battle.</summary>
+/// <param name="self">The acting entity.</param>
+/// <param name="entities">The entity each index of the snapshot refers to.</param>
+/// <param name="result">The simulated turn. Targets left as 0xFF are picked at random.</param>
+/// <param name="turn">To be filled out with the data for the turn.</param>
+void fill_turn(Entity* self, const vector<Entity*>& entities, const SimTurn& result, Turn& turn)
+{
+	turn.user = self;
+
+	// Find the usable in the same slot that the snapshot captured it in
 	turn.usable = nullptr;
-	do { turn.usable = opts[rand() % opts.size()]; } while (!turn.usable);
+	int slot = 0;
+	for (auto iter = self->usables.begin(); iter != self->usables.end() && !turn.usable; ++iter)
+	{
+		if (*iter && slot++ == result.usable)
+			turn.usable = *iter;
+	}
+
+	// The entity passes if there was nothing it could do
+	turn.targets.clear();
+	if (!turn.usable)
+		return;
+
+	for (int k = 0; k < result.target_count; ++k)
+	{
+		if (result.targets[k] != 0xFF)
+			turn.targets.push_back(entities[result.targets[k]]);
+		else
+		{
+			// Pick the random target now
+			int count = count_targets(self, TARGET_RANDOM_ENEMY);
+			turn.targets.push_back(nth_target(self, TARGET_RANDOM_ENEMY, count > 0 ? rand() % count : 0));
+		}
+	}
+}
+
+
+// A node of a search tree.
+struct MctsNode
+{
+	// The turn that leads to the node.
+	SimTurn turn;
+
+	// The side that took the turn.
+	uint8_t side = 0;
+
+	// The entity whose turn it is at the node, or 0xFF if the node has not been expanded.
+	uint8_t actor = 0xFF;
+
+	// The number of children.
+	uint16_t child_count = 0;
+
+	// The index of the first child.
+	uint32_t first_child = 0;
+
+	// The number of times the node has been visited.
+	uint32_t visits = 0;
+
+	// The total reward for the side that took the turn.
+	float reward = 0.f;
+};
+
+/// <summary>Builds a search tree from a battle.</summary>
+/// <param name="root">The battle, with the acting entity taking its turn.</param>
+/// <param name="tree">Filled with the nodes of the tree. The root is the first node, and its children follow it.</param>
+/// <param name="iterations">The maximum number of iterations, or 0 for no limit.</param>
+/// <param name="deadline">The time at which to stop searching, if there is a time limit.</param>
+/// <param name="timed">True if there is a time limit.</param>
+/// <param name="seed">The seed for the search.</param>
+/// <param name="stop">If not nullptr, the search stops once it is set.</param>
+void build_tree(const BattleSnapshot& root, vector<MctsNode>& tree, int iterations, chrono::steady_clock::time_point deadline, bool timed, uint64_t seed, const atomic<bool>* stop)
+{
+	SimRandom random(seed);
+	RandomPolicy policy(seed ^ 0x5DEECE66Dull);
+
+	SimTurn turns[MCTS_MAX_CHILDREN];
+	uint32_t path[MCTS_ROLLOUT_TURNS + 1];
+
+	tree.clear();
+	tree.emplace_back();
+
+	if (root.actor() < 0)
+		return;
 
-	for (auto iter = turn.usable->targets.begin(); iter != turn.usable->targets.end(); ++iter)
+	for (int iteration = 0; iterations == 0 || iteration < iterations; ++iteration)
 	{
-		if (iter->target == TARGET_SINGLE_ENEMY || iter->target == TARGET_RANDOM_ENEMY)
+		// Only check the clock every so often
+		if ((iteration & 31) == 0 && ((timed && chrono::steady_clock::now() >= deadline) || (stop && stop->load(memory_order_relaxed))))
+			break;
+
+		BattleSnapshot state = root.clone();
+		uint32_t node = 0;
+		int depth = 0;
+		path[depth++] = node;
+
+		// Select and expand
+		while (state.winner() < 0 && depth < MCTS_ROLLOUT_TURNS)
 		{
-			vector<Entity*>& enemies = m_Self->party->enemies->allies;
-			Entity* target = nullptr;
-			do
+			int actor = state.actor();
+			if (tree[node].actor == 0xFF)
+			{
+				// Expand the node
+				int count = legal_turns(state, actor, turns, MCTS_MAX_CHILDREN);
+				tree[node].actor = actor;
+				tree[node].first_child = tree.size();
+				tree[node].child_count = count;
+				for (int k = 0; k < count; ++k)
+				{
+					MctsNode child;
+					child.turn = turns[k];
+					child.side = state[actor].side;
+					tree.push_back(child);
+				}
+			}
+			else if (tree[node].actor != actor)
+			{
+				// Chance took the battle somewhere else, so stop following the tree
+				break;
+			}
+
+			// Pick the child with the highest upper confidence bound, visiting every child once first
+			const MctsNode& parent = tree[node];
+			float log_visits = log((float)parent.visits + 1.f);
+			uint32_t best = 0;
+			float best_score = -1.f;
+			SimTurn best_turn;
+			for (uint32_t k = parent.first_child; k < parent.first_child + parent.child_count; ++k)
 			{
-				target = enemies[rand() % enemies.size()];
-			} 
-			while (target->cur_health == 0);
+				SimTurn turn = tree[k].turn;
+				if (!resolve_turn(state, turn, random))
+					continue;
 
-			turn.targets.push_back(target);
+				float score = tree[k].visits == 0
+					? 1000.f + random.below(1000)
+					: tree[k].reward / tree[k].visits + MCTS_EXPLORATION * sqrt(log_visits / tree[k].visits);
+				if (score > best_score)
+				{
+					best = k;
+					best_score = score;
+					best_turn = turn;
+				}
+			}
+
+			if (best_score < 0.f)
+				break;
+
+			state.apply(best_turn);
+			state.advance();
+
+			bool unvisited = tree[best].visits == 0;
+			node = best;
+			path[depth++] = node;
+
+			if (unvisited)
+				break;
 		}
-		else if (iter->target == TARGET_SINGLE_ALLY)
+
+		// Play the rest of the battle out at random
+		int winner = simulate(state, policy, policy, state.turns() + MCTS_ROLLOUT_TURNS);
+
+		// Update the nodes along the path
+		for (int k = 0; k < depth; ++k)
+		{
+			MctsNode& n = tree[path[k]];
+			++n.visits;
+			if (winner < 0)
+				n.reward += 0.5f;
+			else if (winner == n.side)
+				n.reward += 1.f;
+		}
+	}
+}
+
+
+AnytimeAgent::AnytimeAgent(Entity* self, float seconds) : Agent(self), m_Seconds(seconds) {}
+
+void AnytimeAgent::decide(Turn& turn)
+{
+	UsableTable usables;
+	vector<Entity*> entities;
+	BattleSnapshot snapshot = BattleSnapshot::capture(*m_Self->party, usables, &entities, m_Self);
+
+	atomic<bool> stop(false);
+	fill_turn(m_Self, entities, think(snapshot, stop), turn);
+}
+
+AgentDecision* AnytimeAgent::decide_async()
+{
+	return new AgentDecision(this, m_Self, m_Seconds);
+}
+
+
+AgentDecision::AgentDecision(AnytimeAgent* agent, Entity* self, float seconds) : m_Self(self), m_Snapshot(BattleSnapshot::capture(*self->party, m_Usables, &m_Entities, self))
+{
+	m_Timed = seconds > 0.f;
+	m_Deadline = chrono::steady_clock::now() + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<float>(seconds));
+
+	// The worker only ever touches its own copy of the battle
+	m_Thread = thread(
+		[this, agent]()
 		{
-			vector<Entity*>& allies = m_Self->party->allies;
-			turn.targets.push_back(allies[rand() % allies.size()]);
+			BattleSnapshot snapshot = m_Snapshot.clone();
+			m_Result = agent->think(snapshot, m_Stop);
+			m_Ready.store(true, memory_order_release);
 		}
+	);
+}
+
+AgentDecision::~AgentDecision()
+{
+	m_Stop.store(true, memory_order_relaxed);
+	if (m_Thread.joinable())
+		m_Thread.join();
+}
+
+bool AgentDecision::poll(Turn& turn)
+{
+	if (!m_Ready.load(memory_order_acquire))
+	{
+		if (m_Timed && chrono::steady_clock::now() >= m_Deadline)
+			m_Stop.store(true, memory_order_relaxed);
+		return false;
 	}
-}
\ No newline at end of file
+
+	if (m_Thread.joinable())
+		m_Thread.join();
+
+	fill_turn(m_Self, m_Entities, m_Result, turn);
+	return true;
+}
+
+
+MctsAgent::MctsAgent(Entity* self, int iterations, float seconds, unsigned int threads) : AnytimeAgent(self, seconds), m_Iterations(iterations), m_Threads(threads) {}
+
+SimTurn MctsAgent::search(const BattleSnapshot& snapshot, uint64_t seed, const atomic<bool>* stop) const
+{
+	unsigned int threads = m_Threads == 0 ? worker_count() : m_Threads;
+	bool timed = m_Seconds > 0.f;
+	auto deadline = chrono::steady_clock::now() + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<float>(m_Seconds));
+
+	// Each thread builds its own tree from the same root
+	vector<vector<MctsNode>> trees(threads);
+	parallel_for(threads, threads,
+		[&](unsigned int chunk, size_t, size_t)
+		{
+			build_tree(snapshot, trees[chunk], m_Iterations, deadline, timed, seed + chunk * 0x9E3779B97F4A7C15ull, stop);
+		}
+	);
+
+	// Every tree has the same children at the root, so merge their statistics
+	const MctsNode& root = trees[0][0];
+	uint32_t best = 0, best_visits = 0;
+	for (uint32_t k = 0; k < root.child_count; ++k)
+	{
+		uint32_t visits = 0;
+		for (auto iter = trees.begin(); iter != trees.end(); ++iter)
+		{
+			if (iter->size() > root.first_child + k)
+				visits += (*iter)[root.first_child + k].visits;
+		}
+
+		if (visits > best_visits)
+		{
+			best = k;
+			best_visits = visits;
+		}
+	}
+
+	if (root.child_count == 0)
+	{
+		SimTurn pass = {};
+		pass.usable = SIM_PASS;
+		return pass;
+	}
+	return trees[0][root.first_child + best].turn;
+}
+
+SimTurn MctsAgent::think(BattleSnapshot& snapshot, const atomic<bool>& stop)
+{
+	// Seed from the battle itself, since rand() isn't safe to call from worker threads
+	return search(snapshot, snapshot.hash(), &stop);
+}
+
+
+
+ExpectiminimaxAgent::ExpectiminimaxAgent(Entity* self, float seconds, int max_depth, unsigned int table_bits) : AnytimeAgent(self, seconds), m_MaxDepth(min(max_depth, 255)), m_Table(table_bits), m_Fingerprint(0) {}
+
+int ExpectiminimaxAgent::evaluate(const BattleSnapshot& snapshot) const
+{
+	// Compare how much of their Health and Shield each side has left
+	int64_t remaining[2] = {}, total[2] = {};
+	for (size_t k = 0; k < snapshot.size(); ++k)
+	{
+		const SimEntity& e = snapshot[k];
+		total[e.side] += e.max_health + e.max_shield;
+		if (e.flags & SIM_PRESENT)
+			remaining[e.side] += e.cur_health + e.cur_shield;
+	}
+
+	int value[2];
+	for (int side = 0; side < 2; ++side)
+		value[side] = total[side] > 0 ? (int)(remaining[side] * (SEARCH_WIN / 2) / total[side]) : 0;
+
+	return value[m_Side] - value[1 - m_Side];
+}
+
+int ExpectiminimaxAgent::expect(BattleSnapshot& snapshot, SimTurn turn, int depth, int alpha, int beta, int ply)
+{
+	// Find the first target that is still to be picked at random
+	int k = 0;
+	while (k < turn.target_count && turn.targets[k] != 0xFF)
+		++k;
+
+	if (k == turn.target_count)
+	{
+		SimUndo token = snapshot.apply(turn, m_Log);
+		int value = search(snapshot, depth, alpha, beta, ply);
+		snapshot.undo(token, m_Log);
+		return value;
+	}
+
+	// Average over every living enemy it could be
+	int self = snapshot.actor();
+	int64_t sum = 0;
+	int count = 0;
+	for (size_t e = 0; e < snapshot.size() && !m_Abort; ++e)
+	{
+		const SimEntity& target = snapshot[e];
+		if ((target.flags & SIM_PRESENT) && target.side != snapshot[self].side && target.cur_health > 0)
+		{
+			turn.targets[k] = e;
+
+			// Bounds can't be passed on through a chance node, since the value of one outcome says little about the average
+			sum += expect(snapshot, turn, depth, -SEARCH_WIN - 1, SEARCH_WIN + 1, ply);
+			++count;
+		}
+	}
+
+	return count == 0 ? evaluate(snapshot) : (int)(sum / count);
+}
+
+int ExpectiminimaxAgent::search(BattleSnapshot& snapshot, int depth, int alpha, int beta, int ply, uint8_t* best)
+{
+	// Only check the clock every so often
+	if ((++m_Nodes & 1023) == 0 && (chrono::steady_clock::now() >= m_Deadline || (m_Stop && m_Stop->load(memory_order_relaxed))))
+		m_Abort = true;
+	if (m_Abort)
+		return 0;
+
+	// Prefer quicker wins and slower losses
+	if (snapshot.winner() >= 0)
+		return snapshot.winner() == m_Side ? SEARCH_WIN - ply : -SEARCH_WIN + ply;
+
+	int actor = snapshot.actor();
+	if (depth == 0 || actor < 0)
+		return evaluate(snapshot);
+
+	// Check whether the position has already been searched
+	uint64_t key = snapshot.hash();
+	TableEntry entry;
+	uint8_t hint = 0xFF;
+	if (m_Table.probe(key, entry))
+	{
+		hint = entry.best;
+		if (entry.depth >= depth && !best)
+		{
+			if (entry.bound == BOUND_EXACT)
+				return entry.value;
+			if (entry.bound == BOUND_LOWER && entry.value >= beta)
+				return entry.value;
+			if (entry.bound == BOUND_UPPER && entry.value <= alpha)
+				return entry.value;
+		}
+	}
+
+	SimTurn turns[MCTS_MAX_CHILDREN];
+	int count = legal_turns(snapshot, actor, turns, MCTS_MAX_CHILDREN);
+	if (count == 0)
+		return evaluate(snapshot);
+
+	// Try the best turn from before first
+	if (hint < count)
+		swap(turns[0], turns[hint]);
+
+	bool maximising = snapshot[actor].side == m_Side;
+	int original_alpha = alpha, original_beta = beta;
+	int best_value = maximising ? -SEARCH_WIN - 1 : SEARCH_WIN + 1;
+	int best_index = 0;
+
+	for (int k = 0; k < count; ++k)
+	{
+		int value = expect(snapshot, turns[k], depth - 1, alpha, beta, ply + 1);
+		if (m_Abort)
+			return 0;
+
+		if (maximising ? value > best_value : value < best_value)
+		{
+			best_value = value;
+			best_index = k;
+		}
+
+		if (maximising)
+			alpha = max(alpha, value);
+		else
+			beta = min(beta, value);
+
+		if (alpha >= beta)
+			break;
+	}
+
+	// Remember where the best turn was in the unordered list
+	uint8_t best_original = best_index == 0 && hint < count ? hint : (best_index == (int)hint ? 0 : best_index);
+
+	entry.value = best_value;
+	entry.depth = depth;
+	entry.bound = best_value <= original_alpha ? BOUND_UPPER : (best_value >= original_beta ? BOUND_LOWER : BOUND_EXACT);
+	entry.best = best_original;
+	m_Table.store(key, entry);
+
+	if (best)
+		*best = best_original;
+	return best_value;
+}
+
+SimTurn ExpectiminimaxAgent::search(BattleSnapshot& snapshot, const atomic<bool>* stop)
+{
+	SimTurn turn = {};
+	turn.usable = SIM_PASS;
+	int actor = snapshot.actor();
+	if (actor < 0)
+		return turn;
+
+	m_Side = snapshot[actor].side;
+	m_Nodes = 0;
+	m_Stop = stop;
+	m_Abort = false;
+	m_Deadline = chrono::steady_clock::now() + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<float>(m_Seconds));
+
+	SimTurn turns[MCTS_MAX_CHILDREN];
+	if (legal_turns(snapshot, actor, turns, MCTS_MAX_CHILDREN) == 0)
+		return turn;
+	turn = turns[0];
+
+	// Search one turn deeper each time, keeping the result of the deepest search that finished in time
+	for (int depth = 1; depth <= m_MaxDepth; ++depth)
+	{
+		uint8_t best = 0;
+		int value = search(snapshot, depth, -SEARCH_WIN - 1, SEARCH_WIN + 1, 0, &best);
+		if (m_Abort)
+			break;
+
+		turn = turns[best];
+
+		// Stop once the outcome is certain
+		if (value >= SEARCH_WIN - depth || value <= -SEARCH_WIN + depth)
+			break;
+	}
+
+	return turn;
+}
+
+SimTurn ExpectiminimaxAgent::think(BattleSnapshot& snapshot, const atomic<bool>& stop)
+{
+	// Positions are keyed by what changes during a battle, and valued for the side searched for, so results from earlier decisions only hold while the side, the entities and their usables are the same
+	int actor = snapshot.actor();
+	uint64_t fingerprint = snapshot.fingerprint() ^ (actor >= 0 ? snapshot[actor].side + 1 : 0);
+	if (fingerprint != m_Fingerprint)
+	{
+		m_Table.clear();
+		m_Fingerprint = fingerprint;
+	}
+	else
+	{
+		m_Table.age();
+	}
+
+	return search(snapshot, &stop);
+}
@@ -67,8 +67,9 @@ void Turn::enqueue()
 		iter->second->trigger(this);
 	}
 
-	// Queue effects, in reverse
-	usable->enqueue(user, targets);
+	// Queue effects, in reverse. Entities with nothing they can do pass their turn.
+	if (usable)
+		usable->enqueue(user, targets);
 }
 
 
@@ -173,6 +174,7 @@ int DamageEvent::start()
 
 		// Damage the target's Health
 		target->cur_health -= min(target->cur_health, dh);
+		target->party->update(target);
 
 		// Queue animations for the damage
 		m_Queue->insert(new NumberEvent(damage, target->coordinates + vec2i(target->dimensions.get(0) / 2, target->dimensions.get(1) / 2)), INT_MIN);
@@ -280,6 +282,9 @@ int InflictStatusEvent::start()
 			*s = min(*s, target->max_shield);
 		else if (status == TIME_STATUS)
 			*s = min(*s, TIMELINE_MAX);
+
+		if (status == HEALTH_STATUS)
+			target->party->update(target);
 		
 		// Trigger listeners after the entity is inflicted with a status effect
 		auto iter3 = g_AfterStatusInflictedListeners.find(target);
@@ -0,0 +1,611 @@
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include "../include/behavior.h"
+#include "../include/datafile.h"
+#include "../include/gamedata.h"
+#include "../include/legalturn.h"
+
+using namespace std;
+using namespace battle;
+
+
+/// <summary>Splits a line of a script into words. Quoted text is one word, without the quotes, and everything after a hash is a comment.</summary>
+/// <returns>False if a quote is never closed.</returns>
+bool split_words(const string& line, vector<string>& words)
+{
+	words.clear();
+	size_t k = 0;
+	while (k < line.size())
+	{
+		if (line[k] == ' ' || line[k] == '\t' || line[k] == '\r')
+			++k;
+		else if (line[k] == '#')
+			break;
+		else if (line[k] == '"')
+		{
+			size_t end = line.find('"', k + 1);
+			if (end == string::npos)
+				return false;
+			words.push_back(line.substr(k + 1, end - k - 1));
+			k = end + 1;
+		}
+		else
+		{
+			size_t end = line.find_first_of(" \t\r#", k);
+			if (end == string::npos)
+				end = line.size();
+			words.push_back(line.substr(k, end - k));
+			k = end;
+		}
+	}
+	return true;
+}
+
+/// <summary>Looks up a word in a list of names.</summary>
+/// <returns>The index of the word, or -1 if it isn't in the list.</returns>
+int find_word(const string& word, const char* const* names, int count)
+{
+	for (int k = 0; k < count; ++k)
+	{
+		if (word == names[k])
+			return k;
+	}
+	return -1;
+}
+
+const char* const g_Subjects[] = { "self", "ally", "enemy", "allies", "enemies" };
+const char* const g_Stats[] = { "health", "shield", "burn", "toxin", "offense", "defense", "time" };
+const char* const g_Compares[] = { "<", "<=", ">", ">=", "=", "!=" };
+const char* const g_Targetings[] = { "weakest", "strongest", "first", "random" };
+
+/// <summary>Appends a 16-bit value to bytecode.</summary>
+void emit16(vector<uint8_t>& code, uint16_t value)
+{
+	code.push_back(value & 0xFF);
+	code.push_back(value >> 8);
+}
+
+/// <summary>Appends a 32-bit value to bytecode.</summary>
+void emit32(vector<uint8_t>& code, int32_t value)
+{
+	for (int k = 0; k < 4; ++k)
+		code.push_back((uint32_t)value >> (8 * k) & 0xFF);
+}
+
+/// <summary>Reads a 16-bit value from bytecode.</summary>
+inline uint16_t read16(const uint8_t* code)
+{
+	return code[0] | (code[1] << 8);
+}
+
+/// <summary>Reads a 32-bit value from bytecode.</summary>
+inline int32_t read32(const uint8_t* code)
+{
+	return (int32_t)(code[0] | (code[1] << 8) | (code[2] << 16) | ((uint32_t)code[3] << 24));
+}
+
+
+shared_ptr<const BehaviorScript> BehaviorScript::compile(const string& source, string& error)
+{
+	shared_ptr<BehaviorScript> script(new BehaviorScript());
+	vector<uint8_t>& code = script->m_Code;
+
+	istringstream lines(source);
+	string line;
+	vector<string> words;
+	for (int line_number = 1; getline(lines, line); ++line_number)
+	{
+		if (!split_words(line, words))
+		{
+			error = "line " + to_string(line_number) + ": unclosed quote";
+			return nullptr;
+		}
+		if (words.empty())
+			continue;
+
+		// The jumps to patch with the start of the next rule, for when a condition fails
+		vector<size_t> jumps;
+		size_t k = 0;
+
+		auto fail = [&](const string& message)
+		{
+			error = "line " + to_string(line_number) + ": " + message;
+			return nullptr;
+		};
+
+		if (words[0] == "when")
+		{
+			do
+			{
+				++k;
+				if (k + 1 >= words.size())
+					return fail("incomplete condition");
+
+				int subject = find_word(words[k], g_Subjects, 5);
+				if (subject < 0)
+					return fail("unknown subject \"" + words[k] + "\"");
+
+				if (words[k + 1] == "next" && (subject == BEHAVIOR_ALLY || subject == BEHAVIOR_ENEMY))
+				{
+					code.push_back(BEHAVIOR_TEST_NEXT);
+					code.push_back(subject);
+					jumps.push_back(code.size());
+					emit16(code, 0);
+					k += 2;
+					continue;
+				}
+
+				// Counts have no stat
+				int stat = BEHAVIOR_COUNT;
+				if (subject == BEHAVIOR_SELF || subject == BEHAVIOR_ALLY || subject == BEHAVIOR_ENEMY)
+				{
+					stat = find_word(words[++k], g_Stats, 7);
+					if (stat < 0)
+						return fail("unknown stat \"" + words[k] + "\"");
+				}
+
+				if (k + 2 >= words.size())
+					return fail("incomplete condition");
+
+				int compare = find_word(words[k + 1], g_Compares, 6);
+				if (compare < 0)
+					return fail("unknown comparison \"" + words[k + 1] + "\"");
+
+				string value = words[k + 2];
+				bool percent = !value.empty() && value.back() == '%';
+				if (percent)
+				{
+					value.pop_back();
+					if (stat != BEHAVIOR_HEALTH && stat != BEHAVIOR_SHIELD)
+						return fail("only health and shield can be percentages");
+				}
+
+				char* end;
+				long number = strtol(value.c_str(), &end, 10);
+				if (value.empty() || *end != '\0')
+					return fail("\"" + words[k + 2] + "\" is not a number");
+
+				code.push_back(BEHAVIOR_TEST);
+				code.push_back(subject);
+				code.push_back(stat);
+				code.push_back(compare);
+				code.push_back(percent);
+				emit32(code, (int32_t)number);
+				jumps.push_back(code.size());
+				emit16(code, 0);
+				k += 3;
+			}
+			while (k < words.size() && words[k] == "and");
+		}
+		else if (words[0] == "otherwise")
+		{
+			++k;
+		}
+		else
+		{
+			return fail("rules must start with \"when\" or \"otherwise\"");
+		}
+
+		if (k + 1 >= words.size() || words[k] != "use")
+			return fail("expected \"use\" and an item");
+
+		// Refer to items by index, so that the same item is only looked up once
+		auto item = find(script->m_Items.begin(), script->m_Items.end(), words[k + 1]);
+		if (item == script->m_Items.end())
+		{
+			if (script->m_Items.size() == BEHAVIOR_MAX_ITEMS)
+				return fail("too many different items");
+			item = script->m_Items.insert(item, words[k + 1]);
+		}
+		k += 2;
+
+		int targeting = BEHAVIOR_WEAKEST;
+		if (k < words.size())
+		{
+			if (k + 1 >= words.size() || words[k] != "on")
+				return fail("expected \"on\" and how to pick targets");
+
+			targeting = words[k + 1] == "self" ? BEHAVIOR_WEAKEST : find_word(words[k + 1], g_Targetings, 4);
+			if (targeting < 0)
+				return fail("unknown targets \"" + words[k + 1] + "\"");
+			if (k + 2 < words.size())
+				return fail("unexpected \"" + words[k + 2] + "\"");
+		}
+
+		code.push_back(BEHAVIOR_USE);
+		code.push_back((uint8_t)(item - script->m_Items.begin()));
+		code.push_back(targeting);
+
+		if (code.size() > 0xFFFF)
+			return fail("script is too long");
+
+		for (auto iter = jumps.begin(); iter != jumps.end(); ++iter)
+		{
+			code[*iter] = code.size() & 0xFF;
+			code[*iter + 1] = code.size() >> 8;
+		}
+	}
+
+	code.push_back(BEHAVIOR_END);
+	return script;
+}
+
+/// <summary>Reads the text of a behavior script from BEHAVIOR_FOLDER.</summary>
+/// <returns>False if the file cannot be read.</returns>
+bool read_script(const string& name, string& source)
+{
+	ifstream file(BEHAVIOR_FOLDER + name + ".txt", ios::in | ios::binary);
+	if (!file)
+		return false;
+
+	stringstream text;
+	text << file.rdbuf();
+	source = text.str();
+	return true;
+}
+
+shared_ptr<const BehaviorScript> BehaviorScript::load(const string& name)
+{
+	string path = BEHAVIOR_FOLDER + name + ".txt";
+	string source;
+	if (!read_script(name, source))
+	{
+		cerr << "Cannot open behavior script \"" << path << "\"." << endl;
+		return nullptr;
+	}
+
+	string error;
+	shared_ptr<const BehaviorScript> script = compile(source, error);
+	if (!script)
+		cerr << "Error in behavior script \"" << path << "\", " << error << "." << endl;
+	return script;
+}
+
+uint64_t BehaviorScript::hash(const string& name)
+{
+	string source;
+	if (!read_script(name, source))
+		return FNV1A_OFFSET;
+	return data::fnv1a(FNV1A_OFFSET, source.data(), source.size());
+}
+
+const vector<uint8_t>& BehaviorScript::code() const
+{
+	return m_Code;
+}
+
+const vector<string>& BehaviorScript::items() const
+{
+	return m_Items;
+}
+
+
+/// <summary>Checks if an entity has a lower fraction of its Health left than another.</summary>
+template <class E>
+inline bool weaker(const E& lhs, const E& rhs)
+{
+	return (int64_t)lhs.cur_health * max(rhs.max_health, 1) < (int64_t)rhs.cur_health * max(lhs.max_health, 1);
+}
+
+/// <summary>Picks a single target.</summary>
+/// <param name="candidates">The entities that can be targeted. There must be at least one.</param>
+/// <param name="count">The number of entities.</param>
+/// <param name="targeting">How to pick the target.</param>
+/// <param name="random">A random number from 0 to count - 1, for picking at random.</param>
+/// <returns>The index of the target within the candidates.</returns>
+template <class E>
+int pick_target(const E* const* candidates, int count, int targeting, int random)
+{
+	if (targeting == BEHAVIOR_FIRST)
+		return 0;
+	if (targeting == BEHAVIOR_RANDOM)
+		return random;
+
+	int best = 0;
+	for (int k = 1; k < count; ++k)
+	{
+		if (targeting == BEHAVIOR_WEAKEST ? weaker(*candidates[k], *candidates[best]) : weaker(*candidates[best], *candidates[k]))
+			best = k;
+	}
+	return best;
+}
+
+/// <summary>Reads a stat of an entity for a condition.</summary>
+template <class E>
+int stat_value(const E& e, int stat, bool percent)
+{
+	switch (stat)
+	{
+	case BEHAVIOR_HEALTH:
+		return percent ? e.cur_health * 100 / max(e.max_health, 1) : e.cur_health;
+	case BEHAVIOR_SHIELD:
+		return percent ? e.cur_shield * 100 / max(e.max_shield, 1) : e.cur_shield;
+	case BEHAVIOR_BURN:
+		return e.burn;
+	case BEHAVIOR_TOXIN:
+		return e.toxin;
+	case BEHAVIOR_OFFENSE:
+		return e.cur_offense;
+	case BEHAVIOR_DEFENSE:
+		return e.cur_defense;
+	default:
+		return e.time;
+	}
+}
+
+/// <summary>Runs a behavior script. Works for both live and simulated entities, so that both behave the same.</summary>
+/// <param name="script">The script.</param>
+/// <param name="self">The entity taking its turn.</param>
+/// <param name="allies">The living entities on the same side, including the entity itself, in party order.</param>
+/// <param name="ally_count">The number of living allies.</param>
+/// <param name="opponents">The living entities on the other side, in party order.</param>
+/// <param name="opponent_count">The number of living opponents.</param>
+/// <param name="use">A function taking (item index, targeting), which tries to use the item and returns true if it could.</param>
+/// <returns>True if an item was used, false if no rule applied.</returns>
+template <class E, class F>
+bool run_script(const BehaviorScript& script, const E& self, const E* const* allies, int ally_count, const E* const* opponents, int opponent_count, F use)
+{
+	// Find the subjects of conditions
+	const E* ally = nullptr;
+	int ally_time = INT_MAX;
+	for (int k = 0; k < ally_count; ++k)
+	{
+		if (allies[k] == &self)
+			continue;
+		if (!ally || weaker(*allies[k], *ally))
+			ally = allies[k];
+		ally_time = min(ally_time, allies[k]->time);
+	}
+
+	const E* enemy = nullptr;
+	int enemy_time = INT_MAX;
+	for (int k = 0; k < opponent_count; ++k)
+	{
+		if (!enemy || weaker(*opponents[k], *enemy))
+			enemy = opponents[k];
+		enemy_time = min(enemy_time, opponents[k]->time);
+	}
+
+	const uint8_t* code = script.code().data();
+	size_t pc = 0;
+	while (true)
+	{
+		switch (code[pc])
+		{
+		case BEHAVIOR_TEST:
+		{
+			int subject = code[pc + 1], stat = code[pc + 2], compare = code[pc + 3];
+			bool percent = code[pc + 4] != 0;
+			int32_t value = read32(code + pc + 5);
+
+			bool pass = true;
+			int actual = 0;
+			if (subject == BEHAVIOR_ALLIES)
+				actual = ally_count - 1;
+			else if (subject == BEHAVIOR_ENEMIES)
+				actual = opponent_count;
+			else
+			{
+				// Conditions on entities that don't exist always fail
+				const E* e = subject == BEHAVIOR_SELF ? &self : (subject == BEHAVIOR_ALLY ? ally : enemy);
+				if (e)
+					actual = stat_value(*e, stat, percent);
+				else
+					pass = false;
+			}
+
+			if (pass)
+			{
+				switch (compare)
+				{
+				case BEHAVIOR_LESS: pass = actual < value; break;
+				case BEHAVIOR_LESS_EQUAL: pass = actual <= value; break;
+				case BEHAVIOR_GREATER: pass = actual > value; break;
+				case BEHAVIOR_GREATER_EQUAL: pass = actual >= value; break;
+				case BEHAVIOR_EQUAL: pass = actual == value; break;
+				default: pass = actual != value; break;
+				}
+			}
+
+			pc = pass ? pc + 11 : read16(code + pc + 9);
+			break;
+		}
+		case BEHAVIOR_TEST_NEXT:
+		{
+			bool pass = code[pc + 1] == BEHAVIOR_ENEMY ? enemy_time < ally_time : (ally_time <= enemy_time && ally_time != INT_MAX);
+			pc = pass ? pc + 4 : read16(code + pc + 2);
+			break;
+		}
+		case BEHAVIOR_USE:
+			if (use(code[pc + 1], code[pc + 2]))
+				return true;
+			pc += 3;
+			break;
+		default:
+			return false;
+		}
+	}
+}
+
+
+ScriptedAgent::ScriptedAgent(Entity* self, shared_ptr<const BehaviorScript> script) : Agent(self), m_Script(script)
+{
+	// Find the slot of each item the script uses, in the same order that snapshots capture usables in
+	const data::Registry& registry = data::get_registry();
+	const vector<string>& items = m_Script->items();
+	for (size_t k = 0; k < BEHAVIOR_MAX_ITEMS; ++k)
+	{
+		m_Slots[k] = -1;
+		if (k >= items.size())
+			continue;
+
+		const overworld::Item* item = registry.get_item(items[k]);
+		int slot = 0;
+		for (auto iter = m_Self->usables.begin(); iter != m_Self->usables.end() && item; ++iter)
+		{
+			if (!*iter)
+				continue;
+			if ((*iter)->item == item)
+			{
+				m_Slots[k] = slot;
+				break;
+			}
+			++slot;
+		}
+	}
+}
+
+void ScriptedAgent::decide(Turn& turn)
+{
+	turn.user = m_Self;
+	turn.usable = nullptr;
+	turn.targets.clear();
+
+	const vector<Entity*>& allies = m_Self->party->living;
+	const vector<Entity*>& opponents = m_Self->party->enemies->living;
+
+	bool used = run_script<Entity>(*m_Script, *m_Self, allies.data(), allies.size(), opponents.data(), opponents.size(),
+		[&](int item, int targeting)
+		{
+			if (m_Slots[item] < 0)
+				return false;
+
+			Usable* usable = nullptr;
+			int slot = m_Slots[item];
+			for (auto iter = m_Self->usables.begin(); iter != m_Self->usables.end() && !usable; ++iter)
+			{
+				if (*iter && slot-- == 0)
+					usable = *iter;
+			}
+
+			if (count_turns(m_Self, usable) == 0)
+				return false;
+
+			turn.usable = usable;
+			for (auto iter = usable->targets.begin(); iter != usable->targets.end(); ++iter)
+			{
+				if (iter->target == TARGET_RANDOM_ENEMY)
+				{
+					turn.targets.push_back(nth_target(m_Self, iter->target, rand() % count_targets(m_Self, iter->target)));
+				}
+				else if (iter->target == TARGET_SINGLE_ENEMY || iter->target == TARGET_SINGLE_ALLY)
+				{
+					const vector<Entity*>& candidates = iter->target == TARGET_SINGLE_ALLY ? allies : opponents;
+					int count = candidates.size();
+					turn.targets.push_back(candidates[pick_target<Entity>(candidates.data(), count, targeting, rand() % count)]);
+				}
+			}
+			return true;
+		}
+	);
+
+	if (!used)
+		sample_turn(m_Self, turn);
+}
+
+
+vector<shared_ptr<const BehaviorScript>> battle::enemy_scripts(size_t allies, const vector<string>& enemies)
+{
+	vector<shared_ptr<const BehaviorScript>> scripts;
+	const data::Registry& registry = data::get_registry();
+	for (size_t k = 0; k < enemies.size(); ++k)
+	{
+		const EnemyTemplate* enemy = registry.get_enemy(enemies[k]);
+		if (!enemy || !enemy->behavior)
+			continue;
+
+		// Only allocate for battles that have a script, so that the rest cost the same as acting at random
+		if (scripts.empty())
+			scripts.resize(allies + enemies.size());
+		scripts[allies + k] = enemy->behavior;
+	}
+	return scripts;
+}
+
+
+ScriptedPolicy::ScriptedPolicy(const vector<shared_ptr<const BehaviorScript>>& scripts, uint64_t seed) : m_Scripts(scripts), m_Items(scripts.size() * BEHAVIOR_MAX_ITEMS, nullptr), m_Random(seed)
+{
+	// Look up every item up front, so that running a script only needs the usable table
+	const data::Registry& registry = data::get_registry();
+	for (size_t k = 0; k < m_Scripts.size(); ++k)
+	{
+		if (!m_Scripts[k])
+			continue;
+
+		const vector<string>& items = m_Scripts[k]->items();
+		for (size_t item = 0; item < items.size(); ++item)
+			m_Items[k * BEHAVIOR_MAX_ITEMS + item] = registry.get_item(items[item]);
+	}
+}
+
+SimTurn ScriptedPolicy::choose(const BattleSnapshot& snapshot, int actor)
+{
+	SimTurn turn;
+	if (actor >= (int)m_Scripts.size() || !m_Scripts[actor])
+	{
+		sample_turn(snapshot, actor, m_Random, turn);
+		return turn;
+	}
+
+	const SimEntity* allies[256];
+	const SimEntity* opponents[256];
+	uint8_t ally_indices[256], opponent_indices[256];
+	int ally_count = 0, opponent_count = 0;
+
+	const SimEntity& self = snapshot[actor];
+	for (int k = 0; k < (int)snapshot.size(); ++k)
+	{
+		const SimEntity& e = snapshot[k];
+		if (!(e.flags & SIM_PRESENT) || e.cur_health <= 0)
+			continue;
+
+		if (e.side == self.side)
+		{
+			ally_indices[ally_count] = k;
+			allies[ally_count++] = &e;
+		}
+		else
+		{
+			opponent_indices[opponent_count] = k;
+			opponents[opponent_count++] = &e;
+		}
+	}
+
+	bool used = run_script<SimEntity>(*m_Scripts[actor], self, allies, ally_count, opponents, opponent_count,
+		[&](int item, int targeting)
+		{
+			uint16_t index = snapshot.usables().find(m_Items[actor * BEHAVIOR_MAX_ITEMS + item]);
+
+			int slot = 0;
+			while (slot < self.usable_count && self.usables[slot] != index)
+				++slot;
+
+			if (slot == self.usable_count || count_turns(snapshot, actor, slot) == 0)
+				return false;
+
+			turn.usable = slot;
+			turn.target_count = 0;
+
+			const SimUsable& usable = snapshot.usable(actor, slot);
+			for (int k = 0; k < usable.selection_count; ++k)
+			{
+				Target target = snapshot.usables().selection(usable, k).target;
+				if (target == TARGET_RANDOM_ENEMY)
+					turn.targets[turn.target_count++] = opponent_indices[m_Random.below(opponent_count)];
+				else if (target == TARGET_SINGLE_ENEMY)
+					turn.targets[turn.target_count++] = opponent_indices[pick_target<SimEntity>(opponents, opponent_count, targeting, m_Random.below(opponent_count))];
+				else if (target == TARGET_SINGLE_ALLY)
+					turn.targets[turn.target_count++] = ally_indices[pick_target<SimEntity>(allies, ally_count, targeting, m_Random.below(ally_count))];
+			}
+			return true;
+		}
+	);
+
+	if (!used)
+		sample_turn(snapshot, actor, m_Random, turn);
+	return turn;
+}
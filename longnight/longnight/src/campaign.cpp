@@ -0,0 +1,264 @@
+#include <algorithm>
+#include <fstream>
+#include "../include/campaign.h"
+#include "../include/behavior.h"
+#include "../include/datafile.h"
+#include "../include/gamedata.h"
+#include "../include/parallel.h"
+#include "../include/stats.h"
+#include "../include/sweep.h"
+
+using namespace std;
+using namespace battle;
+
+
+bool battle::load_campaign(const string& path, vector<CampaignEncounter>& encounters, string& error)
+{
+	data::DataFile file(path.c_str());
+	if (!file.good())
+	{
+		error = "Could not read \"" + path + "\"";
+		return false;
+	}
+
+	const data::Registry& registry = data::get_registry();
+	encounters.clear();
+	for (size_t k = 0; k < file.size(); ++k)
+	{
+		data::Record record = file[k];
+
+		CampaignEncounter encounter;
+		encounter.id = string(record.id);
+		encounter.enemies = data::split_list(record.get_string("enemies"));
+		encounter.heal = record.get_int("heal");
+		encounter.revive = record.get_int("revive");
+
+		for (auto id = encounter.enemies.begin(); id != encounter.enemies.end(); ++id)
+		{
+			if (!registry.get_enemy(*id))
+			{
+				error = "Unknown enemy \"" + *id + "\" in encounter \"" + encounter.id + "\"";
+				return false;
+			}
+		}
+
+		vector<string> loot = data::split_list(record.get_string("loot"));
+		for (auto id = loot.begin(); id != loot.end(); ++id)
+		{
+			const overworld::Item* item = registry.get_item(*id);
+			if (!item)
+			{
+				error = "Unknown item \"" + *id + "\" in encounter \"" + encounter.id + "\"";
+				return false;
+			}
+			encounter.loot.push_back(item);
+		}
+
+		encounters.push_back(move(encounter));
+	}
+
+	if (encounters.empty())
+	{
+		error = "\"" + path + "\" has no encounters";
+		return false;
+	}
+	return true;
+}
+
+
+void EncounterStats::merge(const EncounterStats& other)
+{
+	reached += other.reached;
+	won += other.won;
+	abandoned += other.abandoned;
+	turns += other.turns;
+
+	for (size_t k = 0; k < health.size() && k < other.health.size(); ++k)
+		health[k] += other.health[k];
+	for (size_t k = 0; k < standing.size() && k < other.standing.size(); ++k)
+		standing[k] += other.standing[k];
+	for (int k = 0; k < CAMPAIGN_HEALTH_BUCKETS; ++k)
+		party_health[k] += other.party_health[k];
+}
+
+
+CampaignSimulator::CampaignSimulator(const vector<overworld::Ally>& party, const vector<CampaignEncounter>& encounters, int max_turns, uint64_t seed)
+	: m_Party(party), m_Encounters(encounters), m_MaxTurns(max_turns), m_Seed(seed)
+{
+	// Add every usable now, so that the threads only ever read from the table
+	for (auto ally = m_Party.begin(); ally != m_Party.end(); ++ally)
+	{
+		for (auto item = ally->items.begin(); item != ally->items.end(); ++item)
+		{
+			if (*item)
+				m_Table.add(*item);
+		}
+	}
+
+	SimRandom random(0);
+	for (auto encounter = m_Encounters.begin(); encounter != m_Encounters.end(); ++encounter)
+	{
+		for (auto item = encounter->loot.begin(); item != encounter->loot.end(); ++item)
+			m_Table.add(*item);
+		BattleSnapshot::create(vector<overworld::Ally>(), encounter->enemies, m_Table, random);
+	}
+
+	m_Stats = empty_stats();
+}
+
+vector<EncounterStats> CampaignSimulator::empty_stats() const
+{
+	EncounterStats empty;
+	empty.health.resize(m_Party.size());
+	empty.standing.resize(m_Party.size() + 1);
+	return vector<EncounterStats>(m_Encounters.size() + 1, empty);
+}
+
+void CampaignSimulator::run_campaign(uint64_t campaign, vector<EncounterStats>& stats)
+{
+	vector<overworld::Ally> party = m_Party;
+
+	int64_t max_health = 0;
+	for (auto ally = party.begin(); ally != party.end(); ++ally)
+		max_health += ally->max_health;
+
+	for (size_t e = 0; e <= m_Encounters.size(); ++e)
+	{
+		// Count the state of the party as it reaches the encounter
+		EncounterStats& encounter_stats = stats[e];
+		int64_t health = 0;
+		size_t standing = 0;
+		for (size_t k = 0; k < party.size(); ++k)
+		{
+			encounter_stats.health[k] += party[k].cur_health;
+			health += party[k].cur_health;
+			standing += party[k].cur_health > 0;
+		}
+		++encounter_stats.reached;
+		++encounter_stats.standing[standing];
+		++encounter_stats.party_health[max_health > 0 ? health * (CAMPAIGN_HEALTH_BUCKETS - 1) / max_health : 0];
+
+		if (e == m_Encounters.size())
+			return;
+		const CampaignEncounter& encounter = m_Encounters[e];
+
+		// Fight the battle the same way a sweep does, and carry the party's Health out of it. Encounters without enemies are only rests.
+		if (!encounter.enemies.empty())
+		{
+			SimRandom random(battle_seed(m_Seed, e, campaign));
+			BattleSnapshot snapshot = BattleSnapshot::create(party, encounter.enemies, m_Table, random);
+			RandomPolicy side0(random.next());
+			ScriptedPolicy side1(enemy_scripts(party.size(), encounter.enemies), random.next());
+			int winner = simulate(snapshot, side0, side1, m_MaxTurns);
+
+			encounter_stats.turns += snapshot.turns();
+			snapshot.write_back(party);
+			if (winner != 0)
+			{
+				encounter_stats.abandoned += winner < 0;
+				return;
+			}
+		}
+		++encounter_stats.won;
+
+		// Rest, and pick up the loot
+		for (auto ally = party.begin(); ally != party.end(); ++ally)
+		{
+			if (ally->cur_health > 0)
+				ally->cur_health = min(ally->max_health, ally->cur_health + ally->max_health * encounter.heal / 100);
+			else if (encounter.revive > 0)
+				ally->cur_health = min(ally->max_health, max(1, ally->max_health * encounter.revive / 100));
+		}
+
+		for (auto item = encounter.loot.begin(); item != encounter.loot.end() && !party.empty(); ++item)
+		{
+			auto holder = min_element(party.begin(), party.end(), [](const overworld::Ally& lhs, const overworld::Ally& rhs) { return lhs.items.size() < rhs.items.size(); });
+			if (holder->items.size() < ALLY_MAX_ITEMS)
+				holder->items.push_back(*item);
+		}
+	}
+}
+
+void CampaignSimulator::run(uint64_t campaigns, unsigned int threads)
+{
+	threads = max(1u, threads);
+	vector<vector<EncounterStats>> workers(threads, empty_stats());
+
+	uint64_t first = m_Campaigns;
+	parallel_for(campaigns, threads, [&](unsigned int chunk, size_t begin, size_t end)
+		{
+			for (size_t k = begin; k < end; ++k)
+				run_campaign(first + k, workers[chunk]);
+		}
+	);
+
+	// Every count is a sum, so the totals don't depend on how the campaigns were split
+	for (auto worker = workers.begin(); worker != workers.end(); ++worker)
+	{
+		for (size_t e = 0; e < m_Stats.size(); ++e)
+			m_Stats[e].merge((*worker)[e]);
+	}
+	m_Campaigns += campaigns;
+}
+
+uint64_t CampaignSimulator::campaigns() const
+{
+	return m_Campaigns;
+}
+
+const vector<CampaignEncounter>& CampaignSimulator::encounters() const
+{
+	return m_Encounters;
+}
+
+const vector<EncounterStats>& CampaignSimulator::stats() const
+{
+	return m_Stats;
+}
+
+bool CampaignSimulator::write_csv(const string& path) const
+{
+	ofstream file(path, ios::out | ios::trunc);
+	if (!file)
+		return false;
+
+	file << "encounter,id,reached,reach_rate,won,win_rate,abandoned,mean_turns,mean_health,health_p10,health_p50,health_p90";
+	for (size_t k = 0; k < m_Party.size(); ++k)
+		file << ",ally_" << (k + 1) << "_health";
+	for (size_t k = 0; k <= m_Party.size(); ++k)
+		file << ",standing_" << k;
+	file << '\n';
+
+	int64_t max_health = 0;
+	for (auto ally = m_Party.begin(); ally != m_Party.end(); ++ally)
+		max_health += ally->max_health;
+
+	for (size_t e = 0; e < m_Stats.size(); ++e)
+	{
+		const EncounterStats& stats = m_Stats[e];
+		bool end = e == m_Encounters.size();
+		double reached = (double)max<uint64_t>(1, stats.reached);
+
+		uint64_t health = 0;
+		for (auto ally = stats.health.begin(); ally != stats.health.end(); ++ally)
+			health += *ally;
+
+		// The Health of the party is given as a fraction of its maximum, to the tenth for percentiles
+		StatHistogram party_health(stats.party_health, CAMPAIGN_HEALTH_BUCKETS);
+		file << (e + 1) << ',' << csv_field(end ? "end" : m_Encounters[e].id) << ',' << stats.reached << ',' << (m_Campaigns ? (double)stats.reached / m_Campaigns : 0.0) << ',';
+		if (end)
+			file << ",,,";
+		else
+			file << stats.won << ',' << (stats.won / reached) << ',' << stats.abandoned << ',' << (stats.turns / reached);
+		file << ',' << (max_health > 0 ? health / reached / max_health : 0.0);
+		file << ',' << (party_health.percentile(0.1) / (CAMPAIGN_HEALTH_BUCKETS - 1.0)) << ',' << (party_health.percentile(0.5) / (CAMPAIGN_HEALTH_BUCKETS - 1.0)) << ',' << (party_health.percentile(0.9) / (CAMPAIGN_HEALTH_BUCKETS - 1.0));
+
+		for (auto ally = stats.health.begin(); ally != stats.health.end(); ++ally)
+			file << ',' << (*ally / reached);
+		for (auto count = stats.standing.begin(); count != stats.standing.end(); ++count)
+			file << ',' << (*count / reached);
+		file << '\n';
+	}
+
+	return file.good();
+}
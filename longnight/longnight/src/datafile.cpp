@@ -0,0 +1,258 @@
+#include <fstream>
+#include "../include/datafile.h"
+#include "../include/parallel.h"
+
+using namespace std;
+using namespace data;
+
+
+inline bool is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline string_view trim(string_view text)
+{
+	size_t first = 0;
+	while (first < text.size() && is_space(text[first]))
+		++first;
+
+	size_t last = text.size();
+	while (last > first && is_space(text[last - 1]))
+		--last;
+
+	return text.substr(first, last - first);
+}
+
+
+string_view Record::get_string(string_view key) const
+{
+	for (size_t k = 0; k < count; ++k)
+	{
+		if (fields[k].key == key)
+			return fields[k].value;
+	}
+	return string_view();
+}
+
+int Record::get_int(string_view key) const
+{
+	return parse_int(get_string(key));
+}
+
+/// <summary>Adds the length and then the bytes of some text to a hash, so that moving bytes from one field to the next changes it.</summary>
+uint64_t hash_text(uint64_t hash, string_view text)
+{
+	// The length is added a byte at a time, least significant first, so the hash does not depend on the byte order of the machine
+	uint8_t length[8];
+	for (int k = 0; k < 8; ++k)
+		length[k] = (uint8_t)((uint64_t)text.size() >> (8 * k));
+
+	return fnv1a(fnv1a(hash, length, sizeof(length)), text.data(), text.size());
+}
+
+uint64_t Record::hash() const
+{
+	uint64_t h = hash_text(FNV1A_OFFSET, id);
+	for (size_t k = 0; k < count; ++k)
+	{
+		h = hash_text(h, fields[k].key);
+		h = hash_text(h, fields[k].value);
+	}
+	return h;
+}
+
+
+vector<string> data::split_list(string_view list)
+{
+	vector<string> entries;
+	size_t start = 0;
+	while (start <= list.size())
+	{
+		size_t comma = list.find(',', start);
+		if (comma == string_view::npos)
+			comma = list.size();
+
+		size_t first = list.find_first_not_of(" \t", start);
+		if (first != string_view::npos && first < comma)
+			entries.emplace_back(list.substr(first, list.find_last_not_of(" \t", comma - 1) + 1 - first));
+
+		start = comma + 1;
+	}
+	return entries;
+}
+
+uint64_t data::fnv1a(uint64_t hash, const void* data, size_t size)
+{
+	for (size_t k = 0; k < size; ++k)
+		hash = (hash ^ ((const uint8_t*)data)[k]) * 0x100000001B3ull;
+	return hash;
+}
+
+
+int data::parse_int(string_view text)
+{
+	size_t k = 0;
+	while (k < text.size() && is_space(text[k]))
+		++k;
+
+	bool negative = false;
+	if (k < text.size() && (text[k] == '-' || text[k] == '+'))
+		negative = text[k++] == '-';
+
+	int value = 0;
+	for (; k < text.size() && text[k] >= '0' && text[k] <= '9'; ++k)
+		value = (10 * value) + (text[k] - '0');
+
+	return negative ? -value : value;
+}
+
+
+DataFile::DataFile(const char* path, unsigned int threads)
+{
+	// Read the whole file into one buffer
+	ifstream file(path, ios::in | ios::binary);
+	if (!file)
+		return;
+
+	file.seekg(0, ios::end);
+	m_Buffer.resize(file.tellg());
+	file.seekg(0, ios::beg);
+	file.read(&m_Buffer[0], m_Buffer.size());
+
+	string_view buffer(m_Buffer);
+
+	// Split the buffer into shards that each start at the beginning of a line
+	if (threads == 0)
+		threads = worker_count();
+	size_t count = min<size_t>(threads, max<size_t>(1, buffer.size() / DATAFILE_MIN_SHARD_SIZE));
+
+	vector<size_t> bounds(count + 1, buffer.size());
+	bounds[0] = 0;
+	for (size_t k = 1; k < count; ++k)
+	{
+		size_t nl = buffer.find('\n', max(bounds[k - 1], buffer.size() * k / count));
+		bounds[k] = nl == string_view::npos ? buffer.size() : nl + 1;
+	}
+
+	if (count == 1)
+	{
+		tokenize(buffer, m_Fields, m_Records);
+		return;
+	}
+
+	// Tokenize the shards concurrently
+	vector<vector<Field>> fields(count);
+	vector<vector<pair<string_view, size_t>>> records(count);
+
+	parallel_for(count, count,
+		[&](unsigned int, size_t first, size_t last)
+		{
+			for (size_t k = first; k < last; ++k)
+				tokenize(buffer.substr(bounds[k], bounds[k + 1] - bounds[k]), fields[k], records[k]);
+		}
+	);
+
+	// Merge the shards in file order
+	size_t field_count = 0, record_count = 0;
+	for (size_t k = 0; k < count; ++k)
+	{
+		field_count += fields[k].size();
+		record_count += records[k].size();
+	}
+	m_Fields.reserve(field_count);
+	m_Records.reserve(record_count);
+
+	for (size_t k = 0; k < count; ++k)
+	{
+		size_t offset = m_Fields.size();
+		for (auto iter = records[k].begin(); iter != records[k].end(); ++iter)
+			m_Records.emplace_back(iter->first, iter->second + offset);
+
+		m_Fields.insert(m_Fields.end(), fields[k].begin(), fields[k].end());
+	}
+}
+
+void DataFile::tokenize(string_view text, vector<Field>& fields, vector<pair<string_view, size_t>>& records)
+{
+	size_t start = 0;
+	while (start < text.size())
+	{
+		size_t end = text.find('\n', start);
+		if (end == string_view::npos)
+			end = text.size();
+
+		tokenize_line(text.substr(start, end - start), fields, records);
+		start = end + 1;
+	}
+}
+
+void DataFile::tokenize_line(string_view line, vector<Field>& fields, vector<pair<string_view, size_t>>& records)
+{
+	line = trim(line);
+	if (line.empty())
+		return;
+
+	size_t first_field = fields.size();
+
+	// The ID is everything before the first key
+	size_t eq = line.find('=');
+	size_t key_end = eq == string_view::npos ? line.size() : eq;
+	while (key_end > 0 && is_space(line[key_end - 1]))
+		--key_end;
+	size_t key_start = key_end;
+	while (key_start > 0 && !is_space(line[key_start - 1]))
+		--key_start;
+
+	records.emplace_back(trim(line.substr(0, eq == string_view::npos ? line.size() : key_start)), first_field);
+
+	// Read each key="value" pair
+	while (eq != string_view::npos)
+	{
+		Field field;
+		field.key = line.substr(key_start, key_end - key_start);
+
+		size_t open = line.find('"', eq + 1);
+		if (open == string_view::npos)
+			break;
+		size_t close = line.find('"', open + 1);
+		if (close == string_view::npos)
+			close = line.size();
+
+		field.value = line.substr(open + 1, close - open - 1);
+		fields.push_back(field);
+
+		if (close >= line.size())
+			break;
+
+		// Find the next key
+		eq = line.find('=', close + 1);
+		if (eq != string_view::npos)
+		{
+			key_start = close + 1;
+			while (key_start < eq && is_space(line[key_start]))
+				++key_start;
+			key_end = eq;
+			while (key_end > key_start && is_space(line[key_end - 1]))
+				--key_end;
+		}
+	}
+}
+
+bool DataFile::good() const
+{
+	return !m_Buffer.empty();
+}
+
+size_t DataFile::size() const
+{
+	return m_Records.size();
+}
+
+Record DataFile::operator[](size_t index) const
+{
+	size_t first = m_Records[index].second;
+	size_t last = index + 1 < m_Records.size() ? m_Records[index + 1].second : m_Fields.size();
+
+	return Record{ m_Records[index].first, m_Fields.data() + first, last - first };
+}
@@ -0,0 +1,257 @@
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <iostream>
+#include <unordered_set>
+#include "../include/gamedata.h"
+#include "../include/parallel.h"
+#include "../include/ui.h"
+
+using namespace std;
+using namespace onion;
+using namespace data;
+
+
+// The published registry, or nullptr if it has not been loaded yet.
+atomic<const Registry*> g_Registry{ nullptr };
+
+// The published registry, for attaching graphics and hot reloading, which change it in place on the main thread.
+Registry* g_MutableRegistry = nullptr;
+
+once_flag g_RegistryLoaded;
+
+
+// The sprite sheet for item icons, or nullptr if graphics have not been attached.
+SpriteSheet* g_ItemSprites = nullptr;
+
+once_flag g_GraphicsAttached;
+
+/// <summary>Creates the icon for an item.</summary>
+/// <param name="item">The item.</param>
+void attach_icon(overworld::Item* item)
+{
+	item->icon = new StaticSpriteGraphic(g_ItemSprites, Sprite::get_sprite("item " + item->icon_name), get_clear_palette());
+}
+
+
+void Registry::load_items(const char* path, unsigned int threads)
+{
+	DataFile file(path, threads);
+
+	// Parse the records in parallel
+	vector<overworld::Item*> items(file.size(), nullptr);
+	parallel_for(file.size(), threads,
+		[&](unsigned int, size_t first, size_t last)
+		{
+			for (size_t k = first; k < last; ++k)
+				items[k] = overworld::Item::parse(file[k]);
+		}
+	);
+
+	// Set the data for each ID in file order, so the first record with an ID takes precedence
+	m_Items.reserve(items.size());
+	for (size_t k = 0; k < items.size(); ++k)
+	{
+		if (items[k] && !m_Items.emplace(string(file[k].id), items[k]).second)
+			delete items[k];
+	}
+}
+
+void Registry::load_enemies(const char* path, unsigned int threads)
+{
+	DataFile file(path, threads);
+
+	// Parse the records in parallel
+	vector<battle::EnemyTemplate> enemies(file.size());
+	parallel_for(file.size(), threads,
+		[&](unsigned int, size_t first, size_t last)
+		{
+			for (size_t k = first; k < last; ++k)
+				enemies[k].load(file[k]);
+		}
+	);
+
+	// Set the data for each ID in file order, so the first record with an ID takes precedence
+	m_Enemies.reserve(enemies.size());
+	for (size_t k = 0; k < enemies.size(); ++k)
+		m_Enemies.emplace(string(file[k].id), move(enemies[k]));
+}
+
+void Registry::load(const char* items, const char* enemies, unsigned int threads)
+{
+	// Load the enemies alongside the items
+	thread enemy_loader(&Registry::load_enemies, this, enemies, threads);
+	load_items(items, threads);
+	enemy_loader.join();
+}
+
+const overworld::Item* Registry::get_item(const string& id) const
+{
+	auto iter = m_Items.find(id);
+	return iter == m_Items.end() ? nullptr : iter->second;
+}
+
+const battle::EnemyTemplate* Registry::get_enemy(const string& id) const
+{
+	auto iter = m_Enemies.find(id);
+	return iter == m_Enemies.end() ? nullptr : &iter->second;
+}
+
+const unordered_map<string, overworld::Item*>& Registry::items() const
+{
+	return m_Items;
+}
+
+const unordered_map<string, battle::EnemyTemplate>& Registry::enemies() const
+{
+	return m_Enemies;
+}
+
+
+double data::time_registry_load(const char* items, const char* enemies, unsigned int threads, size_t& records)
+{
+	Registry registry;
+
+	auto start = chrono::steady_clock::now();
+	registry.load(items, enemies, threads);
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	records = registry.m_Items.size() + registry.m_Enemies.size();
+	for (auto iter = registry.m_Items.begin(); iter != registry.m_Items.end(); ++iter)
+		delete iter->second;
+	return seconds;
+}
+
+void data::load_registry()
+{
+	call_once(g_RegistryLoaded,
+		[]()
+		{
+			Registry* registry = new Registry();
+			registry->load("res/data/items.txt", "res/data/enemies.txt", worker_count());
+
+			g_MutableRegistry = registry;
+			g_Registry.store(registry, memory_order_release);
+		}
+	);
+}
+
+const Registry& data::get_registry()
+{
+	const Registry* registry = g_Registry.load(memory_order_acquire);
+	if (!registry)
+	{
+		load_registry();
+		registry = g_Registry.load(memory_order_acquire);
+	}
+	return *registry;
+}
+
+void data::attach_graphics()
+{
+	load_registry();
+
+	call_once(g_GraphicsAttached,
+		[]()
+		{
+			// Load item sprites
+			g_ItemSprites = SpriteSheet::generate("sprites/items.png");
+
+			for (auto iter = g_MutableRegistry->m_Items.begin(); iter != g_MutableRegistry->m_Items.end(); ++iter)
+				attach_icon(iter->second);
+		}
+	);
+}
+
+void data::reload_items()
+{
+	load_registry();
+
+	DataFile file("res/data/items.txt");
+	if (!file.good())
+		return;
+
+	unordered_map<string, overworld::Item*>& items = g_MutableRegistry->m_Items;
+
+	unordered_set<string_view> seen;
+	for (size_t k = 0; k < file.size(); ++k)
+	{
+		Record data = file[k];
+
+		// Only the first record with an ID is used
+		if (!seen.insert(data.id).second)
+			continue;
+
+		string id(data.id);
+		auto iter = items.find(id);
+		if (iter == items.end())
+		{
+			// Add new items
+			if (overworld::Item* item = overworld::Item::parse(data))
+			{
+				if (g_ItemSprites)
+					attach_icon(item);
+
+				items.emplace(id, item);
+			}
+			continue;
+		}
+
+		overworld::Item* item = iter->second;
+		uint64_t checksum = data.hash();
+		if (item->checksum == checksum)
+			continue;
+
+		// Existing items keep their address, so they can only be patched if their type is unchanged
+		string_view type = data.get_string("type");
+		if ((type == "offense" && !dynamic_cast<overworld::OffenseItem*>(item)) || (type == "support" && !dynamic_cast<overworld::SupportItem*>(item)) || (type != "offense" && type != "support"))
+		{
+			cerr << "Cannot reload item \"" << id << "\" because its type changed." << endl;
+			continue;
+		}
+
+		Graphic* old_icon = nullptr;
+		string old_icon_name = item->icon_name;
+
+		item->load(data);
+		item->checksum = checksum;
+
+		if (g_ItemSprites && item->icon_name != old_icon_name)
+		{
+			old_icon = item->icon;
+			attach_icon(item);
+		}
+
+		// Update the usables that have already been generated from the item
+		battle::refresh_usables(item);
+
+		delete old_icon;
+	}
+}
+
+void data::reload_enemies()
+{
+	load_registry();
+
+	DataFile file("res/data/enemies.txt");
+	if (!file.good())
+		return;
+
+	unordered_map<string, battle::EnemyTemplate>& enemies = g_MutableRegistry->m_Enemies;
+
+	unordered_set<string_view> seen;
+	for (size_t k = 0; k < file.size(); ++k)
+	{
+		Record data = file[k];
+
+		// Only the first record with an ID is used
+		if (!seen.insert(data.id).second)
+			continue;
+
+		// Patch changed templates in place, and add new ones
+		battle::EnemyTemplate& enemy = enemies[string(data.id)];
+		if (enemy.checksum != battle::EnemyTemplate::hash(data))
+			enemy.load(data);
+	}
+}
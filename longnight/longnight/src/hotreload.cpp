@@ -0,0 +1,131 @@
+#include "../include/hotreload.h"
+#include "../include/gamedata.h"
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#else
+#include <algorithm>
+#include <filesystem>
+#endif
+
+using namespace std;
+using namespace data;
+
+
+#ifdef __linux__
+
+DataWatcher::DataWatcher(const char* directory)
+{
+	m_Inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	m_Behaviors = -1;
+
+	// Editors either write the file in place or replace it with a renamed copy
+	if (m_Inotify >= 0 && inotify_add_watch(m_Inotify, directory, IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+	{
+		close(m_Inotify);
+		m_Inotify = -1;
+	}
+
+	// Behavior scripts are part of the enemies, but a game without any still reloads the data files
+	if (m_Inotify >= 0)
+		m_Behaviors = inotify_add_watch(m_Inotify, (string(directory) + "/behaviors").c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+}
+
+DataWatcher::~DataWatcher()
+{
+	if (m_Inotify >= 0)
+		close(m_Inotify);
+}
+
+void DataWatcher::__update(int frames_passed)
+{
+	if (m_Inotify < 0)
+		return;
+
+	bool items = false, enemies = false;
+
+	// Drain all pending events without blocking
+	alignas(inotify_event) char buffer[4096];
+	ssize_t length;
+	while ((length = read(m_Inotify, buffer, sizeof(buffer))) > 0)
+	{
+		for (char* ptr = buffer; ptr < buffer + length; )
+		{
+			const inotify_event* event = (const inotify_event*)ptr;
+			if (event->len > 0)
+			{
+				string name(event->name);
+				if (event->wd == m_Behaviors)
+					enemies = true;
+				else if (name == "items.txt")
+					items = true;
+				else if (name == "enemies.txt")
+					enemies = true;
+			}
+
+			ptr += sizeof(inotify_event) + event->len;
+		}
+	}
+
+	if (items)
+		reload_items();
+	if (enemies)
+		reload_enemies();
+}
+
+#else
+
+long long get_write_time(const filesystem::path& path)
+{
+	error_code error;
+	auto time = filesystem::last_write_time(path, error);
+	return error ? 0 : (long long)time.time_since_epoch().count();
+}
+
+/// <summary>Finds the last time that any file in a folder was written to, or 0 if the folder cannot be read.</summary>
+long long get_folder_time(const filesystem::path& path)
+{
+	error_code error;
+	long long latest = 0;
+	for (filesystem::directory_iterator iter(path, error), end; !error && iter != end; iter.increment(error))
+		latest = max(latest, get_write_time(iter->path()));
+	return latest;
+}
+
+DataWatcher::DataWatcher(const char* directory) : m_Directory(directory)
+{
+	m_Countdown = 0;
+	m_ItemsTime = get_write_time(m_Directory + "/items.txt");
+	m_EnemiesTime = get_write_time(m_Directory + "/enemies.txt");
+	m_BehaviorsTime = get_folder_time(m_Directory + "/behaviors");
+}
+
+DataWatcher::~DataWatcher() {}
+
+void DataWatcher::__update(int frames_passed)
+{
+	// Poll the files about once per second
+	m_Countdown -= frames_passed;
+	if (m_Countdown > 0)
+		return;
+	m_Countdown = onion::UpdateEvent::frames_per_second;
+
+	long long items = get_write_time(m_Directory + "/items.txt");
+	if (items != m_ItemsTime)
+	{
+		m_ItemsTime = items;
+		reload_items();
+	}
+
+	long long enemies = get_write_time(m_Directory + "/enemies.txt");
+	long long behaviors = get_folder_time(m_Directory + "/behaviors");
+	if (enemies != m_EnemiesTime || behaviors != m_BehaviorsTime)
+	{
+		m_EnemiesTime = enemies;
+		m_BehaviorsTime = behaviors;
+		reload_enemies();
+	}
+}
+
+#endif
@@ -1,78 +1,35 @@
-#include "../include/ui.h"
 #include "../include/item.h"
+#include "../include/gamedata.h"
 
 using namespace std;
-using namespace onion;
 using namespace overworld;
 
-unordered_map<string, Item*> Item::m_Items{};
-
-SpriteSheet* Item::m_SpriteSheet{ nullptr };
-
-string get_string_from_key(const unordered_map<string, string>& d, string key)
+Item* Item::parse(const data::Record& data)
 {
-	auto iter = d.find(key);
-	return iter == d.end() ? "" : iter->second;
-}
+	Item* item = nullptr;
 
-int get_int_from_key(const unordered_map<string, string>& d, string key)
-{
-	string v = get_string_from_key(d, key);
-	return v.empty() ? 0 : stoi(v);
-}
-
-Item* Item::get_item(string id)
-{
-	if (!m_SpriteSheet)
+	// Base the item on what type it is
+	string_view type = data.get_string("type");
+	if (type == "offense")
 	{
-		// Load item sprites
-		m_SpriteSheet = SpriteSheet::generate("sprites/items.png");
+		// Load a weapon
+		item = new OffenseItem(data);
 	}
-
-	if (m_Items.empty())
+	else if (type == "support")
 	{
-		// Load items
-		LoadFile file("res/data/items.txt");
-
-		while (file.good())
-		{
-			unordered_map<string, string> data;
-			string data_id = file.load_data(data);
-
-			Item* item = nullptr;
-
-			// Base the item on what type it is
-			string type = get_string_from_key(data, "type");
-			if (type.compare("offense") == 0)
-			{
-				// Load a weapon
-				item = new OffenseItem(data);
-			}
-			else if (type.compare("support") == 0)
-			{
-				// Load a support item
-				item = new SupportItem(data);
-			}
-
-			if (item)
-			{
-				// Load the speed
-				item->speed = get_int_from_key(data, "speed");
-
-				// Load the item sprite
-				item->icon = new StaticSpriteGraphic(m_SpriteSheet, Sprite::get_sprite("item " + get_string_from_key(data, "icon")), get_clear_palette());
-
-				// Set the data for the given ID
-				m_Items.emplace(data_id, item);
-			}
-		}
+		// Load a support item
+		item = new SupportItem(data);
 	}
 
-	// Find the specific item
-	auto iter = m_Items.find(id);
-	if (iter != m_Items.end())
-		return iter->second;
-	return nullptr;
+	if (item)
+		item->checksum = data.hash();
+
+	return item;
+}
+
+const Item* Item::get_item(string id)
+{
+	return data::get_registry().get_item(id);
 }
 
 Item::~Item()
@@ -80,29 +37,47 @@ Item::~Item()
 	delete icon;
 }
 
+void Item::load(const data::Record& data)
+{
+	// Load the speed
+	speed = data.get_int("speed");
+
+	// Load the name of the item sprite
+	icon_name = data.get_string("icon");
+}
+
 
 using namespace battle;
 
-OffenseItem::OffenseItem(const std::unordered_map<std::string, std::string>& data)
+OffenseItem::OffenseItem(const data::Record& data)
+{
+	load(data);
+}
+
+void OffenseItem::load(const data::Record& data)
 {
-	string t = get_string_from_key(data, "target");
-	if (t.compare("all") == 0)
+	Item::load(data);
+
+	string_view t = data.get_string("target");
+	if (t == "all")
 		target = OffenseItem::ALL;
-	else if (t.compare("random") == 0)
+	else if (t == "random")
 		target = OffenseItem::RANDOM;
 	else
 		target = OffenseItem::SINGLE;
 
-	damage = get_int_from_key(data, "damage");
+	damage = data.get_int("damage");
+
+	offense = data.get_int("offense");
+	defense = data.get_int("defense");
 
-	offense = get_int_from_key(data, "offense");
-	defense = get_int_from_key(data, "defense");
+	burn = data.get_int("burn");
+	toxin = data.get_int("toxin");
 
-	burn = get_int_from_key(data, "burn");
-	toxin = get_int_from_key(data, "toxin");
+	stun = data.get_int("stun");
 }
 
-Usable* OffenseItem::generate()
+Usable* OffenseItem::generate() const
 {
 	vector<Effect*> effects;
 	
@@ -122,28 +97,37 @@ Usable* OffenseItem::generate()
 	if (stun > 0)
 		effects.push_back(new InflictStatusEffect(TIME_STATUS, stun));
 
-	return new Usable(icon, nullptr, target == ALL ? TARGET_ALL_ENEMIES : (target == RANDOM ? TARGET_RANDOM_ENEMY : TARGET_SINGLE_ENEMY), effects, speed);
+	Usable* usable = new Usable(icon, nullptr, target == ALL ? TARGET_ALL_ENEMIES : (target == RANDOM ? TARGET_RANDOM_ENEMY : TARGET_SINGLE_ENEMY), effects, speed);
+	usable->item = this;
+	return usable;
 }
 
 
-SupportItem::SupportItem(const std::unordered_map<std::string, std::string>& data)
+SupportItem::SupportItem(const data::Record& data)
+{
+	load(data);
+}
+
+void SupportItem::load(const data::Record& data)
 {
-	string t = get_string_from_key(data, "target");
-	if (t.compare("all") == 0)
+	Item::load(data);
+
+	string_view t = data.get_string("target");
+	if (t == "all")
 		target = SupportItem::ALL;
-	else if (t.compare("self") == 0)
+	else if (t == "self")
 		target = SupportItem::SELF;
 	else
 		target = SupportItem::SINGLE;
 
-	health = get_int_from_key(data, "health");
-	shield = get_int_from_key(data, "shield");
+	health = data.get_int("health");
+	shield = data.get_int("shield");
 
-	offense = get_int_from_key(data, "offense");
-	defense = get_int_from_key(data, "defense");
+	offense = data.get_int("offense");
+	defense = data.get_int("defense");
 }
 
-Usable* SupportItem::generate()
+Usable* SupportItem::generate() const
 {
 	vector<Effect*> effects;
 
@@ -157,5 +141,7 @@ Usable* SupportItem::generate()
 	if (defense > 0)
 		effects.push_back(new InflictStatusEffect(DEFENSE_STATUS, defense));
 
-	return new Usable(icon, nullptr, target == ALL ? TARGET_ALL_ALLIES : (target == SELF ? TARGET_SELF : TARGET_SINGLE_ALLY), effects, speed);
+	Usable* usable = new Usable(icon, nullptr, target == ALL ? TARGET_ALL_ALLIES : (target == SELF ? TARGET_SELF : TARGET_SINGLE_ALLY), effects, speed);
+	usable->item = this;
+	return usable;
 }
\ No newline at end of file
@@ -0,0 +1,292 @@
+#include "../include/legalturn.h"
+
+using namespace std;
+using namespace battle;
+
+
+/// <summary>Checks if a selection needs a single target.</summary>
+inline bool is_single(Target target)
+{
+	return target == TARGET_SINGLE_ENEMY || target == TARGET_SINGLE_ALLY || target == TARGET_RANDOM_ENEMY;
+}
+
+
+int battle::count_targets(const Entity* user, Target target)
+{
+	if (!is_single(target))
+		return 1;
+
+	return target == TARGET_SINGLE_ALLY ? user->party->alive_count() : user->party->enemies->alive_count();
+}
+
+Entity* battle::nth_target(const Entity* user, Target target, int n)
+{
+	const vector<Entity*>& living = target == TARGET_SINGLE_ALLY ? user->party->living : user->party->enemies->living;
+	return n >= 0 && (size_t)n < living.size() ? living[n] : nullptr;
+}
+
+int battle::count_turns(const Entity* user, const Usable* usable)
+{
+	if (!usable)
+		return 0;
+
+	int count = 1, target_count = 0;
+	for (auto iter = usable->targets.begin(); iter != usable->targets.end(); ++iter)
+	{
+		if (is_single(iter->target))
+		{
+			// Usables that need more targets than a turn can hold are never legal
+			if (++target_count > MAX_TURN_TARGETS)
+				return 0;
+
+			int n = count_targets(user, iter->target);
+			count *= iter->target == TARGET_RANDOM_ENEMY ? min(n, 1) : n;
+		}
+	}
+	return count;
+}
+
+int battle::legal_turns(const Entity* user, LegalTurn* turns, int capacity)
+{
+	int count = 0;
+	for (auto iter = user->usables.begin(); iter != user->usables.end() && count < capacity; ++iter)
+	{
+		if (count_turns(user, *iter) == 0)
+			continue;
+
+		// Find the choices for each single target
+		Target targets[MAX_TURN_TARGETS];
+		int choices[MAX_TURN_TARGETS];
+		int target_count = 0;
+		for (auto target_iter = (*iter)->targets.begin(); target_iter != (*iter)->targets.end(); ++target_iter)
+		{
+			if (is_single(target_iter->target))
+			{
+				targets[target_count] = target_iter->target;
+				choices[target_count++] = target_iter->target == TARGET_RANDOM_ENEMY ? 1 : count_targets(user, target_iter->target);
+			}
+		}
+
+		// Go through every combination of targets
+		int index[MAX_TURN_TARGETS] = {};
+		while (count < capacity)
+		{
+			LegalTurn& turn = turns[count++];
+			turn.usable = *iter;
+			turn.target_count = target_count;
+			for (int k = 0; k < target_count; ++k)
+				turn.targets[k] = targets[k] == TARGET_RANDOM_ENEMY ? nullptr : nth_target(user, targets[k], index[k]);
+
+			int k = target_count - 1;
+			while (k >= 0 && ++index[k] == choices[k])
+				index[k--] = 0;
+			if (k < 0)
+				break;
+		}
+	}
+	return count;
+}
+
+bool battle::sample_turn(Entity* user, Turn& turn)
+{
+	turn.user = user;
+	turn.usable = nullptr;
+	turn.targets.clear();
+
+	int total = 0;
+	for (auto iter = user->usables.begin(); iter != user->usables.end(); ++iter)
+		total += count_turns(user, *iter);
+
+	if (total == 0)
+		return false;
+
+	// Find the usable that the chosen turn belongs to
+	int n = rand() % total;
+	for (auto iter = user->usables.begin(); iter != user->usables.end() && !turn.usable; ++iter)
+	{
+		int count = count_turns(user, *iter);
+		if (n < count)
+			turn.usable = *iter;
+		else
+			n -= count;
+	}
+
+	// Decode the targets from the rest of the index, picking random targets as well
+	for (auto iter = turn.usable->targets.begin(); iter != turn.usable->targets.end(); ++iter)
+	{
+		if (iter->target == TARGET_RANDOM_ENEMY)
+		{
+			turn.targets.push_back(nth_target(user, iter->target, rand() % count_targets(user, iter->target)));
+		}
+		else if (is_single(iter->target))
+		{
+			int choices = count_targets(user, iter->target);
+			turn.targets.push_back(nth_target(user, iter->target, n % choices));
+			n /= choices;
+		}
+	}
+
+	return true;
+}
+
+
+
+/// <summary>Counts the entities that can be chosen for a single-target selection in a simulated battle, and optionally lists them.</summary>
+/// <param name="snapshot">The battle.</param>
+/// <param name="actor">The index of the entity taking its turn.</param>
+/// <param name="target">The kind of selection.</param>
+/// <param name="targets">If not nullptr, filled with the indices of the entities.</param>
+/// <returns>The number of entities that can be chosen.</returns>
+int find_targets(const BattleSnapshot& snapshot, int actor, Target target, uint8_t* targets)
+{
+	int side = snapshot[actor].side;
+	bool allies = target == TARGET_SINGLE_ALLY;
+
+	int count = 0;
+	for (int k = 0; k < (int)snapshot.size(); ++k)
+	{
+		const SimEntity& e = snapshot[k];
+		if ((e.flags & SIM_PRESENT) && e.cur_health > 0 && (e.side == side) == allies)
+		{
+			if (targets)
+				targets[count] = k;
+			++count;
+		}
+	}
+	return count;
+}
+
+/// <summary>Counts the legal turns for a usable in a simulated battle, given how many entities can be targeted.</summary>
+/// <param name="snapshot">The battle.</param>
+/// <param name="usable">The usable.</param>
+/// <param name="ally_count">The number of allies that can be targeted.</param>
+/// <param name="enemy_count">The number of enemies that can be targeted.</param>
+/// <returns>The number of different combinations of targets that can be chosen.</returns>
+int count_turns(const BattleSnapshot& snapshot, const SimUsable& usable, int ally_count, int enemy_count)
+{
+	if (usable.single_targets > SIM_MAX_TARGETS)
+		return 0;
+
+	int count = 1;
+	for (int k = 0; k < usable.selection_count; ++k)
+	{
+		Target target = snapshot.usables().selection(usable, k).target;
+		if (target == TARGET_SINGLE_ENEMY)
+			count *= enemy_count;
+		else if (target == TARGET_SINGLE_ALLY)
+			count *= ally_count;
+		else if (target == TARGET_RANDOM_ENEMY)
+			count *= min(enemy_count, 1);
+	}
+	return count;
+}
+
+int battle::count_turns(const BattleSnapshot& snapshot, int actor, int slot)
+{
+	return ::count_turns(snapshot, snapshot.usable(actor, slot), find_targets(snapshot, actor, TARGET_SINGLE_ALLY, nullptr), find_targets(snapshot, actor, TARGET_SINGLE_ENEMY, nullptr));
+}
+
+int battle::legal_turns(const BattleSnapshot& snapshot, int actor, SimTurn* turns, int capacity)
+{
+	uint8_t allies[256], enemies[256];
+	int ally_count = find_targets(snapshot, actor, TARGET_SINGLE_ALLY, allies);
+	int enemy_count = find_targets(snapshot, actor, TARGET_SINGLE_ENEMY, enemies);
+
+	int count = 0;
+	for (int slot = 0; slot < snapshot[actor].usable_count && count < capacity; ++slot)
+	{
+		const SimUsable& usable = snapshot.usable(actor, slot);
+		if (::count_turns(snapshot, usable, ally_count, enemy_count) == 0)
+			continue;
+
+		// Find the choices for each single target
+		const uint8_t* choices[SIM_MAX_TARGETS];
+		int choice_counts[SIM_MAX_TARGETS];
+		int target_count = 0;
+		for (int k = 0; k < usable.selection_count; ++k)
+		{
+			Target target = snapshot.usables().selection(usable, k).target;
+			if (target == TARGET_SINGLE_ENEMY)
+			{
+				choices[target_count] = enemies;
+				choice_counts[target_count++] = enemy_count;
+			}
+			else if (target == TARGET_SINGLE_ALLY)
+			{
+				choices[target_count] = allies;
+				choice_counts[target_count++] = ally_count;
+			}
+			else if (target == TARGET_RANDOM_ENEMY)
+			{
+				choices[target_count] = nullptr;
+				choice_counts[target_count++] = 1;
+			}
+		}
+
+		// Go through every combination of targets
+		int index[SIM_MAX_TARGETS] = {};
+		while (count < capacity)
+		{
+			SimTurn& turn = turns[count++];
+			turn.usable = slot;
+			turn.target_count = target_count;
+			for (int k = 0; k < target_count; ++k)
+				turn.targets[k] = choices[k] ? choices[k][index[k]] : 0xFF;
+
+			int k = target_count - 1;
+			while (k >= 0 && ++index[k] == choice_counts[k])
+				index[k--] = 0;
+			if (k < 0)
+				break;
+		}
+	}
+	return count;
+}
+
+bool battle::sample_turn(const BattleSnapshot& snapshot, int actor, SimRandom& random, SimTurn& turn)
+{
+	turn.usable = SIM_PASS;
+	turn.target_count = 0;
+
+	uint8_t allies[256], enemies[256];
+	int ally_count = find_targets(snapshot, actor, TARGET_SINGLE_ALLY, allies);
+	int enemy_count = find_targets(snapshot, actor, TARGET_SINGLE_ENEMY, enemies);
+
+	int counts[SIM_MAX_USABLES];
+	int total = 0;
+	for (int slot = 0; slot < snapshot[actor].usable_count; ++slot)
+		total += counts[slot] = ::count_turns(snapshot, snapshot.usable(actor, slot), ally_count, enemy_count);
+
+	if (total == 0)
+		return false;
+
+	// Find the usable that the chosen turn belongs to
+	int n = random.below(total);
+	int slot = 0;
+	while (n >= counts[slot])
+		n -= counts[slot++];
+	turn.usable = slot;
+
+	// Decode the targets from the rest of the index, picking random targets as well
+	const SimUsable& usable = snapshot.usable(actor, slot);
+	for (int k = 0; k < usable.selection_count; ++k)
+	{
+		Target target = snapshot.usables().selection(usable, k).target;
+		if (target == TARGET_RANDOM_ENEMY)
+		{
+			turn.targets[turn.target_count++] = enemies[random.below(enemy_count)];
+		}
+		else if (target == TARGET_SINGLE_ENEMY)
+		{
+			turn.targets[turn.target_count++] = enemies[n % enemy_count];
+			n /= enemy_count;
+		}
+		else if (target == TARGET_SINGLE_ALLY)
+		{
+			turn.targets[turn.target_count++] = allies[n % ally_count];
+			n /= ally_count;
+		}
+	}
+
+	return true;
+}
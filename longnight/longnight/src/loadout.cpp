@@ -0,0 +1,294 @@
+#include <algorithm>
+#include <fstream>
+#include <numeric>
+#include <set>
+#include "../include/loadout.h"
+#include "../include/gamedata.h"
+#include "../include/parallel.h"
+
+using namespace std;
+using namespace battle;
+
+
+LoadoutOptimiser::LoadoutOptimiser(const vector<string>& pool, const vector<string>& enemies, const LoadoutOptions& options)
+	: m_Enemies(enemies), m_Options(options), m_Random(options.seed)
+{
+	const data::Registry& registry = data::get_registry();
+	for (auto id = pool.begin(); id != pool.end(); ++id)
+	{
+		const overworld::Item* item = registry.get_item(*id);
+		if (item && find(m_Pool.begin(), m_Pool.end(), item) == m_Pool.end())
+		{
+			m_Pool.push_back(item);
+			m_PoolIds.push_back(*id);
+			m_Table.add(item);
+		}
+	}
+
+	// Add the enemies' usables now too, so that the threads only ever read from the table
+	SimRandom random(0);
+	BattleSnapshot::create(vector<overworld::Ally>(), m_Enemies, m_Table, random);
+}
+
+bool LoadoutOptimiser::open_cache(const string& directory, string& error)
+{
+	return m_Cache.open(directory, error);
+}
+
+void LoadoutOptimiser::canonicalise(Loadout& loadout) const
+{
+	vector<Loadout> allies;
+	for (size_t first = 0; first < loadout.size(); first += m_Options.items)
+	{
+		allies.emplace_back(loadout.begin() + first, loadout.begin() + first + m_Options.items);
+		sort(allies.back().begin(), allies.back().end());
+	}
+	sort(allies.begin(), allies.end());
+
+	loadout.clear();
+	for (auto ally = allies.begin(); ally != allies.end(); ++ally)
+		loadout.insert(loadout.end(), ally->begin(), ally->end());
+}
+
+LoadoutOptimiser::Loadout LoadoutOptimiser::random_loadout()
+{
+	Loadout loadout(m_Options.allies * m_Options.items);
+	for (auto item = loadout.begin(); item != loadout.end(); ++item)
+		*item = (uint16_t)m_Random.below((unsigned int)m_Pool.size());
+	canonicalise(loadout);
+	return loadout;
+}
+
+LoadoutOptimiser::Loadout LoadoutOptimiser::breed(const Loadout& first, const Loadout& second)
+{
+	Loadout child(first.size());
+	for (size_t ally = 0; ally < first.size(); ally += m_Options.items)
+	{
+		const Loadout& parent = m_Random.below(2) == 0 ? first : second;
+		copy(parent.begin() + ally, parent.begin() + ally + m_Options.items, child.begin() + ally);
+	}
+
+	child[m_Random.below((unsigned int)child.size())] = (uint16_t)m_Random.below((unsigned int)m_Pool.size());
+	canonicalise(child);
+	return child;
+}
+
+LoadoutOptimiser::Evaluation& LoadoutOptimiser::evaluation(const Loadout& loadout)
+{
+	auto iter = m_Evaluations.find(loadout);
+	if (iter != m_Evaluations.end())
+		return iter->second;
+
+	Evaluation& evaluation = m_Evaluations[loadout];
+	evaluation.party.resize(m_Options.allies);
+	for (size_t k = 0; k < loadout.size(); ++k)
+		evaluation.party[k / m_Options.items].items.push_back(m_Pool[loadout[k]]);
+
+	// The key is found the same way as for a sweep with common random numbers
+	SimRandom random(0);
+	BattleSnapshot snapshot = BattleSnapshot::create(evaluation.party, m_Enemies, m_Table, random);
+	evaluation.key = battle_key(evaluation.party, m_Enemies, unordered_map<const overworld::Item*, uint64_t>(), snapshot, battle_seed(m_Options.seed, 0, 0), m_Options.max_turns);
+
+	m_Cache.read(evaluation.key, evaluation.outcomes);
+	evaluation.cached = evaluation.outcomes.size();
+	m_CacheHits += evaluation.cached;
+	return evaluation;
+}
+
+void LoadoutOptimiser::evaluate(const vector<const Loadout*>& loadouts, unsigned int battles, unsigned int threads)
+{
+	// Gather the battles each loadout hasn't run yet
+	vector<pair<Evaluation*, unsigned int>> jobs;
+	vector<Evaluation*> grown;
+	for (auto loadout = loadouts.begin(); loadout != loadouts.end(); ++loadout)
+	{
+		Evaluation& evaluation = this->evaluation(**loadout);
+		unsigned int done = (unsigned int)evaluation.outcomes.size();
+		if (done >= battles)
+			continue;
+
+		evaluation.outcomes.resize(battles);
+		for (unsigned int battle = done; battle < battles; ++battle)
+			jobs.emplace_back(&evaluation, battle);
+		grown.push_back(&evaluation);
+	}
+
+	// Battle k of every loadout has the same seed, so the results are the same however the work is split
+	parallel_for(jobs.size(), threads, [&](unsigned int, size_t first, size_t last)
+		{
+			for (size_t k = first; k < last; ++k)
+			{
+				Evaluation& evaluation = *jobs[k].first;
+				evaluation.outcomes[jobs[k].second] = random_battle(evaluation.party, m_Enemies, m_Table, battle_seed(m_Options.seed, 0, jobs[k].second), m_Options.max_turns);
+			}
+		}
+	);
+	m_Run += jobs.size();
+
+	for (auto evaluation = grown.begin(); evaluation != grown.end(); ++evaluation)
+	{
+		if (m_Cache.is_open() && m_Cache.write((*evaluation)->key, (*evaluation)->outcomes.data(), (*evaluation)->outcomes.size()))
+			(*evaluation)->cached = (*evaluation)->outcomes.size();
+	}
+}
+
+double LoadoutOptimiser::score(const Evaluation& evaluation, unsigned int battles) const
+{
+	battles = min(battles, (unsigned int)evaluation.outcomes.size());
+	if (battles == 0)
+		return 0;
+
+	double wins = 0, turns = 0;
+	for (unsigned int k = 0; k < battles; ++k)
+	{
+		const SweepOutcome& outcome = evaluation.outcomes[k];
+		wins += outcome.winner == 0;
+		turns += outcome.winner == 0 ? outcome.turns : m_Options.max_turns;
+	}
+
+	// The mean turns are worth less than one battle won, so they only break ties
+	if (m_Options.objective == LOADOUT_WIN_RATE)
+		return (wins - turns / battles / (m_Options.max_turns + 1)) / battles;
+	return -turns / battles;
+}
+
+void LoadoutOptimiser::run_round(unsigned int threads)
+{
+	// Keep the parents, and fill the rest of the round with their children and some new loadouts
+	vector<Loadout> population;
+	set<Loadout> seen;
+	for (auto parent = m_Parents.begin(); parent != m_Parents.end(); ++parent)
+	{
+		if (seen.insert(*parent).second)
+			population.push_back(*parent);
+	}
+
+	for (unsigned int attempt = 0; population.size() < m_Options.population && attempt < m_Options.population * LOADOUT_ATTEMPTS; ++attempt)
+	{
+		// A quarter of the new loadouts are random, to keep the search from settling too early
+		unsigned int parents = (unsigned int)m_Parents.size();
+		Loadout loadout = parents < 2 || m_Random.below(4) == 0 ? random_loadout() : breed(m_Parents[m_Random.below(parents)], m_Parents[m_Random.below(parents)]);
+		if (seen.insert(loadout).second)
+			population.push_back(loadout);
+	}
+
+	vector<const Loadout*> bracket;
+	for (auto loadout = population.begin(); loadout != population.end(); ++loadout)
+		bracket.push_back(&*loadout);
+
+	// Run successive halving, ranking the loadouts dropped at each step above those dropped before
+	vector<const Loadout*> ranking;
+	unsigned int battles = max(1u, min(m_Options.min_battles, m_Options.max_battles));
+	vector<pair<double, const Loadout*>> scores;
+	while (!bracket.empty())
+	{
+		evaluate(bracket, battles, threads);
+
+		// Every loadout is scored on the same battles, so that common random numbers cancel out as much noise as they can
+		scores.clear();
+		for (auto loadout = bracket.begin(); loadout != bracket.end(); ++loadout)
+			scores.emplace_back(score(evaluation(**loadout), battles), *loadout);
+		stable_sort(scores.begin(), scores.end(), [](const pair<double, const Loadout*>& a, const pair<double, const Loadout*>& b) { return a.first > b.first; });
+		for (size_t k = 0; k < scores.size(); ++k)
+			bracket[k] = scores[k].second;
+
+		if (battles >= m_Options.max_battles)
+			break;
+
+		size_t kept = max<size_t>((bracket.size() + 1) / 2, m_Options.finalists);
+		if (kept < bracket.size())
+		{
+			ranking.insert(ranking.begin(), bracket.begin() + kept, bracket.end());
+			bracket.resize(kept);
+		}
+		battles = min(battles * 2, m_Options.max_battles);
+	}
+	ranking.insert(ranking.begin(), bracket.begin(), bracket.end());
+
+	// The best quarter of the round breeds the next
+	m_Parents.clear();
+	size_t parents = min(ranking.size(), max<size_t>(2, m_Options.population / 4));
+	for (size_t k = 0; k < parents; ++k)
+		m_Parents.push_back(*ranking[k]);
+}
+
+vector<LoadoutResult> LoadoutOptimiser::results() const
+{
+	// Loadouts that ran the most battles come first, since their scores are the surest
+	vector<map<Loadout, Evaluation>::const_iterator> entries;
+	vector<pair<unsigned int, double>> ranks;
+	for (auto iter = m_Evaluations.begin(); iter != m_Evaluations.end(); ++iter)
+	{
+		unsigned int battles = (unsigned int)iter->second.outcomes.size();
+		entries.push_back(iter);
+		ranks.emplace_back(min(battles, m_Options.max_battles), score(iter->second, battles));
+	}
+
+	vector<size_t> order(entries.size());
+	iota(order.begin(), order.end(), 0);
+	stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return ranks[a] > ranks[b]; });
+
+	vector<LoadoutResult> results;
+	for (auto index = order.begin(); index != order.end(); ++index)
+	{
+		const Loadout& loadout = entries[*index]->first;
+		const Evaluation& evaluation = entries[*index]->second;
+
+		LoadoutResult result = {};
+		result.items.resize(m_Options.allies);
+		for (size_t k = 0; k < loadout.size(); ++k)
+			result.items[k / m_Options.items].push_back(m_PoolIds[loadout[k]]);
+
+		for (auto outcome = evaluation.outcomes.begin(); outcome != evaluation.outcomes.end(); ++outcome)
+		{
+			++result.battles;
+			result.wins += outcome->winner == 0;
+			result.turns += outcome->winner == 0 ? outcome->turns : m_Options.max_turns;
+		}
+		if (result.battles > 0)
+			result.turns /= result.battles;
+		wilson_interval(result.wins, result.battles, result.interval);
+		results.push_back(result);
+	}
+	return results;
+}
+
+size_t LoadoutOptimiser::battles_run() const
+{
+	return m_Run;
+}
+
+size_t LoadoutOptimiser::battles_cached() const
+{
+	return m_CacheHits;
+}
+
+bool LoadoutOptimiser::write_csv(const string& path) const
+{
+	ofstream file(path, ios::out | ios::trunc);
+	if (!file)
+		return false;
+
+	file << "rank,battles,wins,win_rate,win_rate_low,win_rate_high,mean_turns";
+	for (int ally = 0; ally < m_Options.allies; ++ally)
+		file << ",ally_" << (ally + 1);
+	file << '\n';
+
+	vector<LoadoutResult> results = this->results();
+	for (size_t k = 0; k < results.size(); ++k)
+	{
+		const LoadoutResult& result = results[k];
+		file << (k + 1) << ',' << result.battles << ',' << result.wins << ',' << (result.battles ? (double)result.wins / result.battles : 0.0) << ',' << result.interval[0] << ',' << result.interval[1] << ',' << result.turns;
+
+		for (auto ally = result.items.begin(); ally != result.items.end(); ++ally)
+		{
+			string items;
+			for (auto item = ally->begin(); item != ally->end(); ++item)
+				items += (item == ally->begin() ? "" : " + ") + *item;
+			file << ',' << csv_field(items);
+		}
+		file << '\n';
+	}
+
+	return file.good();
+}
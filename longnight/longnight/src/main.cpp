@@ -1,7 +1,12 @@
 #include <ctime>
+#include <thread>
 #include "../include/ui.h"
 #include "../include/battle.h"
 #include "../include/party.h"
+#include "../include/gamedata.h"
+#include "../include/hotreload.h"
+#include "../include/profile.h"
+#include "../include/tools.h"
 
 using namespace onion;
 
@@ -28,42 +33,77 @@ onion::Font* get_ui_font()
 }
 
 
-int main()
+int main(int argc, char** argv)
 {
+	// Run a command-line tool instead of the game, if one was asked for.
+	int status;
+	if (run_tool(argc, argv, status))
+		return status;
+
+	// Parse the game data on a worker thread while the window and UI assets load.
+	std::thread data_loader(
+		[]()
+		{
+			StartupPhase phase("data parsing");
+			data::load_registry();
+		}
+	);
+
 	// Initialize the Onion library.
-	onion::init("settings.ini");
+	{
+		StartupPhase phase("onion init");
+		onion::init("settings.ini");
+	}
 
 	// Set the random seed
 	srand(time(nullptr));
 
 	// Register the keyboard controls
-	register_keyboard_control(KEY_SELECT, KEY_SELECT_DEFAULT);
-	register_keyboard_control(KEY_CANCEL, KEY_CANCEL_DEFAULT);
-	register_keyboard_control(KEY_LEFT, KEY_LEFT_DEFAULT);
-	register_keyboard_control(KEY_DOWN, KEY_DOWN_DEFAULT);
-	register_keyboard_control(KEY_RIGHT, KEY_RIGHT_DEFAULT);
-	register_keyboard_control(KEY_UP, KEY_UP_DEFAULT);
+	{
+		StartupPhase phase("key registration");
+		register_keyboard_control(KEY_SELECT, KEY_SELECT_DEFAULT);
+		register_keyboard_control(KEY_CANCEL, KEY_CANCEL_DEFAULT);
+		register_keyboard_control(KEY_LEFT, KEY_LEFT_DEFAULT);
+		register_keyboard_control(KEY_DOWN, KEY_DOWN_DEFAULT);
+		register_keyboard_control(KEY_RIGHT, KEY_RIGHT_DEFAULT);
+		register_keyboard_control(KEY_UP, KEY_UP_DEFAULT);
+	}
 
 	// Load the UI assets.
-	g_ClearPalette = new onion::SinglePalette(vec4i(255, 0, 0, 0), vec4i(0, 255, 0, 0), vec4i(0, 0, 255, 0));
-	g_UIPalette = new onion::SinglePalette(vec4i(255, 255, 255, 0), vec4i(200, 184, 176, 0), vec4i(0, 0, 0, 0));
-	g_UIFont = onion::Font::load_sprite_font("fonts/outline11.png");
+	{
+		StartupPhase phase("ui assets");
+		g_ClearPalette = new onion::SinglePalette(vec4i(255, 0, 0, 0), vec4i(0, 255, 0, 0), vec4i(0, 0, 255, 0));
+		g_UIPalette = new onion::SinglePalette(vec4i(255, 255, 255, 0), vec4i(200, 184, 176, 0), vec4i(0, 0, 0, 0));
+		g_UIFont = onion::Font::load_sprite_font("fonts/outline11.png");
+	}
 
-	// Set up allies
-	std::vector<overworld::Ally>& party = overworld::get_party();
-	party.resize(3);
+	// Wait for the game data, then load the graphics that go with it. Anything that touches the graphics context stays on this thread.
+	{
+		StartupPhase phase("waiting for data");
+		data_loader.join();
+	}
+	{
+		StartupPhase phase("item graphics");
+		data::attach_graphics();
+	}
+
+	// Reload the game data whenever it is edited.
+	(new data::DataWatcher("res/data"))->unfreeze();
 
-	for (int k = 2; k >= 0; --k)
+	// Set up allies
 	{
-		party[k].items.push_back(overworld::Item::get_item("debug offense"));
-		party[k].items.push_back(overworld::Item::get_item("debug offense"));
-		party[k].items.push_back(overworld::Item::get_item("debug offense"));
-		party[k].items.push_back(overworld::Item::get_item("debug offense"));
-		party[k].items.push_back(overworld::Item::get_item("debug support"));
+		StartupPhase phase("party setup");
+		overworld::get_party() = overworld::debug_party();
 	}
 
 	// Set the state.
-	onion::set_state(new battle::State({ "trafmimic", "trafmimic" }));
+	{
+		StartupPhase phase("battle setup");
+		onion::set_state(new battle::State({ "trafmimic", "trafmimic" }));
+	}
+
+	// Report the startup timeline once the first frame updates.
+	(new StartupReport())->unfreeze();
 
 	// Run the Onion main function.
 	onion::state_main();
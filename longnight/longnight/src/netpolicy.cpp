@@ -0,0 +1,522 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "../include/netpolicy.h"
+#include "../include/legalturn.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define NET_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC can always compile AVX2 intrinsics, and only uses them where they are called
+#define NET_AVX2
+#else
+// GCC and Clang need to be told which functions may use AVX2, since the rest of the program can't assume it
+#define NET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NET_SSE2
+#endif
+
+using namespace std;
+using namespace battle;
+
+
+/// <summary>Encodes one entity as inputs to a policy network.</summary>
+template <class E>
+void encode_entity(const E& e, float* inputs)
+{
+	inputs[0] = 1.f;
+	inputs[1] = e.max_health > 0 ? (float)e.cur_health / e.max_health : 0.f;
+	inputs[2] = e.max_shield > 0 ? (float)e.cur_shield / e.max_shield : 0.f;
+	inputs[3] = e.burn / 100.f;
+	inputs[4] = e.toxin / 100.f;
+	inputs[5] = (e.cur_offense - e.base_offense) / 5.f;
+	inputs[6] = (e.cur_defense - e.base_defense) / 5.f;
+	inputs[7] = (float)e.time / TIMELINE_MAX;
+}
+
+/// <summary>Encodes the state of a battle as seen by an entity. Works for both live and simulated entities, so that both give the same inputs.</summary>
+/// <param name="self">The entity taking its turn.</param>
+/// <param name="allies">The living entities on the same side, including the entity itself, in party order.</param>
+/// <param name="ally_count">The number of living allies.</param>
+/// <param name="opponents">The living entities on the other side, in party order.</param>
+/// <param name="opponent_count">The number of living opponents.</param>
+/// <param name="inputs">Filled with NET_INPUTS inputs. Slots without an entity are left as 0.</param>
+template <class E>
+void encode(const E& self, const E* const* allies, int ally_count, const E* const* opponents, int opponent_count, float* inputs)
+{
+	fill(inputs, inputs + NET_INPUTS, 0.f);
+	encode_entity(self, inputs);
+
+	int slot = 0;
+	for (int k = 0; k < ally_count && slot < NET_ALLIES; ++k)
+	{
+		if (allies[k] != &self)
+			encode_entity(*allies[k], inputs + (1 + slot++) * NET_ENTITY_FEATURES);
+	}
+
+	for (int k = 0; k < opponent_count && k < NET_OPPONENTS; ++k)
+		encode_entity(*opponents[k], inputs + (1 + NET_ALLIES + k) * NET_ENTITY_FEATURES);
+}
+
+void battle::encode_state(const Entity* user, float* inputs)
+{
+	const vector<Entity*>& allies = user->party->living;
+	const vector<Entity*>& opponents = user->party->enemies->living;
+	encode<Entity>(*user, allies.data(), allies.size(), opponents.data(), opponents.size(), inputs);
+}
+
+void battle::encode_state(const BattleSnapshot& snapshot, int actor, float* inputs)
+{
+	const SimEntity* allies[256];
+	const SimEntity* opponents[256];
+	int ally_count = 0, opponent_count = 0;
+
+	int side = snapshot[actor].side;
+	for (int k = 0; k < (int)snapshot.size(); ++k)
+	{
+		const SimEntity& e = snapshot[k];
+		if ((e.flags & SIM_PRESENT) && e.cur_health > 0)
+		{
+			if (e.side == side)
+				allies[ally_count++] = &e;
+			else
+				opponents[opponent_count++] = &e;
+		}
+	}
+
+	encode<SimEntity>(snapshot[actor], allies, ally_count, opponents, opponent_count, inputs);
+}
+
+
+// A function that applies a layer to a batch. Rows of weights and inputs are padded to a multiple of NET_LANES.
+// Takes (weights, biases, padded inputs, outputs, padded outputs, inputs, batch size, outputs, whether to apply ReLU).
+typedef void (*DenseKernel)(const float*, const float*, int, int, int, const float*, int, float*, bool);
+
+/// <summary>Applies a layer to a batch, one multiply at a time.</summary>
+void dense_scalar(const float* weights, const float* biases, int in, int out, int stride, const float* x, int count, float* y, bool relu)
+{
+	for (int b = 0; b < count; ++b)
+	{
+		const float* xb = x + (size_t)b * in;
+		float* yb = y + (size_t)b * stride;
+		for (int o = 0; o < out; ++o)
+		{
+			const float* w = weights + (size_t)o * in;
+			float sum = biases[o];
+			for (int i = 0; i < in; ++i)
+				sum += w[i] * xb[i];
+			yb[o] = relu && sum < 0.f ? 0.f : sum;
+		}
+		fill(yb + out, yb + stride, 0.f);
+	}
+}
+
+#ifdef NET_SSE2
+/// <summary>Adds up the lanes of a vector.</summary>
+inline float horizontal_sum(__m128 v)
+{
+	__m128 shuffled = _mm_movehl_ps(v, v);
+	v = _mm_add_ps(v, shuffled);
+	shuffled = _mm_shuffle_ps(v, v, 1);
+	return _mm_cvtss_f32(_mm_add_ss(v, shuffled));
+}
+
+/// <summary>Applies a layer to R items of a batch at once with SSE, so that each load of the weights is used R times.</summary>
+template <int R>
+void dense_sse2_rows(const float* weights, const float* biases, int in, int out, int stride, const float* x, float* y, bool relu)
+{
+	for (int o = 0; o < out; ++o)
+	{
+		const float* w = weights + (size_t)o * in;
+		__m128 sum[R];
+		for (int r = 0; r < R; ++r)
+			sum[r] = _mm_setzero_ps();
+
+		for (int i = 0; i < in; i += 4)
+		{
+			__m128 wv = _mm_loadu_ps(w + i);
+			for (int r = 0; r < R; ++r)
+				sum[r] = _mm_add_ps(sum[r], _mm_mul_ps(wv, _mm_loadu_ps(x + (size_t)r * in + i)));
+		}
+
+		for (int r = 0; r < R; ++r)
+		{
+			float value = horizontal_sum(sum[r]) + biases[o];
+			y[(size_t)r * stride + o] = relu && value < 0.f ? 0.f : value;
+		}
+	}
+}
+
+/// <summary>Applies a layer to a batch with SSE.</summary>
+void dense_sse2(const float* weights, const float* biases, int in, int out, int stride, const float* x, int count, float* y, bool relu)
+{
+	int b = 0;
+	for (; b + 4 <= count; b += 4)
+		dense_sse2_rows<4>(weights, biases, in, out, stride, x + (size_t)b * in, y + (size_t)b * stride, relu);
+	for (; b < count; ++b)
+		dense_sse2_rows<1>(weights, biases, in, out, stride, x + (size_t)b * in, y + (size_t)b * stride, relu);
+
+	for (b = 0; b < count; ++b)
+		fill(y + (size_t)b * stride + out, y + (size_t)(b + 1) * stride, 0.f);
+}
+#endif
+
+#ifdef NET_X86
+/// <summary>Adds up the lanes of a vector.</summary>
+NET_AVX2 inline float horizontal_sum(__m256 v)
+{
+	__m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	__m128 shuffled = _mm_movehl_ps(sum, sum);
+	sum = _mm_add_ps(sum, shuffled);
+	shuffled = _mm_shuffle_ps(sum, sum, 1);
+	return _mm_cvtss_f32(_mm_add_ss(sum, shuffled));
+}
+
+/// <summary>Applies a layer to R items of a batch at once with AVX2, so that each load of the weights is used R times.</summary>
+template <int R>
+NET_AVX2 void dense_avx2_rows(const float* weights, const float* biases, int in, int out, int stride, const float* x, float* y, bool relu)
+{
+	for (int o = 0; o < out; ++o)
+	{
+		const float* w = weights + (size_t)o * in;
+		__m256 sum[R];
+		for (int r = 0; r < R; ++r)
+			sum[r] = _mm256_setzero_ps();
+
+		for (int i = 0; i < in; i += 8)
+		{
+			__m256 wv = _mm256_loadu_ps(w + i);
+			for (int r = 0; r < R; ++r)
+				sum[r] = _mm256_fmadd_ps(wv, _mm256_loadu_ps(x + (size_t)r * in + i), sum[r]);
+		}
+
+		for (int r = 0; r < R; ++r)
+		{
+			float value = horizontal_sum(sum[r]) + biases[o];
+			y[(size_t)r * stride + o] = relu && value < 0.f ? 0.f : value;
+		}
+	}
+}
+
+/// <summary>Applies a layer to a batch with AVX2.</summary>
+NET_AVX2 void dense_avx2(const float* weights, const float* biases, int in, int out, int stride, const float* x, int count, float* y, bool relu)
+{
+	int b = 0;
+	for (; b + 4 <= count; b += 4)
+		dense_avx2_rows<4>(weights, biases, in, out, stride, x + (size_t)b * in, y + (size_t)b * stride, relu);
+	for (; b < count; ++b)
+		dense_avx2_rows<1>(weights, biases, in, out, stride, x + (size_t)b * in, y + (size_t)b * stride, relu);
+
+	for (b = 0; b < count; ++b)
+		fill(y + (size_t)b * stride + out, y + (size_t)(b + 1) * stride, 0.f);
+}
+
+/// <summary>Checks if the CPU and operating system support AVX2 and FMA.</summary>
+bool has_avx2()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+
+	// FMA, OSXSAVE and AVX, and the operating system saving the AVX registers
+	__cpuid(info, 1);
+	if ((info[2] & (1 << 12)) == 0 || (info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 || (_xgetbv(0) & 6) != 6)
+		return false;
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+#endif
+
+// The kernels chosen for this CPU.
+struct KernelChoice
+{
+	DenseKernel kernel;
+	const char* name;
+};
+
+/// <summary>Chooses the fastest kernels that the CPU supports. Only checks the CPU once.</summary>
+const KernelChoice& choose_kernel()
+{
+	static const KernelChoice choice = []()
+	{
+#ifdef NET_X86
+		if (has_avx2())
+			return KernelChoice{ dense_avx2, "avx2" };
+#endif
+#ifdef NET_SSE2
+		return KernelChoice{ dense_sse2, "sse2" };
+#else
+		return KernelChoice{ dense_scalar, "scalar" };
+#endif
+	}();
+	return choice;
+}
+
+const char* battle::network_kernel_name()
+{
+	return choose_kernel().name;
+}
+
+vector<NetworkKernelCheck> battle::check_network_kernels(int in, int out, int count, int repeats, uint64_t seed)
+{
+	vector<KernelChoice> kernels = { { dense_scalar, "scalar" } };
+#ifdef NET_SSE2
+	kernels.push_back({ dense_sse2, "sse2" });
+#endif
+#ifdef NET_X86
+	if (has_avx2())
+		kernels.push_back({ dense_avx2, "avx2" });
+#endif
+
+	// Pad the layer the same way a loaded network is
+	int padded_in = (in + NET_LANES - 1) / NET_LANES * NET_LANES;
+	int padded_out = (out + NET_LANES - 1) / NET_LANES * NET_LANES;
+	vector<float> weights((size_t)out * padded_in, 0.f), biases(out), x((size_t)count * padded_in, 0.f);
+
+	// Numbers from -1 to 1, in steps that floats hold exactly
+	SimRandom random(seed);
+	auto next = [&random]() { return (float)((int)random.below(1 << 16) - (1 << 15)) / (1 << 15); };
+	for (int o = 0; o < out; ++o)
+	{
+		for (int i = 0; i < in; ++i)
+			weights[(size_t)o * padded_in + i] = next();
+		biases[o] = next();
+	}
+	for (int b = 0; b < count; ++b)
+	{
+		for (int i = 0; i < in; ++i)
+			x[(size_t)b * padded_in + i] = next();
+	}
+
+	// Without ReLU, so that negative outputs are compared too
+	vector<double> reference((size_t)count * out), scale((size_t)count * out);
+	for (int b = 0; b < count; ++b)
+	{
+		for (int o = 0; o < out; ++o)
+		{
+			double sum = biases[o], size = fabs(biases[o]);
+			for (int i = 0; i < in; ++i)
+			{
+				double term = (double)weights[(size_t)o * padded_in + i] * x[(size_t)b * padded_in + i];
+				sum += term;
+				size += fabs(term);
+			}
+			reference[(size_t)b * out + o] = sum;
+			scale[(size_t)b * out + o] = max(size, 1e-30);
+		}
+	}
+
+	vector<NetworkKernelCheck> checks;
+	vector<float> y((size_t)count * padded_out);
+	for (auto kernel = kernels.begin(); kernel != kernels.end(); ++kernel)
+	{
+		NetworkKernelCheck check = { kernel->name, 0.0, 0.0 };
+		kernel->kernel(weights.data(), biases.data(), padded_in, out, padded_out, x.data(), count, y.data(), false);
+		for (int b = 0; b < count; ++b)
+		{
+			for (int o = 0; o < out; ++o)
+				check.error = max(check.error, fabs(y[(size_t)b * padded_out + o] - reference[(size_t)b * out + o]) / scale[(size_t)b * out + o]);
+		}
+
+		auto start = chrono::steady_clock::now();
+		for (int k = 0; k < repeats; ++k)
+			kernel->kernel(weights.data(), biases.data(), padded_in, out, padded_out, x.data(), count, y.data(), true);
+		check.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count() / max(1, repeats);
+		checks.push_back(check);
+	}
+	return checks;
+}
+
+
+// The header of a policy network file.
+struct NetworkHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t layer_count;
+};
+
+bool PolicyNetwork::load(const string& path)
+{
+	m_LayerCount = 0;
+
+	ifstream file(path, ios::in | ios::binary);
+	NetworkHeader header;
+	if (!file.read((char*)&header, sizeof(header)) || header.magic != NET_MAGIC || header.version != NET_VERSION || header.layer_count == 0 || header.layer_count > NET_MAX_LAYERS)
+		return false;
+
+	uint32_t widths[NET_MAX_LAYERS + 1];
+	if (!file.read((char*)widths, (header.layer_count + 1) * sizeof(uint32_t)) || widths[0] != NET_INPUTS || widths[header.layer_count] != NET_OUTPUTS)
+		return false;
+
+	for (uint32_t k = 0; k <= header.layer_count; ++k)
+	{
+		if (widths[k] == 0 || widths[k] > NET_MAX_WIDTH)
+			return false;
+
+		m_Widths[k] = widths[k];
+		m_Padded[k] = (widths[k] + NET_LANES - 1) / NET_LANES * NET_LANES;
+	}
+
+	for (uint32_t k = 0; k < header.layer_count; ++k)
+	{
+		int in = m_Widths[k], out = m_Widths[k + 1];
+
+		// Pad each row of weights with zeros, so that padded inputs contribute nothing
+		m_Weights[k].assign((size_t)out * m_Padded[k], 0.f);
+		for (int o = 0; o < out; ++o)
+		{
+			if (!file.read((char*)&m_Weights[k][(size_t)o * m_Padded[k]], in * sizeof(float)))
+				return false;
+		}
+
+		m_Biases[k].resize(out);
+		if (!file.read((char*)m_Biases[k].data(), out * sizeof(float)))
+			return false;
+	}
+
+	m_LayerCount = header.layer_count;
+	return true;
+}
+
+void PolicyNetwork::evaluate(const float* inputs, int count, float* outputs) const
+{
+	if (m_LayerCount == 0)
+	{
+		fill(outputs, outputs + (size_t)count * NET_OUTPUTS, 0.f);
+		return;
+	}
+
+	// Reuse the buffers between calls, so that they stop allocating once they are large enough
+	static thread_local vector<float> front, back;
+	size_t size = 0;
+	for (int k = 0; k <= m_LayerCount; ++k)
+		size = max(size, (size_t)count * m_Padded[k]);
+	if (front.size() < size)
+	{
+		front.resize(size);
+		back.resize(size);
+	}
+
+	// Copy the inputs into padded rows
+	for (int b = 0; b < count; ++b)
+	{
+		float* row = &front[(size_t)b * m_Padded[0]];
+		copy(inputs + (size_t)b * NET_INPUTS, inputs + (size_t)(b + 1) * NET_INPUTS, row);
+		fill(row + NET_INPUTS, row + m_Padded[0], 0.f);
+	}
+
+	DenseKernel kernel = choose_kernel().kernel;
+	float* x = front.data();
+	float* y = back.data();
+	for (int k = 0; k < m_LayerCount; ++k)
+	{
+		kernel(m_Weights[k].data(), m_Biases[k].data(), m_Padded[k], m_Widths[k + 1], m_Padded[k + 1], x, count, y, k + 1 < m_LayerCount);
+		swap(x, y);
+	}
+
+	for (int b = 0; b < count; ++b)
+		copy(x + (size_t)b * m_Padded[m_LayerCount], x + (size_t)b * m_Padded[m_LayerCount] + NET_OUTPUTS, outputs + (size_t)b * NET_OUTPUTS);
+}
+
+void PolicyNetwork::evaluate(const BattleSnapshot* const* snapshots, const int* actors, int count, float* outputs) const
+{
+	static thread_local vector<float> inputs;
+	if (inputs.size() < (size_t)count * NET_INPUTS)
+		inputs.resize((size_t)count * NET_INPUTS);
+
+	for (int b = 0; b < count; ++b)
+		encode_state(*snapshots[b], actors[b], &inputs[(size_t)b * NET_INPUTS]);
+
+	evaluate(inputs.data(), count, outputs);
+}
+
+const PolicyNetwork* PolicyNetwork::get(const string& path)
+{
+	static mutex networks_mutex;
+	static unordered_map<string, unique_ptr<PolicyNetwork>> networks;
+
+	lock_guard<mutex> lock(networks_mutex);
+	auto iter = networks.find(path);
+	if (iter == networks.end())
+	{
+		// Files that fail to load are remembered too, so they are only tried once
+		unique_ptr<PolicyNetwork> network(new PolicyNetwork());
+		if (!network->load(path))
+			network.reset();
+		iter = networks.emplace(path, move(network)).first;
+	}
+	return iter->second.get();
+}
+
+
+/// <summary>Finds the highest-scoring action that has not been tried yet, and marks it as tried.</summary>
+int next_action(const float* scores, bool* tried)
+{
+	int best = -1;
+	for (int a = 0; a < POLICY_MAX_ACTIONS; ++a)
+	{
+		if (!tried[a] && (best < 0 || scores[a] > scores[best]))
+			best = a;
+	}
+	tried[best] = true;
+	return best;
+}
+
+
+NetworkAgent::NetworkAgent(Entity* self, const PolicyNetwork* network) : Agent(self), m_Network(network) {}
+
+void NetworkAgent::decide(Turn& turn)
+{
+	float inputs[NET_INPUTS], outputs[NET_OUTPUTS];
+	encode_state(m_Self, inputs);
+	m_Network->evaluate(inputs, 1, outputs);
+
+	// Take the best-scoring action that is legal
+	bool tried[POLICY_MAX_ACTIONS] = {};
+	for (int n = 0; n < POLICY_MAX_ACTIONS; ++n)
+	{
+		if (policy_turn(m_Self, next_action(outputs, tried), turn))
+			return;
+	}
+
+	sample_turn(m_Self, turn);
+}
+
+
+NetworkPolicy::NetworkPolicy(const PolicyNetwork* network, uint64_t seed) : m_Network(network), m_Random(seed) {}
+
+SimTurn NetworkPolicy::choose(const BattleSnapshot& snapshot, int actor)
+{
+	float inputs[NET_INPUTS], outputs[NET_OUTPUTS];
+	encode_state(snapshot, actor, inputs);
+	m_Network->evaluate(inputs, 1, outputs);
+
+	SimTurn turn;
+	bool tried[POLICY_MAX_ACTIONS] = {};
+	for (int n = 0; n < POLICY_MAX_ACTIONS; ++n)
+	{
+		if (policy_turn(snapshot, actor, next_action(outputs, tried), m_Random, turn))
+			return turn;
+	}
+
+	sample_turn(snapshot, actor, m_Random, turn);
+	return turn;
+}
@@ -5,6 +5,20 @@ using namespace overworld;
 
 vector<Ally> g_Party;
 
+vector<Ally> overworld::debug_party()
+{
+	vector<Ally> party(3);
+	for (int k = 2; k >= 0; --k)
+	{
+		party[k].items.push_back(Item::get_item("debug offense"));
+		party[k].items.push_back(Item::get_item("debug offense"));
+		party[k].items.push_back(Item::get_item("debug offense"));
+		party[k].items.push_back(Item::get_item("debug offense"));
+		party[k].items.push_back(Item::get_item("debug support"));
+	}
+	return party;
+}
+
 vector<Ally>& overworld::get_party()
 {
 	return g_Party;
@@ -0,0 +1,91 @@
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../include/profile.h"
+
+using namespace std;
+using namespace std::chrono;
+
+
+// When the process started.
+const steady_clock::time_point g_ProcessStart = steady_clock::now();
+
+// A recorded phase of startup.
+struct PhaseRecord
+{
+	// The name of the phase.
+	const char* name;
+
+	// The thread that the phase ran on.
+	thread::id thread_id;
+
+	// When the phase started and ended, relative to the start of the process.
+	steady_clock::duration start, end;
+};
+
+// All recorded phases.
+vector<PhaseRecord> g_Phases;
+
+mutex g_PhaseMutex;
+
+
+StartupPhase::StartupPhase(const char* name) : m_Name(name), m_Start(steady_clock::now()) {}
+
+StartupPhase::~StartupPhase()
+{
+	steady_clock::time_point end = steady_clock::now();
+
+	lock_guard<mutex> lock(g_PhaseMutex);
+	g_Phases.push_back({ m_Name, this_thread::get_id(), m_Start - g_ProcessStart, end - g_ProcessStart });
+}
+
+
+void StartupReport::__update(int frames_passed)
+{
+	{
+		lock_guard<mutex> lock(g_PhaseMutex);
+		steady_clock::duration now = steady_clock::now() - g_ProcessStart;
+		g_Phases.push_back({ "first frame", this_thread::get_id(), now, now });
+	}
+
+	print_startup_timeline(clog);
+
+	delete this;
+}
+
+
+void print_startup_timeline(ostream& out)
+{
+	vector<PhaseRecord> phases;
+	{
+		lock_guard<mutex> lock(g_PhaseMutex);
+		phases = g_Phases;
+	}
+	stable_sort(phases.begin(), phases.end(), [](const PhaseRecord& a, const PhaseRecord& b) { return a.start < b.start; });
+
+	// Number the threads in the order they first appear, with the main thread first
+	vector<thread::id> threads;
+	threads.push_back(this_thread::get_id());
+
+	stringstream report;
+	report << fixed << setprecision(2);
+	report << "Startup timeline (ms):" << endl;
+	for (auto iter = phases.begin(); iter != phases.end(); ++iter)
+	{
+		size_t t = find(threads.begin(), threads.end(), iter->thread_id) - threads.begin();
+		if (t == threads.size())
+			threads.push_back(iter->thread_id);
+
+		double start = duration<double, milli>(iter->start).count();
+		double end = duration<double, milli>(iter->end).count();
+
+		report << "  " << setw(9) << start << " - " << setw(9) << end << "  " << setw(9) << (end - start) << "  [thread " << t << "]  " << iter->name << endl;
+	}
+
+	out << report.str();
+}
@@ -0,0 +1,812 @@
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include "../include/simulation.h"
+#include "../include/legalturn.h"
+#include "../include/gamedata.h"
+#include "../include/party.h"
+
+using namespace std;
+using namespace battle;
+
+
+SimRandom::SimRandom(uint64_t seed) : state(seed) {}
+
+uint64_t SimRandom::next()
+{
+	uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+unsigned int SimRandom::below(unsigned int n)
+{
+	return (unsigned int)(((next() >> 32) * n) >> 32);
+}
+
+
+
+uint16_t UsableTable::add(const Usable& usable)
+{
+	SimUsable u;
+	u.first_selection = m_Selections.size();
+	u.selection_count = 0;
+	u.single_targets = 0;
+
+	for (auto iter = usable.targets.begin(); iter != usable.targets.end(); ++iter)
+	{
+		SimSelection selection;
+		selection.target = iter->target;
+		selection.first_effect = m_Effects.size();
+		selection.effect_count = 0;
+
+		if (iter->effects)
+		{
+			for (auto effect_iter = iter->effects->effects.begin(); effect_iter != iter->effects->effects.end(); ++effect_iter)
+			{
+				if (const DamageEffect* damage = dynamic_cast<const DamageEffect*>(*effect_iter))
+				{
+					m_Effects.push_back({ SIM_DAMAGE, HEALTH_STATUS, damage->damage });
+					++selection.effect_count;
+				}
+				else if (const InflictStatusEffect* status = dynamic_cast<const InflictStatusEffect*>(*effect_iter))
+				{
+					m_Effects.push_back({ SIM_STATUS, status->status, status->value });
+					++selection.effect_count;
+				}
+			}
+		}
+
+		if (iter->target == TARGET_SINGLE_ALLY || iter->target == TARGET_SINGLE_ENEMY || iter->target == TARGET_RANDOM_ENEMY)
+			++u.single_targets;
+
+		m_Selections.push_back(selection);
+		++u.selection_count;
+	}
+
+	m_Usables.push_back(u);
+	return m_Usables.size() - 1;
+}
+
+uint16_t UsableTable::add(const overworld::Item* item)
+{
+	auto iter = m_ItemIndex.find(item);
+	if (iter != m_ItemIndex.end())
+		return iter->second;
+
+	Usable* usable = item->generate();
+	uint16_t index = add(*usable);
+	delete usable;
+
+	m_ItemIndex.emplace(item, index);
+	return index;
+}
+
+uint16_t UsableTable::replace(const overworld::Item* item, const overworld::Item* replacement)
+{
+	Usable* usable = replacement->generate();
+	uint16_t index = add(*usable);
+	delete usable;
+
+	m_ItemIndex[item] = index;
+	return index;
+}
+
+uint16_t UsableTable::find(const overworld::Item* item) const
+{
+	auto iter = m_ItemIndex.find(item);
+	return iter == m_ItemIndex.end() ? 0xFFFF : iter->second;
+}
+
+const SimUsable& UsableTable::operator[](uint16_t index) const
+{
+	return m_Usables[index];
+}
+
+const SimSelection& UsableTable::selection(const SimUsable& usable, int index) const
+{
+	return m_Selections[usable.first_selection + index];
+}
+
+const SimEffect& UsableTable::effect(const SimSelection& selection, int index) const
+{
+	return m_Effects[selection.first_effect + index];
+}
+
+size_t UsableTable::size() const
+{
+	return m_Usables.size();
+}
+
+
+
+/// <summary>Generates the Zobrist key for one value of a snapshot.</summary>
+/// <param name="entity">The index of the entity.</param>
+/// <param name="field">The byte offset of the value within SimEntity.</param>
+/// <param name="value">The value.</param>
+/// <returns>The key.</returns>
+inline uint64_t zobrist(int entity, int field, int value)
+{
+	// Values can be far too large for a table of random keys, so each key is generated from a strong mix of its position and value instead
+	uint64_t z = ((uint64_t)(uint8_t)entity << 56) ^ ((uint64_t)(uint8_t)field << 40) ^ (uint32_t)value;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+/// <summary>Generates the Zobrist key for every hashed value of an entity.</summary>
+/// <param name="index">The index of the entity.</param>
+/// <param name="e">The entity.</param>
+/// <returns>The combined key.</returns>
+uint64_t zobrist(int index, const SimEntity& e)
+{
+	uint64_t hash = zobrist(index, offsetof(SimEntity, flags), e.flags);
+	for (size_t field = 0; field < offsetof(SimEntity, side); field += sizeof(int))
+		hash ^= zobrist(index, field, *(const int*)((const char*)&e + field));
+	return hash;
+}
+
+/// <summary>Mixes a value into a fingerprint, so that the same values in another order give another fingerprint.</summary>
+inline uint64_t combine(uint64_t hash, uint64_t value)
+{
+	SimRandom mixer(value);
+	mixer.state = hash ^ mixer.next();
+	return mixer.next();
+}
+
+
+BattleSnapshot::BattleSnapshot(const UsableTable* usables) : m_Usables(usables) {}
+
+BattleSnapshot BattleSnapshot::capture(const Party& party, UsableTable& usables, vector<Entity*>* entities, Entity* actor)
+{
+	BattleSnapshot snapshot(&usables);
+	if (entities)
+		entities->clear();
+
+	const Party* sides[2] = { &party, party.enemies };
+	for (int side = 0; side < 2; ++side)
+	{
+		if (!sides[side])
+			continue;
+
+		for (auto iter = sides[side]->allies.begin(); iter != sides[side]->allies.end(); ++iter)
+		{
+			Entity* e = *iter;
+
+			SimEntity s;
+			s.cur_health = e->cur_health;
+			s.max_health = e->max_health;
+			s.cur_shield = e->cur_shield;
+			s.max_shield = e->max_shield;
+			s.base_offense = e->base_offense;
+			s.cur_offense = e->cur_offense;
+			s.base_defense = e->base_defense;
+			s.cur_defense = e->cur_defense;
+			s.burn = e->burn;
+			s.toxin = e->toxin;
+			s.time = e->time;
+			s.side = side;
+			s.flags = SIM_PRESENT;
+
+			// Anyone else at the front of the timeline already has a turn waiting in the queue
+			if (e != actor && e->cur_health > 0 && e->time <= 0)
+				s.flags |= SIM_PENDING_TURN;
+
+			s.usable_count = 0;
+			for (auto usable_iter = e->usables.begin(); usable_iter != e->usables.end() && s.usable_count < SIM_MAX_USABLES; ++usable_iter)
+			{
+				if (*usable_iter)
+					s.usables[s.usable_count++] = (*usable_iter)->item ? usables.add((*usable_iter)->item) : usables.add(**usable_iter);
+			}
+
+			if (e == actor)
+				snapshot.m_Actor = snapshot.m_Count;
+
+			snapshot.add(s);
+			if (entities)
+				entities->push_back(e);
+		}
+	}
+
+	return snapshot;
+}
+
+BattleSnapshot BattleSnapshot::create(const vector<overworld::Ally>& allies, const vector<string>& enemies, UsableTable& usables, SimRandom& random)
+{
+	BattleSnapshot snapshot(&usables);
+	const data::Registry& registry = data::get_registry();
+
+	for (auto iter = allies.begin(); iter != allies.end(); ++iter)
+	{
+		SimEntity s = {};
+		s.cur_health = iter->cur_health;
+		s.max_health = iter->max_health;
+		s.cur_shield = 0;
+		s.max_shield = 999;
+		s.side = 0;
+		s.flags = SIM_PRESENT;
+
+		for (auto item_iter = iter->items.begin(); item_iter != iter->items.end() && s.usable_count < SIM_MAX_USABLES; ++item_iter)
+		{
+			if (*item_iter)
+				s.usables[s.usable_count++] = usables.add(*item_iter);
+		}
+
+		snapshot.add(s);
+	}
+
+	for (auto iter = enemies.begin(); iter != enemies.end(); ++iter)
+	{
+		const EnemyTemplate* data = registry.get_enemy(*iter);
+		if (!data)
+			continue;
+
+		SimEntity s = {};
+		s.cur_health = s.max_health = data->health;
+		s.cur_shield = s.max_shield = data->shield;
+		s.base_offense = data->offense;
+		s.base_defense = data->defense;
+		s.side = 1;
+		s.flags = SIM_PRESENT;
+
+		for (auto item_iter = data->items.begin(); item_iter != data->items.end() && s.usable_count < SIM_MAX_USABLES; ++item_iter)
+		{
+			if (const overworld::Item* item = registry.get_item(*item_iter))
+				s.usables[s.usable_count++] = usables.add(item);
+		}
+
+		snapshot.add(s);
+	}
+
+	// Place everyone on the timeline, the same way battle::State does
+	for (int k = snapshot.m_Count - 1; k >= 0; --k)
+		snapshot.set(k, &SimEntity::time, random.below(4 * TIMELINE_MAX / 5) + (TIMELINE_MAX / 5));
+
+	return snapshot;
+}
+
+void BattleSnapshot::write_back(vector<overworld::Ally>& allies) const
+{
+	// create() adds the allies first and in order, and entities are never removed
+	size_t ally = 0;
+	for (size_t k = 0; k < m_Count && ally < allies.size(); ++k)
+	{
+		const SimEntity& e = (*this)[k];
+		if (e.side != 0)
+			continue;
+
+		allies[ally].cur_health = max(0, min(e.cur_health, allies[ally].max_health));
+		++ally;
+	}
+}
+
+void BattleSnapshot::add(const SimEntity& entity)
+{
+	m_Hash ^= zobrist(m_Count, entity);
+	if ((entity.flags & SIM_PRESENT) && entity.cur_health > 0)
+		++m_Alive[entity.side];
+
+	if (m_Count < SNAPSHOT_INLINE_ENTITIES)
+	{
+		m_Inline[m_Count++] = entity;
+		return;
+	}
+
+	// Move everything out of line once the battle gets too big
+	if (m_Count == SNAPSHOT_INLINE_ENTITIES)
+		m_Shared = make_shared<vector<SimEntity>>(m_Inline, m_Inline + m_Count);
+	else if (m_Shared.use_count() > 1)
+		m_Shared = make_shared<vector<SimEntity>>(*m_Shared);
+
+	m_Shared->push_back(entity);
+	++m_Count;
+}
+
+uint64_t BattleSnapshot::hash() const
+{
+	return m_Hash ^ zobrist(0xFF, 0xFF, m_Actor);
+}
+
+uint64_t BattleSnapshot::usables_fingerprint(size_t index) const
+{
+	const SimEntity& entity = (*this)[index];
+	uint64_t hash = entity.usable_count;
+	for (int slot = 0; slot < entity.usable_count; ++slot)
+	{
+		const SimUsable& usable = this->usable(index, slot);
+		hash = combine(hash, usable.selection_count);
+		for (int k = 0; k < usable.selection_count; ++k)
+		{
+			const SimSelection& selection = m_Usables->selection(usable, k);
+			hash = combine(hash, (uint64_t)selection.target << 16 | selection.effect_count);
+			for (int n = 0; n < selection.effect_count; ++n)
+			{
+				const SimEffect& effect = m_Usables->effect(selection, n);
+				hash = combine(hash, (uint64_t)effect.type << 40 | (uint64_t)effect.status << 32 | (uint32_t)effect.value);
+			}
+		}
+	}
+	return hash;
+}
+
+uint64_t BattleSnapshot::fingerprint(size_t index) const
+{
+	const SimEntity& entity = (*this)[index];
+	uint64_t hash = combine((uint64_t)entity.side << 32 | (uint32_t)entity.max_health, (uint64_t)(uint32_t)entity.max_shield);
+	hash = combine(hash, (uint64_t)(uint32_t)entity.base_offense << 32 | (uint32_t)entity.base_defense);
+	return combine(hash, usables_fingerprint(index));
+}
+
+uint64_t BattleSnapshot::fingerprint() const
+{
+	uint64_t hash = m_Count;
+	for (int k = 0; k < m_Count; ++k)
+		hash = combine(hash, fingerprint(k));
+	return hash;
+}
+
+void BattleSnapshot::rehash()
+{
+	m_Hash = 0;
+	m_Alive[0] = m_Alive[1] = 0;
+	for (int k = 0; k < m_Count; ++k)
+	{
+		const SimEntity& e = (*this)[k];
+		m_Hash ^= zobrist(k, e);
+		if ((e.flags & SIM_PRESENT) && e.cur_health > 0)
+			++m_Alive[e.side];
+	}
+}
+
+BattleSnapshot BattleSnapshot::clone() const
+{
+	BattleSnapshot copy = *this;
+	copy.m_Tally = nullptr;
+	return copy;
+}
+
+void BattleSnapshot::tally(SimDamageTally* tally)
+{
+	m_Tally = tally;
+}
+
+size_t BattleSnapshot::size() const
+{
+	return m_Count;
+}
+
+const SimEntity& BattleSnapshot::operator[](size_t index) const
+{
+	return m_Count <= SNAPSHOT_INLINE_ENTITIES ? m_Inline[index] : (*m_Shared)[index];
+}
+
+SimEntity& BattleSnapshot::mutate(size_t index)
+{
+	if (m_Count <= SNAPSHOT_INLINE_ENTITIES)
+		return m_Inline[index];
+
+	if (m_Shared.use_count() > 1)
+		m_Shared = make_shared<vector<SimEntity>>(*m_Shared);
+	return (*m_Shared)[index];
+}
+
+const UsableTable& BattleSnapshot::usables() const
+{
+	return *m_Usables;
+}
+
+const SimUsable& BattleSnapshot::usable(int entity, int slot) const
+{
+	return (*m_Usables)[(*this)[entity].usables[slot]];
+}
+
+int BattleSnapshot::actor() const
+{
+	return m_Actor == 0xFF ? -1 : m_Actor;
+}
+
+int BattleSnapshot::alive_count(int side) const
+{
+	return m_Alive[side];
+}
+
+int BattleSnapshot::winner() const
+{
+	return m_Winner;
+}
+
+int BattleSnapshot::turns() const
+{
+	return m_Turns;
+}
+
+
+void BattleSnapshot::set(int index, int SimEntity::* field, int value)
+{
+	SimEntity& e = mutate(index);
+	uint8_t offset = (uint8_t)((char*)&(e.*field) - (char*)&e);
+	if (m_Log)
+		m_Log->changes.push_back({ (uint8_t)index, offset, e.*field });
+	m_Hash ^= zobrist(index, offset, e.*field) ^ zobrist(index, offset, value);
+
+	// Keep track of Health crossing 0
+	if (field == &SimEntity::cur_health && (e.flags & SIM_PRESENT) && (e.cur_health > 0) != (value > 0))
+		value > 0 ? ++m_Alive[e.side] : --m_Alive[e.side];
+
+	e.*field = value;
+}
+
+void BattleSnapshot::set_flags(int index, uint8_t flags)
+{
+	SimEntity& e = mutate(index);
+	if (m_Log)
+		m_Log->changes.push_back({ (uint8_t)index, (uint8_t)offsetof(SimEntity, flags), e.flags });
+	m_Hash ^= zobrist(index, offsetof(SimEntity, flags), e.flags) ^ zobrist(index, offsetof(SimEntity, flags), flags);
+
+	// Keep track of living entities joining or leaving the battle
+	if (e.cur_health > 0 && (e.flags & SIM_PRESENT) != (flags & SIM_PRESENT))
+		(flags & SIM_PRESENT) ? ++m_Alive[e.side] : --m_Alive[e.side];
+
+	e.flags = flags;
+}
+
+
+void BattleSnapshot::damage(int user, int target, int damage, DamageSource source)
+{
+	if ((*this)[target].cur_health <= 0 || !((*this)[target].flags & SIM_PRESENT))
+		return;
+
+	int multiplier = 0;
+	if (source == NORMAL_DAMAGE)
+	{
+		const SimEntity u = (*this)[user];
+		const SimEntity& t = (*this)[target];
+		multiplier = u.cur_offense - t.cur_defense;
+
+		// Reduce user Offense and target Defense, since they activated
+		if (u.cur_offense > u.base_offense)
+			set(user, &SimEntity::cur_offense, u.cur_offense - 1);
+		else if (u.cur_offense < u.base_offense)
+			set(user, &SimEntity::cur_offense, u.cur_offense + 1);
+
+		int defense = (*this)[target].cur_defense, base_defense = (*this)[target].base_defense;
+		if (defense > base_defense)
+			set(target, &SimEntity::cur_defense, defense - 1);
+		else if (defense < base_defense)
+			set(target, &SimEntity::cur_defense, defense + 1);
+	}
+
+	if (multiplier > 0)
+		damage = damage * (10 + multiplier) / 10;
+	else if (multiplier < 0)
+		damage = damage * 10 / (10 - multiplier);
+
+	// Damage Shield first, unless the damage is from Toxin
+	int dh = damage;
+	int shield = (*this)[target].cur_shield;
+	if (shield > 0 && source != TOXIN_DAMAGE)
+	{
+		int ds = min(shield, damage);
+		set(target, &SimEntity::cur_shield, shield - ds);
+		dh -= ds;
+	}
+
+	int health = (*this)[target].cur_health;
+	if (dh > 0)
+		set(target, &SimEntity::cur_health, health - min(health, dh));
+
+	if (m_Tally && damage > 0)
+		m_Tally->damage[(*this)[target].side != 0][source] += (damage - dh) + min(health, dh);
+
+	if ((*this)[target].cur_health <= 0)
+		defeat(target);
+}
+
+void BattleSnapshot::inflict(int target, Status status, int value)
+{
+	const SimEntity& t = (*this)[target];
+	if (t.cur_health <= 0 || !(t.flags & SIM_PRESENT))
+		return;
+
+	int SimEntity::* s = nullptr;
+	switch (status)
+	{
+	case HEALTH_STATUS:
+		s = &SimEntity::cur_health;
+		break;
+	case SHIELD_STATUS:
+		s = &SimEntity::cur_shield;
+		break;
+	case TIME_STATUS:
+		s = &SimEntity::time;
+		break;
+	case OFFENSE_STATUS:
+		s = &SimEntity::cur_offense;
+		break;
+	case DEFENSE_STATUS:
+		s = &SimEntity::cur_defense;
+		break;
+	case BURN_STATUS:
+		s = &SimEntity::burn;
+		break;
+	case TOXIN_STATUS:
+		s = &SimEntity::toxin;
+		break;
+	default:
+		return;
+	}
+
+	int v = max(t.*s + value, 0);
+
+	if (status == HEALTH_STATUS)
+		v = min(v, t.max_health);
+	else if (status == SHIELD_STATUS)
+		v = min(v, t.max_shield);
+	else if (status == TIME_STATUS)
+		v = min(v, TIMELINE_MAX);
+
+	if (v != t.*s)
+		set(target, s, v);
+}
+
+void BattleSnapshot::apply_effects(int user, int target, const SimSelection& selection)
+{
+	for (int k = 0; k < selection.effect_count && m_Winner < 0; ++k)
+	{
+		const SimEffect& effect = m_Usables->effect(selection, k);
+		if (effect.type == SIM_DAMAGE)
+			damage(user, target, effect.value, NORMAL_DAMAGE);
+		else
+			inflict(target, effect.status, effect.value);
+	}
+}
+
+void BattleSnapshot::defeat(int target)
+{
+	int side = (*this)[target].side;
+
+	if (side == 0)
+	{
+		// Reset all status effects, the same way Ally::defeat does
+		set(target, &SimEntity::cur_offense, 0);
+		set(target, &SimEntity::cur_defense, 0);
+		set(target, &SimEntity::burn, 0);
+		set(target, &SimEntity::toxin, 0);
+	}
+	else
+	{
+		// Eject the enemy, the same way Enemy::defeat does
+		set_flags(target, 0);
+	}
+
+	// Check if the whole side has been defeated
+	if (m_Alive[side] == 0)
+		m_Winner = 1 - side;
+}
+
+void BattleSnapshot::tick(int index)
+{
+	const SimEntity& e = (*this)[index];
+
+	// Burn and Toxin both decrease by one as they deal damage
+	int burn = e.burn, toxin = e.toxin;
+	if (burn > 0)
+		set(index, &SimEntity::burn, burn - 1);
+	if (toxin > 0)
+		set(index, &SimEntity::toxin, toxin - 1);
+
+	// An entity still at the front after its turn (because it passed, since every usable moves its user back) waits before acting again, or it would act forever
+	if ((*this)[index].time <= 0)
+		set(index, &SimEntity::time, SIM_PASS_TIME);
+
+	if (burn > 0)
+		damage(-1, index, burn, BURN_DAMAGE);
+	if (toxin > 0 && m_Winner < 0)
+		damage(-1, index, toxin, TOXIN_DAMAGE);
+}
+
+bool BattleSnapshot::advance_timeline()
+{
+	// Find the shortest distance until an entity reaches the front of the timeline or passes a tick point
+	int distance = INT_MAX;
+	for (int k = 0; k < m_Count; ++k)
+	{
+		const SimEntity& e = (*this)[k];
+		if ((e.flags & SIM_PRESENT) && e.cur_health > 0)
+			distance = min(distance, e.time - ((e.time - 1) / SIM_TIMELINE_TICK) * SIM_TIMELINE_TICK);
+	}
+
+	if (distance == INT_MAX)
+		return false;
+
+	// Advance in whole frames, so that entities which would pass a point within the same frame do so together
+	int dt = max(1, (distance + SIM_TIMELINE_STEP - 1) / SIM_TIMELINE_STEP) * SIM_TIMELINE_STEP;
+
+	for (int k = 0; k < m_Count; ++k)
+	{
+		const SimEntity& e = (*this)[k];
+		if (!(e.flags & SIM_PRESENT))
+			continue;
+
+		if (e.cur_health > 0)
+		{
+			int prior = (e.time - 1) / SIM_TIMELINE_TICK;
+			int time = e.time - dt;
+			uint8_t flags = e.flags;
+			set(k, &SimEntity::time, time);
+
+			if (time <= 0)
+				set_flags(k, flags | SIM_PENDING_TURN);
+			else if ((time - 1) / SIM_TIMELINE_TICK != prior)
+				set_flags(k, flags | SIM_PENDING_TICK);
+		}
+		else if (e.time != TIMELINE_MAX)
+		{
+			// Incapacitated entities stay at the back of the timeline
+			set(k, &SimEntity::time, TIMELINE_MAX);
+		}
+	}
+
+	return true;
+}
+
+bool BattleSnapshot::advance()
+{
+	while (m_Winner < 0)
+	{
+		if (m_Actor != 0xFF)
+			return true;
+
+		// Entities at the front of the timeline take their turns first, the furthest past the front going first
+		int next = -1;
+		for (int k = 0; k < m_Count; ++k)
+		{
+			const SimEntity& e = (*this)[k];
+			if ((e.flags & SIM_PENDING_TURN) && (next < 0 || e.time < (*this)[next].time))
+				next = k;
+		}
+
+		if (next >= 0)
+		{
+			set_flags(next, (*this)[next].flags & ~SIM_PENDING_TURN);
+
+			// Make sure the entity is still at the front of the timeline, and still able to act
+			const SimEntity& e = (*this)[next];
+			if ((e.flags & SIM_PRESENT) && e.cur_health > 0 && e.time <= 0)
+				m_Actor = next;
+			continue;
+		}
+
+		// Then entities that passed a tick point
+		for (int k = 0; k < m_Count && next < 0; ++k)
+		{
+			if ((*this)[k].flags & SIM_PENDING_TICK)
+			{
+				set_flags(k, (*this)[k].flags & ~SIM_PENDING_TICK);
+				tick(k);
+				next = k;
+			}
+		}
+
+		if (next < 0 && !advance_timeline())
+			return false;
+	}
+
+	return false;
+}
+
+void BattleSnapshot::apply(const SimTurn& turn)
+{
+	int user = m_Actor;
+	m_Actor = 0xFF;
+	++m_Turns;
+
+	if (turn.usable == SIM_PASS)
+	{
+		tick(user);
+		return;
+	}
+
+	const SimUsable& usable = this->usable(user, turn.usable);
+	int user_side = (*this)[user].side;
+	int next_target = 0;
+
+	for (int k = 0; k < usable.selection_count && m_Winner < 0; ++k)
+	{
+		const SimSelection& selection = m_Usables->selection(usable, k);
+
+		switch (selection.target)
+		{
+		case TARGET_SINGLE_ALLY:
+		case TARGET_SINGLE_ENEMY:
+		case TARGET_RANDOM_ENEMY:
+			if (next_target < turn.target_count)
+				apply_effects(user, turn.targets[next_target++], selection);
+			break;
+		case TARGET_ALL_ALLIES:
+		case TARGET_ALL_ENEMIES:
+		{
+			// The targets are whoever was on the targeted side when the turn began
+			bool allies = selection.target == TARGET_ALL_ALLIES;
+			uint8_t targets[256];
+			int count = 0;
+			for (int t = 0; t < m_Count; ++t)
+			{
+				const SimEntity& e = (*this)[t];
+				if ((e.flags & SIM_PRESENT) && ((e.side == user_side) == allies))
+					targets[count++] = t;
+			}
+
+			for (int t = 0; t < count; ++t)
+				apply_effects(user, targets[t], selection);
+			break;
+		}
+		case TARGET_SELF:
+			apply_effects(user, user, selection);
+			break;
+		}
+	}
+
+	// The turn ends with a tick for the user
+	if (m_Winner < 0)
+		tick(user);
+}
+
+SimUndo BattleSnapshot::apply(const SimTurn& turn, SimUndoLog& log)
+{
+	SimUndo token = { log.changes.size(), m_Hash, { m_Alive[0], m_Alive[1] }, m_Actor, m_Winner, m_Turns };
+
+	m_Log = &log;
+	apply(turn);
+	advance();
+	m_Log = nullptr;
+
+	return token;
+}
+
+void BattleSnapshot::undo(const SimUndo& token, SimUndoLog& log)
+{
+	// Restore the changes in reverse order, so each value ends up as it was before the earliest change
+	while (log.changes.size() > token.position)
+	{
+		const SimChange& change = log.changes.back();
+		char* e = (char*)&mutate(change.entity);
+		if (change.field == offsetof(SimEntity, flags))
+			*(uint8_t*)(e + change.field) = (uint8_t)change.value;
+		else
+			*(int*)(e + change.field) = change.value;
+		log.changes.pop_back();
+	}
+
+	m_Hash = token.hash;
+	m_Alive[0] = token.alive[0];
+	m_Alive[1] = token.alive[1];
+	m_Actor = token.actor;
+	m_Winner = token.winner;
+	m_Turns = token.turns;
+}
+
+
+
+RandomPolicy::RandomPolicy(uint64_t seed) : m_Random(seed) {}
+
+SimTurn RandomPolicy::choose(const BattleSnapshot& snapshot, int actor)
+{
+	SimTurn turn;
+	sample_turn(snapshot, actor, m_Random, turn);
+	return turn;
+}
+
+
+int battle::simulate(BattleSnapshot& snapshot, SimPolicy& side0, SimPolicy& side1, int max_turns)
+{
+	while (snapshot.turns() < max_turns && snapshot.advance())
+	{
+		int actor = snapshot.actor();
+		SimPolicy& policy = snapshot[actor].side == 0 ? side0 : side1;
+		snapshot.apply(policy.choose(snapshot, actor));
+	}
+
+	return snapshot.winner();
+}
@@ -0,0 +1,417 @@
+#include <atomic>
+#include <fstream>
+#include <unordered_set>
+#include "../include/solver.h"
+#include "../include/legalturn.h"
+#include "../include/parallel.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace battle;
+
+
+// The maximum number of legal turns an entity can have, which is more than any entity has in practice.
+#define SOLVER_MAX_TURNS		128
+
+// The header of a solved table file.
+struct SolvedHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t fingerprint;
+	uint64_t capacity;
+};
+
+
+/// <summary>Mixes a value into a hash.</summary>
+inline uint64_t combine(uint64_t hash, uint64_t value)
+{
+	SimRandom mixer(value);
+	mixer.state = hash ^ mixer.next();
+	return mixer.next();
+}
+
+/// <summary>Finds the key and check of a state, for the memo table.</summary>
+SolvedRecord state_record(const BattleSnapshot& snapshot, int turns_left)
+{
+	SolvedRecord record;
+
+	// The Zobrist hash covers the state, but the same state with fewer turns left can have a different outcome
+	record.key = combine(snapshot.hash(), turns_left);
+	if (record.key == 0)
+		record.key = 1;
+
+	// Hash every value separately from the Zobrist hash, so that two states only share an entry if both hashes collide
+	uint64_t check = combine(snapshot.actor() + 1, turns_left);
+	for (size_t k = 0; k < snapshot.size(); ++k)
+	{
+		const SimEntity& e = snapshot[k];
+		check = combine(check, (uint64_t)(uint32_t)e.cur_health << 32 | (uint32_t)e.cur_shield);
+		check = combine(check, (uint64_t)(uint32_t)e.cur_offense << 32 | (uint32_t)e.cur_defense);
+		check = combine(check, (uint64_t)(uint32_t)e.burn << 32 | (uint32_t)e.toxin);
+		check = combine(check, (uint64_t)(uint32_t)e.time << 16 | e.flags);
+	}
+	record.check = check;
+	return record;
+}
+
+
+SolvedTable::~SolvedTable()
+{
+	close();
+}
+
+void SolvedTable::close()
+{
+	if (m_Data)
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(m_Data);
+#else
+		munmap((void*)m_Data, m_Size);
+#endif
+	}
+
+	m_Data = nullptr;
+	m_Size = 0;
+	m_Records = nullptr;
+	m_Mask = 0;
+}
+
+bool SolvedTable::open(const string& path, uint64_t fingerprint)
+{
+	close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	HANDLE mapping = GetFileSizeEx(file, &size) ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+	if (mapping)
+	{
+		m_Data = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		m_Size = m_Data ? (size_t)size.QuadPart : 0;
+		CloseHandle(mapping);
+	}
+	CloseHandle(file);
+#else
+	int file = ::open(path.c_str(), O_RDONLY);
+	if (file < 0)
+		return false;
+
+	struct stat info;
+	if (fstat(file, &info) == 0 && info.st_size > 0)
+	{
+		void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+		if (data != MAP_FAILED)
+		{
+			m_Data = (const uint8_t*)data;
+			m_Size = info.st_size;
+		}
+	}
+	::close(file);
+#endif
+
+	if (!m_Data)
+		return false;
+
+	// Check the header, and that the file is as long as the header says
+	const SolvedHeader* header = (const SolvedHeader*)m_Data;
+	if (m_Size < sizeof(SolvedHeader) || header->magic != SOLVER_MAGIC || header->version != SOLVER_VERSION || header->fingerprint != fingerprint
+		|| header->capacity == 0 || (header->capacity & (header->capacity - 1)) != 0
+		|| header->capacity > (m_Size - sizeof(SolvedHeader)) / sizeof(SolvedRecord))
+	{
+		close();
+		return false;
+	}
+
+	m_Records = (const SolvedRecord*)(m_Data + sizeof(SolvedHeader));
+	m_Mask = header->capacity - 1;
+	return true;
+}
+
+bool SolvedTable::find(SolvedRecord& record) const
+{
+	if (!m_Records)
+		return false;
+
+	for (uint64_t slot = record.key & m_Mask; m_Records[slot].key != 0; slot = (slot + 1) & m_Mask)
+	{
+		if (m_Records[slot].key == record.key && m_Records[slot].check == record.check)
+		{
+			record.result = m_Records[slot].result;
+			return true;
+		}
+	}
+	return false;
+}
+
+vector<SolvedRecord> SolvedTable::records() const
+{
+	vector<SolvedRecord> records;
+	for (uint64_t slot = 0; m_Records && slot <= m_Mask; ++slot)
+	{
+		if (m_Records[slot].key != 0)
+			records.push_back(m_Records[slot]);
+	}
+	return records;
+}
+
+bool SolvedTable::write(const string& path, uint64_t fingerprint, const vector<SolvedRecord>& records)
+{
+	// Keep the table at most half full, so that probes stay short
+	uint64_t capacity = 1;
+	while (capacity < 2 * records.size())
+		capacity <<= 1;
+
+	vector<SolvedRecord> slots(capacity, SolvedRecord{ 0, 0, { 0, 0, 0 } });
+	for (auto iter = records.begin(); iter != records.end(); ++iter)
+	{
+		uint64_t slot = iter->key & (capacity - 1);
+		while (slots[slot].key != 0)
+			slot = (slot + 1) & (capacity - 1);
+		slots[slot] = *iter;
+	}
+
+	ofstream file(path, ios::out | ios::binary | ios::trunc);
+	if (!file)
+		return false;
+
+	// Tables are written in the native byte order, since they are mapped straight into memory
+	SolvedHeader header = { SOLVER_MAGIC, SOLVER_VERSION, fingerprint, capacity };
+	file.write((const char*)&header, sizeof(header));
+	file.write((const char*)slots.data(), slots.size() * sizeof(SolvedRecord));
+	return file.good();
+}
+
+
+WinSolver::WinSolver(int max_turns, const SolvedTable* solved) : m_MaxTurns(max_turns), m_Solved(solved), m_Shards(new Shard[SOLVER_SHARDS]) {}
+
+bool WinSolver::lookup(SolvedRecord& record)
+{
+	Shard& shard = m_Shards[record.key % SOLVER_SHARDS];
+	{
+		lock_guard<mutex> lock(shard.lock);
+		auto iter = shard.states.find(record.key);
+		if (iter != shard.states.end() && iter->second.first == record.check)
+		{
+			record.result = iter->second.second;
+			return true;
+		}
+	}
+
+	// Copy states from earlier runs into the memo table, so that they are written out again along with the new ones
+	if (m_Solved && m_Solved->find(record))
+	{
+		remember(record);
+		return true;
+	}
+	return false;
+}
+
+void WinSolver::remember(const SolvedRecord& record)
+{
+	// If two different states share a key, only the first is remembered
+	Shard& shard = m_Shards[record.key % SOLVER_SHARDS];
+	lock_guard<mutex> lock(shard.lock);
+	shard.states.emplace(record.key, make_pair(record.check, record.result));
+}
+
+SolverResult WinSolver::solve_state(BattleSnapshot& snapshot, SimUndoLog& log)
+{
+	if (snapshot.winner() >= 0)
+		return snapshot.winner() == 0 ? SolverResult{ 1, 0, 0 } : SolverResult{ 0, 1, 0 };
+
+	int actor = snapshot.actor();
+	if (actor < 0 || snapshot.turns() >= m_MaxTurns)
+		return SolverResult{ 0, 0, 0 };
+
+	SolvedRecord record = state_record(snapshot, m_MaxTurns - snapshot.turns());
+	if (lookup(record))
+		return record.result;
+
+	// Every legal turn is equally likely, the same as RandomPolicy
+	SimTurn turns[SOLVER_MAX_TURNS];
+	int count = legal_turns(snapshot, actor, turns, SOLVER_MAX_TURNS);
+	if (count == 0)
+	{
+		turns[0].usable = SIM_PASS;
+		turns[0].target_count = 0;
+		count = 1;
+	}
+
+	SolverResult result = { 0, 0, 0 };
+	for (int k = 0; k < count; ++k)
+	{
+		SolverResult outcome = solve_turn(snapshot, turns[k], log);
+		result.win += outcome.win / count;
+		result.loss += outcome.loss / count;
+		result.turns += outcome.turns / count;
+	}
+
+	record.result = result;
+	remember(record);
+	return result;
+}
+
+SolverResult WinSolver::solve_turn(BattleSnapshot& snapshot, SimTurn turn, SimUndoLog& log)
+{
+	// Find the first target that is still to be picked at random
+	int k = 0;
+	while (k < turn.target_count && turn.targets[k] != 0xFF)
+		++k;
+
+	if (k == turn.target_count)
+	{
+		SimUndo token = snapshot.apply(turn, log);
+		SolverResult result = solve_state(snapshot, log);
+		snapshot.undo(token, log);
+
+		result.turns += 1;
+		return result;
+	}
+
+	// Average over every living enemy it could be
+	int side = snapshot[snapshot.actor()].side;
+	uint8_t targets[256];
+	int count = 0;
+	for (size_t e = 0; e < snapshot.size(); ++e)
+	{
+		const SimEntity& target = snapshot[e];
+		if ((target.flags & SIM_PRESENT) && target.side != side && target.cur_health > 0)
+			targets[count++] = e;
+	}
+
+	SolverResult result = { 0, 0, 0 };
+	for (int n = 0; n < count; ++n)
+	{
+		turn.targets[k] = targets[n];
+		SolverResult outcome = solve_turn(snapshot, turn, log);
+		result.win += outcome.win / count;
+		result.loss += outcome.loss / count;
+		result.turns += outcome.turns / count;
+	}
+	return result;
+}
+
+SolverResult WinSolver::solve(const BattleSnapshot& snapshot, unsigned int threads)
+{
+	BattleSnapshot root = snapshot.clone();
+	root.advance();
+
+	// Expand the battle breadth-first into states that can be solved independently of each other
+	vector<BattleSnapshot> frontier;
+	frontier.push_back(root.clone());
+	for (int depth = 0; depth < SOLVER_SPLIT_TURNS && frontier.size() < (size_t)threads * SOLVER_SPLIT_STATES && threads > 1; ++depth)
+	{
+		vector<BattleSnapshot> next;
+		unordered_set<uint64_t> seen;
+		for (auto iter = frontier.begin(); iter != frontier.end(); ++iter)
+		{
+			int actor = iter->actor();
+			if (iter->winner() >= 0 || actor < 0 || iter->turns() >= m_MaxTurns)
+				continue;
+
+			SimTurn turns[SOLVER_MAX_TURNS];
+			int count = legal_turns(*iter, actor, turns, SOLVER_MAX_TURNS);
+			if (count == 0)
+			{
+				turns[0].usable = SIM_PASS;
+				turns[0].target_count = 0;
+				count = 1;
+			}
+
+			// Turns with random targets are left to the threads along with the rest of the state, since the states after them are usually similar
+			bool random = false;
+			for (int k = 0; k < count; ++k)
+			{
+				for (int t = 0; t < turns[k].target_count; ++t)
+					random = random || turns[k].targets[t] == 0xFF;
+			}
+			if (random)
+			{
+				if (seen.insert(iter->hash()).second)
+					next.push_back(iter->clone());
+				continue;
+			}
+
+			for (int k = 0; k < count; ++k)
+			{
+				BattleSnapshot child = iter->clone();
+				child.apply(turns[k]);
+				child.advance();
+				if (seen.insert(child.hash()).second)
+					next.push_back(move(child));
+			}
+		}
+
+		if (next.empty())
+			break;
+		frontier = move(next);
+	}
+
+	// Solve the states, handing them out one at a time so that threads that finish early take on more
+	atomic<size_t> next_state(0);
+	parallel_for(threads, threads, [&](unsigned int, size_t, size_t)
+		{
+			SimUndoLog log;
+			for (size_t k = next_state++; k < frontier.size(); k = next_state++)
+				solve_state(frontier[k], log);
+		}
+	);
+
+	// Everything below the frontier has been solved, so solving the root only visits the states above it
+	SimUndoLog log;
+	return solve_state(root, log);
+}
+
+size_t WinSolver::size() const
+{
+	size_t count = 0;
+	for (int k = 0; k < SOLVER_SHARDS; ++k)
+	{
+		lock_guard<mutex> lock(m_Shards[k].lock);
+		count += m_Shards[k].states.size();
+	}
+	return count;
+}
+
+vector<SolvedRecord> WinSolver::records() const
+{
+	// Keep the states from earlier runs that this run never needed
+	vector<SolvedRecord> records;
+	if (m_Solved)
+	{
+		for (const SolvedRecord& record : m_Solved->records())
+		{
+			Shard& shard = m_Shards[record.key % SOLVER_SHARDS];
+			lock_guard<mutex> lock(shard.lock);
+			auto iter = shard.states.find(record.key);
+			if (iter == shard.states.end() || iter->second.first != record.check)
+				records.push_back(record);
+		}
+	}
+
+	for (int k = 0; k < SOLVER_SHARDS; ++k)
+	{
+		lock_guard<mutex> lock(m_Shards[k].lock);
+		for (auto iter = m_Shards[k].states.begin(); iter != m_Shards[k].states.end(); ++iter)
+			records.push_back(SolvedRecord{ iter->first, iter->second.first, iter->second.second });
+	}
+	return records;
+}
+
+uint64_t WinSolver::fingerprint(const BattleSnapshot& snapshot, int max_turns)
+{
+	return combine(combine(SOLVER_VERSION, max_turns), snapshot.fingerprint());
+}
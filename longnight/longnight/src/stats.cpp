@@ -0,0 +1,436 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include "../include/stats.h"
+
+using namespace std;
+using namespace battle;
+
+
+// The number of counters of padding on each side of a BattleStats' counters.
+#define STATS_PADDING			(STATS_CACHE_LINE / sizeof(uint64_t))
+
+// The number of counters for the outcomes of battles: abandoned, won by side 0, and won by side 1.
+#define STATS_OUTCOMES			3
+
+// The number of counters for damage: one per side and DamageSource.
+#define STATS_DAMAGE			6
+
+// The longest entity name a partial statistics file may hold.
+#define STATS_MAX_NAME			4096
+
+
+// The header of a partial statistics file.
+struct StatsHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t fingerprint;
+	uint32_t shard_index;
+	uint32_t shard_count;
+	uint32_t entities;
+	int32_t max_turns;
+};
+
+
+StatHistogram::StatHistogram(const uint64_t* counts, size_t size) : m_Counts(counts), m_Size(size) {}
+
+uint64_t StatHistogram::total() const
+{
+	uint64_t total = 0;
+	for (size_t k = 0; k < m_Size; ++k)
+		total += m_Counts[k];
+	return total;
+}
+
+double StatHistogram::mean() const
+{
+	uint64_t total = 0;
+	double sum = 0;
+	for (size_t k = 0; k < m_Size; ++k)
+	{
+		total += m_Counts[k];
+		sum += (double)k * m_Counts[k];
+	}
+	return total == 0 ? 0 : sum / total;
+}
+
+size_t StatHistogram::percentile(double fraction) const
+{
+	uint64_t total = this->total();
+	if (total == 0)
+		return 0;
+
+	uint64_t target = max<uint64_t>(1, (uint64_t)ceil(fraction * total));
+	uint64_t seen = 0;
+	for (size_t k = 0; k < m_Size; ++k)
+	{
+		seen += m_Counts[k];
+		if (seen >= target)
+			return k;
+	}
+	return m_Size - 1;
+}
+
+size_t StatHistogram::size() const
+{
+	return m_Size;
+}
+
+uint64_t StatHistogram::operator[](size_t value) const
+{
+	return m_Counts[value];
+}
+
+
+BattleStats::BattleStats(size_t entities, int max_turns) : m_Entities(entities), m_MaxTurns(max(max_turns, 0))
+{
+	m_Counts.assign(STATS_PADDING * 2 + entity_offset(entities), 0);
+}
+
+uint64_t* BattleStats::counts()
+{
+	return m_Counts.data() + STATS_PADDING;
+}
+
+const uint64_t* BattleStats::counts() const
+{
+	return m_Counts.data() + STATS_PADDING;
+}
+
+size_t BattleStats::entity_size() const
+{
+	// Turns present, the uptime of each status, the picks of each usable and of passing, and the turns of defeat
+	return 1 + STATS_STATUSES + (SIM_MAX_USABLES + 1) + (m_MaxTurns + 1);
+}
+
+size_t BattleStats::entity_offset(size_t entity) const
+{
+	return STATS_OUTCOMES + (m_MaxTurns + 1) + STATS_DAMAGE + entity * entity_size();
+}
+
+int BattleStats::record(BattleSnapshot& snapshot, SimPolicy& side0, SimPolicy& side1)
+{
+	uint64_t* c = counts();
+	uint64_t* damage = c + STATS_OUTCOMES + (m_MaxTurns + 1);
+	size_t count = min(snapshot.size(), m_Entities);
+
+	SimDamageTally tally = {};
+	snapshot.tally(&tally);
+
+	// Whether each entity is still standing, to notice the turn it falls on
+	bool standing[256];
+	for (size_t k = 0; k < count; ++k)
+		standing[k] = (snapshot[k].flags & SIM_PRESENT) && snapshot[k].cur_health > 0;
+
+	auto check_defeats = [&]()
+	{
+		for (size_t k = 0; k < count; ++k)
+		{
+			if (standing[k] && !((snapshot[k].flags & SIM_PRESENT) && snapshot[k].cur_health > 0))
+			{
+				standing[k] = false;
+				uint64_t* e = c + entity_offset(k);
+				++e[1 + STATS_STATUSES + (SIM_MAX_USABLES + 1) + min(snapshot.turns(), m_MaxTurns)];
+			}
+		}
+	};
+
+	while (snapshot.turns() < m_MaxTurns && snapshot.advance())
+	{
+		check_defeats();
+
+		// Status uptime is sampled once per turn, for every entity still standing
+		for (size_t k = 0; k < count; ++k)
+		{
+			if (!standing[k])
+				continue;
+
+			const SimEntity& entity = snapshot[k];
+			uint64_t* e = c + entity_offset(k);
+			++e[0];
+			e[1] += entity.burn > 0;
+			e[2] += entity.toxin > 0;
+			e[3] += entity.cur_offense != entity.base_offense;
+			e[4] += entity.cur_defense != entity.base_defense;
+		}
+
+		int actor = snapshot.actor();
+		SimPolicy& policy = snapshot[actor].side == 0 ? side0 : side1;
+		SimTurn turn = policy.choose(snapshot, actor);
+		if ((size_t)actor < count)
+			++c[entity_offset(actor) + 1 + STATS_STATUSES + min<int>(turn.usable, SIM_MAX_USABLES)];
+
+		snapshot.apply(turn);
+	}
+	check_defeats();
+	snapshot.tally(nullptr);
+
+	int winner = snapshot.winner();
+	++c[winner + 1];
+	++c[STATS_OUTCOMES + min(snapshot.turns(), m_MaxTurns)];
+	for (int side = 0; side < 2; ++side)
+	{
+		for (int source = 0; source < 3; ++source)
+			damage[side * 3 + source] += tally.damage[side][source];
+	}
+
+	return winner;
+}
+
+void BattleStats::merge(const BattleStats& other)
+{
+	const uint64_t* from = other.counts();
+	uint64_t* to = counts();
+	size_t size = min(m_Counts.size(), other.m_Counts.size()) - STATS_PADDING * 2;
+	for (size_t k = 0; k < size; ++k)
+		to[k] += from[k];
+}
+
+void BattleStats::clear()
+{
+	fill(m_Counts.begin(), m_Counts.end(), 0);
+}
+
+size_t BattleStats::entities() const
+{
+	return m_Entities;
+}
+
+int BattleStats::max_turns() const
+{
+	return m_MaxTurns;
+}
+
+uint64_t BattleStats::battles() const
+{
+	const uint64_t* c = counts();
+	return c[0] + c[1] + c[2];
+}
+
+uint64_t BattleStats::outcomes(int winner) const
+{
+	return counts()[winner + 1];
+}
+
+StatHistogram BattleStats::turns() const
+{
+	return StatHistogram(counts() + STATS_OUTCOMES, m_MaxTurns + 1);
+}
+
+uint64_t BattleStats::damage(int side, DamageSource source) const
+{
+	return counts()[STATS_OUTCOMES + (m_MaxTurns + 1) + side * 3 + source];
+}
+
+uint64_t BattleStats::present_turns(size_t entity) const
+{
+	return counts()[entity_offset(entity)];
+}
+
+uint64_t BattleStats::status_turns(size_t entity, int status) const
+{
+	return counts()[entity_offset(entity) + 1 + status];
+}
+
+StatHistogram BattleStats::defeats(size_t entity) const
+{
+	return StatHistogram(counts() + entity_offset(entity) + 1 + STATS_STATUSES + (SIM_MAX_USABLES + 1), m_MaxTurns + 1);
+}
+
+uint64_t BattleStats::picks(size_t entity, int slot) const
+{
+	return counts()[entity_offset(entity) + 1 + STATS_STATUSES + slot];
+}
+
+
+/// <summary>Writes a string as a JSON string.</summary>
+void write_json_string(ofstream& file, const string& text)
+{
+	file << '"';
+	for (char c : text)
+	{
+		if (c == '"' || c == '\\')
+			file << '\\' << c;
+		else if ((unsigned char)c < 0x20)
+		{
+			char escape[8];
+			snprintf(escape, sizeof(escape), "\\u%04x", (unsigned char)c);
+			file << escape;
+		}
+		else
+			file << c;
+	}
+	file << '"';
+}
+
+/// <summary>Writes a histogram as a JSON object of its mean, percentiles and counts. Trailing empty buckets are left out.</summary>
+void write_json_histogram(ofstream& file, const StatHistogram& histogram)
+{
+	file << "{ \"count\": " << histogram.total() << ", \"mean\": " << histogram.mean()
+		<< ", \"p10\": " << histogram.percentile(0.1) << ", \"p50\": " << histogram.percentile(0.5) << ", \"p90\": " << histogram.percentile(0.9)
+		<< ", \"histogram\": [";
+
+	size_t size = histogram.size();
+	while (size > 0 && histogram[size - 1] == 0)
+		--size;
+	for (size_t k = 0; k < size; ++k)
+		file << (k ? ", " : "") << histogram[k];
+	file << "] }";
+}
+
+bool BattleStats::write_json(const string& path, const vector<string>& names) const
+{
+	ofstream file(path);
+	if (!file)
+		return false;
+
+	const char* sources[3] = { "normal", "burn", "toxin" };
+	const char* statuses[STATS_STATUSES] = { "burn", "toxin", "offense", "defense" };
+	uint64_t battles = this->battles();
+
+	file << "{\n";
+	file << "\t\"battles\": " << battles << ",\n";
+	file << "\t\"wins\": " << outcomes(0) << ",\n";
+	file << "\t\"losses\": " << outcomes(1) << ",\n";
+	file << "\t\"turn_limit\": " << outcomes(-1) << ",\n";
+	file << "\t\"turns\": ";
+	write_json_histogram(file, turns());
+	file << ",\n";
+
+	// Damage is given per battle, so that runs of different lengths can be compared
+	file << "\t\"damage_per_battle\": {";
+	for (int side = 0; side < 2; ++side)
+	{
+		file << (side ? ", " : " ") << (side ? "\"enemies\"" : "\"party\"") << ": {";
+		for (int source = 0; source < 3; ++source)
+			file << (source ? ", " : " ") << '"' << sources[source] << "\": " << (battles ? (double)damage(side, (DamageSource)source) / battles : 0.0);
+		file << " }";
+	}
+	file << " },\n";
+
+	file << "\t\"entities\": [";
+	for (size_t k = 0; k < m_Entities; ++k)
+	{
+		file << (k ? ",\n" : "\n") << "\t\t{ \"name\": ";
+		write_json_string(file, k < names.size() ? names[k] : to_string(k));
+
+		uint64_t present = present_turns(k);
+		file << ", \"turns_present\": " << present << ", \"uptime\": {";
+		for (int status = 0; status < STATS_STATUSES; ++status)
+			file << (status ? ", " : " ") << '"' << statuses[status] << "\": " << (present ? (double)status_turns(k, status) / present : 0.0);
+		file << " },\n\t\t\t\"time_to_defeat\": ";
+		write_json_histogram(file, defeats(k));
+
+		file << ",\n\t\t\t\"picks\": [";
+		for (int slot = 0; slot < SIM_MAX_USABLES; ++slot)
+			file << (slot ? ", " : "") << picks(k, slot);
+		file << "], \"passes\": " << picks(k, SIM_MAX_USABLES) << " }";
+	}
+	file << "\n\t]\n}\n";
+
+	return file.good();
+}
+
+
+/// <summary>Writes an unsigned integer seven bits at a time, low bits first, so that small values take a single byte.</summary>
+void write_varint(ofstream& file, uint64_t value)
+{
+	while (value >= 0x80)
+	{
+		file.put((char)((value & 0x7F) | 0x80));
+		value >>= 7;
+	}
+	file.put((char)value);
+}
+
+/// <summary>Reads an unsigned integer written by write_varint().</summary>
+/// <returns>True if an integer was read, false if the file ended or the integer is too long.</returns>
+bool read_varint(ifstream& file, uint64_t& value)
+{
+	value = 0;
+	for (int shift = 0; shift < 64; shift += 7)
+	{
+		int byte = file.get();
+		if (byte == EOF)
+			return false;
+
+		value |= (uint64_t)(byte & 0x7F) << shift;
+		if (!(byte & 0x80))
+			return true;
+	}
+	return false;
+}
+
+bool BattleStats::write_partial(const string& path, const StatsShard& shard, const vector<string>& names) const
+{
+	string temp = path + ".tmp";
+	{
+		ofstream file(temp, ios::out | ios::binary | ios::trunc);
+		if (!file)
+			return false;
+
+		StatsHeader header = { STATS_MAGIC, STATS_VERSION, shard.fingerprint, shard.index, shard.count, (uint32_t)m_Entities, m_MaxTurns };
+		file.write((const char*)&header, sizeof(header));
+
+		for (size_t k = 0; k < m_Entities; ++k)
+		{
+			string name = k < names.size() ? names[k].substr(0, STATS_MAX_NAME) : string();
+			write_varint(file, name.size());
+			file.write(name.data(), name.size());
+		}
+
+		// Most counters are small or empty histogram buckets, which take a byte each
+		size_t size = m_Counts.size() - STATS_PADDING * 2;
+		const uint64_t* c = counts();
+		write_varint(file, size);
+		for (size_t k = 0; k < size; ++k)
+			write_varint(file, c[k]);
+
+		if (!file.good())
+			return false;
+	}
+
+	remove(path.c_str());
+	return rename(temp.c_str(), path.c_str()) == 0;
+}
+
+bool BattleStats::read_partial(const string& path, BattleStats& stats, StatsShard& shard, vector<string>& names)
+{
+	ifstream file(path, ios::in | ios::binary);
+	if (!file)
+		return false;
+
+	StatsHeader header;
+	if (!file.read((char*)&header, sizeof(header)) || header.magic != STATS_MAGIC || header.version != STATS_VERSION || header.max_turns < 0 || header.shard_index >= header.shard_count)
+		return false;
+
+	BattleStats read(header.entities, header.max_turns);
+	vector<string> read_names(header.entities);
+	for (string& name : read_names)
+	{
+		uint64_t length;
+		if (!read_varint(file, length) || length > STATS_MAX_NAME)
+			return false;
+
+		name.resize((size_t)length);
+		if (!file.read(&name[0], length))
+			return false;
+	}
+
+	uint64_t size;
+	uint64_t* c = read.counts();
+	if (!read_varint(file, size) || size != read.m_Counts.size() - STATS_PADDING * 2)
+		return false;
+	for (size_t k = 0; k < size; ++k)
+	{
+		if (!read_varint(file, c[k]))
+			return false;
+	}
+
+	stats = move(read);
+	shard = { header.fingerprint, header.shard_index, header.shard_count };
+	names = move(read_names);
+	return true;
+}
@@ -0,0 +1,1121 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include "../include/sweep.h"
+#include "../include/behavior.h"
+#include "../include/gamedata.h"
+#include "../include/parallel.h"
+#include "../include/solver.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace battle;
+
+
+bool SweepParameter::parse(const string& text, string& error)
+{
+	size_t equals = text.find('=');
+	size_t dot = equals == string::npos ? string::npos : text.rfind('.', equals);
+	if (dot == string::npos || dot == 0)
+	{
+		error = "\"" + text + "\" is not in the form item.field=values";
+		return false;
+	}
+
+	item = text.substr(0, dot);
+	field = text.substr(dot + 1, equals - dot - 1);
+	values.clear();
+
+	static const char* const fields[] = SWEEP_FIELDS;
+	if (find_if(begin(fields), end(fields), [&](const char* name) { return field == name; }) == end(fields))
+	{
+		error = "\"" + field + "\" is not an item field that can be swept";
+		return false;
+	}
+
+	string list = text.substr(equals + 1);
+	size_t range = list.find("..");
+	if (range != string::npos)
+	{
+		low = data::parse_int(list.substr(0, range));
+		high = data::parse_int(list.substr(range + 2));
+		if (high < low)
+			swap(low, high);
+		return true;
+	}
+
+	for (size_t start = 0; start <= list.size();)
+	{
+		size_t comma = min(list.find(',', start), list.size());
+		if (list.find_first_not_of(" \t", start) < comma)
+			values.push_back(data::parse_int(string_view(list).substr(start, comma - start)));
+		start = comma + 1;
+	}
+	if (values.empty())
+	{
+		error = "\"" + text + "\" has no values";
+		return false;
+	}
+	return true;
+}
+
+/// <summary>Gets one of the values of a parameter.</summary>
+/// <param name="parameter">The parameter.</param>
+/// <param name="index">The index of the value, from 0 to count - 1.</param>
+/// <param name="count">The number of values to split ranges into.</param>
+int parameter_value(const SweepParameter& parameter, int index, int count)
+{
+	if (!parameter.values.empty())
+		return parameter.values[index];
+	return count <= 1 ? parameter.low : parameter.low + (int)((int64_t)(parameter.high - parameter.low) * index / (count - 1));
+}
+
+vector<vector<int>> battle::sweep_grid(const vector<SweepParameter>& parameters, int steps)
+{
+	vector<int> counts(parameters.size());
+	size_t total = 1;
+	for (size_t k = 0; k < parameters.size(); ++k)
+	{
+		counts[k] = parameters[k].values.empty() ? max(steps, 1) : (int)parameters[k].values.size();
+		total *= counts[k];
+	}
+
+	// Count through the combinations with the last parameter changing fastest
+	vector<vector<int>> configurations(total, vector<int>(parameters.size()));
+	for (size_t n = 0; n < total; ++n)
+	{
+		size_t rest = n;
+		for (size_t k = parameters.size(); k-- > 0;)
+		{
+			configurations[n][k] = parameter_value(parameters[k], rest % counts[k], counts[k]);
+			rest /= counts[k];
+		}
+	}
+	return configurations;
+}
+
+vector<vector<int>> battle::sweep_latin_hypercube(const vector<SweepParameter>& parameters, int samples, uint64_t seed)
+{
+	SimRandom random(seed);
+	vector<vector<int>> configurations(samples, vector<int>(parameters.size()));
+
+	vector<int> strata(samples);
+	for (size_t k = 0; k < parameters.size(); ++k)
+	{
+		// Each sample takes a different stratum of each parameter, in a random order
+		for (int n = 0; n < samples; ++n)
+			strata[n] = n;
+		for (int n = samples - 1; n > 0; --n)
+			swap(strata[n], strata[random.below(n + 1)]);
+
+		const SweepParameter& parameter = parameters[k];
+		for (int n = 0; n < samples; ++n)
+		{
+			// Pick a point within the stratum
+			double position = (strata[n] + (random.next() >> 11) * (1.0 / 9007199254740992.0)) / samples;
+			if (!parameter.values.empty())
+				configurations[n][k] = parameter.values[min((size_t)(position * parameter.values.size()), parameter.values.size() - 1)];
+			else
+				configurations[n][k] = min(parameter.high, parameter.low + (int)(position * (parameter.high - parameter.low + 1)));
+		}
+	}
+	return configurations;
+}
+
+
+ItemPatcher::ItemPatcher(const char* path) : m_File(path)
+{
+	for (size_t k = 0; k < m_File.size(); ++k)
+		m_Records.emplace(string(m_File[k].id), k);
+}
+
+unique_ptr<overworld::Item> ItemPatcher::patch(const string& id, const vector<pair<string, int>>& fields) const
+{
+	auto iter = m_Records.find(id);
+	if (iter == m_Records.end())
+		return nullptr;
+
+	// Copy the fields of the record, changing or adding the patched ones
+	data::Record original = m_File[iter->second];
+	vector<data::Field> patched(original.fields, original.fields + original.count);
+
+	vector<string> values;
+	values.reserve(fields.size());
+	for (auto field = fields.begin(); field != fields.end(); ++field)
+	{
+		values.push_back(to_string(field->second));
+
+		auto existing = find_if(patched.begin(), patched.end(), [&](const data::Field& f) { return f.key == field->first; });
+		if (existing != patched.end())
+			existing->value = values.back();
+		else
+			patched.push_back(data::Field{ field->first, values.back() });
+	}
+
+	return unique_ptr<overworld::Item>(overworld::Item::parse(data::Record{ original.id, patched.data(), patched.size() }));
+}
+
+
+uint64_t battle::battle_seed(uint64_t seed, uint64_t configuration, uint64_t battle)
+{
+	SimRandom mixer(seed ^ (configuration * 0xD1B54A32D192ED03ull));
+	return mixer.next() + battle * 0x9E3779B97F4A7C15ull;
+}
+
+/// <summary>Sums the Health and Shield of each side.</summary>
+void side_totals(const BattleSnapshot& snapshot, int totals[2])
+{
+	totals[0] = totals[1] = 0;
+	for (size_t k = 0; k < snapshot.size(); ++k)
+		totals[snapshot[k].side != 0] += max(snapshot[k].cur_health, 0) + snapshot[k].cur_shield;
+}
+
+SweepOutcome battle::random_battle(const vector<overworld::Ally>& allies, const vector<string>& enemies, UsableTable& usables, uint64_t seed, int max_turns)
+{
+	SimRandom random(seed);
+	BattleSnapshot snapshot = BattleSnapshot::create(allies, enemies, usables, random);
+
+	int before[2], after[2];
+	side_totals(snapshot, before);
+
+	RandomPolicy side0(random.next());
+	ScriptedPolicy side1(enemy_scripts(allies.size(), enemies), random.next());
+	int winner = simulate(snapshot, side0, side1, max_turns);
+
+	side_totals(snapshot, after);
+	return SweepOutcome{ (int8_t)winner, (uint16_t)snapshot.turns(), before[0] - after[0], before[1] - after[1] };
+}
+
+
+/// <summary>Mixes a value into the key of some battles.</summary>
+uint64_t mix_key(uint64_t key, uint64_t value)
+{
+	SimRandom mixer(key ^ value);
+	return mixer.next();
+}
+
+uint64_t battle::battle_key(const vector<overworld::Ally>& allies, const vector<string>& enemies, const unordered_map<const overworld::Item*, uint64_t>& checksums, const BattleSnapshot& snapshot, uint64_t first_seed, int max_turns)
+{
+	const data::Registry& registry = data::get_registry();
+	auto item_checksum = [&](const overworld::Item* item) -> uint64_t
+	{
+		auto iter = checksums.find(item);
+		return iter != checksums.end() ? iter->second : (item ? item->checksum : 0);
+	};
+
+	// Entities act at random or from their behavior scripts, whose text is in the enemies' checksums, so the records are all that matter of the game data
+	uint64_t key = mix_key(SWEEP_RULES_VERSION, first_seed);
+	for (auto ally = allies.begin(); ally != allies.end(); ++ally)
+	{
+		key = mix_key(key, (uint64_t)(uint32_t)ally->cur_health << 32 | (uint32_t)ally->max_health);
+		key = mix_key(key, ally->items.size());
+		for (auto item = ally->items.begin(); item != ally->items.end(); ++item)
+			key = mix_key(key, item_checksum(*item));
+	}
+	for (auto id = enemies.begin(); id != enemies.end(); ++id)
+	{
+		const EnemyTemplate* enemy = registry.get_enemy(*id);
+		key = mix_key(key, enemy ? enemy->checksum : 0);
+		for (size_t k = 0; enemy && k < enemy->items.size(); ++k)
+			key = mix_key(key, item_checksum(registry.get_item(enemy->items[k])));
+	}
+
+	// The usables cover changes to how items are turned into effects
+	return mix_key(key, WinSolver::fingerprint(snapshot, max_turns));
+}
+
+// The start of a record in a sweep's journal.
+struct JournalRecord
+{
+	uint64_t key;
+	uint32_t first;
+	uint32_t count;
+	uint64_t checksum;
+};
+
+// The outcome of a battle in a sweep's journal or result cache.
+struct PackedOutcome
+{
+	int32_t winner;
+	int32_t turns;
+	int32_t party_damage;
+	int32_t enemy_damage;
+};
+
+/// <summary>Packs the outcome of a battle for a file.</summary>
+PackedOutcome pack_outcome(const SweepOutcome& outcome)
+{
+	return PackedOutcome{ outcome.winner, outcome.turns, outcome.party_damage, outcome.enemy_damage };
+}
+
+/// <summary>Unpacks the outcome of a battle read from a file.</summary>
+SweepOutcome unpack_outcome(const PackedOutcome& outcome)
+{
+	return SweepOutcome{ (int8_t)outcome.winner, (uint16_t)outcome.turns, outcome.party_damage, outcome.enemy_damage };
+}
+
+// The start of an entry in a sweep's result cache.
+struct CacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key;
+	uint64_t count;
+	uint64_t checksum;
+};
+
+/// <summary>Finds the checksum of a journal record or cache entry, over everything in it up to the checksum and then the outcomes.</summary>
+template <class Header>
+uint64_t outcome_checksum(const Header& header, const vector<PackedOutcome>& outcomes)
+{
+	uint64_t hash = data::fnv1a(FNV1A_OFFSET, &header, offsetof(Header, checksum));
+	return data::fnv1a(hash, outcomes.data(), outcomes.size() * sizeof(PackedOutcome));
+}
+
+/// <summary>Waits for everything written to a file to reach the disk, so that it survives the machine stopping.</summary>
+bool sync_file(FILE* file)
+{
+	if (fflush(file) != 0)
+		return false;
+#ifdef _WIN32
+	return _commit(_fileno(file)) == 0;
+#else
+	return fsync(fileno(file)) == 0;
+#endif
+}
+
+
+string ResultCache::path(uint64_t key) const
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.sim", (unsigned long long)key);
+	return (filesystem::path(m_Directory) / name).string();
+}
+
+bool ResultCache::open(const string& directory, string& error)
+{
+	error_code code;
+	filesystem::create_directories(directory, code);
+	if (code)
+	{
+		error = "Could not create \"" + directory + "\"";
+		return false;
+	}
+	m_Directory = directory;
+	return true;
+}
+
+bool ResultCache::is_open() const
+{
+	return !m_Directory.empty();
+}
+
+bool ResultCache::read(uint64_t key, vector<SweepOutcome>& outcomes) const
+{
+	outcomes.clear();
+	FILE* file = is_open() ? fopen(path(key).c_str(), "rb") : nullptr;
+	if (!file)
+		return false;
+
+	CacheHeader header;
+	vector<PackedOutcome> packed;
+	bool valid = fread(&header, sizeof(header), 1, file) == 1 && header.magic == SWEEP_CACHE_MAGIC && header.version == SWEEP_CACHE_VERSION && header.key == key && header.count <= UINT32_MAX;
+	if (valid)
+	{
+		packed.resize((size_t)header.count);
+		valid = fread(packed.data(), sizeof(PackedOutcome), packed.size(), file) == packed.size() && outcome_checksum(header, packed) == header.checksum;
+	}
+	fclose(file);
+	if (!valid)
+		return false;
+
+	outcomes.reserve(packed.size());
+	for (auto outcome = packed.begin(); outcome != packed.end(); ++outcome)
+		outcomes.push_back(unpack_outcome(*outcome));
+	return true;
+}
+
+bool ResultCache::write(uint64_t key, const SweepOutcome* outcomes, size_t count) const
+{
+	if (!is_open())
+		return false;
+
+	vector<PackedOutcome> packed(count);
+	for (size_t n = 0; n < count; ++n)
+		packed[n] = pack_outcome(outcomes[n]);
+
+	CacheHeader header = { SWEEP_CACHE_MAGIC, SWEEP_CACHE_VERSION, key, count, 0 };
+	header.checksum = outcome_checksum(header, packed);
+
+	// Other processes may be writing the same entry, so each temporary file has a name of its own
+	static atomic<uint64_t> counter(0);
+	SimRandom random((uint64_t)chrono::steady_clock::now().time_since_epoch().count() ^ (uint64_t)(uintptr_t)&header ^ counter++);
+
+	string target = path(key);
+	string temp = target + "." + to_string(random.next()) + ".tmp";
+	FILE* file = fopen(temp.c_str(), "wb");
+	bool written = file && fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(packed.data(), sizeof(PackedOutcome), count, file) == count;
+	if (file)
+	{
+		written = sync_file(file) && written;
+		fclose(file);
+	}
+
+	// Renaming over the old entry replaces it at once where the system allows it
+	if (written && rename(temp.c_str(), target.c_str()) != 0)
+	{
+		remove(target.c_str());
+		written = rename(temp.c_str(), target.c_str()) == 0;
+	}
+	if (!written)
+		remove(temp.c_str());
+	return written;
+}
+
+
+void battle::wilson_interval(unsigned int wins, unsigned int battles, double interval[2])
+{
+	if (battles == 0)
+	{
+		interval[0] = 0;
+		interval[1] = 1;
+		return;
+	}
+
+	double z2 = SWEEP_CONFIDENCE_Z * SWEEP_CONFIDENCE_Z;
+	double p = (double)wins / battles;
+	double center = (p + z2 / (2 * battles)) / (1 + z2 / battles);
+	double half = SWEEP_CONFIDENCE_Z * sqrt(p * (1 - p) / battles + z2 / (4.0 * battles * battles)) / (1 + z2 / battles);
+	interval[0] = max(0.0, center - half);
+	interval[1] = min(1.0, center + half);
+}
+
+
+Sweep::Sweep(const vector<SweepParameter>& parameters, const vector<vector<int>>& configurations, const vector<overworld::Ally>& allies, const vector<string>& enemies, const ItemPatcher& patcher, const SweepOptions& options)
+	: m_Parameters(parameters), m_Configurations(configurations), m_Allies(allies), m_Enemies(enemies), m_Options(options)
+{
+	const data::Registry& registry = data::get_registry();
+
+	for (auto configuration = m_Configurations.begin(); configuration != m_Configurations.end(); ++configuration)
+	{
+		unordered_map<const overworld::Item*, uint64_t> checksums;
+		UsableTable* table = new UsableTable();
+		m_Tables.emplace_back(table);
+
+		// Patch each item once, with every field swept for it
+		vector<pair<string, vector<pair<string, int>>>> items;
+		for (size_t k = 0; k < m_Parameters.size(); ++k)
+		{
+			auto item = find_if(items.begin(), items.end(), [&](const pair<string, vector<pair<string, int>>>& i) { return i.first == m_Parameters[k].item; });
+			if (item == items.end())
+				item = items.insert(items.end(), make_pair(m_Parameters[k].item, vector<pair<string, int>>()));
+			item->second.emplace_back(m_Parameters[k].field, (*configuration)[k]);
+		}
+
+		// Without common random numbers, battles are seeded by the patched records rather than the configuration's place in the list, so that the same configuration runs the same battles in any sweep. The sum doesn't depend on the order of the items.
+		uint64_t stream = 0;
+		for (auto item = items.begin(); item != items.end(); ++item)
+		{
+			const overworld::Item* original = registry.get_item(item->first);
+			unique_ptr<overworld::Item> patched = patcher.patch(item->first, item->second);
+			if (original && patched)
+			{
+				table->replace(original, patched.get());
+				checksums[original] = patched->checksum;
+				stream += mix_key(data::fnv1a(FNV1A_OFFSET, item->first.data(), item->first.size()), patched->checksum);
+			}
+		}
+		m_Streams.push_back(m_Options.common_random_numbers ? 0 : stream);
+
+		// Add every other usable now, so that the threads only ever read from the table
+		SimRandom random(0);
+		BattleSnapshot snapshot = BattleSnapshot::create(m_Allies, m_Enemies, *table, random);
+
+		m_Keys.push_back(battle_key(m_Allies, m_Enemies, checksums, snapshot, battle_seed(m_Options.seed, m_Streams.back(), 0), m_Options.max_turns));
+	}
+
+	// The keys cover the battles themselves, and the options cover how many of them each configuration runs
+	double rules[4] = { m_Options.interval_width, m_Options.sprt_delta, m_Options.sprt_alpha, m_Options.sprt_beta };
+	m_Fingerprint = mix_key(SWEEP_PARTIAL_VERSION, m_Configurations.size());
+	for (uint64_t key : m_Keys)
+		m_Fingerprint = mix_key(m_Fingerprint, key);
+	m_Fingerprint = mix_key(m_Fingerprint, (uint64_t)m_Options.battles << 32 | m_Options.batch);
+	m_Fingerprint = mix_key(m_Fingerprint, data::fnv1a(FNV1A_OFFSET, rules, sizeof(rules)));
+	m_Fingerprint = mix_key(m_Fingerprint, m_Options.shard_count);
+
+	m_Outcomes.assign(m_Configurations.size() * m_Options.battles, SweepOutcome{ -1, 0, 0, 0 });
+	m_Known.assign(m_Outcomes.size(), 0);
+	m_Cached.assign(m_Configurations.size(), 0);
+}
+
+Sweep::~Sweep()
+{
+	if (m_Journal)
+		fclose(m_Journal);
+}
+
+bool Sweep::open_journal(const string& path, string& error)
+{
+	if (m_Journal)
+	{
+		fclose(m_Journal);
+		m_Journal = nullptr;
+	}
+
+	unordered_multimap<uint64_t, size_t> configurations;
+	for (size_t k = 0; k < m_Keys.size(); ++k)
+		configurations.emplace(m_Keys[k], k);
+
+	// Read every record that was written in full
+	uint32_t header[2] = { SWEEP_JOURNAL_MAGIC, SWEEP_JOURNAL_VERSION };
+	size_t valid = 0;
+	bool torn = false;
+
+	FILE* file = fopen(path.c_str(), "rb");
+	if (file)
+	{
+		uint32_t existing[2];
+		size_t length = fread(existing, 1, sizeof(existing), file);
+		if ((length > 0 && length < sizeof(existing)) || (length == sizeof(existing) && existing[0] != SWEEP_JOURNAL_MAGIC))
+		{
+			fclose(file);
+			error = "\"" + path + "\" is not a sweep journal";
+			return false;
+		}
+		if (length == sizeof(existing) && existing[1] != SWEEP_JOURNAL_VERSION)
+		{
+			fclose(file);
+			error = "\"" + path + "\" was written by a different version of the sweep";
+			return false;
+		}
+
+		// Journals are created with their header in place, so only an empty file has none
+		torn = length == 0;
+		valid = torn ? 0 : sizeof(existing);
+
+		JournalRecord record;
+		vector<PackedOutcome> outcomes;
+		while (!torn)
+		{
+			length = fread(&record, 1, sizeof(record), file);
+			if (length == 0)
+				break;
+
+			torn = length != sizeof(record) || record.count == 0 || record.count > SWEEP_JOURNAL_RANGE;
+			if (!torn)
+			{
+				outcomes.resize(record.count);
+				torn = fread(outcomes.data(), sizeof(PackedOutcome), record.count, file) != record.count || outcome_checksum(record, outcomes) != record.checksum;
+			}
+			if (torn)
+				break;
+			valid += sizeof(record) + record.count * sizeof(PackedOutcome);
+
+			// Two configurations with the same key have the same outcomes
+			auto range = configurations.equal_range(record.key);
+			for (auto iter = range.first; iter != range.second; ++iter)
+			{
+				for (uint32_t n = 0; n < record.count && record.first + n < m_Options.battles; ++n)
+				{
+					size_t index = iter->second * m_Options.battles + record.first + n;
+					if (m_Known[index])
+						continue;
+
+					m_Outcomes[index] = unpack_outcome(outcomes[n]);
+					m_Known[index] = 1;
+					++m_Resumed;
+				}
+			}
+		}
+		fclose(file);
+	}
+
+	// Start a new journal, or copy the records that were written in full to replace one that an interruption left half-written
+	if (!file || torn)
+	{
+		string temp = path + ".tmp";
+		FILE* source = file ? fopen(path.c_str(), "rb") : nullptr;
+		FILE* target = fopen(temp.c_str(), "wb");
+		bool written = target != nullptr;
+		if (written && valid == 0)
+			written = fwrite(header, sizeof(header), 1, target) == 1;
+
+		char buffer[1 << 16];
+		for (size_t left = valid; written && left > 0;)
+		{
+			size_t size = min(left, sizeof(buffer));
+			written = source && fread(buffer, 1, size, source) == size && fwrite(buffer, 1, size, target) == size;
+			left -= size;
+		}
+
+		if (source)
+			fclose(source);
+		if (target)
+		{
+			written = sync_file(target) && written;
+			fclose(target);
+		}
+
+		// A torn journal is replaced, which on some systems needs it to be removed first
+		if (written && file)
+			written = remove(path.c_str()) == 0;
+		if (!written || rename(temp.c_str(), path.c_str()) != 0)
+		{
+			remove(temp.c_str());
+			error = "Could not write \"" + path + "\"";
+			return false;
+		}
+	}
+
+	m_Journal = fopen(path.c_str(), "ab");
+	if (!m_Journal)
+	{
+		error = "Could not open \"" + path + "\"";
+		return false;
+	}
+	m_Synced = chrono::steady_clock::now();
+	return true;
+}
+
+void Sweep::journal(size_t configuration, unsigned int first, unsigned int count)
+{
+	if (!m_Journal || count == 0)
+		return;
+
+	vector<PackedOutcome> outcomes(count);
+	for (unsigned int n = 0; n < count; ++n)
+		outcomes[n] = pack_outcome(m_Outcomes[configuration * m_Options.battles + first + n]);
+
+	JournalRecord record = { m_Keys[configuration], first, count, 0 };
+	record.checksum = outcome_checksum(record, outcomes);
+
+	// Flushing every record keeps it if the process is killed, but reaching the disk can wait
+	lock_guard<mutex> lock(m_JournalLock);
+	bool written = fwrite(&record, sizeof(record), 1, m_Journal) == 1 && fwrite(outcomes.data(), sizeof(PackedOutcome), count, m_Journal) == count && fflush(m_Journal) == 0;
+	m_JournalIntact = m_JournalIntact && written;
+	sync_journal(false);
+}
+
+bool Sweep::open_cache(const string& directory, string& error)
+{
+	if (!m_Cache.open(directory, error))
+		return false;
+	m_Cached.assign(m_Keys.size(), 0);
+
+	vector<SweepOutcome> outcomes;
+	for (size_t k = 0; k < m_Keys.size(); ++k)
+	{
+		if (!m_Cache.read(m_Keys[k], outcomes))
+			continue;
+
+		m_Cached[k] = (unsigned int)outcomes.size();
+		for (unsigned int n = 0; n < outcomes.size() && n < m_Options.battles; ++n)
+		{
+			size_t index = k * m_Options.battles + n;
+			if (m_Known[index])
+				continue;
+
+			m_Outcomes[index] = outcomes[n];
+			m_Known[index] = 1;
+			++m_CacheHits;
+		}
+	}
+	return true;
+}
+
+bool Sweep::write_cache()
+{
+	if (!m_Cache.is_open())
+		return true;
+
+	bool written = true;
+	for (size_t k = 0; k < m_Keys.size(); ++k)
+	{
+		unsigned int count = 0;
+		while (count < m_Options.battles && m_Known[k * m_Options.battles + count])
+			++count;
+		if (count <= m_Cached[k])
+			continue;
+
+		bool entry = m_Cache.write(m_Keys[k], &m_Outcomes[k * m_Options.battles], count);
+		if (entry)
+			m_Cached[k] = count;
+		written = written && entry;
+	}
+	return written;
+}
+
+void Sweep::sync_journal(bool force)
+{
+	auto now = chrono::steady_clock::now();
+	if (!m_Journal || (!force && chrono::duration<double>(now - m_Synced).count() < SWEEP_JOURNAL_SYNC))
+		return;
+
+	m_JournalIntact = sync_file(m_Journal) && m_JournalIntact;
+	m_Synced = now;
+}
+
+SweepOutcome Sweep::run_battle(size_t configuration, uint64_t battle) const
+{
+	return random_battle(m_Allies, m_Enemies, *m_Tables[configuration], battle_seed(m_Options.seed, m_Streams[configuration], battle), m_Options.max_turns);
+}
+
+bool Sweep::owned(size_t configuration) const
+{
+	return configuration % m_Options.shard_count == m_Options.shard_index || (configuration == 0 && m_Options.sprt_delta > 0);
+}
+
+bool Sweep::active(size_t configuration) const
+{
+	if (!owned(configuration) || m_Done[configuration] >= m_Options.battles)
+		return false;
+
+	bool interval = m_Options.interval_width > 0;
+	bool sprt = m_Options.sprt_delta > 0;
+	if (!interval && !sprt)
+		return true;
+
+	// Every rule in use has to be able to stop the configuration
+	bool stop = true;
+	if (interval)
+	{
+		unsigned int wins = 0;
+		for (size_t k = configuration * m_Options.battles; k < configuration * m_Options.battles + m_Done[configuration]; ++k)
+			wins += m_Outcomes[k].winner == 0;
+
+		double bounds[2];
+		wilson_interval(wins, m_Done[configuration], bounds);
+		stop = bounds[1] - bounds[0] < m_Options.interval_width;
+	}
+
+	if (sprt && configuration > 0)
+		stop = stop && m_Decisions[configuration] != 0;
+	else if (sprt)
+	{
+		// The first configuration keeps going for as long as any comparison with it in this shard needs more battles
+		for (size_t k = 1; k < m_Configurations.size() && stop; ++k)
+			stop = !owned(k) || m_Decisions[k] != 0 || m_Done[k] >= m_Options.battles;
+	}
+
+	return !stop;
+}
+
+void Sweep::run(unsigned int threads)
+{
+	size_t count = m_Configurations.size();
+	m_Done.assign(count, 0);
+	m_Decisions.assign(count, 0);
+	m_Run = 0;
+
+	unsigned int batch = m_Options.batch == 0 ? m_Options.battles : m_Options.batch;
+	double step = log((0.5 + m_Options.sprt_delta) / (0.5 - m_Options.sprt_delta));
+	double upper = log((1 - m_Options.sprt_beta) / m_Options.sprt_alpha);
+	double lower = log(m_Options.sprt_beta / (1 - m_Options.sprt_alpha));
+
+	while (true)
+	{
+		// Gather the next batch of every configuration that hasn't stopped, leaving out battles read from the journal
+		vector<pair<size_t, unsigned int>> jobs;
+		bool progress = false;
+		for (size_t k = 0; k < count; ++k)
+		{
+			if (!active(k))
+				continue;
+
+			unsigned int last = min(m_Done[k] + batch, m_Options.battles);
+			for (unsigned int battle = m_Done[k]; battle < last; ++battle)
+			{
+				if (!m_Known[k * m_Options.battles + battle])
+					jobs.emplace_back(k, battle);
+			}
+			m_Done[k] = last;
+			progress = true;
+		}
+		if (!progress)
+			break;
+		m_Run += jobs.size();
+
+		// Every battle has its own seed, so the results are the same however the work is split
+		parallel_for(jobs.size(), threads, [&](unsigned int, size_t first, size_t last)
+			{
+				size_t start = first;
+				for (size_t k = first; k < last; ++k)
+				{
+					size_t index = jobs[k].first * m_Options.battles + jobs[k].second;
+					m_Outcomes[index] = run_battle(jobs[k].first, jobs[k].second);
+					m_Known[index] = 1;
+
+					// Journal each run of consecutive battles of a configuration once it ends or fills a record
+					bool end = k + 1 == last || jobs[k + 1].first != jobs[k].first || jobs[k + 1].second != jobs[k].second + 1;
+					if (end || k + 1 - start == SWEEP_JOURNAL_RANGE)
+					{
+						journal(jobs[start].first, jobs[start].second, (unsigned int)(k + 1 - start));
+						start = k + 1;
+					}
+				}
+			}
+		);
+
+		// Test each configuration against the first, on the battles both have run
+		if (m_Options.sprt_delta <= 0)
+			continue;
+
+		for (size_t k = 1; k < count; ++k)
+		{
+			if (m_Decisions[k] != 0)
+				continue;
+
+			int difference = 0;
+			unsigned int paired = min(m_Done[0], m_Done[k]);
+			for (unsigned int battle = 0; battle < paired; ++battle)
+			{
+				bool won = m_Outcomes[k * m_Options.battles + battle].winner == 0;
+				bool baseline_won = m_Outcomes[battle].winner == 0;
+				difference += (int)won - (int)baseline_won;
+			}
+
+			double ratio = difference * step;
+			if (ratio >= upper)
+				m_Decisions[k] = 1;
+			else if (ratio <= lower)
+				m_Decisions[k] = -1;
+		}
+	}
+
+	lock_guard<mutex> lock(m_JournalLock);
+	sync_journal(true);
+}
+
+size_t Sweep::battles_used() const
+{
+	size_t total = 0;
+	for (unsigned int done : m_Done)
+		total += done;
+	return total;
+}
+
+size_t Sweep::battles_run() const
+{
+	return m_Run;
+}
+
+size_t Sweep::battles_resumed() const
+{
+	return m_Resumed;
+}
+
+size_t Sweep::battles_cached() const
+{
+	return m_CacheHits;
+}
+
+bool Sweep::journal_intact() const
+{
+	return m_JournalIntact;
+}
+
+/// <summary>Finds the mean and the 10th, 50th and 90th percentile of some values.</summary>
+void describe(vector<int>& values, double stats[4])
+{
+	if (values.empty())
+	{
+		fill(stats, stats + 4, 0.0);
+		return;
+	}
+
+	double sum = 0;
+	for (int value : values)
+		sum += value;
+	stats[0] = sum / values.size();
+
+	sort(values.begin(), values.end());
+	stats[1] = values[(values.size() - 1) / 10];
+	stats[2] = values[(values.size() - 1) / 2];
+	stats[3] = values[(values.size() - 1) * 9 / 10];
+}
+
+SweepSummary Sweep::summarise(size_t configuration) const
+{
+	SweepSummary summary = {};
+	vector<int> party_damage, enemy_damage;
+
+	size_t first = configuration * m_Options.battles;
+	for (size_t k = first; configuration < m_Done.size() && k < first + m_Done[configuration]; ++k)
+	{
+		const SweepOutcome& outcome = m_Outcomes[k];
+		++summary.battles;
+		summary.wins += outcome.winner == 0;
+		summary.turns += outcome.turns;
+		party_damage.push_back(outcome.party_damage);
+		enemy_damage.push_back(outcome.enemy_damage);
+	}
+
+	if (summary.battles > 0)
+		summary.turns /= summary.battles;
+	wilson_interval(summary.wins, summary.battles, summary.interval);
+	summary.decision = configuration < m_Decisions.size() ? m_Decisions[configuration] : 0;
+	describe(party_damage, summary.party_damage);
+	describe(enemy_damage, summary.enemy_damage);
+	return summary;
+}
+
+string battle::csv_field(const string& value)
+{
+	if (value.find_first_of(",\"\n") == string::npos)
+		return value;
+
+	string quoted = "\"";
+	for (char c : value)
+	{
+		if (c == '"')
+			quoted += '"';
+		quoted += c;
+	}
+	return quoted + "\"";
+}
+
+bool Sweep::write_csv(const string& path) const
+{
+	ofstream file(path, ios::out | ios::trunc);
+	if (!file)
+		return false;
+
+	file << "configuration";
+	for (auto parameter = m_Parameters.begin(); parameter != m_Parameters.end(); ++parameter)
+		file << ',' << csv_field(parameter->item + "." + parameter->field);
+	file << ",battles,wins,win_rate,win_rate_low,win_rate_high,mean_turns";
+	for (const char* side : { "party", "enemy" })
+		file << ',' << side << "_damage_mean," << side << "_damage_p10," << side << "_damage_p50," << side << "_damage_p90";
+	if (m_Options.sprt_delta > 0)
+		file << ",versus_first";
+	file << '\n';
+
+	for (size_t k = 0; k < m_Configurations.size(); ++k)
+	{
+		SweepSummary summary = summarise(k);
+
+		file << k;
+		for (int value : m_Configurations[k])
+			file << ',' << value;
+		file << ',' << summary.battles << ',' << summary.wins << ',' << (summary.battles ? (double)summary.wins / summary.battles : 0.0) << ',' << summary.interval[0] << ',' << summary.interval[1] << ',' << summary.turns;
+		for (int n = 0; n < 4; ++n)
+			file << ',' << summary.party_damage[n];
+		for (int n = 0; n < 4; ++n)
+			file << ',' << summary.enemy_damage[n];
+		if (m_Options.sprt_delta > 0)
+			file << ',' << (k == 0 ? "baseline" : (summary.decision > 0 ? "better" : (summary.decision < 0 ? "worse" : "undecided")));
+		file << '\n';
+	}
+
+	return file.good();
+}
+
+bool Sweep::write_columns(const string& path) const
+{
+	ofstream file(path, ios::out | ios::binary | ios::trunc);
+	if (!file)
+		return false;
+
+	// Only the battles that were run are written, in order of configuration and then battle
+	vector<size_t> run;
+	for (size_t k = 0; k < m_Done.size(); ++k)
+	{
+		for (unsigned int battle = 0; battle < m_Done[k]; ++battle)
+			run.push_back(k * m_Options.battles + battle);
+	}
+
+	uint32_t rows = (uint32_t)run.size();
+	uint32_t header[4] = { SWEEP_MAGIC, SWEEP_VERSION, rows, (uint32_t)(6 + m_Parameters.size()) };
+	file.write((const char*)header, sizeof(header));
+
+	vector<int32_t> values(rows);
+	auto write_column = [&](const string& name, auto get)
+	{
+		uint32_t length = (uint32_t)name.size();
+		file.write((const char*)&length, sizeof(length));
+		file.write(name.data(), length);
+
+		for (uint32_t k = 0; k < rows; ++k)
+			values[k] = get(run[k]);
+		file.write((const char*)values.data(), values.size() * sizeof(int32_t));
+	};
+
+	unsigned int battles = m_Options.battles;
+	write_column("configuration", [&](size_t k) { return (int32_t)(k / battles); });
+	write_column("battle", [&](size_t k) { return (int32_t)(k % battles); });
+	for (size_t p = 0; p < m_Parameters.size(); ++p)
+		write_column(m_Parameters[p].item + "." + m_Parameters[p].field, [&](size_t k) { return (int32_t)m_Configurations[k / battles][p]; });
+	write_column("winner", [&](size_t k) { return (int32_t)m_Outcomes[k].winner; });
+	write_column("turns", [&](size_t k) { return (int32_t)m_Outcomes[k].turns; });
+	write_column("party_damage", [&](size_t k) { return (int32_t)m_Outcomes[k].party_damage; });
+	write_column("enemy_damage", [&](size_t k) { return (int32_t)m_Outcomes[k].enemy_damage; });
+
+	return file.good();
+}
+
+// The start of a partial results file.
+struct PartialHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t fingerprint;
+	uint32_t shard_index;
+	uint32_t shard_count;
+	uint32_t battles;
+	uint32_t sprt;
+	uint32_t parameters;
+	uint32_t configurations;
+};
+
+// The start of a configuration in a partial results file.
+struct PartialConfiguration
+{
+	uint64_t key;
+	uint32_t done;
+	int32_t decision;
+};
+
+/// <summary>Writes a string to a binary file, as a 32-bit length and the characters.</summary>
+void write_string(ostream& file, const string& value)
+{
+	uint32_t length = (uint32_t)value.size();
+	file.write((const char*)&length, sizeof(length));
+	file.write(value.data(), length);
+}
+
+/// <summary>Reads a string written by write_string().</summary>
+bool read_string(istream& file, string& value)
+{
+	uint32_t length;
+	if (!file.read((char*)&length, sizeof(length)) || length > 1024)
+		return false;
+
+	value.resize(length);
+	return length == 0 || file.read(&value[0], length);
+}
+
+bool Sweep::write_partial(const string& path) const
+{
+	string temp = path + ".tmp";
+	{
+		ofstream file(temp, ios::out | ios::binary | ios::trunc);
+		if (!file)
+			return false;
+
+		PartialHeader header = { SWEEP_PARTIAL_MAGIC, SWEEP_PARTIAL_VERSION, m_Fingerprint, m_Options.shard_index, m_Options.shard_count, m_Options.battles, m_Options.sprt_delta > 0, (uint32_t)m_Parameters.size(), (uint32_t)m_Configurations.size() };
+		file.write((const char*)&header, sizeof(header));
+
+		for (auto parameter = m_Parameters.begin(); parameter != m_Parameters.end(); ++parameter)
+		{
+			write_string(file, parameter->item);
+			write_string(file, parameter->field);
+		}
+
+		// Configurations from other shards are written with no battles, so that every partial file holds the whole list
+		vector<PackedOutcome> packed;
+		for (size_t k = 0; k < m_Configurations.size(); ++k)
+		{
+			unsigned int done = k < m_Done.size() ? m_Done[k] : 0;
+			PartialConfiguration configuration = { m_Keys[k], done, k < m_Decisions.size() ? m_Decisions[k] : 0 };
+			file.write((const char*)&configuration, sizeof(configuration));
+			file.write((const char*)m_Configurations[k].data(), m_Configurations[k].size() * sizeof(int32_t));
+
+			packed.resize(done);
+			for (unsigned int battle = 0; battle < done; ++battle)
+				packed[battle] = pack_outcome(m_Outcomes[k * m_Options.battles + battle]);
+			file.write((const char*)packed.data(), packed.size() * sizeof(PackedOutcome));
+		}
+
+		if (!file.good())
+			return false;
+	}
+
+	remove(path.c_str());
+	return rename(temp.c_str(), path.c_str()) == 0;
+}
+
+unique_ptr<Sweep> Sweep::read_partial(const string& path)
+{
+	ifstream file(path, ios::in | ios::binary);
+	if (!file)
+		return nullptr;
+
+	PartialHeader header;
+	if (!file.read((char*)&header, sizeof(header)) || header.magic != SWEEP_PARTIAL_MAGIC || header.version != SWEEP_PARTIAL_VERSION || header.shard_index >= header.shard_count || header.parameters == 0)
+		return nullptr;
+
+	unique_ptr<Sweep> sweep(new Sweep());
+	sweep->m_Fingerprint = header.fingerprint;
+	sweep->m_Options.battles = header.battles;
+	sweep->m_Options.sprt_delta = header.sprt ? 1 : 0;
+	sweep->m_Options.shard_index = header.shard_index;
+	sweep->m_Options.shard_count = header.shard_count;
+
+	sweep->m_Parameters.resize(header.parameters);
+	for (auto parameter = sweep->m_Parameters.begin(); parameter != sweep->m_Parameters.end(); ++parameter)
+	{
+		if (!read_string(file, parameter->item) || !read_string(file, parameter->field))
+			return nullptr;
+	}
+
+	vector<PackedOutcome> packed;
+	for (uint32_t k = 0; k < header.configurations; ++k)
+	{
+		PartialConfiguration configuration;
+		vector<int> values(header.parameters);
+		if (!file.read((char*)&configuration, sizeof(configuration)) || configuration.done > header.battles || !file.read((char*)values.data(), values.size() * sizeof(int32_t)))
+			return nullptr;
+
+		packed.resize(configuration.done);
+		if (!file.read((char*)packed.data(), packed.size() * sizeof(PackedOutcome)))
+			return nullptr;
+
+		sweep->m_Keys.push_back(configuration.key);
+		sweep->m_Configurations.push_back(move(values));
+		sweep->m_Done.push_back(configuration.done);
+		sweep->m_Decisions.push_back((int8_t)configuration.decision);
+
+		sweep->m_Outcomes.resize((size_t)(k + 1) * header.battles, SweepOutcome{ -1, 0, 0, 0 });
+		for (uint32_t battle = 0; battle < configuration.done; ++battle)
+			sweep->m_Outcomes[(size_t)k * header.battles + battle] = unpack_outcome(packed[battle]);
+	}
+
+	return sweep;
+}
+
+void Sweep::merge(const Sweep& other)
+{
+	for (size_t k = 0; k < m_Configurations.size() && k < other.m_Configurations.size(); ++k)
+	{
+		if (other.m_Done[k] <= m_Done[k])
+			continue;
+
+		size_t first = k * m_Options.battles;
+		copy(other.m_Outcomes.begin() + first, other.m_Outcomes.begin() + first + other.m_Done[k], m_Outcomes.begin() + first);
+		m_Done[k] = other.m_Done[k];
+		m_Decisions[k] = other.m_Decisions[k];
+	}
+}
+
+uint64_t Sweep::fingerprint() const
+{
+	return m_Fingerprint;
+}
+
+const SweepOptions& Sweep::options() const
+{
+	return m_Options;
+}
+
+size_t Sweep::size() const
+{
+	return m_Configurations.size();
+}
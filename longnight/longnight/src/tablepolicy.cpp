@@ -0,0 +1,522 @@
+#include <climits>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include "../include/tablepolicy.h"
+#include "../include/legalturn.h"
+#include "../include/parallel.h"
+
+using namespace std;
+using namespace battle;
+
+
+/// <summary>Quantises Health into a bucket.</summary>
+inline uint32_t health_bucket(int health, int max_health)
+{
+	if (max_health <= 0 || health <= 0)
+		return 0;
+	return (uint32_t)min(POLICY_HEALTH_BUCKETS - 1, health * POLICY_HEALTH_BUCKETS / max_health);
+}
+
+/// <summary>Quantises whether a stat is above, below, or at its base value.</summary>
+inline uint32_t trend(int current, int base)
+{
+	return current > base ? 2 : (current < base ? 1 : 0);
+}
+
+/// <summary>Quantises the state of a battle as seen by an entity.</summary>
+/// <param name="self">The entity taking its turn.</param>
+/// <param name="allies">The living entities on the same side, including the entity itself, in party order.</param>
+/// <param name="ally_count">The number of living allies.</param>
+/// <param name="opponents">The living entities on the other side, in party order.</param>
+/// <param name="opponent_count">The number of living opponents.</param>
+/// <returns>The feature key, in the low 32 bits.</returns>
+uint32_t encode_features(const SimEntity& self, const SimEntity* const* allies, int ally_count, const SimEntity* const* opponents, int opponent_count)
+{
+	uint32_t key = health_bucket(self.cur_health, self.max_health);
+	key |= (self.cur_shield > 0 ? 1u : 0u) << 2;
+	key |= (self.burn > 0 ? 1u : 0u) << 3;
+	key |= (self.toxin > 0 ? 1u : 0u) << 4;
+	key |= trend(self.cur_offense, self.base_offense) << 5;
+	key |= trend(self.cur_defense, self.base_defense) << 7;
+
+	// The other allies, and who is next in line among them
+	int others = 0, lowest = POLICY_HEALTH_BUCKETS - 1, ally_time = INT_MAX;
+	for (int k = 0; k < ally_count; ++k)
+	{
+		if (allies[k] == &self)
+			continue;
+
+		++others;
+		lowest = min(lowest, (int)health_bucket(allies[k]->cur_health, allies[k]->max_health));
+		ally_time = min(ally_time, allies[k]->time);
+	}
+	key |= (uint32_t)min(others, 3) << 9;
+	key |= (uint32_t)lowest << 11;
+
+	// The opponents
+	int opponent_time = INT_MAX;
+	bool shielded = false;
+	key |= (uint32_t)min(opponent_count, 3) << 13;
+	for (int k = 0; k < opponent_count; ++k)
+	{
+		if (k < POLICY_OPPONENTS)
+			key |= health_bucket(opponents[k]->cur_health, opponents[k]->max_health) << (15 + 2 * k);
+
+		shielded |= opponents[k]->cur_shield > 0;
+		opponent_time = min(opponent_time, opponents[k]->time);
+	}
+	key |= (shielded ? 1u : 0u) << 21;
+	key |= (opponent_time < ally_time ? 1u : 0u) << 22;
+
+	return key;
+}
+
+/// <summary>Finds the target with a given rank in Health, lowest first, with ties going to the earliest.</summary>
+/// <param name="health">The Health of each target.</param>
+/// <param name="count">The number of targets. Must be at least 1.</param>
+/// <param name="rank">The rank. Ranks past the last target pick the last target.</param>
+/// <returns>The index of the target.</returns>
+int ranked_target(const int* health, int count, int rank)
+{
+	rank = min(rank, count - 1);
+	for (int k = 0; k < count; ++k)
+	{
+		int lower = 0;
+		for (int j = 0; j < count; ++j)
+		{
+			if (health[j] < health[k] || (health[j] == health[k] && j < k))
+				++lower;
+		}
+		if (lower == rank)
+			return k;
+	}
+	return 0;
+}
+
+/// <summary>Lists the living entities on each side of a simulated battle, in party order.</summary>
+/// <returns>The number of allies of the actor, including the actor itself.</returns>
+int find_sides(const BattleSnapshot& snapshot, int actor, const SimEntity** allies, const SimEntity** opponents, int& opponent_count)
+{
+	int side = snapshot[actor].side;
+	int ally_count = 0;
+	opponent_count = 0;
+	for (int k = 0; k < (int)snapshot.size(); ++k)
+	{
+		const SimEntity& e = snapshot[k];
+		if ((e.flags & SIM_PRESENT) && e.cur_health > 0)
+		{
+			if (e.side == side)
+				allies[ally_count++] = &e;
+			else
+				opponents[opponent_count++] = &e;
+		}
+	}
+	return ally_count;
+}
+
+
+uint64_t battle::policy_features(const BattleSnapshot& snapshot, int actor)
+{
+	const SimEntity* allies[256];
+	const SimEntity* opponents[256];
+	int opponent_count;
+	int ally_count = find_sides(snapshot, actor, allies, opponents, opponent_count);
+	uint32_t features = encode_features(snapshot[actor], allies, ally_count, opponents, opponent_count);
+	return (snapshot.usables_fingerprint(actor) & 0xFFFFFFFF00000000ull) | features;
+}
+
+bool battle::policy_turn(const BattleSnapshot& snapshot, int actor, int action, SimRandom& random, SimTurn& turn)
+{
+	int slot = action / POLICY_TARGET_RANKS, rank = action % POLICY_TARGET_RANKS;
+	if (slot >= snapshot[actor].usable_count || count_turns(snapshot, actor, slot) == 0)
+		return false;
+
+	// Rank the targets on each side by Health
+	uint8_t allies[256], opponents[256];
+	int ally_health[256], opponent_health[256];
+	int ally_count = 0, opponent_count = 0;
+	int side = snapshot[actor].side;
+	for (int k = 0; k < (int)snapshot.size(); ++k)
+	{
+		const SimEntity& e = snapshot[k];
+		if (!(e.flags & SIM_PRESENT) || e.cur_health <= 0)
+			continue;
+
+		if (e.side == side)
+		{
+			ally_health[ally_count] = e.cur_health;
+			allies[ally_count++] = k;
+		}
+		else
+		{
+			opponent_health[opponent_count] = e.cur_health;
+			opponents[opponent_count++] = k;
+		}
+	}
+
+	turn.usable = slot;
+	turn.target_count = 0;
+
+	const SimUsable& usable = snapshot.usable(actor, slot);
+	for (int k = 0; k < usable.selection_count; ++k)
+	{
+		Target target = snapshot.usables().selection(usable, k).target;
+		if (target == TARGET_RANDOM_ENEMY)
+			turn.targets[turn.target_count++] = opponents[random.below(opponent_count)];
+		else if (target == TARGET_SINGLE_ENEMY)
+			turn.targets[turn.target_count++] = opponents[ranked_target(opponent_health, opponent_count, rank)];
+		else if (target == TARGET_SINGLE_ALLY)
+			turn.targets[turn.target_count++] = allies[ranked_target(ally_health, ally_count, rank)];
+	}
+	return true;
+}
+
+bool battle::policy_turn(Entity* user, int action, Turn& turn)
+{
+	turn.user = user;
+	turn.usable = nullptr;
+	turn.targets.clear();
+
+	// Find the usable in the same slot that snapshots capture it in
+	int slot = action / POLICY_TARGET_RANKS, rank = action % POLICY_TARGET_RANKS;
+	for (auto iter = user->usables.begin(); iter != user->usables.end() && !turn.usable; ++iter)
+	{
+		if (*iter && slot-- == 0)
+			turn.usable = *iter;
+	}
+
+	if (count_turns(user, turn.usable) == 0)
+	{
+		turn.usable = nullptr;
+		return false;
+	}
+
+	for (auto iter = turn.usable->targets.begin(); iter != turn.usable->targets.end(); ++iter)
+	{
+		if (iter->target == TARGET_RANDOM_ENEMY)
+		{
+			turn.targets.push_back(nth_target(user, iter->target, rand() % count_targets(user, iter->target)));
+		}
+		else if (iter->target == TARGET_SINGLE_ENEMY || iter->target == TARGET_SINGLE_ALLY)
+		{
+			int health[256];
+			int count = min(count_targets(user, iter->target), 256);
+			for (int k = 0; k < count; ++k)
+				health[k] = nth_target(user, iter->target, k)->cur_health;
+			turn.targets.push_back(nth_target(user, iter->target, ranked_target(health, count, rank)));
+		}
+	}
+	return true;
+}
+
+/// <summary>Lists the actions that are legal for an entity in a simulated battle, leaving out ranks that would pick the same targets as a lower rank.</summary>
+/// <param name="actions">Filled with the actions. Must hold POLICY_MAX_ACTIONS actions.</param>
+/// <returns>The number of actions.</returns>
+int legal_actions(const BattleSnapshot& snapshot, int actor, uint8_t* actions)
+{
+	int side = snapshot[actor].side;
+	int ally_count = 0, opponent_count = 0;
+	for (int k = 0; k < (int)snapshot.size(); ++k)
+	{
+		const SimEntity& e = snapshot[k];
+		if ((e.flags & SIM_PRESENT) && e.cur_health > 0)
+			++(e.side == side ? ally_count : opponent_count);
+	}
+
+	int count = 0;
+	for (int slot = 0; slot < snapshot[actor].usable_count; ++slot)
+	{
+		if (count_turns(snapshot, actor, slot) == 0)
+			continue;
+
+		// Ranks only matter for usables with chosen targets
+		int choices = 1;
+		const SimUsable& usable = snapshot.usable(actor, slot);
+		for (int k = 0; k < usable.selection_count; ++k)
+		{
+			Target target = snapshot.usables().selection(usable, k).target;
+			if (target == TARGET_SINGLE_ENEMY)
+				choices = max(choices, opponent_count);
+			else if (target == TARGET_SINGLE_ALLY)
+				choices = max(choices, ally_count);
+		}
+
+		for (int rank = 0; rank < min(choices, POLICY_TARGET_RANKS); ++rank)
+			actions[count++] = slot * POLICY_TARGET_RANKS + rank;
+	}
+	return count;
+}
+
+
+// The header of a policy table file. The slots follow straight after it.
+struct PolicyHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t bits;
+	uint32_t count;
+};
+
+PolicyTable::PolicyTable(unsigned int bits) : m_Bits(bits), m_Slots(bits == 0 ? 0 : (size_t)1 << bits, PolicyEntry{}) {}
+
+size_t PolicyTable::find(uint64_t key) const
+{
+	size_t mask = m_Slots.size() - 1;
+	size_t index = (size_t)((key * 0x9E3779B97F4A7C15ull) >> (64 - m_Bits));
+	while (m_Slots[index].key != 0 && m_Slots[index].key != key)
+		index = (index + 1) & mask;
+	return index;
+}
+
+void PolicyTable::insert(uint64_t features, uint8_t action, uint8_t confidence)
+{
+	uint64_t key = features | POLICY_KEY_USED;
+	PolicyEntry& entry = m_Slots[find(key)];
+	if (entry.key == 0)
+		++m_Count;
+	entry = { key, action, confidence, {} };
+}
+
+const PolicyEntry* PolicyTable::lookup(uint64_t features) const
+{
+	if (m_Slots.empty())
+		return nullptr;
+
+	const PolicyEntry& entry = m_Slots[find(features | POLICY_KEY_USED)];
+	return entry.key == 0 ? nullptr : &entry;
+}
+
+unsigned int PolicyTable::size() const
+{
+	return m_Count;
+}
+
+bool PolicyTable::save(const string& path) const
+{
+	ofstream file(path, ios::out | ios::binary | ios::trunc);
+	if (!file)
+		return false;
+
+	// Tables are written in the native byte order, since they are compiled on the same kind of machine that plays the game
+	PolicyHeader header = { POLICY_MAGIC, POLICY_VERSION, m_Bits, m_Count };
+	file.write((const char*)&header, sizeof(header));
+	file.write((const char*)m_Slots.data(), m_Slots.size() * sizeof(PolicyEntry));
+	return file.good();
+}
+
+bool PolicyTable::load(const string& path)
+{
+	m_Bits = 0;
+	m_Count = 0;
+	m_Slots.clear();
+
+	ifstream file(path, ios::in | ios::binary);
+	PolicyHeader header;
+	if (!file.read((char*)&header, sizeof(header)) || header.magic != POLICY_MAGIC || header.version != POLICY_VERSION || header.bits == 0 || header.bits > 28)
+		return false;
+
+	m_Slots.resize((size_t)1 << header.bits);
+	if (!file.read((char*)m_Slots.data(), m_Slots.size() * sizeof(PolicyEntry)))
+	{
+		m_Slots.clear();
+		return false;
+	}
+
+	// A full table would make searches for missing keys loop forever, so the slots are counted rather than trusting the header
+	size_t count = 0;
+	for (auto slot = m_Slots.begin(); slot != m_Slots.end(); ++slot)
+		count += slot->key != 0;
+	if (count != header.count || count >= m_Slots.size())
+	{
+		m_Slots.clear();
+		return false;
+	}
+
+	m_Bits = header.bits;
+	m_Count = header.count;
+	return true;
+}
+
+const PolicyTable* PolicyTable::get(const string& path)
+{
+	static mutex tables_mutex;
+	static unordered_map<string, unique_ptr<PolicyTable>> tables;
+
+	lock_guard<mutex> lock(tables_mutex);
+	auto iter = tables.find(path);
+	if (iter == tables.end())
+	{
+		// Files that fail to load are remembered too, so they are only tried once
+		unique_ptr<PolicyTable> table(new PolicyTable());
+		if (!table->load(path))
+			table.reset();
+		iter = tables.emplace(path, move(table)).first;
+	}
+	return iter->second.get();
+}
+
+
+TablePolicyAgent::TablePolicyAgent(Entity* self, const PolicyTable* table) : Agent(self), m_Table(table) {}
+
+void TablePolicyAgent::decide(Turn& turn)
+{
+	// Look the state up the same way training saw it
+	UsableTable usables;
+	BattleSnapshot snapshot = BattleSnapshot::capture(*m_Self->party, usables, nullptr, m_Self);
+	const PolicyEntry* entry = m_Table->lookup(policy_features(snapshot, snapshot.actor()));
+
+	// Act at random in states the table doesn't cover
+	if (!entry || !policy_turn(m_Self, entry->action, turn))
+		sample_turn(m_Self, turn);
+}
+
+
+TablePolicy::TablePolicy(const PolicyTable* table, uint64_t seed) : m_Table(table), m_Random(seed) {}
+
+SimTurn TablePolicy::choose(const BattleSnapshot& snapshot, int actor)
+{
+	SimTurn turn;
+	const PolicyEntry* entry = m_Table->lookup(policy_features(snapshot, actor));
+	if (!entry || !policy_turn(snapshot, actor, entry->action, m_Random, turn))
+		sample_turn(snapshot, actor, m_Random, turn);
+	return turn;
+}
+
+
+// A policy that follows a table, but sometimes explores a random action instead, and records every action it takes.
+class ExplorePolicy : public SimPolicy
+{
+private:
+	// The table of the best actions found so far.
+	const PolicyTable* m_Table;
+
+	// The probability of exploring, out of 2^24.
+	uint32_t m_Explore;
+
+	// The random number generator.
+	SimRandom& m_Random;
+
+public:
+	// The feature key and action of every decision made.
+	vector<pair<uint64_t, uint8_t>> decisions;
+
+	ExplorePolicy(const PolicyTable* table, float explore, SimRandom& random) : m_Table(table), m_Explore((uint32_t)(explore * (1 << 24))), m_Random(random) {}
+
+	SimTurn choose(const BattleSnapshot& snapshot, int actor)
+	{
+		SimTurn turn;
+		uint64_t key = policy_features(snapshot, actor);
+
+		const PolicyEntry* entry = m_Table->lookup(key);
+		if (entry && m_Random.below(1 << 24) >= m_Explore && policy_turn(snapshot, actor, entry->action, m_Random, turn))
+		{
+			decisions.emplace_back(key, entry->action);
+			return turn;
+		}
+
+		uint8_t actions[POLICY_MAX_ACTIONS];
+		int count = legal_actions(snapshot, actor, actions);
+		if (count == 0)
+		{
+			turn.usable = SIM_PASS;
+			turn.target_count = 0;
+			return turn;
+		}
+
+		uint8_t action = actions[m_Random.below(count)];
+		policy_turn(snapshot, actor, action, m_Random, turn);
+		decisions.emplace_back(key, action);
+		return turn;
+	}
+};
+
+PolicyTrainer::PolicyTrainer(const vector<overworld::Ally>& allies, const vector<string>& enemies, int side) : m_Allies(allies), m_Enemies(enemies), m_Side(side) {}
+
+float PolicyTrainer::train(unsigned int battles, float explore, uint64_t seed)
+{
+	// Every thread follows the same table of the best actions so far, and gathers its own statistics
+	PolicyTable table = compile();
+	unsigned int threads = worker_count();
+	vector<unordered_map<uint64_t, PolicyStats>> stats(threads);
+	vector<unsigned int> wins(threads, 0);
+
+	parallel_for(battles, threads,
+		[&](unsigned int chunk, size_t first, size_t last)
+		{
+			UsableTable usables;
+			for (size_t k = first; k < last; ++k)
+			{
+				SimRandom random(seed + k * 0x9E3779B97F4A7C15ull);
+				BattleSnapshot snapshot = BattleSnapshot::create(m_Allies, m_Enemies, usables, random);
+
+				ExplorePolicy learner(&table, explore, random);
+				RandomPolicy opponent(random.next());
+				bool won = simulate(snapshot, m_Side == 0 ? (SimPolicy&)learner : opponent, m_Side == 0 ? (SimPolicy&)opponent : learner, POLICY_BATTLE_TURNS) == m_Side;
+				wins[chunk] += won;
+
+				for (auto iter = learner.decisions.begin(); iter != learner.decisions.end(); ++iter)
+				{
+					PolicyStats& s = stats[chunk][iter->first];
+					++s.visits[iter->second];
+					s.wins[iter->second] += won;
+				}
+			}
+		}
+	);
+
+	// Merge the statistics in chunk order
+	unsigned int total = 0;
+	for (unsigned int chunk = 0; chunk < threads; ++chunk)
+	{
+		total += wins[chunk];
+		for (auto iter = stats[chunk].begin(); iter != stats[chunk].end(); ++iter)
+		{
+			PolicyStats& s = m_Stats[iter->first];
+			for (int a = 0; a < POLICY_MAX_ACTIONS; ++a)
+			{
+				s.visits[a] += iter->second.visits[a];
+				s.wins[a] += iter->second.wins[a];
+			}
+		}
+	}
+
+	return battles == 0 ? 0.f : (float)total / battles;
+}
+
+PolicyTable PolicyTrainer::compile(unsigned int min_visits) const
+{
+	// Keep the table at most half full, so that lookups stay short
+	unsigned int bits = 4;
+	while (((size_t)1 << bits) < 2 * m_Stats.size())
+		++bits;
+
+	PolicyTable table(bits);
+	for (auto iter = m_Stats.begin(); iter != m_Stats.end(); ++iter)
+	{
+		const PolicyStats& s = iter->second;
+
+		uint32_t visits = 0;
+		int best = -1;
+		for (int a = 0; a < POLICY_MAX_ACTIONS; ++a)
+		{
+			visits += s.visits[a];
+			if (s.visits[a] == 0)
+				continue;
+
+			// Compare win rates without dividing, preferring the better-tested action on a tie
+			if (best < 0)
+				best = a;
+			else
+			{
+				uint64_t lhs = (uint64_t)s.wins[a] * s.visits[best], rhs = (uint64_t)s.wins[best] * s.visits[a];
+				if (lhs > rhs || (lhs == rhs && s.visits[a] > s.visits[best]))
+					best = a;
+			}
+		}
+
+		if (best >= 0 && visits >= min_visits)
+			table.insert(iter->first, best, (uint8_t)(255ull * s.wins[best] / s.visits[best]));
+	}
+	return table;
+}
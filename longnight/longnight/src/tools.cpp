@@ -0,0 +1,1164 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include "../include/tools.h"
+#include "../include/gamedata.h"
+#include "../include/tablepolicy.h"
+#include "../include/netpolicy.h"
+#include "../include/behavior.h"
+#include "../include/solver.h"
+#include "../include/sweep.h"
+#include "../include/stats.h"
+#include "../include/loadout.h"
+#include "../include/campaign.h"
+#include "../include/parallel.h"
+
+using namespace std;
+using namespace battle;
+
+
+ToolArguments::ToolArguments(int argc, char** argv)
+{
+	for (int k = 0; k < argc; ++k)
+	{
+		if (strncmp(argv[k], "--", 2) == 0 && argv[k][2] != '\0')
+		{
+			// Options without a value are flags
+			vector<string>& values = m_Options[argv[k] + 2];
+			if (k + 1 < argc && strncmp(argv[k + 1], "--", 2) != 0)
+				values.emplace_back(argv[++k]);
+			else
+				values.emplace_back();
+		}
+		else
+		{
+			m_Positional.emplace_back(argv[k]);
+		}
+	}
+}
+
+size_t ToolArguments::size() const
+{
+	return m_Positional.size();
+}
+
+const string& ToolArguments::operator[](size_t index) const
+{
+	return m_Positional[index];
+}
+
+bool ToolArguments::has(const string& name) const
+{
+	return m_Options.count(name) != 0;
+}
+
+string ToolArguments::get(const string& name, const string& fallback) const
+{
+	auto iter = m_Options.find(name);
+	return iter == m_Options.end() ? fallback : iter->second.back();
+}
+
+void ToolArguments::invalid(const string& name, const char* expected) const
+{
+	cerr << "--" << name << " must be " << expected << ", not \"" << m_Options.at(name).back() << "\"." << endl;
+	m_Invalid = true;
+}
+
+long long ToolArguments::get_int(const string& name, long long fallback) const
+{
+	auto iter = m_Options.find(name);
+	if (iter == m_Options.end() || iter->second.back().empty())
+		return fallback;
+
+	// The whole value must be the number
+	const char* text = iter->second.back().c_str();
+	char* end;
+	errno = 0;
+	long long value = strtoll(text, &end, 10);
+	if (errno != 0 || end == text || *end != '\0')
+	{
+		invalid(name, "an integer");
+		return fallback;
+	}
+	return value;
+}
+
+double ToolArguments::get_float(const string& name, double fallback) const
+{
+	auto iter = m_Options.find(name);
+	if (iter == m_Options.end() || iter->second.back().empty())
+		return fallback;
+
+	const char* text = iter->second.back().c_str();
+	char* end;
+	errno = 0;
+	double value = strtod(text, &end);
+	if (errno != 0 || end == text || *end != '\0' || !isfinite(value))
+	{
+		invalid(name, "a number");
+		return fallback;
+	}
+	return value;
+}
+
+bool ToolArguments::good() const
+{
+	return !m_Invalid;
+}
+
+vector<string> ToolArguments::get_all(const string& name) const
+{
+	auto iter = m_Options.find(name);
+	return iter == m_Options.end() ? vector<string>() : iter->second;
+}
+
+
+bool parse_allies(const ToolArguments& args, vector<overworld::Ally>& allies)
+{
+	vector<string> loadouts = args.get_all("ally");
+	if (loadouts.empty())
+	{
+		allies = overworld::debug_party();
+		return true;
+	}
+
+	const data::Registry& registry = data::get_registry();
+
+	bool known = true;
+	allies.assign(loadouts.size(), overworld::Ally());
+	for (size_t k = 0; k < loadouts.size(); ++k)
+	{
+		vector<string> items = data::split_list(loadouts[k]);
+		for (auto iter = items.begin(); iter != items.end(); ++iter)
+		{
+			if (const overworld::Item* item = registry.get_item(*iter))
+				allies[k].items.push_back(item);
+			else
+			{
+				cerr << "Unknown item \"" << *iter << "\"." << endl;
+				known = false;
+			}
+		}
+	}
+	return known;
+}
+
+bool parse_enemies(const ToolArguments& args, size_t first, vector<string>& enemies)
+{
+	const data::Registry& registry = data::get_registry();
+
+	// An unknown enemy would be left out of every battle, which quietly makes them easier
+	bool known = true;
+	enemies.clear();
+	for (size_t k = first; k < args.size(); ++k)
+	{
+		if (!registry.get_enemy(args[k]))
+		{
+			cerr << "Unknown enemy \"" << args[k] << "\"." << endl;
+			known = false;
+		}
+		enemies.push_back(args[k]);
+	}
+	return known;
+}
+
+
+/// <summary>Writes a catalogue of items and a catalogue of enemies that hold them, in the format of the game's data files, for benchmarking.</summary>
+bool write_catalogue(const string& items_path, const string& enemies_path, size_t records)
+{
+	ofstream items(items_path, ios::out | ios::trunc);
+	for (size_t k = 0; k < records; ++k)
+	{
+		if (k % 2 == 0)
+			items << "bench item " << k << "     name=\"Bench Item " << k << "\"    icon=\"red pendant\"    type=\"offense\"    target=\"" << (k % 3 == 0 ? "all" : "single") << "\"    damage=\"" << (50 + k % 200) << "\"    burn=\"" << (k % 7) << "\"    speed=\"" << (1 + k % 5) << "\"\n";
+		else
+			items << "bench item " << k << "     name=\"Bench Item " << k << "\"    icon=\"red pendant\"    type=\"support\"    target=\"" << (k % 3 == 0 ? "self" : "single") << "\"    health=\"" << (100 + k % 300) << "\"    shield=\"" << (k % 50) << "\"    speed=\"" << (1 + k % 5) << "\"\n";
+	}
+
+	ofstream enemies(enemies_path, ios::out | ios::trunc);
+	for (size_t k = 0; k < records; ++k)
+	{
+		enemies << "bench enemy " << k << "     name=\"Bench Enemy " << k << "\"    type=\"road\"    health=\"" << (300 + k % 700) << "\"    shield=\"" << (k % 100) << "\"    offense=\"" << (k % 10) << "\"    defense=\"" << (k % 10)
+			<< "\"    items=\"bench item " << (k % records) << ", bench item " << ((k * 7 + 1) % records) << ", bench item " << ((k * 13 + 2) % records) << "\"\n";
+	}
+
+	return items.good() && enemies.good();
+}
+
+/// <summary>Times loading a generated catalogue of items and enemies, the same way the game loads its data, with each number of threads from 1 up.</summary>
+int benchmark_data(const ToolArguments& args)
+{
+	size_t records = (size_t)args.get_int("records", 100000);
+	unsigned int max_threads = max(1u, (unsigned int)args.get_int("threads", worker_count()));
+	int repeats = max(1, (int)args.get_int("repeats", 5));
+	if (!args.good())
+		return 1;
+
+	filesystem::path directory = filesystem::temp_directory_path();
+	string items = (directory / "longnight-bench-items.txt").string();
+	string enemies = (directory / "longnight-bench-enemies.txt").string();
+	if (!write_catalogue(items, enemies, records))
+	{
+		cerr << "Could not write the catalogue to \"" << directory.string() << "\"." << endl;
+		return 1;
+	}
+	cout << "Loading " << records << " items and " << records << " enemies, best of " << repeats << ", on a machine that runs " << worker_count() << (worker_count() == 1 ? " thread" : " threads") << " at once." << endl;
+
+	// Take the best of several loads, since the first is slowed by the file cache and the rest by whatever else is running
+	double single = 0.0;
+	for (unsigned int threads = 1; threads <= max_threads; ++threads)
+	{
+		double best = 0.0;
+		size_t loaded = 0;
+		for (int k = 0; k < repeats; ++k)
+		{
+			double seconds = data::time_registry_load(items.c_str(), enemies.c_str(), threads, loaded);
+			best = k == 0 ? seconds : min(best, seconds);
+		}
+		if (threads == 1)
+			single = best;
+
+		cout << threads << (threads == 1 ? " thread: " : " threads: ") << (1000.0 * best) << " ms for " << loaded << " records, " << (single / best) << "x the speed of 1 thread";
+		cout << (threads > worker_count() ? ", with more threads than the machine runs at once." : ".") << endl;
+	}
+
+	error_code error;
+	filesystem::remove(items, error);
+	filesystem::remove(enemies, error);
+	return 0;
+}
+
+
+/// <summary>Times copying a headless battle and running battles the way sweeps do, and prints a checksum of their outcomes so that builds can be checked to fight the same battles.</summary>
+int benchmark_simulation(const ToolArguments& args)
+{
+	if (args.size() < 1)
+	{
+		cerr << "Usage: bench-sim <enemy ID>... [--ally <item IDs>]... [--battles 100000] [--clones 1000000] [--turns 200] [--seed 1]" << endl;
+		return 1;
+	}
+
+	vector<string> enemies;
+	if (!parse_enemies(args, 0, enemies))
+		return 1;
+
+	uint64_t battles = (uint64_t)args.get_int("battles", 100000);
+	uint64_t clones = (uint64_t)args.get_int("clones", 1000000);
+	int max_turns = (int)args.get_int("turns", POLICY_BATTLE_TURNS);
+	uint64_t seed = (uint64_t)args.get_int("seed", 1);
+	if (!args.good())
+		return 1;
+
+	vector<overworld::Ally> allies;
+	if (!parse_allies(args, allies))
+		return 1;
+	UsableTable usables;
+	SimRandom setup(seed);
+	BattleSnapshot original = BattleSnapshot::create(allies, enemies, usables, setup);
+
+	// Read from every copy, so that copying can't be left out
+	volatile int sink = 0;
+	auto start = chrono::steady_clock::now();
+	for (uint64_t k = 0; k < clones; ++k)
+	{
+		BattleSnapshot copy = original.clone();
+		sink = sink + copy[k % copy.size()].cur_health;
+	}
+	double clone_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	uint64_t turns = 0, checksum = FNV1A_OFFSET;
+	start = chrono::steady_clock::now();
+	for (uint64_t k = 0; k < battles; ++k)
+	{
+		SimRandom random(seed + k * 0x9E3779B97F4A7C15);
+		BattleSnapshot snapshot = BattleSnapshot::create(allies, enemies, usables, random);
+		RandomPolicy side0(random.next());
+		ScriptedPolicy side1(enemy_scripts(allies.size(), enemies), random.next());
+		int outcome[2] = { simulate(snapshot, side0, side1, max_turns), snapshot.turns() };
+
+		turns += outcome[1];
+		checksum = data::fnv1a(checksum, outcome, sizeof(outcome));
+	}
+	double battle_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	cout << "A battle of " << original.size() << " entities takes " << sizeof(BattleSnapshot) << " bytes, and copies in " << (1e9 * clone_seconds / max<uint64_t>(1, clones)) << " ns." << endl;
+	cout << "Ran " << battles << " battles of " << turns << " turns in " << battle_seconds << " seconds, " << (1e9 * battle_seconds / max<uint64_t>(1, turns)) << " ns per turn." << endl;
+	cout << "Outcome checksum: " << hex << checksum << dec << endl;
+	return 0;
+}
+
+
+/// <summary>Checks that every policy network kernel this CPU supports agrees with a double-precision reference on a random layer, and times them against the scalar kernel.</summary>
+int check_network(const ToolArguments& args)
+{
+	int in = (int)args.get_int("inputs", NET_INPUTS);
+	int out = (int)args.get_int("outputs", 64);
+	int count = (int)args.get_int("batch", 64);
+	int repeats = (int)args.get_int("repeats", 2000);
+	double tolerance = args.get_float("tolerance", 1e-5);
+	uint64_t seed = (uint64_t)args.get_int("seed", 1);
+	if (!args.good())
+		return 1;
+
+	if (in < 1 || in > NET_MAX_WIDTH || out < 1 || out > NET_MAX_WIDTH || count < 1 || repeats < 1)
+	{
+		cerr << "Usage: check-net [--inputs " << NET_INPUTS << "] [--outputs 64] [--batch 64] [--repeats 2000] [--tolerance 1e-5] [--seed 1]" << endl;
+		cerr << "The layer can have 1 to " << NET_MAX_WIDTH << " inputs and outputs, and the batch and repeats must be at least 1." << endl;
+		return 1;
+	}
+
+	vector<NetworkKernelCheck> checks = check_network_kernels(in, out, count, repeats, seed);
+	cout << "A layer of " << in << " inputs and " << out << " outputs, over " << count << " items. Networks use the " << network_kernel_name() << " kernel on this CPU." << endl;
+
+	bool agree = true;
+	for (auto check = checks.begin(); check != checks.end(); ++check)
+	{
+		bool close = check->error <= tolerance;
+		agree = agree && close;
+		cout << check->name << ": " << (1e6 * check->seconds) << " us, " << (checks[0].seconds / check->seconds) << "x the scalar kernel, relative error " << check->error << (close ? "." : ", more than the tolerance.") << endl;
+	}
+	return agree ? 0 : 1;
+}
+
+
+/// <summary>Compiles a behavior script, and shows the turn it takes for one entity at the start of a battle. Fails if the script has an error, or if it doesn't use the item given by "--expect".</summary>
+int check_behavior(const ToolArguments& args)
+{
+	if (args.size() < 2)
+	{
+		cerr << "Usage: behavior <script name> <enemy ID>... [--ally <item IDs>]... [--actor <index>] [--health <percent>] [--expect <item ID>] [--seed 1]" << endl;
+		cerr << "The script runs for the entity at the index given by --actor, counting the allies first, or for the first enemy by default." << endl;
+		return 1;
+	}
+
+	shared_ptr<const BehaviorScript> script = BehaviorScript::load(args[0]);
+	if (!script)
+		return 1;
+
+	vector<string> enemies;
+	if (!parse_enemies(args, 1, enemies))
+		return 1;
+
+	vector<overworld::Ally> allies;
+	if (!parse_allies(args, allies))
+		return 1;
+
+	int actor = (int)args.get_int("actor", allies.size());
+	int health = (int)args.get_int("health", 100);
+	uint64_t seed = (uint64_t)args.get_int("seed", 1);
+	if (!args.good())
+		return 1;
+
+	const data::Registry& registry = data::get_registry();
+	const overworld::Item* expected = nullptr;
+	if (args.has("expect") && !(expected = registry.get_item(args.get("expect"))))
+	{
+		cerr << "Unknown item \"" << args.get("expect") << "\"." << endl;
+		return 1;
+	}
+
+	UsableTable usables;
+	SimRandom random(seed);
+	BattleSnapshot snapshot = BattleSnapshot::create(allies, enemies, usables, random);
+	if (actor < 0 || actor >= (int)snapshot.size() || health < 1 || health > 100)
+	{
+		cerr << "--actor must be from 0 to " << (snapshot.size() - 1) << ", and --health from 1 to 100." << endl;
+		return 1;
+	}
+
+	SimEntity& self = snapshot.mutate(actor);
+	self.cur_health = max(1, self.max_health * health / 100);
+	snapshot.rehash();
+
+	vector<shared_ptr<const BehaviorScript>> scripts(snapshot.size());
+	scripts[actor] = script;
+	ScriptedPolicy policy(scripts, seed);
+	SimTurn turn = policy.choose(snapshot, actor);
+
+	// Find the item that the usable came from, to name it
+	const overworld::Item* used = nullptr;
+	string name = "nothing";
+	for (auto item = registry.items().begin(); item != registry.items().end() && turn.usable != SIM_PASS; ++item)
+	{
+		if (usables.find(item->second) == self.usables[turn.usable])
+		{
+			used = item->second;
+			name = "\"" + item->first + "\"";
+			break;
+		}
+	}
+
+	cout << "Entity " << actor << " at " << health << "% Health uses " << name;
+	for (int k = 0; k < turn.target_count; ++k)
+		cout << (k == 0 ? " on entity " : ", ") << (int)turn.targets[k];
+	cout << "." << endl;
+
+	if (expected && used != expected)
+	{
+		cerr << "Expected \"" << args.get("expect") << "\"." << endl;
+		return 1;
+	}
+	return 0;
+}
+
+
+/// <summary>Learns a policy table for the enemies of a battle, and compiles it to a file.</summary>
+int train_policy(const ToolArguments& args)
+{
+	if (args.size() < 2)
+	{
+		cerr << "Usage: train-policy <output file> <enemy ID>... [--ally <item IDs>]... [--rounds 8] [--battles 20000] [--explore 0.2] [--min-visits 4] [--seed 1]" << endl;
+		return 1;
+	}
+
+	vector<string> enemies;
+	if (!parse_enemies(args, 1, enemies))
+		return 1;
+
+	int rounds = (int)args.get_int("rounds", 8);
+	unsigned int battles = (unsigned int)args.get_int("battles", 20000);
+	float explore = (float)args.get_float("explore", 0.2);
+	unsigned int min_visits = (unsigned int)args.get_int("min-visits", 4);
+	uint64_t seed = (uint64_t)args.get_int("seed", 1);
+	if (!args.good())
+		return 1;
+
+	vector<overworld::Ally> allies;
+	if (!parse_allies(args, allies))
+		return 1;
+	PolicyTrainer trainer(allies, enemies, 1);
+
+	for (int round = 0; round < rounds; ++round)
+	{
+		float win_rate = trainer.train(battles, explore, seed + (uint64_t)round * battles);
+		cout << "Round " << (round + 1) << ": won " << (100.f * win_rate) << "% while exploring." << endl;
+	}
+
+	PolicyTable table = trainer.compile(min_visits);
+	if (!table.save(args[0]))
+	{
+		cerr << "Could not write \"" << args[0] << "\"." << endl;
+		return 1;
+	}
+	cout << "Wrote " << table.size() << " states to \"" << args[0] << "\"." << endl;
+
+	// Compare the table against acting at random, on battles that training never saw
+	UsableTable usables;
+	int table_wins = 0, random_wins = 0, trials = 2000;
+	for (int k = 0; k < trials; ++k)
+	{
+		uint64_t trial_seed = ~seed - k;
+
+		SimRandom random(trial_seed);
+		BattleSnapshot snapshot = BattleSnapshot::create(allies, enemies, usables, random);
+		BattleSnapshot copy = snapshot.clone();
+
+		RandomPolicy opponent(trial_seed), other_opponent(trial_seed), baseline(~trial_seed);
+		TablePolicy policy(&table, ~trial_seed);
+		table_wins += simulate(snapshot, opponent, policy, POLICY_BATTLE_TURNS) == 1;
+		random_wins += simulate(copy, other_opponent, baseline, POLICY_BATTLE_TURNS) == 1;
+	}
+	cout << "The table wins " << (100.f * table_wins / trials) << "% of battles, against " << (100.f * random_wins / trials) << "% when acting at random." << endl;
+
+	return 0;
+}
+
+
+/// <summary>Computes the exact chance of winning a battle where everyone acts at random, and its expected length, averaged over some sampled starting timelines.
+/// Each start is solved exactly, but the game picks the timeline at random, so the result is only the battle's true outcome as far as the sampled starts represent every start.</summary>
+int solve_battle(const ToolArguments& args)
+{
+	if (args.size() < 1)
+	{
+		cerr << "Usage: solve <enemy ID>... [--ally <item IDs>]... [--turns 200] [--seed 1] [--starts 1] [--table <file>] [--threads <count>]" << endl;
+		cerr << "Battles start with everyone placed on the timeline at random. Each of the --starts sampled placements is solved exactly, and the results are averaged, so they are conditional on the starts sampled." << endl;
+		return 1;
+	}
+
+	vector<string> enemies;
+	if (!parse_enemies(args, 0, enemies))
+		return 1;
+
+	int max_turns = (int)args.get_int("turns", POLICY_BATTLE_TURNS);
+	uint64_t seed = (uint64_t)args.get_int("seed", 1);
+	int starts = (int)args.get_int("starts", 1);
+	unsigned int threads = (unsigned int)args.get_int("threads", worker_count());
+	string path = args.get("table", "");
+	if (!args.good())
+		return 1;
+	if (starts < 1)
+	{
+		cerr << "--starts must be at least 1." << endl;
+		return 1;
+	}
+
+	vector<overworld::Ally> allies;
+	if (!parse_allies(args, allies))
+		return 1;
+	UsableTable usables;
+
+	// Each start has different timeline positions, chosen the same way a battle picks them
+	vector<BattleSnapshot> battles;
+	for (int k = 0; k < starts; ++k)
+	{
+		SimRandom random(seed + k);
+		battles.push_back(BattleSnapshot::create(allies, enemies, usables, random));
+	}
+
+	// The solver can only follow random play, so it tells the user rather than quietly disagreeing with a sweep
+	if (!enemy_scripts(allies.size(), enemies).empty())
+		cout << "Enemies act at random here, even those with a behavior script." << endl;
+
+	uint64_t fingerprint = WinSolver::fingerprint(battles[0], max_turns);
+	SolvedTable solved;
+	if (!path.empty() && solved.open(path, fingerprint))
+		cout << "Reusing states solved in \"" << path << "\"." << endl;
+
+	WinSolver solver(max_turns, &solved);
+	SolverResult total = { 0, 0, 0 };
+	auto start = chrono::steady_clock::now();
+	for (int k = 0; k < starts; ++k)
+	{
+		SolverResult result = solver.solve(battles[k], threads);
+		total.win += result.win / starts;
+		total.loss += result.loss / starts;
+		total.turns += result.turns / starts;
+	}
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	cout << "Averaged over " << starts << (starts == 1 ? " sampled starting timeline" : " sampled starting timelines") << ". Each is solved exactly, but the results hold for these starts only; sample more with --starts." << endl;
+	cout.precision(10);
+	cout << "Win: " << (100 * total.win) << "%" << endl;
+	cout << "Loss: " << (100 * total.loss) << "%" << endl;
+	cout << "Turn limit: " << (100 * (1 - total.win - total.loss)) << "%" << endl;
+	cout << "Expected turns: " << total.turns << endl;
+	cout.precision(4);
+	cout << "Solved " << solver.size() << " states in " << seconds << " seconds." << endl;
+
+	if (!path.empty())
+	{
+		// The old table is still mapped while the new one is written, so write it alongside and swap it in
+		vector<SolvedRecord> records = solver.records();
+		string temp = path + ".tmp";
+		if (!SolvedTable::write(temp, fingerprint, records))
+		{
+			cerr << "Could not write \"" << temp << "\"." << endl;
+			return 1;
+		}
+		solved.close();
+		remove(path.c_str());
+		if (rename(temp.c_str(), path.c_str()) != 0)
+		{
+			cerr << "Could not write \"" << path << "\"." << endl;
+			return 1;
+		}
+		cout << "Wrote " << records.size() << " states to \"" << path << "\"." << endl;
+	}
+
+	return 0;
+}
+
+
+/// <summary>Runs battles for many configurations of item fields, and writes the results to a CSV file and a columnar file.
+/// With --journal, every battle is also appended to a journal as it finishes, and a sweep run again with the same journal picks up where the last one stopped.
+/// With --cache, configurations that any earlier sweep ran with the same game data and seeds are read from a result cache instead of being run again.</summary>
+int sweep_items(const ToolArguments& args)
+{
+	vector<string> texts = args.get_all("param");
+	if (args.size() < 2 || texts.empty())
+	{
+		cerr << "Usage: sweep <output prefix, or partial file with --shard> <enemy ID>... --param <item>.<field>=<a,b,c|low..high>... [--ally <item IDs>]... [--design grid|lhs] [--steps 5] [--samples 16] [--battles 1000] [--turns 200] [--seed 1] [--crn] [--batch 100] [--ci-width <width>] [--sprt <delta> [--alpha 0.05] [--beta 0.05]] [--journal <path>] [--cache <directory>] [--threads <count>] [--shard <index>/<count>]" << endl;
+		cerr << "With --shard, only every count-th configuration is run, and the results are written to a partial file for \"merge\" to combine. Give each shard its own journal." << endl;
+		return 1;
+	}
+
+	const data::Registry& registry = data::get_registry();
+	vector<SweepParameter> parameters(texts.size());
+	for (size_t k = 0; k < texts.size(); ++k)
+	{
+		string error;
+		if (!parameters[k].parse(texts[k], error))
+		{
+			cerr << error << "." << endl;
+			return 1;
+		}
+		if (!registry.get_item(parameters[k].item))
+		{
+			cerr << "Unknown item \"" << parameters[k].item << "\"." << endl;
+			return 1;
+		}
+	}
+
+	vector<string> enemies;
+	if (!parse_enemies(args, 1, enemies))
+		return 1;
+
+	SweepOptions options;
+	options.battles = (unsigned int)args.get_int("battles", 1000);
+	options.max_turns = (int)args.get_int("turns", POLICY_BATTLE_TURNS);
+	options.seed = (uint64_t)args.get_int("seed", 1);
+	options.common_random_numbers = args.has("crn");
+	options.batch = (unsigned int)args.get_int("batch", 100);
+	options.interval_width = args.get_float("ci-width", 0);
+	options.sprt_delta = args.get_float("sprt", 0);
+	options.sprt_alpha = args.get_float("alpha", 0.05);
+	options.sprt_beta = args.get_float("beta", 0.05);
+	int steps = (int)args.get_int("steps", 5);
+	int samples = (int)args.get_int("samples", 16);
+	unsigned int threads = (unsigned int)args.get_int("threads", worker_count());
+	if (!args.good())
+		return 1;
+	if (options.sprt_delta < 0 || options.sprt_delta >= 0.5)
+	{
+		cerr << "The SPRT delta must be between 0 and 0.5." << endl;
+		return 1;
+	}
+	if (options.sprt_delta > 0 && !options.common_random_numbers)
+		cerr << "Comparing configurations without --crn needs far more battles." << endl;
+
+	bool sharded = args.has("shard");
+	if (sharded && (sscanf(args.get("shard").c_str(), "%u/%u", &options.shard_index, &options.shard_count) != 2 || options.shard_index >= options.shard_count))
+	{
+		cerr << "The shard must be given as <index>/<count>, with the index counting from 0." << endl;
+		return 1;
+	}
+
+	string design = args.get("design", "grid");
+	vector<vector<int>> configurations;
+	if (design == "grid")
+		configurations = sweep_grid(parameters, steps);
+	else if (design == "lhs")
+		configurations = sweep_latin_hypercube(parameters, samples, options.seed);
+	else
+	{
+		cerr << "Unknown design \"" << design << "\"; expected grid or lhs." << endl;
+		return 1;
+	}
+
+
+	vector<overworld::Ally> allies;
+	if (!parse_allies(args, allies))
+		return 1;
+
+	ItemPatcher patcher;
+	Sweep sweep(parameters, configurations, allies, enemies, patcher, options);
+
+	if (args.has("journal"))
+	{
+		string path = args.get("journal", "");
+		string error;
+		if (!sweep.open_journal(path, error))
+		{
+			cerr << error << "." << endl;
+			return 1;
+		}
+		if (sweep.battles_resumed() > 0)
+			cout << "Read " << sweep.battles_resumed() << " battles from \"" << path << "\"." << endl;
+	}
+
+	if (args.has("cache"))
+	{
+		string path = args.get("cache", "");
+		string error;
+		if (!sweep.open_cache(path, error))
+		{
+			cerr << error << "." << endl;
+			return 1;
+		}
+		if (sweep.battles_cached() > 0)
+			cout << "Found " << sweep.battles_cached() << " battles in \"" << path << "\"." << endl;
+	}
+
+	auto start = chrono::steady_clock::now();
+	sweep.run(threads);
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	cout << "Used " << sweep.battles_used() << " of up to " << (size_t)options.battles * sweep.size() << " battles for " << sweep.size() << " configurations, running " << sweep.battles_run() << " in " << seconds << " seconds";
+	cout << " and reading " << sweep.battles_resumed() << " from the journal and " << sweep.battles_cached() << " from the cache." << endl;
+	if (!sweep.journal_intact())
+		cerr << "Some battles could not be written to the journal, and will be run again if the sweep is resumed." << endl;
+	if (!sweep.write_cache())
+		cerr << "Some results could not be written to the cache." << endl;
+
+	if (sharded)
+	{
+		if (!sweep.write_partial(args[0]))
+		{
+			cerr << "Could not write \"" << args[0] << "\"." << endl;
+			return 1;
+		}
+		cout << "Wrote shard " << options.shard_index << " of " << options.shard_count << " to \"" << args[0] << "\"." << endl;
+		return 0;
+	}
+
+	if (!sweep.write_csv(args[0] + ".csv") || !sweep.write_columns(args[0] + ".cols"))
+	{
+		cerr << "Could not write the results to \"" << args[0] << "\"." << endl;
+		return 1;
+	}
+	cout << "Wrote \"" << args[0] << ".csv\" and \"" << args[0] << ".cols\"." << endl;
+	return 0;
+}
+
+
+/// <summary>Searches the items the party could hold for the loadout that does best against some enemies, and writes how well every loadout tried did to a CSV file.</summary>
+int optimise_loadout(const ToolArguments& args)
+{
+	if (args.size() < 2)
+	{
+		cerr << "Usage: loadout <output CSV> <enemy ID>... [--pool <item IDs>] [--allies 3] [--items 5] [--objective wins|turns] [--population 64] [--rounds 4] [--min-battles 50] [--max-battles 3200] [--finalists 4] [--turns 200] [--seed 1] [--cache <directory>] [--threads <count>]" << endl;
+		return 1;
+	}
+
+	const data::Registry& registry = data::get_registry();
+	vector<string> enemies;
+	if (!parse_enemies(args, 1, enemies))
+		return 1;
+
+	// Every item can be held unless a pool is given
+	vector<string> pool = data::split_list(args.get("pool", ""));
+	if (pool.empty())
+	{
+		for (auto iter = registry.items().begin(); iter != registry.items().end(); ++iter)
+			pool.push_back(iter->first);
+		sort(pool.begin(), pool.end());
+	}
+	for (auto id = pool.begin(); id != pool.end(); ++id)
+	{
+		if (!registry.get_item(*id))
+		{
+			cerr << "Unknown item \"" << *id << "\"." << endl;
+			return 1;
+		}
+	}
+
+	LoadoutOptions options;
+	options.allies = (int)args.get_int("allies", 3);
+	options.items = (int)args.get_int("items", LOADOUT_ITEMS);
+	long long population = args.get_int("population", 64);
+	long long rounds = args.get_int("rounds", 4);
+	options.min_battles = (unsigned int)args.get_int("min-battles", 50);
+	options.max_battles = (unsigned int)args.get_int("max-battles", 3200);
+	options.finalists = (unsigned int)max(1ll, args.get_int("finalists", 4));
+	options.max_turns = (int)args.get_int("turns", POLICY_BATTLE_TURNS);
+	options.seed = (uint64_t)args.get_int("seed", 1);
+	unsigned int threads = (unsigned int)args.get_int("threads", worker_count());
+	if (!args.good())
+		return 1;
+	if (options.allies < 1 || options.items < 1 || options.items > ALLY_MAX_ITEMS || pool.empty())
+	{
+		cerr << "Each of at least one ally must hold from 1 to " << ALLY_MAX_ITEMS << " items, from a pool of at least one." << endl;
+		return 1;
+	}
+	if (population < 1 || population > UINT32_MAX || rounds < 1 || rounds > UINT32_MAX)
+	{
+		cerr << "The population and the number of rounds must be at least 1." << endl;
+		return 1;
+	}
+	options.population = (unsigned int)population;
+	options.rounds = (unsigned int)rounds;
+
+	string objective = args.get("objective", "wins");
+	if (objective == "turns")
+		options.objective = LOADOUT_SHORTEST;
+	else if (objective != "wins")
+	{
+		cerr << "Unknown objective \"" << objective << "\"; expected wins or turns." << endl;
+		return 1;
+	}
+
+	LoadoutOptimiser optimiser(pool, enemies, options);
+	if (args.has("cache"))
+	{
+		string error;
+		if (!optimiser.open_cache(args.get("cache", ""), error))
+		{
+			cerr << error << "." << endl;
+			return 1;
+		}
+	}
+
+	auto describe = [](const LoadoutResult& result)
+	{
+		for (auto ally = result.items.begin(); ally != result.items.end(); ++ally)
+		{
+			cout << (ally == result.items.begin() ? "[" : " [");
+			for (auto item = ally->begin(); item != ally->end(); ++item)
+				cout << (item == ally->begin() ? "" : ", ") << *item;
+			cout << "]";
+		}
+		cout << ", winning " << (100.0 * result.wins / max(1u, result.battles)) << "% of " << result.battles << " battles in " << result.turns << " turns on average." << endl;
+	};
+
+	auto start = chrono::steady_clock::now();
+	for (unsigned int round = 0; round < options.rounds; ++round)
+	{
+		optimiser.run_round(threads);
+		cout << "Round " << (round + 1) << ": ";
+		describe(optimiser.results().front());
+	}
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	vector<LoadoutResult> results = optimiser.results();
+	cout << "Tried " << results.size() << " loadouts, running " << optimiser.battles_run() << " battles in " << seconds << " seconds and reading " << optimiser.battles_cached() << " from the cache." << endl;
+
+	// A loadout dominates if the others that ran as many battles are all clearly worse
+	if (!results.empty())
+	{
+		const LoadoutResult& best = results.front();
+		size_t finalists = 0, close = 0;
+		for (auto result = results.begin() + 1; result != results.end(); ++result)
+		{
+			if (min(result->battles, options.max_battles) < min(best.battles, options.max_battles))
+				continue;
+			++finalists;
+			close += result->interval[1] >= best.interval[0];
+		}
+		cout << "Best: ";
+		describe(best);
+		cout << close << " of the " << finalists << " other loadouts that ran as many battles have win rates within its confidence interval";
+		cout << (close == 0 && finalists > 0 ? ", so it dominates them." : ".") << endl;
+	}
+
+	if (!optimiser.write_csv(args[0]))
+	{
+		cerr << "Could not write \"" << args[0] << "\"." << endl;
+		return 1;
+	}
+	cout << "Wrote \"" << args[0] << "\"." << endl;
+	return 0;
+}
+
+
+/// <summary>Runs a party through the encounters of a campaign many times over, carrying its Health and items from battle to battle, and writes how often it reaches each encounter and how worn down it is to a CSV file.</summary>
+int simulate_campaign(const ToolArguments& args)
+{
+	if (args.size() < 2)
+	{
+		cerr << "Usage: campaign <output CSV> <encounter list> [--ally <item IDs>]... [--campaigns 10000] [--turns 200] [--seed 1] [--threads <count>]" << endl;
+		return 1;
+	}
+
+	vector<CampaignEncounter> encounters;
+	string error;
+	if (!load_campaign(args[1], encounters, error))
+	{
+		cerr << error << "." << endl;
+		return 1;
+	}
+
+	uint64_t campaigns = (uint64_t)args.get_int("campaigns", 10000);
+	int max_turns = (int)args.get_int("turns", POLICY_BATTLE_TURNS);
+	uint64_t seed = (uint64_t)args.get_int("seed", 1);
+	unsigned int threads = max(1u, (unsigned int)args.get_int("threads", worker_count()));
+	if (!args.good())
+		return 1;
+
+	vector<overworld::Ally> allies;
+	if (!parse_allies(args, allies))
+		return 1;
+
+	CampaignSimulator simulator(allies, encounters, max_turns, seed);
+
+	auto start = chrono::steady_clock::now();
+	simulator.run(campaigns, threads);
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	const vector<EncounterStats>& stats = simulator.stats();
+	for (size_t e = 0; e < encounters.size(); ++e)
+	{
+		uint64_t reached = stats[e].reached;
+		StatHistogram health(stats[e].party_health, CAMPAIGN_HEALTH_BUCKETS);
+		cout << (e + 1) << ". " << encounters[e].id << ": reached by " << (100.0 * reached / max<uint64_t>(1, campaigns)) << "% with a median of " << (100 * health.percentile(0.5) / (CAMPAIGN_HEALTH_BUCKETS - 1)) << "% Health, won by "
+			<< (100.0 * stats[e].won / max<uint64_t>(1, reached)) << "% of those." << endl;
+	}
+	cout << "Finished " << (100.0 * stats.back().reached / max<uint64_t>(1, campaigns)) << "% of " << campaigns << " campaigns in " << seconds << " seconds." << endl;
+
+	if (!simulator.write_csv(args[0]))
+	{
+		cerr << "Could not write \"" << args[0] << "\"." << endl;
+		return 1;
+	}
+	cout << "Wrote \"" << args[0] << "\"." << endl;
+	return 0;
+}
+
+
+/// <summary>Runs battles where enemies follow their behavior scripts and everyone else acts at random, and writes statistics about them to a JSON file.
+/// With "--shard i/N", only the i-th of N equal parts of the battles are run, and their counters are written to a partial file for "merge" to combine.</summary>
+int battle_stats(const ToolArguments& args)
+{
+	if (args.size() < 2)
+	{
+		cerr << "Usage: stats <JSON file, or partial file with --shard> <enemy ID>... [--ally <item IDs>]... [--battles 10000] [--epoch <battles>] [--turns 200] [--seed 1] [--threads <count>] [--shard <index>/<count>]" << endl;
+		return 1;
+	}
+
+	vector<string> enemies;
+	if (!parse_enemies(args, 1, enemies))
+		return 1;
+
+	uint64_t battles = (uint64_t)args.get_int("battles", 10000);
+	uint64_t epoch = (uint64_t)args.get_int("epoch", 0);
+	int max_turns = (int)args.get_int("turns", POLICY_BATTLE_TURNS);
+	uint64_t seed = (uint64_t)args.get_int("seed", 1);
+	unsigned int threads = max(1u, (unsigned int)args.get_int("threads", worker_count()));
+	if (!args.good())
+		return 1;
+	if (epoch == 0)
+		epoch = battles;
+
+	StatsShard shard = { 0, 0, 1 };
+	bool sharded = args.has("shard");
+	if (sharded && (sscanf(args.get("shard").c_str(), "%u/%u", &shard.index, &shard.count) != 2 || shard.index >= shard.count))
+	{
+		cerr << "The shard must be given as <index>/<count>, with the index counting from 0." << endl;
+		return 1;
+	}
+
+	vector<overworld::Ally> allies;
+	if (!parse_allies(args, allies))
+		return 1;
+	vector<string> names;
+	for (size_t k = 0; k < allies.size(); ++k)
+		names.push_back("ally " + to_string(k + 1));
+	names.insert(names.end(), enemies.begin(), enemies.end());
+
+	// Every usable is added up front, so that battles only read from the table
+	UsableTable usables;
+	SimRandom setup(seed);
+	BattleSnapshot setup_snapshot = BattleSnapshot::create(allies, enemies, usables, setup);
+
+	// Shards of the same run agree on everything that changes the battles they run
+	SimRandom mixer(WinSolver::fingerprint(setup_snapshot, max_turns) ^ seed);
+	shard.fingerprint = mixer.next() ^ battles;
+
+	// Each shard runs its own range of battles, seeded by their index in the whole run, so merged shards count exactly the same battles as one process would
+	uint64_t first_battle = battles * shard.index / shard.count;
+	uint64_t last_battle = battles * (shard.index + 1) / shard.count;
+
+	// Each thread counts into its own statistics, which are only merged between epochs
+	vector<BattleStats> workers(threads, BattleStats(names.size(), max_turns));
+	BattleStats total(names.size(), max_turns);
+
+	// Write after every epoch, so that long runs can be looked at while they go
+	auto write = [&]()
+	{
+		if (sharded ? total.write_partial(args[0], shard, names) : total.write_json(args[0], names))
+			return true;
+		cerr << "Could not write \"" << args[0] << "\"." << endl;
+		return false;
+	};
+
+	auto start = chrono::steady_clock::now();
+	for (uint64_t first = first_battle; first < last_battle; first += epoch)
+	{
+		uint64_t count = min(epoch, last_battle - first);
+		parallel_for(count, threads, [&](unsigned int chunk, size_t begin, size_t end)
+			{
+				BattleStats& stats = workers[chunk];
+				for (size_t k = begin; k < end; ++k)
+				{
+					SimRandom random(seed + (first + k) * 0x9E3779B97F4A7C15);
+					BattleSnapshot snapshot = BattleSnapshot::create(allies, enemies, usables, random);
+					RandomPolicy side0(random.next());
+					ScriptedPolicy side1(enemy_scripts(allies.size(), enemies), random.next());
+					stats.record(snapshot, side0, side1);
+				}
+			}
+		);
+
+		for (BattleStats& stats : workers)
+		{
+			total.merge(stats);
+			stats.clear();
+		}
+
+		if (!write())
+			return 1;
+		if (first + count < last_battle)
+			cout << "Ran " << (first + count - first_battle) << " of " << (last_battle - first_battle) << " battles." << endl;
+	}
+
+	// A shard with no battles still writes its file, so that merging can tell it wasn't lost
+	if (first_battle == last_battle && !write())
+		return 1;
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	cout << "Ran " << total.battles() << " battles in " << seconds << " seconds, winning " << (100.0 * total.outcomes(0) / max<uint64_t>(1, total.battles())) << "%." << endl;
+	cout << "Wrote \"" << args[0] << "\"." << endl;
+	return 0;
+}
+
+
+/// <summary>Combines the partial files written by the shards of a sweep, and writes the results of the whole sweep the same way one process would have.</summary>
+/// <param name="total">The sweep read from the first partial file.</param>
+int merge_sweep(const ToolArguments& args, unique_ptr<Sweep> total)
+{
+	const SweepOptions& first = total->options();
+	vector<bool> seen(first.shard_count, false);
+	seen[first.shard_index] = true;
+	for (size_t k = 2; k < args.size(); ++k)
+	{
+		unique_ptr<Sweep> sweep = Sweep::read_partial(args[k]);
+		if (!sweep)
+		{
+			cerr << "Could not read \"" << args[k] << "\" as a partial sweep." << endl;
+			return 1;
+		}
+
+		const SweepOptions& shard = sweep->options();
+		if (sweep->fingerprint() != total->fingerprint() || shard.shard_count != first.shard_count)
+		{
+			cerr << "\"" << args[k] << "\" is from a different sweep than \"" << args[1] << "\"." << endl;
+			return 1;
+		}
+		if (seen[shard.shard_index])
+		{
+			cerr << "Shard " << shard.shard_index << " is given more than once, the second time by \"" << args[k] << "\"." << endl;
+			return 1;
+		}
+		seen[shard.shard_index] = true;
+		total->merge(*sweep);
+	}
+
+	size_t missing = count(seen.begin(), seen.end(), false);
+	if (missing > 0)
+	{
+		cerr << missing << " of " << first.shard_count << " shards are missing." << endl;
+		if (!args.has("incomplete"))
+		{
+			cerr << "Pass --incomplete to merge the shards that are here anyway." << endl;
+			return 1;
+		}
+	}
+
+	if (!total->write_csv(args[0] + ".csv") || !total->write_columns(args[0] + ".cols"))
+	{
+		cerr << "Could not write the results to \"" << args[0] << "\"." << endl;
+		return 1;
+	}
+	cout << "Merged " << (first.shard_count - missing) << " shards, " << total->battles_used() << " battles for " << total->size() << " configurations." << endl;
+	cout << "Wrote \"" << args[0] << ".csv\" and \"" << args[0] << ".cols\"." << endl;
+	return 0;
+}
+
+/// <summary>Combines the partial files written by the shards of a "stats" run or a sweep, and writes the results of the whole run: statistics to a JSON file, or a sweep's results under an output prefix.</summary>
+int merge_stats(const ToolArguments& args)
+{
+	if (args.size() < 2)
+	{
+		cerr << "Usage: merge <JSON file, or output prefix for a sweep> <partial file>... [--incomplete]" << endl;
+		return 1;
+	}
+
+	if (unique_ptr<Sweep> sweep = Sweep::read_partial(args[1]))
+		return merge_sweep(args, move(sweep));
+
+	BattleStats total(0, 0);
+	StatsShard first = { 0, 0, 0 };
+	vector<string> names;
+	vector<bool> seen;
+	for (size_t k = 1; k < args.size(); ++k)
+	{
+		BattleStats stats(0, 0);
+		StatsShard shard;
+		vector<string> shard_names;
+		if (!BattleStats::read_partial(args[k], stats, shard, shard_names))
+		{
+			cerr << "Could not read \"" << args[k] << "\" as partial statistics." << endl;
+			return 1;
+		}
+
+		if (k == 1)
+		{
+			total = BattleStats(stats.entities(), stats.max_turns());
+			first = shard;
+			names = shard_names;
+			seen.assign(shard.count, false);
+		}
+		else if (shard.fingerprint != first.fingerprint || shard.count != first.count || stats.entities() != total.entities() || stats.max_turns() != total.max_turns())
+		{
+			cerr << "\"" << args[k] << "\" is from a different run than \"" << args[1] << "\"." << endl;
+			return 1;
+		}
+
+		// Merging a shard twice would count its battles twice
+		if (seen[shard.index])
+		{
+			cerr << "Shard " << shard.index << " is given more than once, the second time by \"" << args[k] << "\"." << endl;
+			return 1;
+		}
+		seen[shard.index] = true;
+		total.merge(stats);
+	}
+
+	size_t missing = count(seen.begin(), seen.end(), false);
+	if (missing > 0)
+	{
+		cerr << missing << " of " << first.count << " shards are missing." << endl;
+		if (!args.has("incomplete"))
+		{
+			cerr << "Pass --incomplete to merge the shards that are here anyway." << endl;
+			return 1;
+		}
+	}
+
+	if (!total.write_json(args[0], names))
+	{
+		cerr << "Could not write \"" << args[0] << "\"." << endl;
+		return 1;
+	}
+	cout << "Merged " << (first.count - missing) << " shards, " << total.battles() << " battles, winning " << (100.0 * total.outcomes(0) / max<uint64_t>(1, total.battles())) << "%." << endl;
+	cout << "Wrote \"" << args[0] << "\"." << endl;
+	return 0;
+}
+
+
+// A command-line tool.
+struct Tool
+{
+	// The name that runs the tool.
+	const char* name;
+
+	// The function that runs the tool, returning the exit status.
+	int (*run)(const ToolArguments& args);
+};
+
+// Every command-line tool.
+const Tool g_Tools[] = {
+	{ "bench-data", benchmark_data },
+	{ "bench-sim", benchmark_simulation },
+	{ "check-net", check_network },
+	{ "behavior", check_behavior },
+	{ "train-policy", train_policy },
+	{ "solve", solve_battle },
+	{ "sweep", sweep_items },
+	{ "loadout", optimise_loadout },
+	{ "campaign", simulate_campaign },
+	{ "stats", battle_stats },
+	{ "merge", merge_stats }
+};
+
+bool run_tool(int argc, char** argv, int& status)
+{
+	if (argc < 2)
+		return false;
+
+	for (const Tool& tool : g_Tools)
+	{
+		if (strcmp(argv[1], tool.name) == 0)
+		{
+			data::load_registry();
+			status = tool.run(ToolArguments(argc - 2, argv + 2));
+			return true;
+		}
+	}
+	return false;
+}
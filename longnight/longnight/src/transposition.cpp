@@ -0,0 +1,71 @@
+#include "../include/transposition.h"
+
+using namespace std;
+using namespace battle;
+
+
+/// <summary>Packs an entry into 64 bits.</summary>
+inline uint64_t pack(const TableEntry& entry)
+{
+	return (uint64_t)(uint32_t)entry.value | ((uint64_t)entry.depth << 32) | ((uint64_t)entry.bound << 40) | ((uint64_t)entry.best << 48) | ((uint64_t)entry.generation << 56);
+}
+
+/// <summary>Unpacks an entry from 64 bits.</summary>
+inline TableEntry unpack(uint64_t data)
+{
+	TableEntry entry;
+	entry.value = (int32_t)(uint32_t)data;
+	entry.depth = (uint8_t)(data >> 32);
+	entry.bound = (Bound)(uint8_t)(data >> 40);
+	entry.best = (uint8_t)(data >> 48);
+	entry.generation = (uint8_t)(data >> 56);
+	return entry;
+}
+
+
+TranspositionTable::TranspositionTable(unsigned int bits) : m_Slots(new Slot[(size_t)1 << bits]), m_Mask(((uint64_t)1 << bits) - 1), m_Generation(0)
+{
+	clear();
+}
+
+void TranspositionTable::clear()
+{
+	for (uint64_t k = 0; k <= m_Mask; ++k)
+	{
+		m_Slots[k].check.store(0, memory_order_relaxed);
+		m_Slots[k].data.store(0, memory_order_relaxed);
+	}
+}
+
+void TranspositionTable::age()
+{
+	++m_Generation;
+}
+
+bool TranspositionTable::probe(uint64_t key, TableEntry& entry) const
+{
+	const Slot& slot = m_Slots[key & m_Mask];
+	uint64_t data = slot.data.load(memory_order_relaxed);
+	if ((slot.check.load(memory_order_relaxed) ^ data) != key)
+		return false;
+
+	entry = unpack(data);
+	return entry.bound != BOUND_NONE;
+}
+
+void TranspositionTable::store(uint64_t key, const TableEntry& entry)
+{
+	Slot& slot = m_Slots[key & m_Mask];
+
+	// Keep deeper results for the same position, and deeper results of the current search for other positions
+	uint64_t old = slot.data.load(memory_order_relaxed);
+	TableEntry previous = unpack(old);
+	if (previous.bound != BOUND_NONE && previous.depth > entry.depth && ((slot.check.load(memory_order_relaxed) ^ old) == key || previous.generation == m_Generation))
+		return;
+
+	TableEntry current = entry;
+	current.generation = m_Generation;
+	uint64_t data = pack(current);
+	slot.check.store(key ^ data, memory_order_relaxed);
+	slot.data.store(data, memory_order_relaxed);
+}
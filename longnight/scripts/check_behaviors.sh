@@ -0,0 +1,30 @@
+#!/bin/sh
+# Checks that the example behavior scripts compile and use the items they should, with the "behavior" tool.
+#
+# Usage: scripts/check_behaviors.sh
+#
+# Run it from the directory the game runs from, so that the game data and scripts are found.
+# LONGNIGHT is the game executable (default ./longnight).
+
+exe=${LONGNIGHT:-./longnight}
+failed=0
+
+# Runs one case, with the expected item first
+check()
+{
+	expect=$1
+	shift
+	if ! "$exe" behavior "$@" --expect "$expect"; then
+		echo "Failed: behavior $* --expect \"$expect\"" >&2
+		failed=1
+	fi
+}
+
+# An ally holding both items attacks while healthy, and heals itself once hurt
+check "debug offense" medic trafmimic --ally "debug offense,debug support" --actor 0
+check "debug support" medic trafmimic --ally "debug offense,debug support" --actor 0 --health 20
+
+# An enemy without the support item falls through to attacking, however hurt it is
+check "debug offense" medic trafmimic --health 20
+
+exit $failed
@@ -0,0 +1,38 @@
+#!/bin/sh
+# Checks that a sweep killed part of the way through and resumed from its journal writes the same results as one that ran without stopping.
+#
+# Usage: scripts/check_sweep_resume.sh <enemy ID>... --param <item>.<field>=<values>... [sweep options]...
+#
+# Run it from the directory the game runs from, so that the game data is found.
+# LONGNIGHT is the game executable (default ./longnight).
+# KILL_AFTER is how many seconds the first attempt runs before it is killed (default 1). Give the sweep enough battles to still be running by then.
+
+if [ "$#" -lt 2 ]; then
+	echo "Usage: $0 <enemy ID>... --param <item>.<field>=<values>... [sweep options]..." >&2
+	exit 1
+fi
+
+exe=${LONGNIGHT:-./longnight}
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+"$exe" sweep "$dir/whole" "$@" > /dev/null || exit 1
+
+# Kill the first attempt without warning, as a crash or a lost machine would
+"$exe" sweep "$dir/resumed" "$@" --journal "$dir/journal" > /dev/null &
+pid=$!
+sleep "${KILL_AFTER:-1}"
+if ! kill -9 "$pid" 2> /dev/null; then
+	echo "The sweep finished before it could be killed; give it more battles or a lower KILL_AFTER." >&2
+	exit 1
+fi
+wait "$pid" 2> /dev/null
+
+"$exe" sweep "$dir/resumed" "$@" --journal "$dir/journal" || exit 1
+
+if cmp -s "$dir/whole.csv" "$dir/resumed.csv" && cmp -s "$dir/whole.cols" "$dir/resumed.cols"; then
+	echo "The resumed sweep wrote the same results."
+	exit 0
+fi
+echo "The resumed sweep wrote different results." >&2
+exit 1
@@ -0,0 +1,65 @@
+#!/bin/sh
+# Runs the "stats" tool or a sweep split into shards, one process per shard, then merges their partial files into one JSON file, or a sweep's results.
+#
+# Usage: scripts/run_shards.sh <shards> <JSON file, or output prefix for a sweep> <enemy ID>... [tool options]...
+#
+# Run it from the directory the game runs from, so that every process finds the game data.
+# LONGNIGHT is the game executable (default ./longnight).
+# TOOL is the tool to shard, stats (default) or sweep.
+# HOSTS is a space-separated list of hosts to run shards on over ssh, taking turns; the working directory must be on a filesystem they all share.
+# Without HOSTS, every shard runs on this machine, so pass "--threads 1" to have one process per core.
+# PARTS is the directory the partial files are written to (default <JSON file>.parts).
+
+if [ "$#" -lt 3 ]; then
+	echo "Usage: $0 <shards> <JSON file, or output prefix for a sweep> <enemy ID>... [tool options]..." >&2
+	exit 1
+fi
+
+shards=$1
+output=$2
+shift 2
+
+exe=${LONGNIGHT:-./longnight}
+tool=${TOOL:-stats}
+parts=${PARTS:-$output.parts}
+mkdir -p "$parts" || exit 1
+
+# Quote every argument, so that they survive being passed through ssh
+quoted=""
+for arg in "$@"; do
+	quoted="$quoted '$(printf '%s' "$arg" | sed "s/'/'\\\\''/g")'"
+done
+
+set -- $HOSTS
+pids=""
+index=0
+while [ "$index" -lt "$shards" ]; do
+	part="$parts/shard-$index-of-$shards.part"
+	command="'$exe' $tool '$part'$quoted --shard $index/$shards"
+
+	if [ "$#" -gt 0 ]; then
+		# Pick the next host in turn
+		host=$(eval "echo \${$(( index % $# + 1 ))}")
+		ssh "$host" "cd '$PWD' && $command" > "$parts/shard-$index.log" 2>&1 &
+	else
+		sh -c "$command" > "$parts/shard-$index.log" 2>&1 &
+	fi
+	pids="$pids $!"
+	index=$((index + 1))
+done
+
+# Wait for every shard, noting any that failed
+failed=0
+index=0
+for pid in $pids; do
+	if ! wait "$pid"; then
+		echo "Shard $index failed; see $parts/shard-$index.log" >&2
+		failed=1
+	fi
+	index=$((index + 1))
+done
+if [ "$failed" -ne 0 ]; then
+	exit 1
+fi
+
+"$exe" merge "$output" "$parts"/shard-*-of-"$shards".part